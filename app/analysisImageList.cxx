@@ -33,9 +33,29 @@
 #include "itkListSample.h"
 #include "vcl_algorithm.h"
 #include "otbMultiToMonoChannelExtractROI.h"
+#include "otbSamplingWindow.h"
+#include "otbPolygonHilbertScheduler.h"
+#include "otbAdaptiveQuadtreeTiling.h"
+#include "otbTileCache.h"
+#include "otbSamplingImageIO.h"
+#include "otbBandStatistics.h"
+#include "otbPolygonClassStatisticsFilter.h"
+#include "otbPolygonStatisticsFile.h"
 #include "otbStatisticsXMLFileWriter.h"
+#include "otbSubsampleEstimate.h"
+#include "otbPolygonSpanCounter.h"
+#include "otbImageAnalysis.h"
+#include "otbOverlapMask.h"
+#include "otbIncrementalAnalysis.h"
+#include "otbShardPlan.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkMutexLockHolder.h"
+#include "itksys/SystemTools.hxx"
+#include <set>
 #include <sstream>
 #include <iterator>   
+#include <typeinfo>
 
 namespace otb
 {
@@ -57,16 +77,8 @@ public:
   typedef AnalysisImageList Self;
   typedef itk::SmartPointer<Self> Pointer; 
   
-  typedef FloatVectorImageType                 ImageType;  
-  typedef ImageType::InternalPixelType         ImagePixelType;
   typedef UInt32ImageType                      LabelImageType;
   typedef LabelImageType::InternalPixelType    LabelImagePixelType; 
-  typedef itk::ImageRegionIterator<ImageType>  IteratorType;
-  ImageType::IndexType IndexType;
-  
-  typename ImageType::RegionType            polygonRegion;
-  
-  typedef otb::MultiChannelExtractROI<ImagePixelType, ImagePixelType>  ExtractROIFilterType;
   
   itkNewMacro(Self);
 
@@ -76,18 +88,82 @@ private:
   void DoInit()
   {
     SetName("AnalysisImageList");
-    SetDescription("This application analyse the input image, the output is a .xml file.");
+    SetDescription("This application analyse the input image, or a list of images concurrently, the output is a binary statistics file, optionally exported in XML.");
     
     AddParameter(ParameterType_InputImage, "in", "Input Image");    
+    MandatoryOff("in");
+    AddParameter(ParameterType_InputFilenameList, "il", "Input image list, analysed concurrently, the vector file being loaded once (grid traversal and pixel counts only)");
+    MandatoryOff("il");
     
     AddParameter(ParameterType_InputFilename, "shp", "Vectoriel File");    
-    AddParameter(ParameterType_OutputFilename, "out", "Output XML file");       
+    AddParameter(ParameterType_OutputFilename, "out", "Output statistics file (binary), combined over all the images of the list");
+    MandatoryOff("out");
+    AddParameter(ParameterType_Directory, "outdir", "Output directory of the statistics file (binary) of each image of the list, named after the image");
+    MandatoryOff("outdir");
+    AddParameter(ParameterType_OutputFilename, "outxml", "Export of the statistics in the XML format");
+    MandatoryOff("outxml");
     AddParameter(ParameterType_String, "cfield", "Field of class");
         
     AddParameter(ParameterType_Int, "tiles", "Size of square tiles");
     SetDefaultParameterInt("tiles", 200);
     MandatoryOff("tiles");
     
+    AddParameter(ParameterType_Choice, "traversal", "Traversal of the image");
+    AddChoice("traversal.grid", "Regular grid of square tiles over the whole image");
+    AddChoice("traversal.hilbert", "Windows around the polygons, in Hilbert order, small polygons grouped in windows of at most tiles x tiles pixels");
+    AddChoice("traversal.adaptive", "Quadtree tiles adapted to the polygon density, empty areas are skipped");
+    AddParameter(ParameterType_Int, "traversal.adaptive.min", "Minimum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.min", 50);
+    AddParameter(ParameterType_Int, "traversal.adaptive.max", "Maximum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.max", 1000);
+    AddParameter(ParameterType_Float, "traversal.adaptive.overhead", "Cost of a tile, in number of pixel tests");
+    SetDefaultParameterFloat("traversal.adaptive.overhead", 1e5);
+    
+    AddParameter(ParameterType_StringList, "bands", "Bands to read and output (indices starting at 1), all the bands by default");
+    MandatoryOff("bands");
+    
+    AddParameter(ParameterType_Int, "cache", "RAM budget of the decoded tile cache (MB), 0 to disable it");
+    SetDefaultParameterInt("cache", 0);
+    MandatoryOff("cache");
+    
+    AddParameter(ParameterType_Directory, "cachedir", "Scratch directory where cached tiles are spilled, to be reused by later processes");
+    MandatoryOff("cachedir");
+    AddParameter(ParameterType_Int, "cachedisk", "Disk budget of the scratch directory (MB), the least recently used tiles being deleted beyond it");
+    SetDefaultParameterInt("cachedisk", 4096);
+    MandatoryOff("cachedisk");
+    
+    AddParameter(ParameterType_Int, "sketch", "Size of the per-class quantile sketches, larger is more accurate (rank error about 1.7/size)");
+    SetDefaultParameterInt("sketch", 200);
+    MandatoryOff("sketch");
+    
+    AddParameter(ParameterType_Choice, "count", "Counting of the pixels of the polygons");
+    AddChoice("count.pixels", "Read the pixels of the polygons, with their band statistics and quantile sketches");
+    AddChoice("count.geometry", "Count the pixel centres from the geometries, without band statistics, the pixels being only read to exclude the nodata ones");
+    AddParameter(ParameterType_Empty, "count.geometry.keepnodata", "Count the nodata pixels too, without reading any pixel : the counts then can not set the quotas of a sampling, which skips them");
+    MandatoryOff("count.geometry.keepnodata");
+    
+    AddParameter(ParameterType_Choice, "approx", "Approximate pixel counts, for strategy planning");
+    AddChoice("approx.none", "Exact counts over the full resolution");
+    AddChoice("approx.overview", "Counts over the overview level nearest a resolution, scaled to the full resolution");
+    AddParameter(ParameterType_Float, "approx.overview.res", "Requested resolution, in the unit of the pixel spacing");
+    SetDefaultParameterFloat("approx.overview.res", 100);
+    AddChoice("approx.stride", "Counts over a systematic subsample of the read windows, scaled to the whole image");
+    AddParameter(ParameterType_Int, "approx.stride.step", "One window out of step is read");
+    SetDefaultParameterInt("approx.stride.step", 10);
+    
+    AddParameter(ParameterType_Empty, "incremental", "Incremental analysis of an image list : the statistics files of the output directory are patched, only the features edited since they were written being analysed again, with all the features of the classes of the modified or removed ones");
+    MandatoryOff("incremental");
+    
+    AddParameter(ParameterType_Choice, "overlap", "Resolution of the overlaps between the images of the list");
+    AddChoice("overlap.none", "Each image counts all its pixels, those of an overlap being counted once per image");
+    AddChoice("overlap.first", "The pixels of an overlap are counted with the first image of the list covering them with valid data, the images being in one projection");
+    AddChoice("overlap.score", "The pixels of an overlap are counted with the image of lowest score covering them with valid data, the images being in one projection");
+    AddParameter(ParameterType_StringList, "overlap.score.values", "Score of each image of the list, such as its cloud cover or off-nadir angle");
+    MandatoryOff("overlap.score.values");
+    
+    AddParameter(ParameterType_String, "shard", "Shard i/K of the read windows analysed by this process (i from 1 to K), the statistics files of the K shards being merged by MergeShards");
+    MandatoryOff("shard");
+    
     AddParameter(ParameterType_Int, "nd", "NoData value");
     SetDefaultParameterInt("nd", 0);
     MandatoryOff("nd");          
@@ -98,8 +174,576 @@ private:
   }
 
   void DoExecute()
+  {
+    if(IsParameterEnabled("il") && HasValue("il"))
+    {
+      if(IsParameterEnabled("shard") && HasValue("shard"))
+      {
+        itkExceptionMacro(<< "The images of a list are shared among processes by splitting the list, a single image is sharded");
+      }
+      ExecuteList();
+      return;
+    }
+    if(!HasValue("in") || !HasValue("out"))
+    {
+      itkExceptionMacro(<< "An input image and an output file, or an image list, are needed");
+    }
+    if(IsParameterEnabled("incremental"))
+    {
+      itkExceptionMacro(<< "The incremental analysis needs an image list, a single image being given as a list of one image");
+    }
+    if(IsParameterEnabled("shard") && HasValue("shard") &&
+       (GetParameterString("count") != "pixels" || GetParameterString("approx") != "none"))
+    {
+      itkExceptionMacro(<< "A shard counts the pixels of its windows exactly, without approximation");
+    }
+    if(GetParameterString("count") == "geometry" && GetParameterString("approx") == "stride")
+    {
+      itkExceptionMacro(<< "The counts from the geometries read no windows, they can not be strided");
+    }
+    
+    //The image is processed in the pixel type of the file, values are only converted when written out
+    switch(otb::ReadImageComponentType(GetParameterString("in")))
+    {
+      case itk::ImageIOBase::UCHAR:
+        ExecuteTyped<UInt8VectorImageType>();
+        break;
+      case itk::ImageIOBase::USHORT:
+        ExecuteTyped<UInt16VectorImageType>();
+        break;
+      case itk::ImageIOBase::SHORT:
+        ExecuteTyped<Int16VectorImageType>();
+        break;
+      default:
+        ExecuteTyped<FloatVectorImageType>();
+        break;
+    }
+  }
+
+  //Images of the list analysed by the threads, each one taking the next image until none is left.
+  //Settings are copied from the parameters before the threads are started.
+  struct ListTask
+  {
+    AnalysisImageList* app;
+    const std::vector<std::string>* filenames;
+    
+    std::vector<unsigned int> bands;
+    std::string classField;
+    std::string approx;
+    double overviewResolution;
+    int strideStep;
+    int noDataValue;
+    int sizeTiles;
+    unsigned int sketchSize;
+    unsigned long cacheBudget;
+    std::string cacheDirectory;
+    unsigned long long cacheDiskBudget;
+    std::string outputDirectory;
+    bool combined;
+    bool incremental;
+    
+    //Parts of each image whose pixels are counted with another image, none without overlap resolution
+    std::vector<otb::OverlapMask> overlaps;
+    
+    //Vector layer loaded once, only locked while the footprint index of an image is built
+    otb::ogr::Layer* layer;
+    itk::SimpleFastMutexLock* mutex;
+    unsigned long nextImage;
+    
+    //Results of each image
+    std::vector<otb::ImageAnalysis> analyses;
+    std::vector<unsigned long> nbFeatures;
+    std::vector<long> nbChanged;
+    std::vector<double> fractions;
+    std::vector<std::map<int, double> > classErrors;
+    std::vector<std::string> errors;
+    
+    ListTask() : app(NULL), filenames(NULL), combined(false), incremental(false), layer(NULL), mutex(NULL), nextImage(0) {}
+  };
+  
+  static ITK_THREAD_RETURN_TYPE AnalyzeImagesThread(void* arg)
+  {
+    itk::MultiThreader::ThreadInfoStruct* info = static_cast<itk::MultiThreader::ThreadInfoStruct*>(arg);
+    ListTask* task = static_cast<ListTask*>(info->UserData);
+    
+    for(;;)
+    {
+      unsigned long i;
+      {
+        itk::MutexLockHolder<itk::SimpleFastMutexLock> holder(*task->mutex);
+        i = task->nextImage++;
+      }
+      if(i >= task->filenames->size())
+      {
+        break;
+      }
+      
+      try
+      {
+        switch(otb::ReadImageComponentType((*task->filenames)[i]))
+        {
+          case itk::ImageIOBase::UCHAR:
+            task->app->AnalyzeListImage<UInt8VectorImageType>(*task, i);
+            break;
+          case itk::ImageIOBase::USHORT:
+            task->app->AnalyzeListImage<UInt16VectorImageType>(*task, i);
+            break;
+          case itk::ImageIOBase::SHORT:
+            task->app->AnalyzeListImage<Int16VectorImageType>(*task, i);
+            break;
+          default:
+            task->app->AnalyzeListImage<FloatVectorImageType>(*task, i);
+            break;
+        }
+      }
+      catch(std::exception& e)
+      {
+        task->errors[i] = e.what();
+      }
+    }
+    return ITK_THREAD_RETURN_VALUE;
+  }
+  
+  //Name of the statistics file of an image of the list
+  static std::string ListOutputFilename(const std::string& directory, const std::string& imageFilename)
+  {
+    std::string path = imageFilename.substr(0, imageFilename.find('?'));
+    return directory + "/" + itksys::SystemTools::GetFilenameWithoutLastExtension(path) + ".bin";
+  }
+  
+  //Analysis of an image of the list, over the regular grid, from the features of its footprint only
+  template <class TImage>
+  void AnalyzeListImage(ListTask& task, unsigned long i)
+  {
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+    
+    //Approximate mode on an overview: the level nearest the requested resolution is read instead
+    std::string inputFilename = (*task.filenames)[i];
+    double fraction = 1.;
+    if(task.approx == "overview")
+    {
+      double factor;
+      unsigned int level = otb::NearestOverviewLevel(inputFilename, task.overviewResolution, factor);
+      inputFilename = otb::OverviewFilename(inputFilename, level);
+      fraction = 1. / (factor*factor);
+    }
+    
+    typedef otb::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(otb::BandSubsetFilename(inputFilename, task.bands));
+    typename ImageType::Pointer image = reader->GetOutput();
+    image->UpdateOutputInformation(); 
+    
+    //Features over the footprint of the image, the shared layer being locked while they are fetched
+    otb::FootprintFeatureIndex featureIndex;
+    {
+      itk::MutexLockHolder<itk::SimpleFastMutexLock> holder(*task.mutex);
+      featureIndex.Build(image.GetPointer(), *task.layer, 3);
+    }
+    task.nbFeatures[i] = featureIndex.GetNumberOfFeatures();
+    
+    //Incremental analysis : the stored analysis is patched, only the windows touched by the features edited since
+    //are read. Without a stored analysis, the image is analysed in full and its feature hashes stored.
+    otb::ImageAnalysis& analysis = task.analyses[i];
+    analysis.sketchSize = task.sketchSize;
+    otb::FeatureHashMap records;
+    otb::FeatureHashMap storedRecords;
+    std::set<long> stale;
+    std::set<itk::int64_t> resketchClasses;
+    bool patch = false;
+    const std::string outputFilename = task.outputDirectory.empty() ? std::string() : ListOutputFilename(task.outputDirectory, (*task.filenames)[i]);
+    if(task.incremental)
+    {
+      records = otb::HashFeatures(featureIndex.GetFeatures(), task.classField);
+      patch = itksys::SystemTools::FileExists(outputFilename.c_str())
+              && otb::ReadFeatureHashes(otb::FeatureHashFilename(outputFilename), storedRecords);
+      task.nbChanged[i] = -1;
+      if(patch)
+      {
+        std::set<long> changed;
+        otb::DiffFeatureHashes(storedRecords, records, stale, changed);
+        task.nbChanged[i] = changed.size() + stale.size();
+        //The classes of the stale features are analysed again in full, for their quantile sketches
+        resketchClasses = otb::ResketchClasses(storedRecords, records, stale, changed);
+        featureIndex.Retain(changed);
+      }
+    }
+    
+    otb::TileCache tileCache;
+    tileCache.SetBudget(task.cacheBudget);
+    if(!task.cacheDirectory.empty())
+    {
+      tileCache.SetScratchDirectory(task.cacheDirectory, task.cacheDiskBudget);
+    }
+    const std::string imageKey = otb::TileCache::MakeImageKey(inputFilename, otb::BandListToString(task.bands), typeid(ImagePixelType).name());
+    
+    otb::SamplingWindowList windows = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), task.sizeTiles);
+    if(task.approx == "stride")
+    {
+      windows = otb::SubsampleWindows(windows, task.strideStep, fraction);
+    }
+    
+    //The windows inside an overlap counted with another image are not read
+    const otb::OverlapMask* overlap = task.overlaps.empty() ? NULL : &task.overlaps[i];
+    
+    otb::ImageAnalysis changedAnalysis;
+    changedAnalysis.sketchSize = task.sketchSize;
+    otb::ImageAnalysis& windowAnalysis = patch ? changedAnalysis : analysis;
+    
+    //Class counts of each subsampled window, those not read counting none, for the sampling errors of the strided counts
+    const bool strided = task.approx == "stride";
+    std::vector<std::map<int, int> > windowClassCounts;
+    for(unsigned long w = 0; w < windows.size() && featureIndex.GetNumberOfFeatures() > 0; ++w)
+    {
+      if(strided)
+      {
+        windowClassCounts.push_back(std::map<int, int>());
+      }
+      if(overlap && overlap->CoversWindow(image.GetPointer(), windows[w]))
+      {
+        continue;
+      }
+      std::vector<otb::ogr::Feature> features = featureIndex.GetWindowFeatures(image.GetPointer(), windows[w]);
+      if(features.empty())
+      {
+        continue;
+      }
+      typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), windows[w].region, &tileCache, imageKey);
+      std::map<int, int> previousCounts;
+      if(strided)
+      {
+        previousCounts = windowAnalysis.classCounts;
+      }
+      otb::AnalyzeWindow(image.GetPointer(), tile.GetPointer(), windows[w], features, task.classField, task.noDataValue, windowAnalysis, overlap);
+      if(strided)
+      {
+        for(std::map<int, int>::const_iterator iClass = windowAnalysis.classCounts.begin(); iClass != windowAnalysis.classCounts.end(); ++iClass)
+        {
+          int count = iClass->second - previousCounts[iClass->first];
+          if(count > 0)
+          {
+            windowClassCounts.back()[iClass->first] = count;
+          }
+        }
+      }
+    }
+    
+    if(fraction < 1.)
+    {
+      if(strided)
+      {
+        task.classErrors[i] = otb::ClassTotalStandardErrors(windowClassCounts, analysis.classCounts, fraction);
+      }
+      otb::ScaleImageAnalysis(analysis, fraction);
+    }
+    task.fractions[i] = fraction;
+    
+    if(patch)
+    {
+      otb::LoadImageAnalysis(outputFilename, analysis);
+      otb::PatchImageAnalysis(analysis, stale, changedAnalysis, records, resketchClasses);
+    }
+    
+    //The feature hashes are removed while the statistics file is rewritten, an interrupted write leading to a full analysis.
+    //Without any edited feature, the files are left as they are.
+    if(!outputFilename.empty() && !(patch && task.nbChanged[i] == 0))
+    {
+      if(task.incremental)
+      {
+        itksys::SystemTools::RemoveFile(otb::FeatureHashFilename(outputFilename).c_str());
+      }
+      otb::PolygonStatisticsFile::Write(outputFilename, analysis.classCounts, analysis.polygonCounts,
+                                        analysis.classStatistics, analysis.polygonStatistics, analysis.classSketches);
+      if(task.incremental)
+      {
+        otb::WriteFeatureHashes(otb::FeatureHashFilename(outputFilename), records);
+      }
+    }
+    //Without a combined output, the analysis is not kept once written
+    if(!task.combined)
+    {
+      analysis = otb::ImageAnalysis();
+    }
+  }
+  
+  void ExecuteList()
+  {
+    std::vector<std::string> imageFilenameList = GetParameterStringList("il");
+    
+    ListTask task;
+    task.app = this;
+    task.filenames = &imageFilenameList;
+    task.combined = IsParameterEnabled("out") && HasValue("out");
+    if(IsParameterEnabled("outdir") && HasValue("outdir"))
+    {
+      task.outputDirectory = GetParameterString("outdir");
+    }
+    if(!task.combined && task.outputDirectory.empty())
+    {
+      itkExceptionMacro(<< "An image list needs a combined output file, an output directory, or both");
+    }
+    if(GetParameterString("traversal") != "grid" || GetParameterString("count") != "pixels")
+    {
+      itkExceptionMacro(<< "An image list is analysed over the grid traversal, with the pixel counts");
+    }
+    task.incremental = IsParameterEnabled("incremental");
+    if(task.incremental && (task.outputDirectory.empty() || GetParameterString("approx") != "none"))
+    {
+      itkExceptionMacro(<< "The incremental analysis patches the statistics files of an output directory, with exact counts");
+    }
+    
+    //Images with the same name would overwrite their statistics files
+    if(!task.outputDirectory.empty())
+    {
+      std::set<std::string> outputFilenames;
+      for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+      {
+        if(!outputFilenames.insert(ListOutputFilename(task.outputDirectory, imageFilenameList[i])).second)
+        {
+          itkExceptionMacro(<< "Two images of the list are named after " << ListOutputFilename(task.outputDirectory, imageFilenameList[i]));
+        }
+      }
+    }
+    
+    if(IsParameterEnabled("bands") && HasValue("bands"))
+    {
+      task.bands = otb::ParseBandList(GetParameterStringList("bands"));
+    }
+    task.classField = GetParameterString("cfield");
+    task.approx = GetParameterString("approx");
+    task.overviewResolution = GetParameterFloat("approx.overview.res");
+    task.strideStep = GetParameterInt("approx.stride.step");
+    task.noDataValue = GetParameterInt("nd");
+    task.sizeTiles = GetParameterInt("tiles");
+    task.sketchSize = GetParameterInt("sketch");
+    task.cacheBudget = static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024;
+    if(IsParameterEnabled("cachedir") && HasValue("cachedir"))
+    {
+      task.cacheDirectory = GetParameterString("cachedir");
+      task.cacheDiskBudget = static_cast<unsigned long long>(GetParameterInt("cachedisk"))*1024*1024;
+    }
+    
+    //Overlaps between the images, resolved from the image extents and a coarse footprint of their valid data
+    std::vector<std::string> scores;
+    if(IsParameterEnabled("overlap.score.values") && HasValue("overlap.score.values"))
+    {
+      scores = GetParameterStringList("overlap.score.values");
+    }
+    task.overlaps = otb::ResolveImageListOverlaps(GetParameterString("overlap"), imageFilenameList, scores, task.noDataValue);
+    for(unsigned long i = 0; i < task.overlaps.size(); ++i)
+    {
+      if(!task.overlaps[i].IsEmpty())
+      {
+        otbAppLogINFO(<< imageFilenameList[i] << " : " << task.overlaps[i].GetNumberOfAreas() << " overlaps counted with other images" << std::endl);
+      }
+    }
+    
+    //The vector file is read once into memory, its features and attributes being shared by the images
+    otb::ogr::DataSource::Pointer source = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
+    otb::ogr::DataSource::Pointer vectorData = otb::ogr::DataSource::New();
+    otb::ogr::Layer sourceLayer = source->GetLayer(0);
+    otb::ogr::Layer sharedLayer = vectorData->CopyLayer(sourceLayer, sourceLayer.GetName());
+    source = NULL;
+    itk::SimpleFastMutexLock mutex;
+    task.layer = &sharedLayer;
+    task.mutex = &mutex;
+    
+    task.analyses.resize(imageFilenameList.size());
+    task.nbFeatures.resize(imageFilenameList.size());
+    task.nbChanged.resize(imageFilenameList.size());
+    task.fractions.resize(imageFilenameList.size());
+    task.classErrors.resize(imageFilenameList.size());
+    task.errors.resize(imageFilenameList.size());
+    
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    unsigned int nbThreads = std::max(1u, std::min(static_cast<unsigned int>(imageFilenameList.size()),
+                                                   static_cast<unsigned int>(threader->GetNumberOfThreads())));
+    threader->SetNumberOfThreads(nbThreads);
+    otbAppLogINFO(<< "Analysing " << imageFilenameList.size() << " images, " << nbThreads << " at once" << std::endl);
+    threader->SetSingleMethod(AnalyzeImagesThread, &task);
+    threader->SingleMethodExecute();
+    
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      if(!task.errors[i].empty())
+      {
+        itkExceptionMacro(<< "Image " << imageFilenameList[i] << " : " << task.errors[i]);
+      }
+      std::ostringstream changes;
+      if(task.incremental)
+      {
+        if(task.nbChanged[i] < 0)
+        {
+          changes << ", full analysis";
+        }
+        else
+        {
+          changes << ", " << task.nbChanged[i] << " edited features analysed again";
+        }
+      }
+      otbAppLogINFO(<< imageFilenameList[i] << " : " << task.nbFeatures[i] << " features in the footprint"
+                    << (task.fractions[i] < 1. ? ", counts estimated from a subsample" : "") << changes.str() << std::endl);
+      for(std::map<int, double>::const_iterator iClass = task.classErrors[i].begin(); iClass != task.classErrors[i].end(); ++iClass)
+      {
+        if(iClass->second == iClass->second)
+        {
+          otbAppLogINFO(<< "  Class " << iClass->first << " : +/- " << static_cast<int>(iClass->second + 0.5) << " pixels" << std::endl);
+        }
+      }
+    }
+    
+    //Strided counts : the errors of the images, independent subsamples, add up in the combined counts
+    const bool strided = GetParameterString("approx") == "stride";
+    std::map<int, double> combinedErrors;
+    for(unsigned long i = 0; i < task.classErrors.size(); ++i)
+    {
+      otb::AddClassStandardErrors(combinedErrors, task.classErrors[i]);
+    }
+    
+    //Combined statistics of all the images
+    if(task.combined)
+    {
+      otb::ImageAnalysis& combined = task.analyses[0];
+      for(unsigned long i = 1; i < task.analyses.size(); ++i)
+      {
+        combined.Merge(task.analyses[i]);
+        task.analyses[i] = otb::ImageAnalysis();
+      }
+      otbAppLogINFO(<< "Nb nbPixelsGlobal " << combined.nbPixels << std::endl);
+      if(strided)
+      {
+        LogClassEstimates(combined.classCounts, combinedErrors);
+      }
+      otb::PolygonStatisticsFile::Write(GetParameterString("out"), combined.classCounts, combined.polygonCounts,
+                                        combined.classStatistics, combined.polygonStatistics, combined.classSketches);
+      if(IsParameterEnabled("outxml") && HasValue("outxml"))
+      {
+        otb::PolygonStatisticsFile::WriteXML(GetParameterString("outxml"), combined.classCounts, combined.polygonCounts,
+                                             strided ? &combinedErrors : NULL);
+      }
+    }
+  }
+
+  //Estimated pixel count of each class, with its standard error when it is known
+  void LogClassEstimates(const std::map<int, int>& classCounts, const std::map<int, double>& classErrors)
+  {
+    for(std::map<int, int>::const_iterator iClass = classCounts.begin(); iClass != classCounts.end(); ++iClass)
+    {
+      std::ostringstream error;
+      std::map<int, double>::const_iterator found = classErrors.find(iClass->first);
+      if(found != classErrors.end() && found->second == found->second)
+      {
+        error << " +/- " << static_cast<int>(found->second + 0.5);
+      }
+      otbAppLogINFO(<< "Class " << iClass->first << " : " << iClass->second << error.str() << " pixels" << std::endl);
+    }
+  }
+  
+  //Exact pixel counts of the polygons from their coverage spans on the image grid. Pixels are only
+  //read, over the bounding region of each polygon, when the nodata pixels are to be excluded. The
+  //features are those counted by AnalyzeWindow and sampled : polygons, and line strings as buffers.
+  template <class TImage>
+  void CountFromGeometries(TImage* image, otb::ogr::Layer layer, bool nodataFiltering, int noDataValue,
+                           otb::TileCache* tileCache, const std::string& imageKey,
+                           std::map<int, int>& elmtsInClass, std::map<unsigned long, int>& polygon, int& nbPixelsGlobal)
+  {
+    std::vector<long> fids;
+    std::vector<itk::ImageRegion<2> > regions;
+    otb::ScanLayerEnvelopes(image, layer, 3, fids, regions);
+    otbAppLogINFO(<< "Counting the pixels of " << fids.size() << " features from their geometry" << std::endl);
+    
+    unsigned int nbComponents = image->GetNumberOfComponentsPerPixel();
+    for(unsigned long f = 0; f < fids.size(); ++f)
+    {
+      otb::ogr::Feature feature = layer.GetFeature(fids[f]);
+      OGRGeometry * geom = feature.ogr().GetGeometryRef();
+      OGRGeometry * buffer = NULL;
+      if(geom->getGeometryType() == wkbLineString)
+      {
+        buffer = geom->Buffer(3);
+        geom = buffer;
+      }
+      
+      //Other geometries (multipolygons, points) are neither counted nor sampled from their pixels
+      if(geom->getGeometryType() != wkbPolygon25D && geom->getGeometryType() != wkbPolygon)
+      {
+        if(buffer)
+        {
+          OGRGeometryFactory::destroyGeometry(buffer);
+        }
+        continue;
+      }
+      
+      otb::PixelSpanList spans = otb::ComputeGeometrySpans(image, geom, regions[f]);
+      int nbOfPixelsInGeom = otb::CountSpanPixels(spans);
+      
+      if(nodataFiltering && nbOfPixelsInGeom > 0)
+      {
+        //Pixels with one of their elements equal to the nodata value are not counted
+        typename TImage::Pointer tile = otb::ExtractTile(image, regions[f], tileCache, imageKey);
+        typename TImage::IndexType index;
+        for(otb::PixelSpanList::const_iterator span = spans.begin(); span != spans.end(); ++span)
+        {
+          index[1] = span->row - regions[f].GetIndex()[1];
+          for(long column = span->begin; column < span->end; ++column)
+          {
+            index[0] = column - regions[f].GetIndex()[0];
+            typename TImage::PixelType pixelValue = tile->GetPixel(index);
+            for(unsigned int i = 0; i < nbComponents; ++i)
+            {
+              if(pixelValue[i] == noDataValue)
+              {
+                nbOfPixelsInGeom--;
+                break;
+              }
+            }
+          }
+        }
+      }
+      
+      if(buffer)
+      {
+        OGRGeometryFactory::destroyGeometry(buffer);
+      }
+      
+      int className = feature.ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());
+      polygon[fids[f]] += nbOfPixelsInGeom;
+      elmtsInClass[className] += nbOfPixelsInGeom;
+      nbPixelsGlobal += nbOfPixelsInGeom;
+    }
+  }
+
+  template <class TImage>
+  void ExecuteTyped()
   {  
-    ImageType::Pointer image = GetParameterImage("in");
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+    
+    //Band subset, pushed down to the reader so that only these bands are decoded
+    std::vector<unsigned int> bands;
+    if(IsParameterEnabled("bands") && HasValue("bands"))
+    {
+      bands = otb::ParseBandList(GetParameterStringList("bands"));
+    }
+    
+    //Approximate mode on an overview: the level nearest the requested resolution is read instead
+    std::string inputFilename = GetParameterString("in");
+    double fraction = 1.;
+    if(GetParameterString("approx") == "overview")
+    {
+      double factor;
+      unsigned int level = otb::NearestOverviewLevel(inputFilename, GetParameterFloat("approx.overview.res"), factor);
+      otbAppLogINFO(<< "Reading the overview level " << level << ", subsampled by " << factor << std::endl);
+      inputFilename = otb::OverviewFilename(inputFilename, level);
+      fraction = 1. / (factor*factor);
+    }
+    
+    //Input image, read in its own pixel type
+    typedef otb::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(otb::BandSubsetFilename(inputFilename, bands));
+    typename ImageType::Pointer image = reader->GetOutput();
     image->UpdateOutputInformation(); 
         
     //Input shape file
@@ -116,34 +760,20 @@ private:
     //Dimension of a side of the square tiles
     int sizeTiles = GetParameterInt("tiles");
     
-    //Number of elements in each pixels
-    unsigned int nbComponents = image->GetNumberOfComponentsPerPixel();
-    
     //Initialisation of the output shape file
     otb::ogr::Layer preFiltered = vectorData->GetLayer(0);    
     otb::ogr::Feature preFeature = preFiltered.GetFeature(0);
         
-    unsigned long sizeTilesX = sizeTiles;
-    unsigned long sizeTilesY = sizeTiles;
-    unsigned long sizeImageX;
-    unsigned long sizeImageY;    
-    unsigned long nbTilesX;
-    unsigned long nbTilesY;
-        
-    //Number of pixels in all the polygons
-    int nbPixelsGlobal = 0; 
+    //Pixel counts, band statistics and quantile sketches of the polygons and classes
+    otb::ImageAnalysis analysis;
+    analysis.sketchSize = GetParameterInt("sketch");
     
+    //Number of pixels in all the polygons
+    int& nbPixelsGlobal = analysis.nbPixels;
     //Number of pixels in each classes
-    std::map<int, int> elmtsInClass;
-    
+    std::map<int, int>& elmtsInClass = analysis.classCounts;
     //Number of pixels in each polygons
-    std::map<unsigned long, int> polygon;
-    //Counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygon;
-    //Shifted counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygonShifted;
-    //RandomPosition of a sampled pixel for each polygons
-    std::map<unsigned long, int> randomPositionInPolygon;
+    std::map<unsigned long, int>& polygon = analysis.polygonCounts;
         
     otbAppLogINFO(<< "Computing the number of pixels for each polygons and classes" << std::endl);
     
@@ -153,174 +783,138 @@ private:
     int stepsProgression = 0;
     int currentProgression;      
     
-    sizeImageX = image->GetLargestPossibleRegion().GetSize()[0];
-    sizeImageY = image->GetLargestPossibleRegion().GetSize()[1];
-    nbTilesX = sizeImageX/sizeTilesX + (sizeImageX%sizeTilesX > 0 ? 1 : 0);
-    nbTilesY = sizeImageY/sizeTilesY + (sizeImageY%sizeTilesY > 0 ? 1 : 0);      
-      
-    // *** *** 1st run :  PROSPECTION      *** ***    
-    int countTest = 0; 
-    //Loop across tiles
-    for(unsigned int row = 0; row < nbTilesY; ++row)
+    //Cache of the decoded tiles, shared by the passes and, through the scratch directory, by later processes
+    otb::TileCache tileCache;
+    tileCache.SetBudget(static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024);
+    if(IsParameterEnabled("cachedir") && HasValue("cachedir"))
     {
-      for(unsigned int column = 0; column < nbTilesX; ++column)
-      { 
+      tileCache.SetScratchDirectory(GetParameterString("cachedir"), static_cast<unsigned long long>(GetParameterInt("cachedisk"))*1024*1024);
+    }
+    const std::string imageKey = otb::TileCache::MakeImageKey(inputFilename, otb::BandListToString(bands), typeid(ImagePixelType).name());
+    
+    //Class counts of each read window, for the sampling errors of the strided counts
+    const bool strided = GetParameterString("approx") == "stride";
+    std::vector<std::map<int, int> > windowClassCounts;
+    
+    if(GetParameterString("count") == "geometry")
+    {
+      // *** *** 1st run :  PROSPECTION FROM THE GEOMETRIES      *** ***
+      bool nodataFiltering = !IsParameterEnabled("count.geometry.keepnodata");
+      CountFromGeometries(image.GetPointer(), vectorData->GetLayer(0), nodataFiltering, noDataValue,
+                          &tileCache, imageKey, elmtsInClass, polygon, nbPixelsGlobal);
+    }
+    else
+    {
+      //Read windows : regular tiles over the whole image, windows around the polygons in Hilbert order,
+      //or quadtree tiles adapted to the polygon density
+      otb::SamplingWindowList windows;
+      if(GetParameterString("traversal") == "hilbert")
+      {
+        otb::PolygonHilbertScheduler scheduler;
+        scheduler.SetSizeTiles(sizeTiles);
+        scheduler.SetLineBuffer(3);
+        scheduler.AddLayer(image.GetPointer(), preFiltered);
+        windows = scheduler.GenerateWindows();
+      }
+      else if(GetParameterString("traversal") == "adaptive")
+      {
+        otb::AdaptiveQuadtreeTiling tiling;
+        tiling.SetMinimumSize(GetParameterInt("traversal.adaptive.min"));
+        tiling.SetMaximumSize(GetParameterInt("traversal.adaptive.max"));
+        tiling.SetTileOverhead(GetParameterFloat("traversal.adaptive.overhead"));
+        tiling.SetLineBuffer(3);
+        tiling.AddLayer(image.GetPointer(), preFiltered);
+        windows = tiling.GenerateWindows(image->GetLargestPossibleRegion());
+      }
+      else
+      {
+        windows = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), sizeTiles);
+      }
+      if(GetParameterString("approx") == "stride")
+      {
+        windows = otb::SubsampleWindows(windows, GetParameterInt("approx.stride.step"), fraction);
+      }
+      otbAppLogINFO(<< "Number of read windows : " << windows.size() << std::endl);
+      
+      //Windows of the shard, all of them in a single process
+      unsigned long firstWindow = 0;
+      unsigned long lastWindow = windows.size();
+      if(IsParameterEnabled("shard") && HasValue("shard"))
+      {
+        unsigned int shardIndex, shardCount;
+        otb::ParseShard(GetParameterString("shard"), shardIndex, shardCount);
+        otb::ShardWindowRange(windows.size(), shardIndex, shardCount, firstWindow, lastWindow);
+        otbAppLogINFO(<< "Shard " << shardIndex << "/" << shardCount << " : windows " << firstWindow << " to " << lastWindow << std::endl);
+      }
+      
+      // *** *** 1st run :  PROSPECTION      *** ***    
+      otb::ogr::Layer filtered = vectorData->GetLayer(0);
+      int countTest = 0; 
+      //Loop across the read windows
+      for(unsigned long w = firstWindow; w < lastWindow; ++w)
+      {
+        const otb::SamplingWindow& window = windows[w];
+      
         //Progression bar printing
-        currentProgression = ((row)*(nbTilesY)+(column+1))*10/(nbTilesX*nbTilesY);        
+        currentProgression = (w-firstWindow+1)*10/(lastWindow-firstWindow);
         if(currentProgression > stepsProgression)
         {
           std::cout<<stepsProgression*10<<"%..."<<std::flush;
           stepsProgression++;
+        } 
+      
+        //Extraction of the image, from the tile cache when possible
+        typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), window.region, &tileCache, imageKey);
+      
+        //Extraction of the features processed in the window, and counting of their pixels
+        std::vector<otb::ogr::Feature> features = otb::GetWindowFeatures(image.GetPointer(), filtered, window);
+        std::map<int, int> previousCounts;
+        if(strided)
+        {
+          previousCounts = elmtsInClass;
         }
-        countTest++;
-        //std::cout<<"count Test " << countTest << std::endl;
-        countTest++;
-          
-        //Tiles dimensions
-        unsigned long startX = column*sizeTilesX;
-        unsigned long startY = row*sizeTilesY;
-        unsigned long sizeX  = vcl_min(sizeTilesX,sizeImageX-startX);
-        unsigned long sizeY  = vcl_min(sizeTilesY,sizeImageY-startY);
-          
-        //Extraction of the image
-        ExtractROIFilterType::Pointer extractROIFilter = ExtractROIFilterType::New();
-        extractROIFilter->SetInput(image);
-        extractROIFilter->SetStartX(startX);
-        extractROIFilter->SetStartY(startY);
-        extractROIFilter->SetSizeX(sizeX);
-        extractROIFilter->SetSizeY(sizeY);
-        extractROIFilter->Update();
-                  
-        //Extraction of the shape file       
-        OGRLinearRing spatialFilterRing;
-        OGRPoint ul,ur,lr,ll;
-        ImageType::IndexType urIndex;
-        ImageType::IndexType llIndex;
-          
-        urIndex[0] = startX + sizeX;
-        urIndex[1] = startY + sizeY;
-        llIndex[0] = startX;
-        llIndex[1] = startY;        
-            
-        itk::Point<double, 2> ulPoint;
-        itk::Point<double, 2> lrPoint;
-            
-        image->TransformIndexToPhysicalPoint(urIndex, lrPoint);
-        image->TransformIndexToPhysicalPoint(llIndex, ulPoint);  
-            
-        ul.setX(ulPoint[0]);
-        ul.setY(ulPoint[1]);
-        lr.setX(lrPoint[0]);
-        lr.setY(lrPoint[1]); 
-
-        otb::ogr::Layer filtered = vectorData->GetLayer(0);
-        filtered.SetSpatialFilterRect(ul.getX(), ul.getY(), lr.getX(), lr.getY());         
-            
-        otb::ogr::Layer::const_iterator featIt = filtered.begin(); 
-          
-        //Loop across the features in the layer
-        for(; featIt!=filtered.end(); ++featIt)
-        {          
-          OGRGeometry * geom = featIt->ogr().GetGeometryRef();
-          
-          if(!geom)
-          {
-            std::cout<<featIt->ogr().GetFID()<<std::endl;
-            break;  
-          } 
-              
-          bool testPoly = false;
-          bool testLineBuffers = false;
-          if(geom->getGeometryType() == wkbLineString)
-          {
-            geom = geom->Buffer(3);
-            //std::cout<< "Coord : " << geom->getCoordinateDimension() << std::endl;
-            testLineBuffers = true;
-          }
-            
-          if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
+        otb::AnalyzeWindow(image.GetPointer(), tile.GetPointer(), window, features, GetParameterString("cfield"), noDataValue, analysis);
+        if(strided)
+        {
+          std::map<int, int> counts;
+          for(std::map<int, int>::const_iterator iClass = elmtsInClass.begin(); iClass != elmtsInClass.end(); ++iClass)
           {
-            testPoly = true;
-          }
-                     
-          //We are dealing with simple polygons
-          if(testPoly || testLineBuffers)
-          {   
-            OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);
-            OGRLinearRing * exteriorRing = inPolygon->getExteriorRing();
-            IteratorType it(extractROIFilter->GetOutput(), extractROIFilter->GetOutput()->GetLargestPossibleRegion());
-              
-            //Number of pixels in a polygon
-            int nbOfPixelsInGeom = 0;
-              
-            //Loop across pixels in the tile
-            for (it.GoToBegin(); !it.IsAtEnd(); ++it)
-            {                          
-              itk::Point<double, 2> point;
-              extractROIFilter->GetOutput()->TransformIndexToPhysicalPoint(it.GetIndex(), point);           
-                
-              //Access to the pixel value 
-              ImageType::PixelType pixelValue = it.Get();
-                
-              //Tranformation in OGRPoint in order to know if it's in the geometry
-              OGRPoint pointOGR;
-              pointOGR.setX(point[0]);
-              pointOGR.setY(point[1]);
-                             
-              //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
-              bool noDataTest = false;            
-              for (unsigned int i=0; i<nbComponents; i++)
-              {   
-                if(noDataTest && (pixelValue[i] == noDataValue))
-                {
-                  noDataTest = true; 
-                }  
-              }             
-                
-              //If the pixel is not "No-Data" and is in the geometry, them we count it
-              //isPointOnRingBoundary() is not relevent beacause there is not (or very few) pixel excatly on the line boundary...
-              /*&& !(exteriorRing->isPointOnRingBoundary(&pointOGR, TRUE))*/
-                              
-              //Test if the current pixel is in a polygon hole
-              bool isNotInHole = true;
-              
-              for (int i=0; i < inPolygon->getNumInteriorRings(); ++i)
-              {
-                if(inPolygon->getInteriorRing(i) != NULL)
-                {
-                  OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
-                  if(interiorRing->isPointInRing(&pointOGR, TRUE))
-                  {
-                    isNotInHole = false;
-                  }
-                }
-              }
-                
-              if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole)
-              {
-                nbOfPixelsInGeom++;
-                nbPixelsGlobal++;
-              }                    
+            int count = iClass->second - previousCounts[iClass->first];
+            if(count > 0)
+            {
+              counts[iClass->first] = count;
             }
-              
-            //Class name recuperation
-            int className = featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());             
-              
-            //Counters update, number of pixel in each classes and in each polygones 
-            polygon[featIt->ogr().GetFID()] += nbOfPixelsInGeom;
-              
-            //Generation of a random number for the sampling in a polygon where we only need one pixel, it's choosen randomly
-            elmtsInClass[className] = elmtsInClass[className] + nbOfPixelsInGeom;  
-            //std::cout<<"Test"<<std::endl; 
-          }   
-        }      
-      }     
+          }
+          windowClassCounts.push_back(counts);
+        }
+      }
     }
     std::cout<<std::endl;
         
     //End of progression bar
     std::cout<<"100%"<<std::endl;
+    
+    if(tileCache.IsEnabled())
+    {
+      otbAppLogINFO(<< "Tile cache : " << tileCache.GetHits() << " hits, " << tileCache.GetMisses() << " misses" << std::endl);
+    }
       
+    //Approximate mode : counts scaled to the full resolution image, with the sampling error of the strided
+    //counts, from the variation between the read windows, written next to them in the XML output. An overview
+    //is resampled and has no sampling error.
+    std::map<int, double> classErrors;
+    if(fraction < 1.)
+    {
+      otbAppLogINFO(<< "Counts estimated from " << fraction*100 << "% of the pixels"
+                    << (windowClassCounts.empty() ? ", without sampling error on an overview" : "") << std::endl);
+      if(strided)
+      {
+        classErrors = otb::ClassTotalStandardErrors(windowClassCounts, elmtsInClass, fraction);
+      }
+      otb::ScaleImageAnalysis(analysis, fraction);
+      LogClassEstimates(elmtsInClass, classErrors);
+    }
+    
     /* TRACES */
     //
     std::cout<< "Nb de classes : " << elmtsInClass.size() << std::endl;
@@ -343,35 +937,13 @@ private:
       std::cout << "Dans le polygon " << (*ipolygon).first << " il y a " << (*ipolygon).second << " pixels." << std::endl;
     }*/   
       
-    TiXmlDocument doc;
-    TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "", "");
-    doc.LinkEndChild(decl);
-      
-    TiXmlElement * root = new TiXmlElement("ImageAnalysis");
-    doc.LinkEndChild(root);
-      
-    TiXmlElement * featureImage = new TiXmlElement("Image");
-    root->LinkEndChild(featureImage);  
-    for(std::map<int, int>::iterator iImage = elmtsInClass.begin(); iImage != elmtsInClass.end(); ++iImage)
+    //Binary statistics file with the band statistics, and optional export of the counts in the XML format
+    otb::PolygonStatisticsFile::Write(GetParameterString("out"), elmtsInClass, polygon, analysis.classStatistics,
+                                      analysis.polygonStatistics, analysis.classSketches);
+    if(IsParameterEnabled("outxml") && HasValue("outxml"))
     {
-            
-      TiXmlElement * featureClass = new TiXmlElement("Class");
-      featureClass->SetDoubleAttribute("name", (*iImage).first);
-      featureClass->SetAttribute("value", (*iImage).second);
-      featureImage->LinkEndChild(featureClass);        
-    }     
-    
-    TiXmlElement * featurePolygon = new TiXmlElement("Polygon");
-    root->LinkEndChild(featurePolygon);
-    for(std::map<unsigned long, int>::iterator ipolygon = polygon.begin(); ipolygon != polygon.end(); ++ipolygon)
-    {         
-      TiXmlElement * featureId = new TiXmlElement("Id");
-      featureId->SetAttribute("name", (*ipolygon).first);
-      featureId->SetDoubleAttribute("value", (*ipolygon).second);
-      featurePolygon->LinkEndChild(featureId);   
+      otb::PolygonStatisticsFile::WriteXML(GetParameterString("outxml"), elmtsInClass, polygon, strided ? &classErrors : NULL);
     }
-      
-    doc.SaveFile(GetParameterString("out").c_str());
   }
 };
 }
@@ -24,6 +24,12 @@
 #include "otbOGRFeatureWrapper.h"
 #include "otbStreamingTraits.h"
 #include "otbStreamingMinMaxVectorImageFilter.h"
+#include "otbPersistentFilterStreamingDecorator.h"
+#include "otbStreamingBandStatisticsFilter.h"
+#include "otbStatisticsXMLFileWriter.h"
+#include "otbSamplingImageIO.h"
+#include "otbSamplingWindow.h"
+#include "otbSubsampleEstimate.h"
 #include "otbStandardFilterWatcher.h"
 #include "otbWrapperApplication.h"
 #include "otbWrapperApplicationFactory.h"
@@ -66,6 +72,10 @@ public:
   typedef itk::ImageRegionIterator<ImageType>  IteratorType;
   typedef otb::ImageFileReader<ImageType>      ReaderType;
   typedef otb::StreamingMinMaxVectorImageFilter<ImageType> StreamingMinMaxVectorImageFilterType;
+  typedef otb::PersistentBandStatisticsFilter<ImageType> BandStatisticsFilterType;
+  typedef otb::PersistentFilterStreamingDecorator<BandStatisticsFilterType> StreamingBandStatisticsFilterType;
+  typedef itk::VariableLengthVector<double> MeasurementType;
+  typedef otb::StatisticsXMLFileWriter<MeasurementType> StatisticsWriterType;
   ImageType::IndexType IndexType;
   
   typename ImageType::RegionType            polygonRegion;
@@ -80,10 +90,35 @@ private:
   void DoInit()
   {
     SetName("BandValues");
-    SetDescription("This application output the min and max values for each band of the input image. ");
+    SetDescription("This application computes, in one streamed pass, the min, max, mean, standard deviation, nodata count and histogram of each band of the input image.");
     
     AddParameter(ParameterType_InputImage, "in", "Input Image");    
-    
+    AddParameter(ParameterType_OutputFilename, "out", "Output statistics file (XML)");
+    MandatoryOff("out");
+
+    AddParameter(ParameterType_Float, "nodata", "Nodata value, excluded from the statistics and counted apart (NaN values always are)");
+    MandatoryOff("nodata");
+
+    AddParameter(ParameterType_Int, "hist", "Number of bins of the histograms, 0 for no histogram");
+    SetDefaultParameterInt("hist", 256);
+    MandatoryOff("hist");
+    AddParameter(ParameterType_Float, "histmin", "Lower bound of the histograms (by default the range of the pixel type of 8 and 16 bits integer images; for the other types the range of each band, the histograms being then estimated from quantile sketches and flagged as approximate)");
+    MandatoryOff("histmin");
+    AddParameter(ParameterType_Float, "histmax", "Upper bound of the histograms");
+    MandatoryOff("histmax");
+
+    AddParameter(ParameterType_Choice, "approx", "Approximate statistics, from a subsample of the pixels");
+    AddChoice("approx.none", "Exact statistics over the full resolution");
+    AddChoice("approx.overview", "Statistics of the overview level nearest a resolution");
+    AddParameter(ParameterType_Float, "approx.overview.res", "Requested resolution, in the unit of the pixel spacing");
+    SetDefaultParameterFloat("approx.overview.res", 100);
+    AddChoice("approx.stride", "Statistics of a systematic subsample of the blocks of the image");
+    AddParameter(ParameterType_Int, "approx.stride.step", "One block out of step is read");
+    SetDefaultParameterInt("approx.stride.step", 10);
+    AddParameter(ParameterType_Int, "approx.stride.tiles", "Size of the square blocks");
+    SetDefaultParameterInt("approx.stride.tiles", 256);
+
+    AddRAMParameter();
   }
 
   void DoUpdateParameters()
@@ -92,23 +127,165 @@ private:
 
   void DoExecute()
   {  
-    //Input image
+    //Input image, or its overview level nearest the requested resolution
     ImageType::Pointer image = GetParameterImage("in");
+    double fraction = 1.;
+    ReaderType::Pointer overviewReader;
+    if(GetParameterString("approx") == "overview")
+    {
+      double factor;
+      unsigned int level = otb::NearestOverviewLevel(GetParameterString("in"), GetParameterFloat("approx.overview.res"), factor);
+      otbAppLogINFO(<< "Reading the overview level " << level << ", subsampled by " << factor << std::endl);
+      overviewReader = ReaderType::New();
+      overviewReader->SetFileName(otb::OverviewFilename(GetParameterString("in"), level));
+      image = overviewReader->GetOutput();
+      fraction = 1. / (factor*factor);
+    }
     image->UpdateOutputInformation();    
-    
-    StreamingMinMaxVectorImageFilterType::Pointer filter = StreamingMinMaxVectorImageFilterType::New();
-     
-    //ReaderType::Pointer reader = ReaderType::New();
-    //reader->SetFileName(image);
-    
-    filter->GetStreamer()->SetNumberOfLinesStrippedStreaming( 10 );
+    unsigned int nbBands = image->GetNumberOfComponentsPerPixel();
+
+    StreamingBandStatisticsFilterType::Pointer filter = StreamingBandStatisticsFilterType::New();
     filter->SetInput(image);
-    otb::StandardFilterWatcher watcher(filter, "Min Max Computation");
-    filter->Update();
-    
-    std::cout << filter->GetMaximum()[0] << " " << filter->GetMaximum()[1]<< " " << filter->GetMaximum()[2]<< " " << filter->GetMaximum()[3] << std::endl;
-   
-   
+    filter->GetStreamer()->SetAutomaticAdaptativeStreaming(GetParameterInt("ram"));
+
+    if(IsParameterEnabled("nodata") && HasValue("nodata"))
+    {
+      filter->GetFilter()->SetNoDataValue(GetParameterFloat("nodata"));
+    }
+    filter->GetFilter()->SetHistogramBins(std::max(0, GetParameterInt("hist")));
+    if(HasValue("histmin") && HasValue("histmax"))
+    {
+      if(GetParameterFloat("histmax") <= GetParameterFloat("histmin"))
+      {
+        itkExceptionMacro(<< "histmax must be greater than histmin");
+      }
+      filter->GetFilter()->SetHistogramRange(GetParameterFloat("histmin"), GetParameterFloat("histmax"));
+    }
+    else
+    {
+      //Exact bins over the range of the integer pixel types
+      double typeMin, typeMax;
+      if(otb::ComponentTypeRange(otb::ReadImageComponentType(GetParameterString("in")), typeMin, typeMax))
+      {
+        filter->GetFilter()->SetHistogramRange(typeMin, typeMax);
+      }
+    }
+    if(filter->GetFilter()->IsHistogramEstimated())
+    {
+      otbAppLogINFO(<< "No histogram range for this pixel type : the histograms are estimated from quantile sketches, "
+                    << "give histmin and histmax for exact bins" << std::endl);
+    }
+
+    //Sums and counts of the valid values of each band in each read block, for the error of the strided means
+    std::vector<std::vector<double> > blockSums(nbBands), blockCounts(nbBands);
+    if(GetParameterString("approx") == "stride")
+    {
+      //Subsample of the blocks, each one processed by the persistent filter, multithreaded
+      otb::SamplingWindowList windows = otb::SubsampleWindows(otb::GenerateGridWindows(image->GetLargestPossibleRegion(), GetParameterInt("approx.stride.tiles")),
+                                                              GetParameterInt("approx.stride.step"), fraction);
+      otbAppLogINFO(<< "Reading " << windows.size() << " blocks, " << fraction*100 << "% of the pixels" << std::endl);
+      ExtractROIFilterType::Pointer extract = ExtractROIFilterType::New();
+      extract->SetInput(image);
+      BandStatisticsFilterType* blockFilter = filter->GetFilter();
+      blockFilter->SetInput(extract->GetOutput());
+      blockFilter->Reset();
+      std::vector<double> previousCounts(nbBands, 0.), previousSums(nbBands, 0.);
+      for(unsigned long w = 0; w < windows.size(); ++w)
+      {
+        extract->SetStartX(windows[w].region.GetIndex()[0]);
+        extract->SetStartY(windows[w].region.GetIndex()[1]);
+        extract->SetSizeX(windows[w].region.GetSize()[0]);
+        extract->SetSizeY(windows[w].region.GetSize()[1]);
+        blockFilter->Update();
+        for(unsigned int b = 0; b < nbBands; ++b)
+        {
+          double count, sum;
+          blockFilter->GetRunningSums(b, count, sum);
+          blockCounts[b].push_back(count - previousCounts[b]);
+          blockSums[b].push_back(sum - previousSums[b]);
+          previousCounts[b] = count;
+          previousSums[b] = sum;
+        }
+      }
+      blockFilter->Synthetize();
+    }
+    else
+    {
+      otb::StandardFilterWatcher watcher(filter->GetStreamer(), "Band statistics computation");
+      filter->Update();
+    }
+
+    const BandStatisticsFilterType::BandSummaryList& summaries = filter->GetFilter()->GetBandSummaries();
+    MeasurementType count(nbBands), nodata(nbBands), mean(nbBands), stddev(nbBands), min(nbBands), max(nbBands), histMin(nbBands), histMax(nbBands);
+    MeasurementType meanError(nbBands), sampledFraction(1);
+    const bool strided = GetParameterString("approx") == "stride";
+    if(GetParameterString("approx") == "overview")
+    {
+      otbAppLogINFO(<< "The pixels of an overview are resampled, not sampled : the means have no sampling error" << std::endl);
+    }
+    sampledFraction[0] = fraction;
+    for(unsigned int b = 0; b < nbBands; ++b)
+    {
+      const otb::BandStatistics& moments = summaries[b].moments;
+      //Counts are estimated for the full resolution image
+      count[b] = otb::EstimateTotal(moments.GetCount(), fraction);
+      nodata[b] = otb::EstimateTotal(summaries[b].nodata, fraction);
+      mean[b] = moments.GetMean(0);
+      stddev[b] = std::sqrt(moments.GetVariance(0));
+      meanError[b] = strided ? otb::ClusterMeanStandardError(blockSums[b], blockCounts[b], fraction) : 0.;
+      min[b] = moments.GetCount() > 0 ? moments.GetMinimum(0) : 0.;
+      max[b] = moments.GetCount() > 0 ? moments.GetMaximum(0) : 0.;
+      histMin[b] = moments.GetCount() > 0 ? filter->GetFilter()->GetHistogramMinimum(b) : 0.;
+      histMax[b] = moments.GetCount() > 0 ? filter->GetFilter()->GetHistogramMaximum(b) : 0.;
+      otbAppLogINFO(<< "Band " << b+1 << ": min " << min[b] << ", max " << max[b] << ", mean " << mean[b] << (strided ? " +/- " + to_string(meanError[b]) : std::string())
+                    << ", stddev " << stddev[b] << ", nodata " << summaries[b].nodata << std::endl);
+    }
+
+    if(IsParameterEnabled("out") && HasValue("out"))
+    {
+      // OTB statistics XML: mean, stddev, min and max are read by the feature normalization
+      StatisticsWriterType::Pointer writer = StatisticsWriterType::New();
+      writer->SetFileName(GetParameterString("out"));
+      writer->AddInput("mean", mean);
+      writer->AddInput("stddev", stddev);
+      writer->AddInput("min", min);
+      writer->AddInput("max", max);
+      writer->AddInput("count", count);
+      writer->AddInput("nodata", nodata);
+      if(fraction < 1.)
+      {
+        //Sampled fraction of the pixels; min and max are those of the subsample
+        writer->AddInput("fraction", sampledFraction);
+      }
+      if(strided)
+      {
+        //Standard error of the means, from the variation between the read blocks
+        writer->AddInput("meanstderr", meanError);
+      }
+      unsigned int nbBins = filter->GetFilter()->GetHistogramBins();
+      if(nbBins > 0)
+      {
+        writer->AddInput("histmin", histMin);
+        writer->AddInput("histmax", histMax);
+        if(filter->GetFilter()->IsHistogramEstimated())
+        {
+          //Bins estimated from the quantile sketches, not counted
+          MeasurementType approximate(1);
+          approximate[0] = 1;
+          writer->AddInput("histapprox", approximate);
+        }
+        for(unsigned int b = 0; b < nbBands; ++b)
+        {
+          MeasurementType histogram(nbBins);
+          for(unsigned int bin = 0; bin < nbBins; ++bin)
+          {
+            histogram[bin] = summaries[b].histogram[bin];
+          }
+          writer->AddInput(("histogram_b" + to_string(b)).c_str(), histogram);
+        }
+      }
+      writer->Update();
+    }
   }
 };
 }
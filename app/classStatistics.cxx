@@ -23,8 +23,9 @@
  *   - Optionally a mask indicating which input image pixels are to be considered
  *   -
  * Outputs:
- *   -
- *   -
+ *   - A binary table with the pixel count and the band statistics of every polygon,
+ *     and the per-class counts, statistics and quantile sketches
+ *   - Optionally the polygons with their statistics (and histograms) as fields
  */
 
 #include "otbImage.h"
@@ -33,6 +34,10 @@
 #include "otbWrapperApplicationFactory.h"
 #include "otbImageFileReader.h"
 #include "otbPersistentFilterStreamingDecorator.h"
+#include "otbPolygonStatisticsFile.h"
+#include "itksys/SystemTools.hxx"
+#include <sstream>
+#include <cmath>
 
 namespace otb
 {
@@ -52,22 +57,34 @@ private:
   void DoInit()
   {
     SetName("PolygonClassStatistics");
-    SetDescription("");
+    SetDescription("Per-polygon statistics of the bands (zonal statistics) and per-class counts, in one streamed pass.");
     
     AddParameter(ParameterType_InputFilename, "image", "Input image");    
     AddParameter(ParameterType_InputFilename, "shapefile", "Input shapefile");    
     AddParameter(ParameterType_InputImage, "mask", "Input mask (optional)");
     MandatoryOff("mask");
 
-    AddParameter(ParameterType_OutputFilename, "out", "Output XML file");       
+    AddParameter(ParameterType_OutputFilename, "out", "Output statistics file (binary table of the polygons)");       
+    AddParameter(ParameterType_OutputFilename, "outvec", "Output vector file, the polygons with their statistics as fields");
+    MandatoryOff("outvec");
     AddParameter(ParameterType_String, "cfield", "Field of class");
+    
+    AddParameter(ParameterType_Int, "hist", "Number of bins of the per-polygon histograms, 0 for no histogram");
+    SetDefaultParameterInt("hist", 0);
+    MandatoryOff("hist");
+    AddParameter(ParameterType_Float, "histmin", "Lower bound of the histograms");
+    SetDefaultParameterFloat("histmin", 0);
+    MandatoryOff("histmin");
+    AddParameter(ParameterType_Float, "histmax", "Upper bound of the histograms");
+    SetDefaultParameterFloat("histmax", 255);
+    MandatoryOff("histmax");
   }
 
   void DoUpdateParameters() {}
 
   void DoExecute()
   {  
-    typedef otb::Image<float, 2> ImageType;
+    typedef FloatVectorImageType ImageType;
     //typedef otb::Image<unsigned char, 2> MaskType;
 
     // Reader
@@ -78,20 +95,126 @@ private:
     // Input shape file
     otb::ogr::DataSource::Pointer polygons = otb::ogr::DataSource::New(GetParameterString("shapefile").c_str(), otb::ogr::DataSource::Modes::Read);
 
-    // Input mask
-    //
-
-    typedef otb::PersistentFilterStreamingDecorator < PolygonClassStatisticsFilter<ImageType, ImageType> > FilterType;
+    typedef PolygonClassStatisticsFilter<ImageType, ImageType> StatisticsFilterType;
+    typedef otb::PersistentFilterStreamingDecorator<StatisticsFilterType> FilterType;
     FilterType::Pointer filter = FilterType::New();
 
     filter->GetFilter()->SetInput(reader->GetOutput());
     filter->GetFilter()->SetPolygons(polygons);
-    // if provided
-      // filter.SetMask(
-      //
-    filter->SetNumberOfThreads(1);
+    filter->GetFilter()->SetClassField(GetParameterString("cfield"));
+    filter->GetFilter()->SetZonalStatistics(true);
+    if(GetParameterInt("hist") < 0)
+    {
+      itkExceptionMacro(<< "hist must be positive or zero");
+    }
+    if(GetParameterInt("hist") > 0 && GetParameterFloat("histmax") <= GetParameterFloat("histmin"))
+    {
+      itkExceptionMacro(<< "histmax must be greater than histmin");
+    }
+    filter->GetFilter()->SetHistogram(GetParameterInt("hist"), GetParameterFloat("histmin"), GetParameterFloat("histmax"));
+    // Input mask, if provided
+    if(IsParameterEnabled("mask") && HasValue("mask"))
+    {
+      filter->GetFilter()->SetMask(GetParameterImage("mask"));
+    }
 
     filter->Update();
+
+    const std::vector<long>& fids = filter->GetFilter()->GetPolygonFIDs();
+    const std::vector<int>& classes = filter->GetFilter()->GetPolygonClasses();
+    const StatisticsFilterType::ZonalStatisticsList& zonalStatistics = filter->GetFilter()->GetZonalStatistics();
+    unsigned int nbBands = reader->GetOutput()->GetNumberOfComponentsPerPixel();
+
+    // Binary table, same format as the image analysis, with the class counts and statistics
+    std::map<long, itk::uint64_t> polygonCounts;
+    std::map<long, otb::BandStatistics> polygonStatistics;
+    std::map<int, itk::uint64_t> classCounts;
+    std::map<int, otb::BandStatistics> classStatistics;
+    for(unsigned long i = 0; i < fids.size(); ++i)
+    {
+      const otb::BandStatistics& moments = zonalStatistics[i].moments;
+      if(moments.GetCount() == 0)
+      {
+        continue;
+      }
+      polygonCounts[fids[i]] = moments.GetCount();
+      polygonStatistics[fids[i]] = moments;
+      classCounts[classes[i]] += moments.GetCount();
+      classStatistics[classes[i]].Merge(moments);
+    }
+    otb::PolygonStatisticsFile::Write(GetParameterString("out"), classCounts, polygonCounts, classStatistics, polygonStatistics,
+                                      filter->GetFilter()->GetClassStatistics()->GetClassSketches());
+    otbAppLogINFO(<< polygonCounts.size() << " polygons with pixels, in " << classCounts.size() << " classes" << std::endl);
+
+    // Vector output : the input polygons with their statistics
+    if(IsParameterEnabled("outvec") && HasValue("outvec"))
+    {
+      otb::ogr::Layer inLayer = polygons->GetLayer(0);
+      inLayer.SetSpatialFilter(NULL);
+
+      otb::ogr::DataSource::Pointer ogrDS = otb::ogr::DataSource::New(GetParameterString("outvec").c_str(), otb::ogr::DataSource::Modes::Overwrite);
+      std::string layername = itksys::SystemTools::GetFilenameName(GetParameterString("outvec").c_str());
+      std::string extension = itksys::SystemTools::GetFilenameLastExtension(GetParameterString("outvec").c_str());
+      layername = layername.substr(0,layername.size()-(extension.size()));
+      std::vector<std::string> options;
+      otb::ogr::Layer outLayer = ogrDS->CreateLayer(layername, inLayer.GetSpatialRef(), inLayer.GetGeomType(), options);
+
+      OGRFeatureDefn& inDefn = inLayer.GetLayerDefn();
+      for(int f = 0; f < inDefn.GetFieldCount(); ++f)
+      {
+        OGRFieldDefn field(inDefn.GetFieldDefn(f));
+        outLayer.CreateField(field, true);
+      }
+      OGRFieldDefn countField("count", OFTInteger);
+      outLayer.CreateField(countField, true);
+      for(unsigned int b = 0; b < nbBands; ++b)
+      {
+        const char* suffixes[] = {"_mean", "_std", "_min", "_max"};
+        for(unsigned int k = 0; k < 4; ++k)
+        {
+          OGRFieldDefn field((BandName(b) + suffixes[k]).c_str(), OFTReal);
+          outLayer.CreateField(field, true);
+        }
+        if(GetParameterInt("hist") > 0)
+        {
+          OGRFieldDefn field((BandName(b) + "_hist").c_str(), OFTString);
+          outLayer.CreateField(field, true);
+        }
+      }
+
+      unsigned long ordinal = 0;
+      for(otb::ogr::Layer::const_iterator featIt = inLayer.begin(); featIt != inLayer.end(); ++featIt, ++ordinal)
+      {
+        const ZonalStatistics& polygonZonal = zonalStatistics[ordinal];
+        otb::ogr::Feature featureOutput(outLayer.GetLayerDefn());
+        featureOutput.SetFrom(*featIt, TRUE);
+        featureOutput.ogr().SetField("count", static_cast<int>(polygonZonal.moments.GetCount()));
+        for(unsigned int b = 0; b < nbBands && polygonZonal.moments.GetCount() > 0; ++b)
+        {
+          featureOutput.ogr().SetField((BandName(b) + "_mean").c_str(), polygonZonal.moments.GetMean(b));
+          featureOutput.ogr().SetField((BandName(b) + "_std").c_str(), std::sqrt(polygonZonal.moments.GetVariance(b)));
+          featureOutput.ogr().SetField((BandName(b) + "_min").c_str(), polygonZonal.moments.GetMinimum(b));
+          featureOutput.ogr().SetField((BandName(b) + "_max").c_str(), polygonZonal.moments.GetMaximum(b));
+          if(GetParameterInt("hist") > 0)
+          {
+            std::ostringstream histogram;
+            for(int bin = 0; bin < GetParameterInt("hist"); ++bin)
+            {
+              histogram << (bin > 0 ? "," : "") << polygonZonal.histogram[b*GetParameterInt("hist") + bin];
+            }
+            featureOutput.ogr().SetField((BandName(b) + "_hist").c_str(), histogram.str().c_str());
+          }
+        }
+        outLayer.CreateFeature(featureOutput);
+      }
+    }
+  }
+
+  static std::string BandName(unsigned int band)
+  {
+    std::ostringstream oss;
+    oss << "b" << band;
+    return oss.str();
   }
 };
 }
@@ -0,0 +1,198 @@
+/*=========================================================================
+ Program:   ORFEO Toolbox
+ Language:  C++
+ Date:      $Date$
+ Version:   $Revision$
+
+
+ Copyright (c) Centre National d'Etudes Spatiales. All rights reserved.
+ See OTBCopyright.txt for details.
+
+
+ This software is distributed WITHOUT ANY WARRANTY; without even
+ the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ PURPOSE.  See the above copyright notices for more information.
+
+ =========================================================================*/
+
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbImageAnalysis.h"
+#include "otbIncrementalAnalysis.h"
+#include "otbPolygonStatisticsFile.h"
+#include "itksys/SystemTools.hxx"
+#include <fstream>
+#include <vector>
+#include <string>
+
+namespace otb
+{
+
+namespace Wrapper
+{
+
+// Merge of the outputs of a sharded run, the shards being given in their
+// order : the statistics files of AnalysisImageList, or the sample text files
+// and verification masks of otbSampling
+class MergeShards : public Application
+{
+public:
+  typedef MergeShards Self;
+  typedef itk::SmartPointer<Self> Pointer;
+
+  itkNewMacro(Self);
+
+  itkTypeMacro(MergeShards, otb::Application);
+
+private:
+  void DoInit()
+  {
+    SetName("MergeShards");
+    SetDescription("This application merges the outputs of the shards of a run, in the order of the shards.");
+
+    AddParameter(ParameterType_InputFilenameList, "analyses", "Statistics files (binary) of the shards of AnalysisImageList");
+    MandatoryOff("analyses");
+    AddParameter(ParameterType_OutputFilename, "out", "Output statistics file (binary) of the whole image");
+    MandatoryOff("out");
+    AddParameter(ParameterType_OutputFilename, "outxml", "Export of the statistics in the XML format");
+    MandatoryOff("outxml");
+
+    AddParameter(ParameterType_InputFilenameList, "samples", "Sample text files of the shards of otbSampling");
+    MandatoryOff("samples");
+    AddParameter(ParameterType_OutputFilename, "outsamples", "Output text file of the samples of the whole image");
+    MandatoryOff("outsamples");
+
+    AddParameter(ParameterType_InputFilenameList, "masks", "Verification masks of the shards of otbSampling");
+    MandatoryOff("masks");
+    AddParameter(ParameterType_OutputFilename, "v", "Output verification mask of the whole image");
+    MandatoryOff("v");
+  }
+
+  void DoUpdateParameters()
+  {
+  }
+
+  void DoExecute()
+  {
+    bool merged = false;
+    if(HasInputs("analyses", "out"))
+    {
+      MergeAnalyses();
+      merged = true;
+    }
+    if(HasInputs("samples", "outsamples"))
+    {
+      MergeTextFiles();
+      merged = true;
+    }
+    if(HasInputs("masks", "v"))
+    {
+      MergeMasks();
+      merged = true;
+    }
+    if(!merged)
+    {
+      itkExceptionMacro(<< "Nothing to merge : shard statistics files with out, sample files with outsamples, or masks with v are needed");
+    }
+  }
+
+  bool HasInputs(const std::string& inputs, const std::string& output)
+  {
+    bool hasInputs = IsParameterEnabled(inputs) && HasValue(inputs);
+    bool hasOutput = IsParameterEnabled(output) && HasValue(output);
+    if(hasInputs != hasOutput)
+    {
+      itkExceptionMacro(<< "The parameters " << inputs << " and " << output << " go together");
+    }
+    return hasInputs;
+  }
+
+  //Statistics of the shards : the counts of a polygon over several shards are summed, the band
+  //statistics and the quantile sketches merged
+  void MergeAnalyses()
+  {
+    std::vector<std::string> filenames = GetParameterStringList("analyses");
+    otb::ImageAnalysis combined;
+    for(unsigned int i = 0; i < filenames.size(); ++i)
+    {
+      otb::ImageAnalysis shard;
+      otb::LoadImageAnalysis(filenames[i], shard);
+      combined.Merge(shard);
+    }
+    otbAppLogINFO(<< filenames.size() << " shards, " << combined.polygonCounts.size() << " polygons, "
+                  << combined.nbPixels << " pixels" << std::endl);
+
+    otb::PolygonStatisticsFile::Write(GetParameterString("out"), combined.classCounts, combined.polygonCounts,
+                                      combined.classStatistics, combined.polygonStatistics, combined.classSketches);
+    if(IsParameterEnabled("outxml") && HasValue("outxml"))
+    {
+      otb::PolygonStatisticsFile::WriteXML(GetParameterString("outxml"), combined.classCounts, combined.polygonCounts);
+    }
+  }
+
+  //Sample text files, one after the other
+  void MergeTextFiles()
+  {
+    std::vector<std::string> filenames = GetParameterStringList("samples");
+    std::ofstream out(GetParameterString("outsamples").c_str(), std::ios::binary);
+    for(unsigned int i = 0; i < filenames.size(); ++i)
+    {
+      std::ifstream in(filenames[i].c_str(), std::ios::binary);
+      if(!in)
+      {
+        itkExceptionMacro(<< "Unable to read the samples " << filenames[i]);
+      }
+      //An empty shard has nothing to copy, and operator<< would fail the output stream
+      if(in.peek() != std::ifstream::traits_type::eof())
+      {
+        out << in.rdbuf();
+      }
+    }
+    if(!out)
+    {
+      itkExceptionMacro(<< "Unable to write the samples " << GetParameterString("outsamples"));
+    }
+  }
+
+  //Verification masks : the points of the shards copied in their order, in a layer with the fields of the first one
+  void MergeMasks()
+  {
+    std::vector<std::string> filenames = GetParameterStringList("masks");
+    otb::ogr::DataSource::Pointer outDS = otb::ogr::DataSource::New(GetParameterString("v").c_str(), otb::ogr::DataSource::Modes::Overwrite);
+    otb::ogr::Layer outLayer(NULL, false);
+    unsigned long nbPoints = 0;
+    for(unsigned int i = 0; i < filenames.size(); ++i)
+    {
+      otb::ogr::DataSource::Pointer inDS = otb::ogr::DataSource::New(filenames[i].c_str(), otb::ogr::DataSource::Modes::Read);
+      otb::ogr::Layer inLayer = inDS->GetLayer(0);
+      if(i == 0)
+      {
+        std::vector<std::string> options;
+        std::string layername = itksys::SystemTools::GetFilenameName(GetParameterString("v").c_str());
+        std::string extension = itksys::SystemTools::GetFilenameLastExtension(GetParameterString("v").c_str());
+        layername = layername.substr(0, layername.size() - extension.size());
+        outLayer = outDS->CreateLayer(layername, const_cast<OGRSpatialReference*>(inLayer.GetSpatialRef()), wkbPoint, options);
+        OGRFeatureDefn& defn = inLayer.GetLayerDefn();
+        for(int comp = 0; comp < defn.GetFieldCount(); ++comp)
+        {
+          OGRFieldDefn field(defn.GetFieldDefn(comp)->GetNameRef(), defn.GetFieldDefn(comp)->GetType());
+          outLayer.CreateField(field, true);
+        }
+      }
+      for(otb::ogr::Layer::const_iterator featIt = inLayer.cbegin(); featIt != inLayer.cend(); ++featIt)
+      {
+        otb::ogr::Feature feature(outLayer.GetLayerDefn());
+        feature.SetFrom(*featIt);
+        outLayer.CreateFeature(feature);
+        ++nbPoints;
+      }
+    }
+    otbAppLogINFO(<< nbPoints << " samples in the merged mask" << std::endl);
+  }
+};
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::MergeShards)
@@ -33,8 +33,18 @@
 #include "itkListSample.h"
 #include "vcl_algorithm.h"
 #include "otbMultiToMonoChannelExtractROI.h"
+#include "otbSamplingWindow.h"
+#include "otbPolygonHilbertScheduler.h"
+#include "otbAdaptiveQuadtreeTiling.h"
+#include "otbTileCache.h"
+#include "otbSamplingImageIO.h"
+#include "otbQuotaSampler.h"
+#include "otbBandStatistics.h"
+#include "otbShardPlan.h"
+#include <boost/shared_ptr.hpp>
 #include <sstream>
 #include <iterator>   
+#include <typeinfo>
 
 namespace otb
 {
@@ -56,22 +66,49 @@ public:
   typedef otbSampling Self;
   typedef itk::SmartPointer<Self> Pointer; 
   
-  typedef FloatVectorImageType                 ImageType;  
-  typedef ImageType::InternalPixelType         ImagePixelType;
   typedef UInt32ImageType                      LabelImageType;
   typedef LabelImageType::InternalPixelType    LabelImagePixelType; 
-  typedef itk::ImageRegionIterator<ImageType>  IteratorType;
-  ImageType::IndexType IndexType;
-  
-  typename ImageType::RegionType            polygonRegion;
-  
-  typedef otb::MultiChannelExtractROI<ImagePixelType, ImagePixelType>  ExtractROIFilterType;
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
   
   itkNewMacro(Self);
 
   itkTypeMacro(otbSampling, otb::Application);
   
 private:
+  //A sampling configuration (mode, number of samples, seed) with its outputs and its sampling state
+  struct SamplingConfiguration
+  {
+    SamplingConfiguration() : samples(0), seed(0), layer(NULL, false) {}
+    
+    std::string mode;
+    int samples;
+    int seed;
+    GeneratorType::Pointer generator;
+    
+    //Output text file, closed with the last copy of the configuration, and verification mask
+    boost::shared_ptr<std::ofstream> file;
+    otb::ogr::DataSource::Pointer ogrDS;
+    otb::ogr::Layer layer;
+    
+    //Number of samples of each class, and of pixels raised
+    std::map<int, int> nbSamples;
+    std::map<int, int> nbPixelsRaised;
+    //Counter of pixels in the current polygon
+    std::map<unsigned long, int> counterPixelsInPolygon;
+    //Shifted counter of pixels in the current polygon
+    std::map<unsigned long, int> counterPixelsInPolygonShifted;
+    //RandomPosition of a sampled pixel for each polygons
+    std::map<unsigned long, int> randomPositionInPolygon;
+    //Quota mode : selection sampling of each class
+    otb::QuotaSampler quotaSampler;
+    
+    //State of the feature being sampled
+    int nbPixelsInPolygon;
+    int periodOfSampling;
+    int nextPixelRaisedPosition;
+    bool selected;
+  };
+  
   void DoInit()
   {
     SetName("otbSampling");
@@ -89,6 +126,7 @@ private:
     AddChoice("mode.randomequally", "Random sampling equally distributed according to the classes size");
     AddChoice("mode.periodic", "Periodic sampling, in all the polygons");
     AddChoice("mode.periodicrandom", "Periodic sampling, in all the polygons, randomly shifted");
+    AddChoice("mode.quota", "Random sampling of the number of samples of each class, the windows being read in a random order until every class quota is met");
         
     AddParameter(ParameterType_Int, "samples", "Number of samples per classes");
     SetDefaultParameterInt("samples", 2000);
@@ -98,12 +136,54 @@ private:
     SetDefaultParameterInt("tiles", 200);
     MandatoryOff("tiles");
     
+    AddParameter(ParameterType_Choice, "traversal", "Traversal of the image");
+    AddChoice("traversal.grid", "Regular grid of square tiles over the whole image");
+    AddChoice("traversal.hilbert", "Windows around the polygons, in Hilbert order, small polygons grouped in windows of at most tiles x tiles pixels");
+    AddChoice("traversal.adaptive", "Quadtree tiles adapted to the polygon density, empty areas are skipped");
+    AddParameter(ParameterType_Int, "traversal.adaptive.min", "Minimum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.min", 50);
+    AddParameter(ParameterType_Int, "traversal.adaptive.max", "Maximum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.max", 1000);
+    AddParameter(ParameterType_Float, "traversal.adaptive.overhead", "Cost of a tile, in number of pixel tests");
+    SetDefaultParameterFloat("traversal.adaptive.overhead", 1e5);
+    
+    AddParameter(ParameterType_StringList, "bands", "Bands to read and output (indices starting at 1), all the bands by default");
+    MandatoryOff("bands");
+    
+    AddParameter(ParameterType_Int, "cache", "RAM budget of the decoded tile cache (MB), 0 to disable it");
+    SetDefaultParameterInt("cache", 0);
+    MandatoryOff("cache");
+    
+    AddParameter(ParameterType_Directory, "cachedir", "Scratch directory where cached tiles are spilled, to be reused by later processes");
+    MandatoryOff("cachedir");
+    AddParameter(ParameterType_Int, "cachedisk", "Disk budget of the scratch directory (MB), the least recently used tiles being deleted beyond it");
+    SetDefaultParameterInt("cachedisk", 4096);
+    MandatoryOff("cachedisk");
+    
     AddParameter(ParameterType_Int, "nd", "NoData value");
     SetDefaultParameterInt("nd", 0);
     MandatoryOff("nd"); 
     
+    AddParameter(ParameterType_OutputFilename, "outstats", "Band statistics of the pixels of all the classes (XML), for the feature normalization");
+    MandatoryOff("outstats");
+    
     AddParameter(ParameterType_Int, "rand", "Seed value for Mersenne Twister Random Generator");
     MandatoryOff("rand"); 
+    
+    AddParameter(ParameterType_StringList, "configs", "Several sampling configurations, as mode[:samples[:seed]], sampled in one pass over the image. "
+                 "The outputs of the k-th one are the out and v files suffixed with _k; mode, samples and rand are then the defaults");
+    MandatoryOff("configs");
+    
+    AddParameter(ParameterType_Empty, "windowseeds", "One random stream per read window, seeded from the seed and the window number : the draws in a window do not depend on the windows read before it");
+    MandatoryOff("windowseeds");
+    
+    AddParameter(ParameterType_String, "shard", "Shard i/K of the read windows processed by this process (i from 1 to K), the outputs of the K shards being merged by MergeShards");
+    MandatoryOff("shard");
+    AddParameter(ParameterType_Choice, "shardstage", "Stage of a sharded run, the counts of all the shards being needed to sample any of them");
+    AddChoice("shardstage.count", "Count the pixels of the polygons in the windows of the shard, written to the out file suffixed with .counts");
+    AddChoice("shardstage.sample", "Sample the windows of the shard");
+    AddParameter(ParameterType_InputFilenameList, "shardstage.sample.counts", "Counts of the K shards, in the order of the shards");
+    MandatoryOff("shardstage.sample.counts");
   }
 
   void DoUpdateParameters()
@@ -111,43 +191,59 @@ private:
   }
 
   void DoExecute()
+  {
+    //The image is processed in the pixel type of the file, values are only converted when written out
+    switch(otb::ReadImageComponentType(GetParameterString("in")))
+    {
+      case itk::ImageIOBase::UCHAR:
+        ExecuteTyped<UInt8VectorImageType>();
+        break;
+      case itk::ImageIOBase::USHORT:
+        ExecuteTyped<UInt16VectorImageType>();
+        break;
+      case itk::ImageIOBase::SHORT:
+        ExecuteTyped<Int16VectorImageType>();
+        break;
+      default:
+        ExecuteTyped<FloatVectorImageType>();
+        break;
+    }
+  }
+
+  template <class TImage>
+  void ExecuteTyped()
   {  
-    //Input image
-    ImageType::Pointer image = GetParameterImage("in");
-    image->UpdateOutputInformation();    
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+    typedef itk::ImageRegionIterator<ImageType>     IteratorType;
     
-    //Output text file
-    std::ofstream myfile;
-    myfile.open (GetParameterString("out").c_str());
+    //Band subset, pushed down to the reader so that only these bands are decoded
+    std::vector<unsigned int> bands;
+    if(IsParameterEnabled("bands") && HasValue("bands"))
+    {
+      bands = otb::ParseBandList(GetParameterStringList("bands"));
+    }
+    
+    //Input image, read in its own pixel type
+    typedef otb::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(otb::BandSubsetFilename(GetParameterString("in"), bands));
+    typename ImageType::Pointer image = reader->GetOutput();
+    image->UpdateOutputInformation();    
     
     //Input shape file
     otb::ogr::DataSource::Pointer vectorData = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
     
-    //Output shape file
-    std::vector<std::string> options;
+    //Spatial reference of the output shape files
     std::string projRef = image->GetProjectionRef();
     OGRSpatialReference oSRS(projRef.c_str());
     
-    otb::ogr::DataSource::Pointer ogrDS;
-    ogrDS = otb::ogr::DataSource::New(GetParameterString("v").c_str(), otb::ogr::DataSource::Modes::Overwrite);
-    otb::ogr::Layer layer(NULL, false);
-    std::string layername = itksys::SystemTools::GetFilenameName(GetParameterString("v").c_str());
-    std::string extension = itksys::SystemTools::GetFilenameLastExtension(GetParameterString("v").c_str());
-    layername = layername.substr(0,layername.size()-(extension.size()));
-    layer = ogrDS->CreateLayer(layername, &oSRS, wkbPoint, options);
-    
     //No data value for pixels value
     int noDataValue = GetParameterInt("nd");
         
     //Dimension of a side of the square tiles
     int sizeTiles = GetParameterInt("tiles");
     
-    //Seed value for Mersenne Twister Random Generator 
-    int seed = GetParameterInt("rand");
-    
-    //Mode recuperation from the parameter
-    const std::string samplingMode = GetParameterString("mode");
-    
     //Number of elements in each pixels
     unsigned int nbComponents = image->GetNumberOfComponentsPerPixel();
     
@@ -155,44 +251,110 @@ private:
     otb::ogr::Layer preFiltered = vectorData->GetLayer(0);    
     otb::ogr::Feature preFeature = preFiltered.GetFeature(0);
         
-    for(unsigned int comp = 0; comp<nbComponents; ++comp)
-    {  
-      std::ostringstream fieldoss;
-      fieldoss<<"b"<<comp;
-      OGRFieldDefn field(fieldoss.str().c_str(), OFTReal);
-      layer.CreateField(field, true);
-    }  
+    //Sampling configurations, each one with its own outputs : the image is read once for all of them
+    std::vector<SamplingConfiguration> configurations = ParseConfigurations();
     
-    for(int comp = 0; comp < preFeature.ogr().GetFieldCount(); ++comp)
-    {  
-      std::ostringstream fieldoss;
-      fieldoss<<comp + nbComponents;
-      OGRFieldDefn field(preFeature.ogr().GetFieldDefnRef(comp)->GetNameRef(), preFeature.ogr().GetFieldDefnRef(comp)->GetType());
-      layer.CreateField(field, true);  
-    }  
-    
-    //Tiling
-    unsigned long sizeTilesX = sizeTiles;
-    unsigned long sizeTilesY = sizeTiles;
-    unsigned long sizeImageX = image->GetLargestPossibleRegion().GetSize()[0];
-    unsigned long sizeImageY = image->GetLargestPossibleRegion().GetSize()[1];    
-    unsigned int nbTilesX    = sizeImageX/sizeTilesX + (sizeImageX%sizeTilesX > 0 ? 1 : 0);
-    unsigned int nbTilesY    = sizeImageY/sizeTilesY + (sizeImageY%sizeTilesY > 0 ? 1 : 0);
+    //Sharded run : the windows of one shard, counted by a first stage then sampled by a second one, with one
+    //random stream per window so that the merged shards give the samples of a single process
+    const bool sharded = IsParameterEnabled("shard") && HasValue("shard");
+    const bool countStage = sharded && GetParameterString("shardstage") == "count";
+    const bool sampleStage = sharded && GetParameterString("shardstage") == "sample";
+    const bool windowSeeds = sharded || IsParameterEnabled("windowseeds");
+    unsigned int shardIndex = 1;
+    unsigned int shardCount = 1;
+    if(sharded)
+    {
+      std::string error;
+      try
+      {
+        otb::ParseShard(GetParameterString("shard"), shardIndex, shardCount);
+      }
+      catch(itk::ExceptionObject& err)
+      {
+        error = err.GetDescription();
+      }
+      for(unsigned int k = 0; k < configurations.size() && error.empty(); ++k)
+      {
+        //Selection sampling follows the pixels of a class over all the windows read before
+        if(configurations[k].mode == "quota")
+        {
+          error = "The quota mode cannot be sharded";
+        }
+      }
+      if(error.empty() && sampleStage && (!HasValue("shardstage.sample.counts") ||
+                                          GetParameterStringList("shardstage.sample.counts").size() != shardCount))
+      {
+        error = "The sampling of a shard needs the counts of the " + to_string(shardCount) + " shards";
+      }
+      if(!error.empty())
+      {
+        itkExceptionMacro(<< error);
+      }
+    }
+    
+    if(!countStage)
+    {
+      for(unsigned int k = 0; k < configurations.size(); ++k)
+      {
+        CreateOutputs(configurations[k], k, configurations.size(), oSRS, bands, nbComponents, preFeature);
+      }
+    }
+    
+    //Cache of the decoded tiles, shared by the passes and, through the scratch directory, by later processes
+    otb::TileCache tileCache;
+    tileCache.SetBudget(static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024);
+    if(IsParameterEnabled("cachedir") && HasValue("cachedir"))
+    {
+      tileCache.SetScratchDirectory(GetParameterString("cachedir"), static_cast<unsigned long long>(GetParameterInt("cachedisk"))*1024*1024);
+    }
+    const std::string imageKey = otb::TileCache::MakeImageKey(GetParameterString("in"), otb::BandListToString(bands), typeid(ImagePixelType).name());
+    
+    //Read windows : regular tiles over the whole image, windows around the polygons in Hilbert order,
+    //or quadtree tiles adapted to the polygon density
+    otb::SamplingWindowList windows;
+    if(GetParameterString("traversal") == "hilbert")
+    {
+      otb::PolygonHilbertScheduler scheduler;
+      scheduler.SetSizeTiles(sizeTiles);
+      scheduler.SetLineBuffer(3);
+      scheduler.AddLayer(image.GetPointer(), preFiltered);
+      windows = scheduler.GenerateWindows();
+    }
+    else if(GetParameterString("traversal") == "adaptive")
+    {
+      otb::AdaptiveQuadtreeTiling tiling;
+      tiling.SetMinimumSize(GetParameterInt("traversal.adaptive.min"));
+      tiling.SetMaximumSize(GetParameterInt("traversal.adaptive.max"));
+      tiling.SetTileOverhead(GetParameterFloat("traversal.adaptive.overhead"));
+      tiling.SetLineBuffer(3);
+      tiling.AddLayer(image.GetPointer(), preFiltered);
+      windows = tiling.GenerateWindows(image->GetLargestPossibleRegion());
+    }
+    else
+    {
+      windows = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), sizeTiles);
+    }
+    otbAppLogINFO(<< "Number of read windows : " << windows.size() << std::endl);
+    
+    //Windows of the shard, all of them in a single process
+    unsigned long firstWindow = 0;
+    unsigned long lastWindow = windows.size();
+    if(sharded)
+    {
+      otb::ShardWindowRange(windows.size(), shardIndex, shardCount, firstWindow, lastWindow);
+      otbAppLogINFO(<< "Shard " << shardIndex << "/" << shardCount << " : windows " << firstWindow << " to " << lastWindow << std::endl);
+    }
  
     //Number of pixels in all the polygons
     int nbPixelsGlobal = 0; 
     
     //Number of pixels in each classes
     std::map<int, int> elmtsInClass;
+    //Band statistics of the pixels of each class
+    std::map<int, otb::BandStatistics> classStatistics;
     
     //Number of pixels in each polygons
     std::map<unsigned long, int> polygon;
-    //Counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygon;
-    //Shifted counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygonShifted;
-    //RandomPosition of a sampled pixel for each polygons
-    std::map<unsigned long, int> randomPositionInPolygon;
     
     //Varibles to build the progression bar
     int stepsProgression = 0;
@@ -200,76 +362,57 @@ private:
     
     otbAppLogINFO(<< "Computing the number of pixels for each polygons and classes" << std::endl);
     
-    //Initialisation of the random generator
-    typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
-    GeneratorType::Pointer generator = GeneratorType::New();
-    generator->Initialize();
-    generator->SetSeed(seed);
-    
     int polyForced = 0;
             
-    // *** *** 1st run :  PROSPECTION      *** ***    
-    
-    //Loop across tiles
-    for(unsigned int row = 0; row < nbTilesY; ++row)
+    //Sampling stage of a shard : the counts of all the shards, and the pixels seen by the shards before this one
+    std::map<unsigned long, int> previousSampled;
+    if(sampleStage)
+    {
+      std::vector<std::string> countFiles = GetParameterStringList("shardstage.sample.counts");
+      otb::ShardCounts counts;
+      for(unsigned int i = 0; i < countFiles.size(); ++i)
+      {
+        if(i + 1 == shardIndex)
+        {
+          previousSampled = counts.sampledCounts;
+        }
+        counts.Merge(otb::ReadShardCounts(countFiles[i]));
+      }
+      polygon = counts.polygonCounts;
+      elmtsInClass = counts.classCounts;
+      classStatistics = counts.classStatistics;
+      nbPixelsGlobal = counts.nbPixels;
+    }
+    else
     {
-      for(unsigned int column = 0; column < nbTilesX; ++column)
-      { 
+      // *** *** 1st run :  PROSPECTION      *** ***    
+      otb::ogr::Layer filtered = vectorData->GetLayer(0);
+    
+      //Loop across the read windows
+      for(unsigned long w = firstWindow; w < lastWindow; ++w)
+      {
+        const otb::SamplingWindow& window = windows[w];
+      
         //Progression bar printing
-        currentProgression = ((row)*(nbTilesY)+(column+1))*10/(nbTilesX*nbTilesY);        
+        currentProgression = (w-firstWindow+1)*10/(lastWindow-firstWindow);
         if(currentProgression > stepsProgression)
         {
           std::cout<<stepsProgression*10<<"%..."<<std::flush;
           stepsProgression++;
         } 
-        
-        //Tiles dimensions
-        unsigned long startX = column*sizeTilesX;
-        unsigned long startY = row*sizeTilesY;
-        unsigned long sizeX  = vcl_min(sizeTilesX,sizeImageX-startX);
-        unsigned long sizeY  = vcl_min(sizeTilesY,sizeImageY-startY);
-        
-        //Extraction of the image
-        ExtractROIFilterType::Pointer extractROIFilter = ExtractROIFilterType::New();
-        extractROIFilter->SetInput(image);
-        extractROIFilter->SetStartX(startX);
-        extractROIFilter->SetStartY(startY);
-        extractROIFilter->SetSizeX(sizeX);
-        extractROIFilter->SetSizeY(sizeY);
-        extractROIFilter->Update();
-                 
-        //Extraction of the shape file       
-        OGRLinearRing spatialFilterRing;
-        OGRPoint ul,ur,lr,ll;
-        ImageType::IndexType urIndex;
-        ImageType::IndexType llIndex;
-        
-        urIndex[0] = startX + sizeX;
-        urIndex[1] = startY + sizeY;
-        llIndex[0] = startX;
-        llIndex[1] = startY;        
-          
-        itk::Point<double, 2> ulPoint;
-        itk::Point<double, 2> lrPoint;
-          
-        image->TransformIndexToPhysicalPoint(urIndex, lrPoint);
-        image->TransformIndexToPhysicalPoint(llIndex, ulPoint);  
-          
-        ul.setX(ulPoint[0]);
-        ul.setY(ulPoint[1]);
-        lr.setX(lrPoint[0]);
-        lr.setY(lrPoint[1]); 
-
-        otb::ogr::Layer filtered = vectorData->GetLayer(0);
-        filtered.SetSpatialFilterRect(ul.getX(), ul.getY(), lr.getX(), lr.getY());         
-  
-        otb::ogr::Layer::const_iterator featIt = filtered.begin(); 
-        
+      
+        //Extraction of the image, from the tile cache when possible
+        typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), window.region, &tileCache, imageKey);
+      
+        //Extraction of the features processed in the window
+        std::vector<otb::ogr::Feature> features = otb::GetWindowFeatures(image.GetPointer(), filtered, window);
+        std::vector<otb::ogr::Feature>::iterator featIt = features.begin();
+      
         //Loop across the features in the layer
-        for(; featIt!=filtered.end(); ++featIt)
+        for(; featIt!=features.end(); ++featIt)
         {          
           OGRGeometry * geom = featIt->ogr().GetGeometryRef();
-          
+        
           bool testPoly = false;
           bool testLineBuffers = false;
           if(geom->getGeometryType() == wkbLineString)
@@ -278,53 +421,60 @@ private:
             //std::cout<< "Coord : " << geom->getCoordinateDimension() << std::endl;
             testLineBuffers = true;
           }
-          
+        
           if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
           {
             testPoly = true;
           }
-                    
+                  
           //We are dealing with simple polygons
           if(testPoly || testLineBuffers)
           {   
             OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);
             OGRLinearRing * exteriorRing = inPolygon->getExteriorRing();
-            IteratorType it(extractROIFilter->GetOutput(), extractROIFilter->GetOutput()->GetLargestPossibleRegion());
-            
-            //Number of pixels in a polygon
+            //Region of the window over which the feature is processed
+            typename ImageType::RegionType featureRegion;
+            if(!otb::GeometryRegionInWindow(image.GetPointer(), geom, window, featureRegion))
+            {
+              continue;
+            }
+            IteratorType it(tile, featureRegion);
+          
+            //Number of pixels in a polygon, and statistics of their bands
             int nbOfPixelsInGeom = 0;
-            
+            otb::BandStatistics geomStatistics(nbComponents);
+          
             //Loop across pixels in the tile
             for (it.GoToBegin(); !it.IsAtEnd(); ++it)
             {                          
               itk::Point<double, 2> point;
-              extractROIFilter->GetOutput()->TransformIndexToPhysicalPoint(it.GetIndex(), point);           
-              
+              tile->TransformIndexToPhysicalPoint(it.GetIndex(), point);           
+            
               //Access to the pixel value 
-              ImageType::PixelType pixelValue = it.Get();
-              
+              typename ImageType::PixelType pixelValue = it.Get();
+            
               //Tranformation in OGRPoint in order to know if it's in the geometry
               OGRPoint pointOGR;
               pointOGR.setX(point[0]);
               pointOGR.setY(point[1]);
-                            
+                          
               //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
               bool noDataTest = false;            
               for (unsigned int i=0; i<nbComponents; i++)
               {   
-                if(noDataTest && (pixelValue[i] == noDataValue))
+                if(pixelValue[i] == noDataValue)
                 {
                   noDataTest = true; 
                 }  
               }             
-              
+            
               //If the pixel is not "No-Data" and is in the geometry, them we count it
               //isPointOnRingBoundary() is not relevent beacause there is not (or very few) pixel excatly on the line boundary...
               /*&& !(exteriorRing->isPointOnRingBoundary(&pointOGR, TRUE))*/
-                            
+                          
               //Test if the current pixel is in a polygon hole
               bool isNotInHole = true;
-              
+            
               for (int i=0; i < inPolygon->getNumInteriorRings(); ++i)
               {
                 if(inPolygon->getInteriorRing(i) != NULL)
@@ -336,30 +486,45 @@ private:
                   }
                 }
               }
-              
+            
               if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole)
               {
                 nbOfPixelsInGeom++;
                 nbPixelsGlobal++;
+                geomStatistics.Add(pixelValue);
               }                    
             }
-            
+          
             //Class name recuperation
             int className = featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());             
-            
+          
             //Counters update, number of pixel in each classes and in each polygones 
             polygon[featIt->ogr().GetFID()] += nbOfPixelsInGeom;
-            //Generation of a random number for the sampling in a polygon where we only need one pixel, it's choosen randomly
-            randomPositionInPolygon[featIt->ogr().GetFID()] = static_cast<int>(generator->GetUniformVariate(0, polygon[featIt->ogr().GetFID()]));
+            classStatistics[className].Merge(geomStatistics);
             elmtsInClass[className] = elmtsInClass[className] + nbOfPixelsInGeom;                                  
           }   
         }      
-      }     
+      }
     }
     
     //End of progression bar
     std::cout<<"100%"<<std::endl;
     
+    //Counting stage of a shard : its counts, read by the sampling stage of every shard
+    if(countStage)
+    {
+      otb::ShardCounts counts;
+      counts.polygonCounts = polygon;
+      //The prospection skips the nodata pixels as the sampling does, it counts the pixels the sampling sees
+      counts.sampledCounts = polygon;
+      counts.classCounts = elmtsInClass;
+      counts.classStatistics = classStatistics;
+      counts.nbPixels = nbPixelsGlobal;
+      otb::WriteShardCounts(GetParameterString("out") + ".counts", counts);
+      otbAppLogINFO(<< "Counts of the shard written to " << GetParameterString("out") << ".counts" << std::endl);
+      return;
+    }
+    
     /* TRACES */
     //
     std::cout<< "Nb de classes : " << elmtsInClass.size() << std::endl;
@@ -379,322 +544,503 @@ private:
     //{
     //  std::cout << "Dans le polygon " << (*ipolygon).first << " il y a " << (*ipolygon).second << " pixels." << std::endl;
     //} 
-            
-    otbAppLogINFO(<< "Sampling pixels with the sampling mode : " << samplingMode << std::endl);
     
+    //Band statistics of all the classes, computed during the prospection
+    if(IsParameterEnabled("outstats") && HasValue("outstats"))
+    {
+      otb::BandStatistics globalStatistics(nbComponents);
+      for(std::map<int, otb::BandStatistics>::iterator iClass = classStatistics.begin(); iClass != classStatistics.end(); ++iClass)
+      {
+        globalStatistics.Merge((*iClass).second);
+      }
+      otb::WriteBandStatisticsXML(GetParameterString("outstats"), globalStatistics);
+    }
+            
     //Progression bar re-initialisation
-    stepsProgression = 0;    
-        
-    //Initialisation counter of pixel raised in each classes
-    std::map<int, int> nbPixelsRaised;
-    std::map<int, int> nbSamples;
-    for(std::map<int, int>::iterator iClass = elmtsInClass.begin(); iClass != elmtsInClass.end(); ++iClass)
+    stepsProgression = 0;
+
+    //Initialisation of each configuration : number of samples, random generator and quotas
+    bool allQuota = true;
+    for(unsigned int k = 0; k < configurations.size(); ++k)
     {
-      nbSamples[(*iClass).first] = GetParameterInt("samples");
-      if(nbSamples[(*iClass).first] > (*iClass).second)
+      SamplingConfiguration& config = configurations[k];
+      otbAppLogINFO(<< "Sampling pixels with the sampling mode : " << config.mode << ", " << config.samples << " samples per class, seed " << config.seed << std::endl);
+
+      config.generator = GeneratorType::New();
+      config.generator->Initialize();
+      config.generator->SetSeed(config.seed);
+      //Sampling stage of a shard : the polygons are counted from the pixels seen by the shards before this one
+      config.counterPixelsInPolygon = previousSampled;
+      for(std::map<int, int>::iterator iClass = elmtsInClass.begin(); iClass != elmtsInClass.end(); ++iClass)
       {
-        nbSamples[(*iClass).first] = (*iClass).second;
+        config.nbSamples[(*iClass).first] = std::min(config.samples, (*iClass).second);
+        config.quotaSampler.SetQuota(iClass->first, config.nbSamples[iClass->first], iClass->second);
       }
-      
+      //Generation of a random number for the sampling in a polygon where we only need one pixel, it's choosen randomly
+      for(std::map<unsigned long, int>::iterator iPolygon = polygon.begin(); iPolygon != polygon.end(); ++iPolygon)
+      {
+        config.randomPositionInPolygon[iPolygon->first] = static_cast<int>(config.generator->GetUniformVariate(0, iPolygon->second));
+      }
+      allQuota = allQuota && config.mode == "quota";
+    }
+
+    //Quota mode : the windows are read in a random order, until the quotas are met. With other
+    //configurations sharing the pass, every window has to be read anyway.
+    if(allQuota)
+    {
+      otb::ShuffleList(windows, configurations[0].generator.GetPointer());
     }
+
     // *** *** 2nd run : SAMPLING   *** ***
-    //Loop across tiles
-    for(unsigned int row = 0; row < nbTilesY; ++row)
+    otb::ogr::DataSource::Pointer vectorData2 = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
+    otb::ogr::Layer filtered2 = vectorData2->GetLayer(0);
+    //Loop across the read windows
+    for(unsigned long w = firstWindow; w < lastWindow; ++w)
     {
-      for(unsigned int column = 0; column < nbTilesX; ++column)
-      {         
-        //Progression bar printing
-        currentProgression = ((row)*(nbTilesY)+(column+1))*10/(nbTilesX*nbTilesY);        
-        if(currentProgression > stepsProgression)
+      const otb::SamplingWindow& window = windows[w];
+
+      //Quota mode : no more reading once every class is complete
+      if(allQuota && IsComplete(configurations))
+      {
+        otbAppLogINFO(<< "Every class quota is met, " << windows.size() - w << " windows left unread" << std::endl);
+        break;
+      }
+
+      //Progression bar printing
+      currentProgression = (w-firstWindow+1)*10/(lastWindow-firstWindow);
+      if(currentProgression > stepsProgression)
+      {
+        std::cout<<stepsProgression*10<<"%..."<<std::flush;
+        stepsProgression++;
+      }
+
+      //Random stream of the window
+      if(windowSeeds)
+      {
+        for(unsigned int k = 0; k < configurations.size(); ++k)
         {
-          std::cout<<stepsProgression*10<<"%..."<<std::flush;
-          stepsProgression++;
+          configurations[k].generator->SetSeed(otb::WindowSeed(configurations[k].seed, w));
         }
-        
-        //Tiles dimensions
-        unsigned long startX = column*sizeTilesX;
-        unsigned long startY = row*sizeTilesY;
-        unsigned long sizeX  = vcl_min(sizeTilesX,sizeImageX-startX);
-        unsigned long sizeY  = vcl_min(sizeTilesY,sizeImageY-startY);
-        
-        //Extraction of the image
-        ExtractROIFilterType::Pointer extractROIFilter = ExtractROIFilterType::New();
-        extractROIFilter->SetInput(image);
-        extractROIFilter->SetStartX(startX);
-        extractROIFilter->SetStartY(startY);
-        extractROIFilter->SetSizeX(sizeX);
-        extractROIFilter->SetSizeY(sizeY);
-        extractROIFilter->Update();           
-                
-        //Extraction of the shape file
-        OGRLinearRing spatialFilterRing;
-        OGRPoint ul,ur,lr,ll;
-        ImageType::IndexType urIndex;
-        ImageType::IndexType llIndex;
-        
-        urIndex[0] = startX + sizeX;
-        urIndex[1] = startY + sizeY;
-        llIndex[0] = startX;
-        llIndex[1] = startY;        
-          
-        itk::Point<double, 2> ulPoint;
-        itk::Point<double, 2> lrPoint;
-          
-        image->TransformIndexToPhysicalPoint(urIndex, lrPoint);
-        image->TransformIndexToPhysicalPoint(llIndex, ulPoint);  
-          
-        ul.setX(ulPoint[0]);
-        ul.setY(ulPoint[1]);
-        lr.setX(lrPoint[0]);
-        lr.setY(lrPoint[1]);
-        
-        otb::ogr::DataSource::Pointer vectorData2 = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
-        otb::ogr::Layer filtered2 = vectorData2->GetLayer(0);
-        filtered2.SetSpatialFilterRect(ul.getX(), ul.getY(), lr.getX(), lr.getY());
-        otb::ogr::Layer::const_iterator featIt = filtered2.begin(); 
-        
-        unsigned int c = 0;
-        
-        //Loop across the features in the layer
-        for(; featIt!=filtered2.end(); ++featIt,++c)
-        {                     
-          OGRGeometry * geom = featIt->ogr().GetGeometryRef();
-          bool testPoly = false;
-          bool testLineBuffers = false;
-          if(geom->getGeometryType() == wkbLineString)
+      }
+
+      //Extraction of the features processed in the window
+      std::vector<otb::ogr::Feature> features = otb::GetWindowFeatures(image.GetPointer(), filtered2, window);
+      std::vector<otb::ogr::Feature>::iterator featIt = features.begin();
+
+      //Quota mode : the window is not read when all its classes are complete
+      if(allQuota)
+      {
+        bool needed = false;
+        for(; featIt != features.end() && !needed; ++featIt)
+        {
+          needed = IsClassNeeded(configurations, featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str()));
+        }
+        featIt = features.begin();
+        if(!needed)
+        {
+          continue;
+        }
+      }
+
+      //Extraction of the image, from the tile cache when possible
+      typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), window.region, &tileCache, imageKey);
+
+      //Loop across the features in the layer
+      for(; featIt!=features.end(); ++featIt)
+      {
+        OGRGeometry * geom = featIt->ogr().GetGeometryRef();
+        bool testPoly = false;
+        bool testLineBuffers = false;
+        if(geom->getGeometryType() == wkbLineString)
+        {
+          // Il faut redéfinir geom
+          //geom = geom->Buffer(3);
+          //std::cout<< "Coord : " << geom->getCoordinateDimension() << std::endl;
+          testLineBuffers = true;
+        }
+
+        if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
+        {
+          testPoly = true;
+          //std::cout<< "Coord : " << featIt->ogr().GetFID() << std::endl;
+        }
+
+        //Class name recuperation
+        int className = featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());
+        if(!IsClassNeeded(configurations, className))
+        {
+          continue;
+        }
+
+        //We are dealing with simple polygons
+        if(testPoly || testLineBuffers)
+        {
+          OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);
+          OGRLinearRing * exteriorRing = inPolygon->getExteriorRing();
+
+          //Region of the window over which the feature is processed
+          typename ImageType::RegionType featureRegion;
+          if(!otb::GeometryRegionInWindow(image.GetPointer(), geom, window, featureRegion))
           {
-            // Il faut redéfinir geom
-            //geom = geom->Buffer(3);
-            //std::cout<< "Coord : " << geom->getCoordinateDimension() << std::endl;
-            testLineBuffers = true;
+            continue;
           }
-          
-          if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
+          IteratorType it(tile, featureRegion);
+
+          unsigned long fid = featIt->ogr().GetFID();
+          for(unsigned int k = 0; k < configurations.size(); ++k)
           {
-            testPoly = true;
-            //std::cout<< "Coord : " << featIt->ogr().GetFID() << std::endl;
-          }
-             
-          //Class name recuperation
-          int className = featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());
-          
-          //We are dealing with simple polygons
-          if(testPoly || testLineBuffers)
-          {           
-            OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);          
-            OGRLinearRing * exteriorRing = inPolygon->getExteriorRing(); 
-            
-            IteratorType it(extractROIFilter->GetOutput(), extractROIFilter->GetOutput()->GetLargestPossibleRegion());
-             
+            SamplingConfiguration& config = configurations[k];
+
             //Compute the number of pixel we need to sample in each polygons
-            int nbPixelsInPolygon = static_cast<int>((nbSamples[className])*(polygon[featIt->ogr().GetFID()])/(elmtsInClass[className]));    
-            
+            config.nbPixelsInPolygon = static_cast<int>((config.nbSamples[className])*(polygon[fid])/(elmtsInClass[className]));
+
             //If this number is less then 1, we force it to be 1
-            if(nbPixelsInPolygon < 1)
+            if(config.nbPixelsInPolygon < 1)
             {
-              nbPixelsInPolygon = 1;
+              config.nbPixelsInPolygon = 1;
               polyForced++;
             }
-            
+
             //Compute of the period of sampling, every n-pixels we raise one
-            int periodOfSampling = static_cast<int>(polygon[featIt->ogr().GetFID()]/nbPixelsInPolygon);    
-                        
-            //Counters initialisations            
-            //Shifted counter, to anticipate the position of the next raised pixel            
-            counterPixelsInPolygonShifted[featIt->ogr().GetFID()] = counterPixelsInPolygon[featIt->ogr().GetFID()] + periodOfSampling;
+            config.periodOfSampling = static_cast<int>(polygon[fid]/config.nbPixelsInPolygon);
+
+            //Counters initialisations
+            //Shifted counter, to anticipate the position of the next raised pixel
+            config.counterPixelsInPolygonShifted[fid] = config.counterPixelsInPolygon[fid] + config.periodOfSampling;
             //Position of the next pixel raised
-            int nextPixelRaisedPosition = periodOfSampling;
-                                               
-            //Loop across pixels in the tile
-            for (it.GoToBegin(); !it.IsAtEnd(); ++it)
-            {   
-              itk::Point<double, 2> point;
-              
-              //Boolean variable, we sample the current pixel or not
-              bool resultTest = false;
-                                         
-              extractROIFilter->GetOutput()->TransformIndexToPhysicalPoint(it.GetIndex(), point); 
-              
-              //Access to the pixel value
-              ImageType::PixelType pixelValue = it.Get();
-               
-              //Tranformation in OGRPoint in order to know if it's in the geometry
-              OGRPoint pointOGR;
-              pointOGR.setX(point[0]);
-              pointOGR.setY(point[1]); 
-              
-              //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
-              bool noDataTest = false;            
-              for (unsigned int i=0; i<nbComponents; i++)
-              {   
-                if(pixelValue[i] == noDataValue)
-                {
-                  noDataTest = true; 
-                }  
+            config.nextPixelRaisedPosition = config.periodOfSampling;
+          }
+
+          //Loop across pixels in the tile
+          for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+          {
+            itk::Point<double, 2> point;
+
+            tile->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+
+            //Access to the pixel value
+            typename ImageType::PixelType pixelValue = it.Get();
+
+            //Tranformation in OGRPoint in order to know if it's in the geometry
+            OGRPoint pointOGR;
+            pointOGR.setX(point[0]);
+            pointOGR.setY(point[1]);
+
+            //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
+            bool noDataTest = false;
+            for (unsigned int i=0; i<nbComponents; i++)
+            {
+              if(pixelValue[i] == noDataValue)
+              {
+                noDataTest = true;
               }
-              
-              //Pre-test is the polygon at least one pixel
-              if(polygon[featIt->ogr().GetFID()]!=0)
+            }
+
+            //Pre-test is the polygon at least one pixel : we sample the current pixel or not, in each configuration
+            for(unsigned int k = 0; k < configurations.size(); ++k)
+            {
+              configurations[k].selected = polygon[fid] != 0 && SelectPixel(configurations[k], className, fid, nbPixelsGlobal, elmtsInClass[className]);
+            }
+
+            //Test if the current pixel is in a polygon hole
+            bool isNotInHole = true;
+
+            for (int i=0; i != inPolygon->getNumInteriorRings(); ++i)
+            {
+              if(inPolygon->getInteriorRing(i) != NULL)
               {
-                //Succession of tests to know in whoch mode we are
-                //Exhautive mode : we extract all pixels in every polygons in every classes
-                if (samplingMode == "exhaustive")
-                {
-                  resultTest= true;
-                }
-                
-                //Random mode : we extract nbSamples pixels randomly in all the image
-                if (samplingMode == "random")
-                {
-                  //The probability of sampling a pixel is function of the number of pixels in every classes
-                  float probability = static_cast<float>(nbSamples[className])/static_cast<float>(nbPixelsGlobal);
-                  if(generator->GetUniformVariate(0, 1) < probability)
-                  {
-                    resultTest= true;        
-                  }
-                }
-                
-                //Random mode equally : we extract nbSAmples pixels for each classes
-                if (samplingMode == "randomequally")
-                {
-                  //The probability of sampling a pixel is function of the number of pixels in each classes
-                  float probability = static_cast<float>(nbSamples[className])/static_cast<float>(elmtsInClass[className]);
-                  if(generator->GetUniformVariate(0, 1) < probability)
-                  {
-                    resultTest= true;        
-                  }
-                }
-                
-                //Periodic : we extract, more or less, nbsamples pixels for each classes every n pixels
-                if (samplingMode == "periodic")
+                OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
+                if(interiorRing->isPointInRing(&pointOGR, TRUE))
                 {
-                  //In a polygon where we only need one pixel, we raise it at a radom position
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()] == randomPositionInPolygon[featIt->ogr().GetFID()])&&(nbPixelsInPolygon == 1))
-                  {
-                    resultTest= true;
-                  } 
-                  //If we need more then one pixel in the polygon, we sample a pixel periodicly, every n-pixels
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()]%periodOfSampling)==0 && (nbPixelsInPolygon != 1))
-                  {
-                    resultTest= true;                  
-                  }
-                }
-                
-                //Periodic random : we extract, more or less, nbsmaples pixels for each classes every n+-delta pixels ( 0<delta<n/2 )
-                if (samplingMode == "periodicrandom")
-                {
-                  //In a polygon where we only need one pixel, we raise it at a radom position
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()] == randomPositionInPolygon[featIt->ogr().GetFID()]) && (nbPixelsInPolygon == 1))
-                  {
-                    resultTest= true;
-                  } 
-                  //If we need more then one pixel in the polygon
-                  else if(nbPixelsInPolygon != 1)
-                  {
-                    //The first pixel raised is randomly choosen
-                    if(counterPixelsInPolygon[featIt->ogr().GetFID()] == static_cast<int>(generator->GetUniformVariate(0, (periodOfSampling/2))))
-                    {
-                      resultTest= true;  
-                    }
-                    
-                    //We raised the pixel if we are at the good position
-                    if(counterPixelsInPolygon[featIt->ogr().GetFID()] == nextPixelRaisedPosition)
-                    {
-                      resultTest= true; 
-                    }
-                    
-                    //Every n-pixels we compute the position of the next pixel sampled
-                    if(counterPixelsInPolygonShifted[featIt->ogr().GetFID()]%periodOfSampling == 0)
-                    {
-                      int sign = generator->GetUniformVariate(0, 1);
-                      int rdm = static_cast<int>(generator->GetUniformVariate(0, (periodOfSampling/2)));   
-                      
-                      if (sign<0.5)
-                      {
-                        nextPixelRaisedPosition = counterPixelsInPolygonShifted[featIt->ogr().GetFID()] - rdm;
-                      }
-                      else
-                      {
-                        nextPixelRaisedPosition = counterPixelsInPolygonShifted[featIt->ogr().GetFID()] + rdm;
-                      }
-                    }                                  
-                  }
+                  isNotInHole = false;
                 }
               }
-              
-              //Test if the current pixel is in a polygon hole
-              bool isNotInHole = true;
-              
-              for (int i=0; i != inPolygon->getNumInteriorRings(); ++i)
+            }
+
+            //If the pixel is not "No-Data" and is in the geometry, them we count it
+            /*&& !(exteriorRing->isPointOnRingBoundary(&pointOGR, TRUE))*/
+            if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole )
+            {
+              for(unsigned int k = 0; k < configurations.size(); ++k)
               {
-                if(inPolygon->getInteriorRing(i) != NULL)
+                SamplingConfiguration& config = configurations[k];
+
+                //Quota mode : the pixel is selected among the pixels of its class not seen yet
+                if(config.mode == "quota")
                 {
-                  OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
-                  if(interiorRing->isPointInRing(&pointOGR, TRUE))
-                  {
-                    isNotInHole = false;
-                  }
+                  config.selected = config.quotaSampler.Select(className, config.generator->GetUniformVariate(0, 1));
                 }
-              }  
-              
-              //If the pixel is not "No-Data" and is in the geometry, them we count it              
-              /*&& !(exteriorRing->isPointOnRingBoundary(&pointOGR, TRUE))*/
-              if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole )
-              {              
+
                 //Test if the current pixel is good to sample or not
-                if(resultTest)
+                if(config.selected)
                 {
-                  std::string message = to_string(className);
-                  otb::ogr::Feature featureOutput(layer.GetLayerDefn());       
-                  
-                  //Adding the raised pixel to our output shape file
-                  featureOutput.SetGeometry(&pointOGR);     
-                    
-                  //Completing the text and shape output files with the pixel values
-                  for (unsigned int i=0; i<nbComponents; i++)
-                  {
-                    message += " " + to_string(i+1) + ":" + to_string(pixelValue[i]);  
-                    featureOutput.ogr().SetField(i, pixelValue[i]);    
-                  }
-                  
-                  //We also add informations about where the pixel is extract from
-                  for(int c = 0; c < preFeature.ogr().GetFieldCount(); ++c)
-                  {  
-                    if(featIt->ogr().GetFieldDefnRef(c)->GetType() == OFTString )
-                    {
-                      featureOutput.ogr().SetField(nbComponents + c, featIt->ogr().GetFieldAsString(c));
-                    }  
-                    else if(featIt->ogr().GetFieldDefnRef(c)->GetType() == OFTInteger )
-                    {
-                      featureOutput.ogr().SetField(nbComponents + c, featIt->ogr().GetFieldAsInteger(c));
-                    }
-                  }  
-                  
-                  layer.CreateFeature(featureOutput);
-                  myfile << message << std::endl; 
-                  //Incrementation of the counter of raised pixels in each classes
-                  nbPixelsRaised[className]++;
-                }    
+                  WriteSample(config, className, pointOGR, pixelValue, nbComponents, *featIt, preFeature);
+                }
                 //Incrementation of counters of pixels studied
-                counterPixelsInPolygon[featIt->ogr().GetFID()]++;
-                counterPixelsInPolygonShifted[featIt->ogr().GetFID()]++;
-              }                
-            }  
-          }   
+                config.counterPixelsInPolygon[fid]++;
+                config.counterPixelsInPolygonShifted[fid]++;
+              }
+            }
+          }
         }
       }
-    }      
-    myfile.close();
-    
+    }
+
+    if(tileCache.IsEnabled())
+    {
+      otbAppLogINFO(<< "Tile cache : " << tileCache.GetHits() << " hits, " << tileCache.GetMisses() << " misses" << std::endl);
+    }
+
     //End of progression bar
-    std::cout<<"100%"<<std::endl;    
+    std::cout<<"100%"<<std::endl;
     //std::cout<<"polyForced" << polyForced<<std::endl;
     //Output the number of pixel sampled in each classes.
-    for(std::map<int, int>::iterator iClass = nbPixelsRaised.begin(); iClass != nbPixelsRaised.end(); ++iClass)
+    for(unsigned int k = 0; k < configurations.size(); ++k)
     {
-      otbAppLogINFO(<< "Number of pixels raised in class " << (*iClass).first << " : "<< (*iClass).second<< std::endl);
+      for(std::map<int, int>::iterator iClass = configurations[k].nbPixelsRaised.begin(); iClass != configurations[k].nbPixelsRaised.end(); ++iClass)
+      {
+        otbAppLogINFO(<< (configurations.size() > 1 ? "Configuration " + to_string(k) + " : " : std::string())
+                      << "Number of pixels raised in class " << (*iClass).first << " : "<< (*iClass).second<< std::endl);
+      }
+      configurations[k].file->close();
     }
-    
+  }
+
+  //Sampling configurations : the configs list, or the single one of the mode, samples and rand parameters
+  std::vector<SamplingConfiguration> ParseConfigurations()
+  {
+    std::vector<std::string> descriptions;
+    if(IsParameterEnabled("configs") && HasValue("configs"))
+    {
+      descriptions = GetParameterStringList("configs");
+    }
+    else
+    {
+      descriptions.push_back(GetParameterString("mode"));
+    }
+
+    std::vector<SamplingConfiguration> configurations;
+    for(std::vector<std::string>::const_iterator it = descriptions.begin(); it != descriptions.end(); ++it)
+    {
+      SamplingConfiguration config;
+      config.samples = GetParameterInt("samples");
+      config.seed = GetParameterInt("rand");
+
+      std::istringstream iss(*it);
+      std::getline(iss, config.mode, ':');
+      std::string value;
+      if(std::getline(iss, value, ':') && !value.empty())
+      {
+        config.samples = atoi(value.c_str());
+      }
+      if(std::getline(iss, value, ':') && !value.empty())
+      {
+        config.seed = atoi(value.c_str());
+      }
+
+      if(config.mode != "exhaustive" && config.mode != "random" && config.mode != "randomequally" &&
+         config.mode != "periodic" && config.mode != "periodicrandom" && config.mode != "quota")
+      {
+        itkExceptionMacro(<< "Unknown sampling mode " << config.mode << " in the configuration " << *it);
+      }
+      configurations.push_back(config);
+    }
+    return configurations;
+  }
+
+  //Output filename of the k-th configuration : the filename itself when there is only one
+  static std::string ConfigurationFilename(const std::string& filename, unsigned int k, unsigned int nbConfigurations)
+  {
+    if(nbConfigurations == 1)
+    {
+      return filename;
+    }
+    std::string extension = itksys::SystemTools::GetFilenameLastExtension(filename);
+    return filename.substr(0, filename.size() - extension.size()) + "_" + to_string(k) + extension;
+  }
+
+  //Output text file and verification mask of a configuration
+  void CreateOutputs(SamplingConfiguration& config, unsigned int k, unsigned int nbConfigurations, OGRSpatialReference& oSRS,
+                     const std::vector<unsigned int>& bands, unsigned int nbComponents, otb::ogr::Feature& preFeature)
+  {
+    config.file.reset(new std::ofstream(ConfigurationFilename(GetParameterString("out"), k, nbConfigurations).c_str()));
+
+    std::string maskFilename = ConfigurationFilename(GetParameterString("v"), k, nbConfigurations);
+    std::vector<std::string> options;
+    config.ogrDS = otb::ogr::DataSource::New(maskFilename.c_str(), otb::ogr::DataSource::Modes::Overwrite);
+    std::string layername = itksys::SystemTools::GetFilenameName(maskFilename.c_str());
+    std::string extension = itksys::SystemTools::GetFilenameLastExtension(maskFilename.c_str());
+    layername = layername.substr(0,layername.size()-(extension.size()));
+    config.layer = config.ogrDS->CreateLayer(layername, &oSRS, wkbPoint, options);
+
+    for(unsigned int comp = 0; comp<nbComponents; ++comp)
+    {
+      OGRFieldDefn field(otb::BandFieldName(bands, comp).c_str(), OFTReal);
+      config.layer.CreateField(field, true);
+    }
+
+    for(int comp = 0; comp < preFeature.ogr().GetFieldCount(); ++comp)
+    {
+      OGRFieldDefn field(preFeature.ogr().GetFieldDefnRef(comp)->GetNameRef(), preFeature.ogr().GetFieldDefnRef(comp)->GetType());
+      config.layer.CreateField(field, true);
+    }
+  }
+
+  //The class still needs samples in one of the configurations (the others than quota always do)
+  static bool IsClassNeeded(const std::vector<SamplingConfiguration>& configurations, int className)
+  {
+    for(unsigned int k = 0; k < configurations.size(); ++k)
+    {
+      if(configurations[k].mode != "quota" || !configurations[k].quotaSampler.IsClassComplete(className))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool IsComplete(const std::vector<SamplingConfiguration>& configurations)
+  {
+    for(unsigned int k = 0; k < configurations.size(); ++k)
+    {
+      if(configurations[k].mode != "quota" || !configurations[k].quotaSampler.IsComplete())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //Selection of a pixel of the bounding region of the polygon, before the test of the geometry
+  static bool SelectPixel(SamplingConfiguration& config, int className, unsigned long fid, int nbPixelsGlobal, int nbPixelsInClass)
+  {
+    bool resultTest = false;
+
+    //Succession of tests to know in whoch mode we are
+    //Exhautive mode : we extract all pixels in every polygons in every classes
+    if (config.mode == "exhaustive")
+    {
+      resultTest= true;
+    }
+
+    //Random mode : we extract nbSamples pixels randomly in all the image
+    if (config.mode == "random")
+    {
+      //The probability of sampling a pixel is function of the number of pixels in every classes
+      float probability = static_cast<float>(config.nbSamples[className])/static_cast<float>(nbPixelsGlobal);
+      if(config.generator->GetUniformVariate(0, 1) < probability)
+      {
+        resultTest= true;
+      }
+    }
+
+    //Random mode equally : we extract nbSAmples pixels for each classes
+    if (config.mode == "randomequally")
+    {
+      //The probability of sampling a pixel is function of the number of pixels in each classes
+      float probability = static_cast<float>(config.nbSamples[className])/static_cast<float>(nbPixelsInClass);
+      if(config.generator->GetUniformVariate(0, 1) < probability)
+      {
+        resultTest= true;
+      }
+    }
+
+    int counter = config.counterPixelsInPolygon[fid];
+    int periodOfSampling = config.periodOfSampling;
+
+    //Periodic : we extract, more or less, nbsamples pixels for each classes every n pixels
+    if (config.mode == "periodic")
+    {
+      //In a polygon where we only need one pixel, we raise it at a radom position
+      if((counter == config.randomPositionInPolygon[fid])&&(config.nbPixelsInPolygon == 1))
+      {
+        resultTest= true;
+      }
+      //If we need more then one pixel in the polygon, we sample a pixel periodicly, every n-pixels
+      if((counter%periodOfSampling)==0 && (config.nbPixelsInPolygon != 1))
+      {
+        resultTest= true;
+      }
+    }
+
+    //Periodic random : we extract, more or less, nbsmaples pixels for each classes every n+-delta pixels ( 0<delta<n/2 )
+    if (config.mode == "periodicrandom")
+    {
+      //In a polygon where we only need one pixel, we raise it at a radom position
+      if((counter == config.randomPositionInPolygon[fid]) && (config.nbPixelsInPolygon == 1))
+      {
+        resultTest= true;
+      }
+      //If we need more then one pixel in the polygon
+      else if(config.nbPixelsInPolygon != 1)
+      {
+        //The first pixel raised is randomly choosen
+        if(counter == static_cast<int>(config.generator->GetUniformVariate(0, (periodOfSampling/2))))
+        {
+          resultTest= true;
+        }
+
+        //We raised the pixel if we are at the good position
+        if(counter == config.nextPixelRaisedPosition)
+        {
+          resultTest= true;
+        }
+
+        //Every n-pixels we compute the position of the next pixel sampled
+        if(config.counterPixelsInPolygonShifted[fid]%periodOfSampling == 0)
+        {
+          int sign = config.generator->GetUniformVariate(0, 1);
+          int rdm = static_cast<int>(config.generator->GetUniformVariate(0, (periodOfSampling/2)));
+
+          if (sign<0.5)
+          {
+            config.nextPixelRaisedPosition = config.counterPixelsInPolygonShifted[fid] - rdm;
+          }
+          else
+          {
+            config.nextPixelRaisedPosition = config.counterPixelsInPolygonShifted[fid] + rdm;
+          }
+        }
+      }
+    }
+    return resultTest;
+  }
+
+  //Adding a raised pixel to the outputs of a configuration
+  template <class TPixel>
+  void WriteSample(SamplingConfiguration& config, int className, OGRPoint& pointOGR, const TPixel& pixelValue, unsigned int nbComponents,
+                   otb::ogr::Feature& feature, otb::ogr::Feature& preFeature)
+  {
+    std::string message = to_string(className);
+    otb::ogr::Feature featureOutput(config.layer.GetLayerDefn());
+
+    //Adding the raised pixel to our output shape file
+    featureOutput.SetGeometry(&pointOGR);
+
+    //Completing the text and shape output files with the pixel values
+    for (unsigned int i=0; i<nbComponents; i++)
+    {
+      message += " " + to_string(i+1) + ":" + to_string(static_cast<double>(pixelValue[i]));
+      featureOutput.ogr().SetField(i, static_cast<double>(pixelValue[i]));
+    }
+
+    //We also add informations about where the pixel is extract from
+    for(int c = 0; c < preFeature.ogr().GetFieldCount(); ++c)
+    {
+      if(feature.ogr().GetFieldDefnRef(c)->GetType() == OFTString )
+      {
+        featureOutput.ogr().SetField(nbComponents + c, feature.ogr().GetFieldAsString(c));
+      }
+      else if(feature.ogr().GetFieldDefnRef(c)->GetType() == OFTInteger )
+      {
+        featureOutput.ogr().SetField(nbComponents + c, feature.ogr().GetFieldAsInteger(c));
+      }
+    }
+
+    config.layer.CreateFeature(featureOutput);
+    *config.file << message << std::endl;
+    //Incrementation of the counter of raised pixels in each classes
+    config.nbPixelsRaised[className]++;
   }
 };
 }
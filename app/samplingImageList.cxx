@@ -33,10 +33,21 @@
 #include "itkListSample.h"
 #include "vcl_algorithm.h"
 #include "otbMultiToMonoChannelExtractROI.h"
+#include "otbSamplingWindow.h"
+#include "otbPolygonHilbertScheduler.h"
+#include "otbAdaptiveQuadtreeTiling.h"
+#include "otbTileCache.h"
+#include "otbSamplingImageIO.h"
+#include "otbQuotaSampler.h"
+#include "otbImageSampler.h"
+#include "otbSamplingJournal.h"
+#include "otbShardPlan.h"
+#include "otbPolygonStatisticsFile.h"
 #include "otbStatisticsXMLFileWriter.h"
 #include "otbStatisticsXMLFileReader.h"
 #include <sstream>
 #include <iterator>   
+#include <typeinfo>
 
 namespace otb
 {
@@ -58,16 +69,8 @@ public:
   typedef SamplingImageList Self;
   typedef itk::SmartPointer<Self> Pointer; 
   
-  typedef FloatVectorImageType                 ImageType;  
-  typedef ImageType::InternalPixelType         ImagePixelType;
   typedef UInt32ImageType                      LabelImageType;
   typedef LabelImageType::InternalPixelType    LabelImagePixelType; 
-  typedef itk::ImageRegionIterator<ImageType>  IteratorType;
-  ImageType::IndexType IndexType;
-  
-  typename ImageType::RegionType            polygonRegion;
-  
-  typedef otb::MultiChannelExtractROI<ImagePixelType, ImagePixelType>  ExtractROIFilterType;
   
   itkNewMacro(Self);
 
@@ -80,7 +83,7 @@ private:
     SetDescription("This application sample pixels from an image and shape file with instruction from .xml file.");
     
     AddParameter(ParameterType_InputImage, "in", "Input Image List");    
-    AddParameter(ParameterType_InputFilename, "xml", "XML Analysis File");
+    AddParameter(ParameterType_InputFilename, "xml", "Analysis file (binary or XML)");
     AddParameter(ParameterType_InputFilename, "xmlglobal", "XML Global Analysis File");
     AddParameter(ParameterType_InputFilename, "shp", "Vectoriel File"); 
     AddParameter(ParameterType_OutputFilename, "v", "Verification Mask");
@@ -94,17 +97,52 @@ private:
     AddChoice("mode.randomequally", "Random sampling equally distributed according to the classes size");
     AddChoice("mode.periodic", "Periodic sampling, in all the polygons");
     AddChoice("mode.periodicrandom", "Periodic sampling, in all the polygons, randomly shifted");
+    AddChoice("mode.quota", "Random sampling of the number of samples of each class, the windows being read in a random order until every class quota is met");
         
     AddParameter(ParameterType_Int, "tiles", "Size of square tiles");
     SetDefaultParameterInt("tiles", 200);
     MandatoryOff("tiles");
     
+    AddParameter(ParameterType_Choice, "traversal", "Traversal of the image");
+    AddChoice("traversal.grid", "Regular grid of square tiles over the whole image");
+    AddChoice("traversal.hilbert", "Windows around the polygons, in Hilbert order, small polygons grouped in windows of at most tiles x tiles pixels");
+    AddChoice("traversal.adaptive", "Quadtree tiles adapted to the polygon density, empty areas are skipped");
+    AddParameter(ParameterType_Int, "traversal.adaptive.min", "Minimum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.min", 50);
+    AddParameter(ParameterType_Int, "traversal.adaptive.max", "Maximum size of the tiles");
+    SetDefaultParameterInt("traversal.adaptive.max", 1000);
+    AddParameter(ParameterType_Float, "traversal.adaptive.overhead", "Cost of a tile, in number of pixel tests");
+    SetDefaultParameterFloat("traversal.adaptive.overhead", 1e5);
+    
+    AddParameter(ParameterType_StringList, "bands", "Bands to read and output (indices starting at 1), all the bands by default");
+    MandatoryOff("bands");
+    
+    AddParameter(ParameterType_Int, "cache", "RAM budget of the decoded tile cache (MB), 0 to disable it");
+    SetDefaultParameterInt("cache", 0);
+    MandatoryOff("cache");
+    
+    AddParameter(ParameterType_Directory, "cachedir", "Scratch directory where cached tiles are spilled, to be reused by later processes");
+    MandatoryOff("cachedir");
+    AddParameter(ParameterType_Int, "cachedisk", "Disk budget of the scratch directory (MB), the least recently used tiles being deleted beyond it");
+    SetDefaultParameterInt("cachedisk", 4096);
+    MandatoryOff("cachedisk");
+    
     AddParameter(ParameterType_Int, "nd", "NoData value");
     SetDefaultParameterInt("nd", 0);
     MandatoryOff("nd"); 
     
     AddParameter(ParameterType_Int, "rand", "Seed value for Mersenne Twister Random Generator");
     MandatoryOff("rand"); 
+    
+    AddParameter(ParameterType_OutputFilename, "journal", "Journal of the checkpoints of the run (completed windows, sampler counters, output sizes), to resume it");
+    MandatoryOff("journal");
+    
+    AddParameter(ParameterType_Int, "checkpoint", "Minimum time between two checkpoints (s), lengthened to keep their cost under 1% of the run");
+    SetDefaultParameterInt("checkpoint", 60);
+    MandatoryOff("checkpoint");
+    
+    AddParameter(ParameterType_Empty, "resume", "Resume the run from the last checkpoint of the journal, the outputs being cut back to it");
+    MandatoryOff("resume");
   }
 
   void DoUpdateParameters()
@@ -112,29 +150,95 @@ private:
   }
 
   void DoExecute()
+  {
+    //The image is processed in the pixel type of the file, values are only converted when written out
+    switch(otb::ReadImageComponentType(GetParameterString("in")))
+    {
+      case itk::ImageIOBase::UCHAR:
+        ExecuteTyped<UInt8VectorImageType>();
+        break;
+      case itk::ImageIOBase::USHORT:
+        ExecuteTyped<UInt16VectorImageType>();
+        break;
+      case itk::ImageIOBase::SHORT:
+        ExecuteTyped<Int16VectorImageType>();
+        break;
+      default:
+        ExecuteTyped<FloatVectorImageType>();
+        break;
+    }
+  }
+
+  template <class TImage>
+  void ExecuteTyped()
   {  
-    ImageType::Pointer image = GetParameterImage("in");
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+    
+    //Band subset, pushed down to the reader so that only these bands are decoded
+    std::vector<unsigned int> bands;
+    if(IsParameterEnabled("bands") && HasValue("bands"))
+    {
+      bands = otb::ParseBandList(GetParameterStringList("bands"));
+    }
+    
+    //Input image, read in its own pixel type
+    typedef otb::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(otb::BandSubsetFilename(GetParameterString("in"), bands));
+    typename ImageType::Pointer image = reader->GetOutput();
     image->UpdateOutputInformation(); 
     
-    //Output text file
+    //Checkpoints of the run, and the last one to resume from
+    const bool journaled = IsParameterEnabled("journal") && HasValue("journal");
+    const std::string signature = journaled ? RunSignature(bands) : "";
+    otb::SamplingCheckpoint checkpoint;
+    bool resumed = false;
+    if(IsParameterEnabled("resume"))
+    {
+      if(!journaled)
+      {
+        itkExceptionMacro(<< "Resuming needs the journal of the run");
+      }
+      resumed = otb::ReadSamplingJournal(GetParameterString("journal"), signature, checkpoint);
+      if(resumed)
+      {
+        otbAppLogINFO(<< "Resuming from checkpoint " << checkpoint.number << " at window " << checkpoint.nextWindow << std::endl);
+      }
+      else
+      {
+        otbAppLogINFO(<< "No checkpoint in the journal, the run starts from the beginning" << std::endl);
+      }
+    }
+    else if(journaled)
+    {
+      //A new run : the checkpoints of a previous one no longer match the outputs
+      itksys::SystemTools::RemoveFile(GetParameterString("journal").c_str());
+    }
+    
+    //Output text file, cut back to the checkpoint when resuming
     std::ofstream myfile;
-    myfile.open (GetParameterString("out").c_str());
+    if(resumed)
+    {
+      otb::TruncateTextOutput(GetParameterString("out"), checkpoint.textOffset);
+      myfile.open(GetParameterString("out").c_str(), std::ios::in | std::ios::out);
+      myfile.seekp(0, std::ios::end);
+    }
+    else
+    {
+      myfile.open(GetParameterString("out").c_str());
+    }
     
     //Input shape file
     otb::ogr::DataSource::Pointer vectorData = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
     
     //Output shape file
-    std::vector<std::string> options;
     std::string projRef = image->GetProjectionRef();
     OGRSpatialReference oSRS(projRef.c_str());
     
     otb::ogr::DataSource::Pointer ogrDS;
-    ogrDS = otb::ogr::DataSource::New(GetParameterString("v").c_str(), otb::ogr::DataSource::Modes::Overwrite);
-    otb::ogr::Layer layer(NULL, false);
-    std::string layername = itksys::SystemTools::GetFilenameName(GetParameterString("v").c_str());
-    std::string extension = itksys::SystemTools::GetFilenameLastExtension(GetParameterString("v").c_str());
-    layername = layername.substr(0,layername.size()-(extension.size()));
-    layer = ogrDS->CreateLayer(layername, &oSRS, wkbPoint, options);
+    ogrDS = otb::ogr::DataSource::New(GetParameterString("v").c_str(),
+                                      resumed ? otb::ogr::DataSource::Modes::Update_LayerUpdate : otb::ogr::DataSource::Modes::Overwrite);
     
     //No data value for pixels value
     int noDataValue = GetParameterInt("nd");
@@ -153,38 +257,29 @@ private:
     
     //Initialisation of the output shape file
     otb::ogr::Layer preFiltered = vectorData->GetLayer(0);    
-    otb::ogr::Feature preFeature = preFiltered.GetFeature(0);
-        
-    for(unsigned int comp = 0; comp<nbComponents; ++comp)
-    {  
-      std::ostringstream fieldoss;
-      fieldoss<<"b"<<comp;
-      OGRFieldDefn field(fieldoss.str().c_str(), OFTReal);
-      layer.CreateField(field, true);
-    }  
-    
-    for(int comp = 0; comp < preFeature.ogr().GetFieldCount(); ++comp)
-    {  
-      std::ostringstream fieldoss;
-      fieldoss<<comp + nbComponents;
-      OGRFieldDefn field(preFeature.ogr().GetFieldDefnRef(comp)->GetNameRef(), preFeature.ogr().GetFieldDefnRef(comp)->GetType());
-      layer.CreateField(field, true);  
-    }  
-    
-    //Number of pixels in all the polygons
-    int nbPixelsGlobal = 0; 
-    
-    //Number of pixels in each classes
-    std::map<int, int> elmtsInClass;
-    std::map<int, int> elmtsInClassGlobal;
-    //Number of pixels in each polygons
-    std::map<unsigned long, int> polygon;
-    //Counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygon;
-    //Shifted counter of pixels in the current polygon
-    std::map<unsigned long, int> counterPixelsInPolygonShifted;
-    //RandomPosition of a sampled pixel for each polygons
-    std::map<unsigned long, int> randomPositionInPolygon;
+    otb::ogr::Layer layer(NULL, false);
+    if(resumed)
+    {
+      //Features written after the checkpoint are deleted
+      layer = ogrDS->GetLayer(0);
+      std::vector<long> lateFeatures;
+      for(otb::ogr::Layer::const_iterator featIt = layer.cbegin(); featIt != layer.cend(); ++featIt)
+      {
+        if(featIt->ogr().GetFID() >= checkpoint.nextFID)
+        {
+          lateFeatures.push_back(featIt->ogr().GetFID());
+        }
+      }
+      for(unsigned long f = 0; f < lateFeatures.size(); ++f)
+      {
+        layer.DeleteFeature(lateFeatures[f]);
+      }
+    }
+    else
+    {
+      layer = otb::CreateSamplesLayer(ogrDS.GetPointer(), GetParameterString("v"), &oSRS, bands, nbComponents,
+                                      preFiltered.GetLayerDefn());
+    }
     
     //Varibles to build the progression bar
     int stepsProgression = 0;
@@ -196,58 +291,64 @@ private:
     generator->Initialize();
     generator->SetSeed(seed);
         
-    int polyForced = 0;
-              
     otbAppLogINFO(<< "Sampling pixels with the sampling mode : " << samplingMode << std::endl);
     
-    //Tiling
-    unsigned long sizeTilesX = sizeTiles;
-    unsigned long sizeTilesY = sizeTiles;
-    unsigned long sizeImageX = image->GetLargestPossibleRegion().GetSize()[0];
-    unsigned long sizeImageY = image->GetLargestPossibleRegion().GetSize()[1];    
-    unsigned int nbTilesX    = sizeImageX/sizeTilesX + (sizeImageX%sizeTilesX > 0 ? 1 : 0);
-    unsigned int nbTilesY    = sizeImageY/sizeTilesY + (sizeImageY%sizeTilesY > 0 ? 1 : 0);   
-     
-    //Progression bar re-initialisation
-    stepsProgression = 0;    
-      
-    TiXmlDocument doc(GetParameterString("xml").c_str());
-    if(!doc.LoadFile())
+    //Cache of the decoded tiles, shared by the passes and, through the scratch directory, by later processes
+    otb::TileCache tileCache;
+    tileCache.SetBudget(static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024);
+    if(IsParameterEnabled("cachedir") && HasValue("cachedir"))
     {
-      std::cout << "le DOC n'existe pas" << std::endl;
+      tileCache.SetScratchDirectory(GetParameterString("cachedir"), static_cast<unsigned long long>(GetParameterInt("cachedisk"))*1024*1024);
     }
-    TiXmlElement *elem = doc.FirstChildElement()->FirstChildElement();
-    if(!elem)
+    const std::string imageKey = otb::TileCache::MakeImageKey(GetParameterString("in"), otb::BandListToString(bands), typeid(ImagePixelType).name());
+    
+    //Read windows : regular tiles over the whole image, windows around the polygons in Hilbert order,
+    //or quadtree tiles adapted to the polygon density
+    otb::SamplingWindowList windows;
+    if(GetParameterString("traversal") == "hilbert")
     {
-      std::cout << "le elem n'existe pas" << std::endl;
+      otb::PolygonHilbertScheduler scheduler;
+      scheduler.SetSizeTiles(sizeTiles);
+      scheduler.SetLineBuffer(3);
+      scheduler.AddLayer(image.GetPointer(), preFiltered);
+      windows = scheduler.GenerateWindows();
     }
-
-    for(TiXmlElement* sample = elem->FirstChildElement("Class"); sample != NULL; sample = sample->NextSiblingElement())
+    else if(GetParameterString("traversal") == "adaptive")
     {
-      // Get the current value of the statistic vector
-      int name, value;
-      sample->QueryIntAttribute("name", &name);
-      sample->QueryIntAttribute("value", &value);
-      elmtsInClass[name] = value;
+      otb::AdaptiveQuadtreeTiling tiling;
+      tiling.SetMinimumSize(GetParameterInt("traversal.adaptive.min"));
+      tiling.SetMaximumSize(GetParameterInt("traversal.adaptive.max"));
+      tiling.SetTileOverhead(GetParameterFloat("traversal.adaptive.overhead"));
+      tiling.SetLineBuffer(3);
+      tiling.AddLayer(image.GetPointer(), preFiltered);
+      windows = tiling.GenerateWindows(image->GetLargestPossibleRegion());
     }
-    for(std::map<int, int>::iterator iClass = elmtsInClass.begin(); iClass != elmtsInClass.end(); ++iClass)
+    else
     {
-      std::cout << "Dans la classe " << (*iClass).first << " il y a " << (*iClass).second << " pixels." << std::endl;
+      windows = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), sizeTiles);
     }
-    elem = elem->NextSiblingElement();
+    otbAppLogINFO(<< "Number of read windows : " << windows.size() << std::endl);
+     
+    //Progression bar re-initialisation
+    stepsProgression = 0;    
+      
+    //Analysis file, binary (memory-mapped) or XML
+    otb::PolygonStatisticsFile polygonStats;
+    polygonStats.Open(GetParameterString("xml"));
     
-    for(TiXmlElement* sample = elem->FirstChildElement("Id"); sample != NULL; sample = sample->NextSiblingElement())
+    //Number of pixels in each classes
+    std::map<int, int> elmtsInClass;
+    const otb::PolygonStatisticsFile::ClassCountMap& classCounts = polygonStats.GetClassCounts();
+    for(otb::PolygonStatisticsFile::ClassCountMap::const_iterator iClass = classCounts.begin(); iClass != classCounts.end(); ++iClass)
+    {
+      elmtsInClass[static_cast<int>(iClass->first)] = static_cast<int>(iClass->second);
+    }
+    for(std::map<int, int>::iterator iClass = elmtsInClass.begin(); iClass != elmtsInClass.end(); ++iClass)
     {
-      // Get the current value of the statistic vector
-      double name, value;
-      sample->QueryDoubleAttribute("name", &name);
-      sample->QueryDoubleAttribute("value", &value);
-      polygon[name] = value;
-      randomPositionInPolygon[name] = static_cast<int>(generator->GetUniformVariate(0, polygon[name]));
+      std::cout << "Dans la classe " << (*iClass).first << " il y a " << (*iClass).second << " pixels." << std::endl;
     }
-                   
-    //Initialisation counter of pixel raised in each classes
-    std::map<int, int> nbPixelsRaised;
+    
+    //Number of samples of each class in this image, from the strategy
     std::map<int, int> nbSamples;
     
     TiXmlDocument docGlobal(GetParameterString("xmlglobal").c_str());
@@ -297,305 +398,145 @@ private:
       std::cout << "Dans le polygon " << (*ipolygon).first << " il y a " << (*ipolygon).second << " pixels." << std::endl;
     }*/
       
+    //Sampler of the pixels, from the analysis and the strategy
+    otb::ImageSampler<ImageType> sampler;
+    sampler.SetMode(samplingMode);
+    sampler.SetClassField(GetParameterString("cfield"));
+    sampler.SetNoDataValue(noDataValue);
+    sampler.SetGenerator(generator);
+    sampler.SetOutputs(&myfile, layer);
+    sampler.SetAnalysis(&polygonStats, nbSamples);
+    
+    //Quota mode : selection sampling of each class, over the windows in a random order, until the quotas are met
+    if(samplingMode == "quota")
+    {
+      otb::ShuffleList(windows, generator.GetPointer());
+    }
+    
+    //Resuming : the state of the sampler at the checkpoint, the generator being seeded again at each window
+    unsigned long firstWindow = 0;
+    if(resumed)
+    {
+      std::istringstream samplerState(checkpoint.samplerState);
+      sampler.ReadState(samplerState);
+      firstWindow = checkpoint.complete ? windows.size() : checkpoint.nextWindow;
+    }
+    
+    //Checkpoints : at most one every "checkpoint" seconds, and at least 100 times their own cost apart
+    const double checkpointInterval = GetParameterInt("checkpoint");
+    double lastCheckpoint = itksys::SystemTools::GetTime();
+    double checkpointCost = 0.;
+    
     // *** *** 2nd run : SAMPLING   *** ***
-    //Loop across tiles
-    for(unsigned int row = 0; row < nbTilesY; ++row)
+    otb::ogr::DataSource::Pointer vectorData2 = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
+    otb::ogr::Layer filtered2 = vectorData2->GetLayer(0);
+    //Loop across the read windows
+    for(unsigned long w = firstWindow; w < windows.size(); ++w)
     {
-      for(unsigned int column = 0; column < nbTilesX; ++column)
-      {         
-        //Progression bar printing
-        currentProgression = ((row)*(nbTilesY)+(column+1))*10/(nbTilesX*nbTilesY);        
-        if(currentProgression > stepsProgression)
-        {
-          std::cout<<stepsProgression*10<<"%..."<<std::flush;
-          stepsProgression++;
-        }
-          
-        //Tiles dimensions
-        unsigned long startX = column*sizeTilesX;
-        unsigned long startY = row*sizeTilesY;
-        unsigned long sizeX  = vcl_min(sizeTilesX,sizeImageX-startX);
-        unsigned long sizeY  = vcl_min(sizeTilesY,sizeImageY-startY);
-         
-        //Extraction of the image
-        ExtractROIFilterType::Pointer extractROIFilter = ExtractROIFilterType::New();
-        extractROIFilter->SetInput(image);
-        extractROIFilter->SetStartX(startX);
-        extractROIFilter->SetStartY(startY);
-        extractROIFilter->SetSizeX(sizeX);
-        extractROIFilter->SetSizeY(sizeY);
-        extractROIFilter->Update();           
-                
-        //Extraction of the shape file
-        OGRLinearRing spatialFilterRing;
-        OGRPoint ul,ur,lr,ll;
-        ImageType::IndexType urIndex;
-        ImageType::IndexType llIndex;
-        
-        urIndex[0] = startX + sizeX;
-        urIndex[1] = startY + sizeY;
-        llIndex[0] = startX;
-        llIndex[1] = startY;        
-          
-        itk::Point<double, 2> ulPoint;
-        itk::Point<double, 2> lrPoint;
-          
-        image->TransformIndexToPhysicalPoint(urIndex, lrPoint);
-        image->TransformIndexToPhysicalPoint(llIndex, ulPoint);  
-           
-        ul.setX(ulPoint[0]);
-        ul.setY(ulPoint[1]);
-        lr.setX(lrPoint[0]);
-        lr.setY(lrPoint[1]);
-          
-        otb::ogr::DataSource::Pointer vectorData2 = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
-        otb::ogr::Layer filtered2 = vectorData2->GetLayer(0);
-        filtered2.SetSpatialFilterRect(ul.getX(), ul.getY(), lr.getX(), lr.getY());
-        otb::ogr::Layer::const_iterator featIt = filtered2.begin(); 
-          
-        unsigned int c = 0;
-          
-        //Loop across the features in the layer
-        for(; featIt!=filtered2.end(); ++featIt,++c)
-        {                     
-          OGRGeometry * geom = featIt->ogr().GetGeometryRef();
-          bool testPoly = false;
-          bool testLineBuffers = false;
-          if(geom->getGeometryType() == wkbLineString)
-          {
-            // Il faut redéfinir geom
-            //geom = geom->Buffer(3);
-            //std::cout<< "Coord : " << geom->getCoordinateDimension() << std::endl;
-            testLineBuffers = true;
-          }
-           
-          if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
-          {
-            testPoly = true;
-            //std::cout<< "Coord : " << featIt->ogr().GetFID() << std::endl;
-          }
-              
-          //Class name recuperation
-          int className = featIt->ogr().GetFieldAsInteger(GetParameterString("cfield").c_str());
-            
-          //We are dealing with simple polygons
-          if(testPoly || testLineBuffers)
-          {           
-            OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);          
-            OGRLinearRing * exteriorRing = inPolygon->getExteriorRing(); 
-              
-            IteratorType it(extractROIFilter->GetOutput(), extractROIFilter->GetOutput()->GetLargestPossibleRegion());
-              
-            //Compute the number of pixel we need to sample in each polygons
-            int nbPixelsInPolygon = static_cast<int>((nbSamples[className])*(polygon[featIt->ogr().GetFID()])/(elmtsInClass[className]));    
-              
-            //If this number is less then 1, we force it to be 1
-            if(nbPixelsInPolygon < 1)
-            {
-              nbPixelsInPolygon = 1;
-              polyForced++;
-            }
-              
-            //Compute of the period of sampling, every n-pixels we raise one
-            int periodOfSampling = static_cast<int>(polygon[featIt->ogr().GetFID()]/nbPixelsInPolygon);    
-                          
-            //Counters initialisations            
-            //Shifted counter, to anticipate the position of the next raised pixel            
-            counterPixelsInPolygonShifted[featIt->ogr().GetFID()] = counterPixelsInPolygon[featIt->ogr().GetFID()] + periodOfSampling;
-            //Position of the next pixel raised
-            int nextPixelRaisedPosition = periodOfSampling;
-                                                
-            //Loop across pixels in the tile
-            for (it.GoToBegin(); !it.IsAtEnd(); ++it)
-            {   
-              itk::Point<double, 2> point;
-              
-              //Boolean variable, we sample the current pixel or not
-              bool resultTest = false;
-                                        
-              extractROIFilter->GetOutput()->TransformIndexToPhysicalPoint(it.GetIndex(), point); 
-                
-              //Access to the pixel value
-              ImageType::PixelType pixelValue = it.Get();
-                
-              //Tranformation in OGRPoint in order to know if it's in the geometry
-              OGRPoint pointOGR;
-              pointOGR.setX(point[0]);
-              pointOGR.setY(point[1]); 
-                
-              //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
-              bool noDataTest = false;            
-              for (unsigned int i=0; i<nbComponents; i++)
-              {   
-                if(pixelValue[i] == noDataValue)
-                {
-                  noDataTest = true; 
-                }  
-              }
-                
-              //Pre-test is the polygon at least one pixel
-              if(polygon[featIt->ogr().GetFID()]!=0)
-              {
-                //Succession of tests to know in whoch mode we are
-                //Exhautive mode : we extract all pixels in every polygons in every classes
-                if (samplingMode == "exhaustive")
-                {
-                  resultTest= true;
-                }
-                  
-                //Random mode : we extract nbSamples pixels randomly in all the image
-                if (samplingMode == "random")
-                {
-                  //The probability of sampling a pixel is function of the number of pixels in every classes
-                  float probability = static_cast<float>(nbSamples[className])/static_cast<float>(nbPixelsGlobal);
-                  if(generator->GetUniformVariate(0, 1) < probability)
-                  {
-                    resultTest= true;        
-                  }
-                }
-                  
-                //Random mode equally : we extract nbSAmples pixels for each classes
-                if (samplingMode == "randomequally")
-                {
-                  //The probability of sampling a pixel is function of the number of pixels in each classes
-                  float probability = static_cast<float>(nbSamples[className])/static_cast<float>(elmtsInClass[className]);
-                  if(generator->GetUniformVariate(0, 1) < probability)
-                  {
-                    resultTest= true;        
-                  }
-                }
-                  
-                //Periodic : we extract, more or less, nbsamples pixels for each classes every n pixels
-                if (samplingMode == "periodic")
-                {
-                  //In a polygon where we only need one pixel, we raise it at a radom position
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()] == randomPositionInPolygon[featIt->ogr().GetFID()])&&(nbPixelsInPolygon == 1))
-                  {
-                    resultTest= true;
-                  } 
-                  //If we need more then one pixel in the polygon, we sample a pixel periodicly, every n-pixels
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()]%periodOfSampling)==0 && (nbPixelsInPolygon != 1))
-                  {
-                    resultTest= true;                  
-                  }
-                }
-                  
-                //Periodic random : we extract, more or less, nbsmaples pixels for each classes every n+-delta pixels ( 0<delta<n/2 )
-                if (samplingMode == "periodicrandom")
-                {
-                  //In a polygon where we only need one pixel, we raise it at a radom position
-                  if((counterPixelsInPolygon[featIt->ogr().GetFID()] == randomPositionInPolygon[featIt->ogr().GetFID()])&&(nbPixelsInPolygon == 1))
-                  {
-                    resultTest= true;
-                  } 
-                  //If we need more then one pixel in the polygon
-                  else if(nbPixelsInPolygon != 1)
-                  {
-                    //The first pixel raised is randomly choosen
-                    if(counterPixelsInPolygon[featIt->ogr().GetFID()] == static_cast<int>(generator->GetUniformVariate(0, (periodOfSampling/2))))
-                    {
-                      resultTest= true;  
-                    }
-                      
-                    //We raised the pixel if we are at the good position
-                    if(counterPixelsInPolygon[featIt->ogr().GetFID()] == nextPixelRaisedPosition)
-                    {
-                      resultTest= true; 
-                    }
-                      
-                    //Every n-pixels we compute the position of the next pixel sampled
-                    if(counterPixelsInPolygonShifted[featIt->ogr().GetFID()]%periodOfSampling == 0)
-                    {
-                      int sign = generator->GetUniformVariate(0, 1);
-                      int rdm = static_cast<int>(generator->GetUniformVariate(0, (periodOfSampling/2)));   
-                      
-                      if (sign<0.5)
-                      {
-                        nextPixelRaisedPosition = counterPixelsInPolygonShifted[featIt->ogr().GetFID()] - rdm;
-                      }
-                      else
-                      {
-                        nextPixelRaisedPosition = counterPixelsInPolygonShifted[featIt->ogr().GetFID()] + rdm;
-                      }
-                    }                                  
-                  }
-                }
-              }
-                
-              //Test if the current pixel is in a polygon hole
-              bool isNotInHole = true;
-              
-              for (int i=0; i != inPolygon->getNumInteriorRings(); ++i)
-              {
-                if(inPolygon->getInteriorRing(i) != NULL)
-                {
-                  OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
-                  if(interiorRing->isPointInRing(&pointOGR, TRUE))
-                  {
-                    isNotInHole = false;
-                  }
-                }
-              }  
-                
-              //If the pixel is not "No-Data" and is in the geometry, them we count it              
-              /*&& !(exteriorRing->isPointOnRingBoundary(&pointOGR, TRUE))*/
-              if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole )
-              {              
-                //Test if the current pixel is good to sample or not
-                if(resultTest)
-                {
-                  std::string message = to_string(className);
-                  otb::ogr::Feature featureOutput(layer.GetLayerDefn());       
-                  
-                  //Adding the raised pixel to our output shape file
-                  featureOutput.SetGeometry(&pointOGR);     
-                    
-                  //Completing the text and shape output files with the pixel values
-                  for (unsigned int i=0; i<nbComponents; i++)
-                  {
-                    message += " " + to_string(i+1) + ":" + to_string(pixelValue[i]);  
-                    featureOutput.ogr().SetField(i, pixelValue[i]);    
-                  }
-                    
-                  //We also add informations about where the pixel is extract from
-                  for(int c = 0; c < preFeature.ogr().GetFieldCount(); ++c)
-                  {  
-                    if(featIt->ogr().GetFieldDefnRef(c)->GetType() == OFTString )
-                    {
-                      featureOutput.ogr().SetField(nbComponents + c, featIt->ogr().GetFieldAsString(c));
-                    }  
-                    else if(featIt->ogr().GetFieldDefnRef(c)->GetType() == OFTInteger )
-                    {
-                      featureOutput.ogr().SetField(nbComponents + c, featIt->ogr().GetFieldAsInteger(c));
-                    }
-                  }  
-                    
-                  layer.CreateFeature(featureOutput);
-                  myfile << message << std::endl; 
-                  //Incrementation of the counter of raised pixels in each classes
-                  nbPixelsRaised[className]++;
-                }    
-                //Incrementation of counters of pixels studied
-                counterPixelsInPolygon[featIt->ogr().GetFID()]++;
-                counterPixelsInPolygonShifted[featIt->ogr().GetFID()]++;
-              }                
-            }  
-          }   
-        }
+      const otb::SamplingWindow& window = windows[w];
+      
+      //Checkpoint of the windows before this one
+      if(journaled && itksys::SystemTools::GetTime() - lastCheckpoint >= std::max(checkpointInterval, 100*checkpointCost))
+      {
+        double start = itksys::SystemTools::GetTime();
+        WriteCheckpoint(checkpoint, signature, w, false, myfile, ogrDS, sampler);
+        lastCheckpoint = itksys::SystemTools::GetTime();
+        checkpointCost = lastCheckpoint - start;
+      }
+      
+      //Quota mode : no more reading once every class is complete
+      if(sampler.IsComplete())
+      {
+        otbAppLogINFO(<< "Every class quota is met, " << windows.size() - w << " windows left unread" << std::endl);
+        break;
       }
-    } 
+      
+      //Progression bar printing
+      currentProgression = (w+1)*10/windows.size();
+      if(currentProgression > stepsProgression)
+      {
+        std::cout<<stepsProgression*10<<"%..."<<std::flush;
+        stepsProgression++;
+      } 
+      
+      //Extraction of the features processed in the window
+      std::vector<otb::ogr::Feature> features = otb::GetWindowFeatures(image.GetPointer(), filtered2, window);
+      
+      //Quota mode : the window is not read when all its classes are complete
+      if(!sampler.IsWindowNeeded(features))
+      {
+        continue;
+      }
+      
+      //Random stream of the window : the draws depend neither on the checkpoints nor on a resume
+      generator->SetSeed(otb::WindowSeed(seed, w));
+      
+      //Extraction of the image, from the tile cache when possible, and sampling of its pixels
+      typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), window.region, &tileCache, imageKey);
+      sampler.SampleWindow(image.GetPointer(), tile.GetPointer(), window, features);
+    }
+    
+    //Final checkpoint : resuming a completed run leaves its outputs as they are
+    if(journaled)
+    {
+      WriteCheckpoint(checkpoint, signature, windows.size(), true, myfile, ogrDS, sampler);
+    }
     
     myfile.close();
     
+    if(tileCache.IsEnabled())
+    {
+      otbAppLogINFO(<< "Tile cache : " << tileCache.GetHits() << " hits, " << tileCache.GetMisses() << " misses" << std::endl);
+    }
+    
     //End of progression bar
     std::cout<<"100%"<<std::endl;    
     //std::cout<<"polyForced" << polyForced<<std::endl;
     //Output the number of pixel sampled in each classes.
-    for(std::map<int, int>::iterator iClass = nbPixelsRaised.begin(); iClass != nbPixelsRaised.end(); ++iClass)
+    const std::map<int, int>& nbPixelsRaised = sampler.GetNumberOfPixelsRaised();
+    for(std::map<int, int>::const_iterator iClass = nbPixelsRaised.begin(); iClass != nbPixelsRaised.end(); ++iClass)
     {
       otbAppLogINFO(<< "Number of pixels raised in class " << (*iClass).first << " : "<< (*iClass).second<< std::endl);
     }    
   }
+  
+  // Inputs and parameters the windows and the draws depend on : a journal is
+  // only resumed by the same run
+  std::string RunSignature(const std::vector<unsigned int>& bands)
+  {
+    std::ostringstream signature;
+    signature << GetParameterString("in") << "|" << GetParameterString("xml") << "|" << GetParameterString("xmlglobal")
+              << "|" << GetParameterString("shp") << "|" << GetParameterString("cfield") << "|" << GetParameterInt("imagenum")
+              << "|" << GetParameterString("mode") << "|" << GetParameterInt("tiles") << "|" << GetParameterString("traversal");
+    if(GetParameterString("traversal") == "adaptive")
+    {
+      signature << ":" << GetParameterInt("traversal.adaptive.min") << ":" << GetParameterInt("traversal.adaptive.max")
+                << ":" << GetParameterFloat("traversal.adaptive.overhead");
+    }
+    signature << "|" << otb::BandListToString(bands) << "|" << GetParameterInt("nd") << "|" << GetParameterInt("rand");
+    return signature.str();
+  }
+  
+  // Flush the outputs and record their state in the journal, the windows
+  // before nextWindow being sampled
+  template <class TSampler>
+  void WriteCheckpoint(otb::SamplingCheckpoint& checkpoint, const std::string& signature, unsigned long nextWindow, bool complete,
+                       std::ofstream& file, otb::ogr::DataSource::Pointer ogrDS, const TSampler& sampler)
+  {
+    file.flush();
+    ogrDS->SyncToDisk();
+    
+    std::ostringstream samplerState;
+    sampler.WriteState(samplerState);
+    
+    ++checkpoint.number;
+    checkpoint.nextWindow = nextWindow;
+    checkpoint.complete = complete;
+    checkpoint.textOffset = static_cast<itk::uint64_t>(file.tellp());
+    checkpoint.nextFID = sampler.GetNextFID();
+    checkpoint.samplerState = samplerState.str();
+    otb::WriteSamplingJournal(GetParameterString("journal"), signature, checkpoint);
+  }
 };
 }
 }
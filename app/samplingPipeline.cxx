@@ -0,0 +1,442 @@
+/*=========================================================================
+ Program:   ORFEO Toolbox
+ Language:  C++
+ Date:      $Date$
+ Version:   $Revision$
+
+
+ Copyright (c) Centre National d'Etudes Spatiales. All rights reserved.
+ See OTBCopyright.txt for details.
+
+
+ This software is distributed WITHOUT ANY WARRANTY; without even
+ the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ PURPOSE.  See the above copyright notices for more information.
+
+ =========================================================================*/
+
+#include "otbImage.h"
+#include "otbImageFileReader.h"
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+#include "itkSmartPointer.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkMutexLockHolder.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "otbSamplingWindow.h"
+#include "otbTileCache.h"
+#include "otbSamplingImageIO.h"
+#include "otbQuotaSampler.h"
+#include "otbImageAnalysis.h"
+#include "otbImageSampler.h"
+#include "otbPolygonStatisticsFile.h"
+#include "otbSamplingStrategy.h"
+#include "otbOverlapMask.h"
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <typeinfo>
+
+namespace otb
+{
+
+namespace Wrapper
+{
+
+class SamplingPipeline : public Application
+{
+public:
+  typedef SamplingPipeline Self;
+  typedef itk::SmartPointer<Self> Pointer;
+
+  itkNewMacro(Self);
+
+  itkTypeMacro(SamplingPipeline, otb::Application);
+
+private:
+  void DoInit()
+  {
+    SetName("SamplingPipeline");
+    SetDescription("This application analyses a list of images, computes the sampling strategy and samples the images in one process, the statistics being kept in memory.");
+
+    AddParameter(ParameterType_InputFilenameList, "il", "Input Image List");
+    AddParameter(ParameterType_InputFilename, "shp", "Vectoriel File");
+    AddParameter(ParameterType_String, "cfield", "Field of class");
+    AddParameter(ParameterType_Directory, "outdir", "Output directory of the samples, a text file and a shape file per image (samples_<image number>)");
+
+    AddParameter(ParameterType_Int, "samples", "Number of samples per classes");
+
+    AddParameter(ParameterType_Choice, "strategy", "Strategy of sampling");
+    AddChoice("strategy.equally", "Equal repartion across the images");
+    AddChoice("strategy.proportional", "Proportional repartion across the images");
+
+    AddParameter(ParameterType_Choice, "mode", "Mode of sampling");
+    AddChoice("mode.exhaustive", "Exhaustive Sampling");
+    AddChoice("mode.random", "Random Sampling");
+    AddChoice("mode.randomequally", "Random sampling equally distributed according to the classes size");
+    AddChoice("mode.periodic", "Periodic sampling, in all the polygons");
+    AddChoice("mode.periodicrandom", "Periodic sampling, in all the polygons, randomly shifted");
+    AddChoice("mode.quota", "Random sampling of the number of samples of each class, the windows being read in a random order until every class quota is met");
+
+    AddParameter(ParameterType_Int, "tiles", "Size of square tiles");
+    SetDefaultParameterInt("tiles", 200);
+    MandatoryOff("tiles");
+
+    AddParameter(ParameterType_Int, "cache", "RAM budget of the decoded tile cache of each image being processed (MB), 0 to disable it");
+    SetDefaultParameterInt("cache", 0);
+    MandatoryOff("cache");
+
+    AddParameter(ParameterType_Choice, "overlap", "Resolution of the overlaps between the images");
+    AddChoice("overlap.none", "Each image analyses and samples all its pixels, those of an overlap being processed once per image");
+    AddChoice("overlap.first", "The pixels of an overlap are analysed and sampled with the first image of the list covering them with valid data, the images being in one projection");
+    AddChoice("overlap.score", "The pixels of an overlap are analysed and sampled with the image of lowest score covering them with valid data, the images being in one projection");
+    AddParameter(ParameterType_StringList, "overlap.score.values", "Score of each image of the list, such as its cloud cover or off-nadir angle");
+    MandatoryOff("overlap.score.values");
+
+    AddParameter(ParameterType_Int, "nd", "NoData value");
+    SetDefaultParameterInt("nd", 0);
+    MandatoryOff("nd");
+
+    AddParameter(ParameterType_Int, "rand", "Seed value for Mersenne Twister Random Generator, the image number being added to it");
+    SetDefaultParameterInt("rand", 0);
+    MandatoryOff("rand");
+
+    AddParameter(ParameterType_Directory, "debug", "Directory of the intermediate files, for debugging : analysis files of the images (binary and XML) and strategy file");
+    MandatoryOff("debug");
+
+    AddRAMParameter("ram");
+  }
+
+  void DoUpdateParameters()
+  {
+  }
+
+  //Images processed by the threads of the pool, each one taking the next image of the list until none is left.
+  //Settings are copied from the parameters before the threads are started.
+  struct PipelineTask
+  {
+    SamplingPipeline* app;
+    bool sampling;
+    const std::vector<std::string>* filenames;
+
+    std::string classField;
+    std::string samplingMode;
+    std::string outputDirectory;
+    int noDataValue;
+    int sizeTiles;
+    int seed;
+    unsigned long cacheBudget;
+
+    //Parts of each image processed with another image, none without overlap resolution
+    std::vector<otb::OverlapMask> overlaps;
+
+    //Vector layer shared by the threads, only locked while the footprint index of an image is built
+    otb::ogr::Layer* layer;
+    itk::SimpleFastMutexLock* mutex;
+    unsigned long nextImage;
+
+    //Results of each image
+    std::vector<otb::ImageAnalysis> analyses;
+    std::vector<std::map<int, int> > imageSamples;
+    std::vector<std::map<int, int> > pixelsRaised;
+    std::vector<std::string> errors;
+
+    PipelineTask() : app(NULL), sampling(false), filenames(NULL), layer(NULL), mutex(NULL), nextImage(0) {}
+  };
+
+  static ITK_THREAD_RETURN_TYPE ProcessImagesThread(void* arg)
+  {
+    itk::MultiThreader::ThreadInfoStruct* info = static_cast<itk::MultiThreader::ThreadInfoStruct*>(arg);
+    PipelineTask* task = static_cast<PipelineTask*>(info->UserData);
+
+    for(;;)
+    {
+      unsigned long i;
+      {
+        itk::MutexLockHolder<itk::SimpleFastMutexLock> holder(*task->mutex);
+        i = task->nextImage++;
+      }
+      if(i >= task->filenames->size())
+      {
+        break;
+      }
+
+      try
+      {
+        task->app->ProcessImage(*task, i);
+      }
+      catch(std::exception& e)
+      {
+        task->errors[i] = e.what();
+      }
+    }
+    return ITK_THREAD_RETURN_VALUE;
+  }
+
+  void ProcessImage(PipelineTask& task, unsigned long i)
+  {
+    //The image is processed in the pixel type of the file
+    switch(otb::ReadImageComponentType((*task.filenames)[i]))
+    {
+      case itk::ImageIOBase::UCHAR:
+        ProcessImageTyped<UInt8VectorImageType>(task, i);
+        break;
+      case itk::ImageIOBase::USHORT:
+        ProcessImageTyped<UInt16VectorImageType>(task, i);
+        break;
+      case itk::ImageIOBase::SHORT:
+        ProcessImageTyped<Int16VectorImageType>(task, i);
+        break;
+      default:
+        ProcessImageTyped<FloatVectorImageType>(task, i);
+        break;
+    }
+  }
+
+  template <class TImage>
+  void ProcessImageTyped(PipelineTask& task, unsigned long i)
+  {
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+
+    //Input image, read in its own pixel type
+    const std::string& filename = (*task.filenames)[i];
+    typedef otb::ImageFileReader<ImageType> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(filename);
+    typename ImageType::Pointer image = reader->GetOutput();
+    image->UpdateOutputInformation();
+
+    //Features over the footprint of the image, the shared layer being locked while they are fetched
+    otb::FootprintFeatureIndex featureIndex;
+    {
+      itk::MutexLockHolder<itk::SimpleFastMutexLock> holder(*task.mutex);
+      featureIndex.Build(image.GetPointer(), *task.layer, 3);
+    }
+
+    //Cache of the decoded tiles of this image
+    otb::TileCache tileCache;
+    tileCache.SetBudget(task.cacheBudget);
+    const std::string imageKey = otb::TileCache::MakeImageKey(filename, "", typeid(ImagePixelType).name());
+
+    //The same pixels are skipped by both stages, the windows inside an overlap processed with another image not being read
+    const otb::OverlapMask* overlap = task.overlaps.empty() ? NULL : &task.overlaps[i];
+    otb::SamplingWindowList windows;
+    {
+      otb::SamplingWindowList grid = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), task.sizeTiles);
+      for(unsigned long w = 0; w < grid.size(); ++w)
+      {
+        if(!overlap || !overlap->CoversWindow(image.GetPointer(), grid[w]))
+        {
+          windows.push_back(grid[w]);
+        }
+      }
+    }
+
+    if(!task.sampling)
+    {
+      // *** *** 1st run :  PROSPECTION      *** ***
+      otb::ImageAnalysis& analysis = task.analyses[i];
+      for(unsigned long w = 0; w < windows.size(); ++w)
+      {
+        std::vector<otb::ogr::Feature> features = featureIndex.GetWindowFeatures(image.GetPointer(), windows[w]);
+        if(features.empty())
+        {
+          continue;
+        }
+        typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), windows[w].region, &tileCache, imageKey);
+        otb::AnalyzeWindow(image.GetPointer(), tile.GetPointer(), windows[w], features, task.classField, task.noDataValue, analysis, overlap);
+      }
+      return;
+    }
+
+    // *** *** 2nd run : SAMPLING   *** ***
+    std::ostringstream basename;
+    basename << task.outputDirectory << "/samples_" << i+1;
+
+    std::ofstream myfile((basename.str() + ".txt").c_str());
+    std::string projRef = image->GetProjectionRef();
+    OGRSpatialReference oSRS(projRef.c_str());
+    otb::ogr::DataSource::Pointer ogrDS = otb::ogr::DataSource::New(basename.str() + ".shp", otb::ogr::DataSource::Modes::Overwrite);
+    otb::ogr::Layer layer(NULL, false);
+    {
+      itk::MutexLockHolder<itk::SimpleFastMutexLock> holder(*task.mutex);
+      layer = otb::CreateSamplesLayer(ogrDS.GetPointer(), basename.str() + ".shp", &oSRS, std::vector<unsigned int>(),
+                                      image->GetNumberOfComponentsPerPixel(), task.layer->GetLayerDefn());
+    }
+
+    //Generator of the image, seeded from its number so that the samples do not depend on the scheduling
+    typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+    GeneratorType::Pointer generator = GeneratorType::New();
+    generator->Initialize();
+    generator->SetSeed(task.seed + i);
+
+    //Pixel counts of the analysis, looked up in memory
+    otb::PolygonStatisticsFile polygonStats;
+    polygonStats.Assign(task.analyses[i].classCounts, task.analyses[i].polygonCounts);
+
+    otb::ImageSampler<ImageType> sampler;
+    sampler.SetMode(task.samplingMode);
+    sampler.SetClassField(task.classField);
+    sampler.SetNoDataValue(task.noDataValue);
+    sampler.SetGenerator(generator);
+    sampler.SetOutputs(&myfile, layer);
+    sampler.SetOverlapMask(overlap);
+    sampler.SetAnalysis(&polygonStats, task.imageSamples[i]);
+    if(task.samplingMode == "quota")
+    {
+      otb::ShuffleList(windows, generator.GetPointer());
+    }
+
+    for(unsigned long w = 0; w < windows.size() && !sampler.IsComplete(); ++w)
+    {
+      std::vector<otb::ogr::Feature> features = featureIndex.GetWindowFeatures(image.GetPointer(), windows[w]);
+      if(features.empty() || !sampler.IsWindowNeeded(features))
+      {
+        continue;
+      }
+      typename ImageType::Pointer tile = otb::ExtractTile(image.GetPointer(), windows[w].region, &tileCache, imageKey);
+      sampler.SampleWindow(image.GetPointer(), tile.GetPointer(), windows[w], features);
+    }
+    task.pixelsRaised[i] = sampler.GetNumberOfPixelsRaised();
+  }
+
+  //Run a stage over all the images on the thread pool, and stop on the first failed image
+  void RunStage(PipelineTask& task, unsigned int nbWorkers, bool sampling)
+  {
+    task.sampling = sampling;
+    task.nextImage = 0;
+    task.errors.assign(task.filenames->size(), std::string());
+
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(nbWorkers);
+    threader->SetSingleMethod(ProcessImagesThread, &task);
+    threader->SingleMethodExecute();
+
+    for(unsigned long i = 0; i < task.errors.size(); ++i)
+    {
+      if(!task.errors[i].empty())
+      {
+        itkExceptionMacro(<< "Image " << (*task.filenames)[i] << " : " << task.errors[i]);
+      }
+    }
+  }
+
+  void DoExecute()
+  {
+    std::vector<std::string> imageFilenameList = GetParameterStringList("il");
+
+    //The vector file is read once into memory, its features and attributes being shared by the stages and images
+    otb::ogr::DataSource::Pointer source = otb::ogr::DataSource::New(GetParameterString("shp").c_str(), otb::ogr::DataSource::Modes::Read);
+    otb::ogr::DataSource::Pointer vectorData = otb::ogr::DataSource::New();
+    otb::ogr::Layer sourceLayer = source->GetLayer(0);
+    otb::ogr::Layer sharedLayer = vectorData->CopyLayer(sourceLayer, sourceLayer.GetName());
+    otbAppLogINFO(<< sharedLayer.GetFeatureCount(true) << " features loaded" << std::endl);
+
+    PipelineTask task;
+    task.app = this;
+    task.filenames = &imageFilenameList;
+    task.classField = GetParameterString("cfield");
+    task.samplingMode = GetParameterString("mode");
+    task.outputDirectory = GetParameterString("outdir");
+    task.noDataValue = GetParameterInt("nd");
+    task.sizeTiles = GetParameterInt("tiles");
+    task.seed = GetParameterInt("rand");
+    task.cacheBudget = static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024;
+    task.layer = &sharedLayer;
+
+    //Overlaps between the images, resolved from the image extents and a coarse footprint of their valid data
+    std::vector<std::string> scores;
+    if(IsParameterEnabled("overlap.score.values") && HasValue("overlap.score.values"))
+    {
+      scores = GetParameterStringList("overlap.score.values");
+    }
+    task.overlaps = otb::ResolveImageListOverlaps(GetParameterString("overlap"), imageFilenameList, scores, task.noDataValue);
+
+    itk::SimpleFastMutexLock mutex;
+    task.mutex = &mutex;
+    task.analyses.resize(imageFilenameList.size());
+    task.pixelsRaised.resize(imageFilenameList.size());
+
+    //Number of images processed at once : one per thread, within the RAM budget. An image being processed
+    //holds its decoded window, the extracted copy and its tile cache.
+    unsigned long imageMemory = 0;
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      imageMemory = std::max(imageMemory, 2*otb::EstimateWindowMemory(imageFilenameList[i], task.sizeTiles) + task.cacheBudget);
+    }
+    unsigned long ramBudget = static_cast<unsigned long>(GetParameterInt("ram"))*1024*1024;
+    unsigned int nbWorkers = itk::MultiThreader::New()->GetNumberOfThreads();
+    nbWorkers = std::min(nbWorkers, static_cast<unsigned int>(imageFilenameList.size()));
+    if(imageMemory > 0)
+    {
+      nbWorkers = std::min(nbWorkers, static_cast<unsigned int>(ramBudget / imageMemory));
+    }
+    nbWorkers = std::max(1u, nbWorkers);
+    otbAppLogINFO(<< imageFilenameList.size() << " images, " << nbWorkers << " processed at once" << std::endl);
+
+    // *** *** ANALYSIS   *** ***
+    RunStage(task, nbWorkers, false);
+
+    // *** *** STRATEGY   *** ***
+    std::map<int, int> elmtsInClassGlobal;
+    std::vector<std::map<int, int> > imageCounts(imageFilenameList.size());
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      imageCounts[i] = task.analyses[i].classCounts;
+      for(std::map<int, int>::const_iterator iClass = imageCounts[i].begin(); iClass != imageCounts[i].end(); ++iClass)
+      {
+        elmtsInClassGlobal[iClass->first] += iClass->second;
+      }
+    }
+    for(std::map<int, int>::iterator iClass = elmtsInClassGlobal.begin(); iClass != elmtsInClassGlobal.end(); ++iClass)
+    {
+      otbAppLogINFO(<< "Class " << iClass->first << " : " << iClass->second << " pixels" << std::endl);
+    }
+    task.imageSamples = otb::ComputeSamplingStrategy(GetParameterString("strategy"), GetParameterInt("samples"),
+                                                     imageCounts, elmtsInClassGlobal);
+
+    //Intermediate files, as written by AnalysisImageList and StrategyImageList
+    if(IsParameterEnabled("debug") && HasValue("debug"))
+    {
+      const std::string debugDirectory = GetParameterString("debug");
+      for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+      {
+        std::ostringstream basename;
+        basename << debugDirectory << "/analysis_" << i+1;
+        const otb::ImageAnalysis& analysis = task.analyses[i];
+        otb::PolygonStatisticsFile::Write(basename.str() + ".bin", analysis.classCounts, analysis.polygonCounts,
+                                          analysis.classStatistics, analysis.polygonStatistics,
+                                          analysis.classSketches);
+        otb::PolygonStatisticsFile::WriteXML(basename.str() + ".xml", analysis.classCounts, analysis.polygonCounts);
+      }
+      otb::WriteSamplingStrategyXML(debugDirectory + "/strategy.xml", task.imageSamples);
+    }
+
+    //The band statistics are not needed by the sampling
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      task.analyses[i].polygonStatistics.clear();
+      task.analyses[i].classStatistics.clear();
+      task.analyses[i].classSketches.clear();
+    }
+
+    // *** *** SAMPLING   *** ***
+    RunStage(task, nbWorkers, true);
+
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      for(std::map<int, int>::const_iterator iClass = task.pixelsRaised[i].begin(); iClass != task.pixelsRaised[i].end(); ++iClass)
+      {
+        otbAppLogINFO(<< "Image " << i+1 << ", number of pixels raised in class " << iClass->first << " : " << iClass->second << std::endl);
+      }
+    }
+  }
+};
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::SamplingPipeline)
@@ -0,0 +1,571 @@
+/*=========================================================================
+ Program:   ORFEO Toolbox
+ Language:  C++
+ Date:      $Date$
+ Version:   $Revision$
+
+
+ Copyright (c) Centre National d'Etudes Spatiales. All rights reserved.
+ See OTBCopyright.txt for details.
+
+
+ This software is distributed WITHOUT ANY WARRANTY; without even
+ the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ PURPOSE.  See the above copyright notices for more information.
+
+ =========================================================================*/
+
+#include "otbImage.h"
+#include "otbImageFileReader.h"
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+#include "itkSmartPointer.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "itksys/SystemTools.hxx"
+#include "otbSamplingWindow.h"
+#include "otbTileCache.h"
+#include "otbSamplingImageIO.h"
+#include "otbQuotaSampler.h"
+#include "otbImageAnalysis.h"
+#include "otbImageSampler.h"
+#include "otbPolygonStatisticsFile.h"
+#include "otbStrategyState.h"
+#include "otbLocalSocket.h"
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include <typeinfo>
+
+namespace otb
+{
+
+namespace Wrapper
+{
+
+// Long-lived server of sampling, statistics and analysis jobs over a Unix
+// domain socket. The images, the vector files, the feature indexes of each
+// image and the decoded tiles stay open between the jobs, so that a job over a
+// small area of interest only reads the tiles it touches. Jobs are served one
+// at a time, in the order of the connections.
+//
+// A request is one JSON object on one line:
+//
+//   {"job": "statistics", "image": "im.tif", "vector": "ref.shp", "cfield": "class",
+//    "aoi": {"minx": ..., "miny": ..., "maxx": ..., "maxy": ...}}
+//
+// job is statistics (class counts and band statistics in the reply), analysis
+// (analysis file written to out), sampling (samples of the area written to out
+// and v, samples per class and mode as for otbSampling, seed), status or
+// shutdown. The area of interest, in the map coordinates of the image, is the
+// whole image when not given. The reply is one JSON object on one line, with
+// status ok or error and message; its values are strings.
+class SamplingServer : public Application
+{
+public:
+  typedef SamplingServer Self;
+  typedef itk::SmartPointer<Self> Pointer;
+
+  itkNewMacro(Self);
+
+  itkTypeMacro(SamplingServer, otb::Application);
+
+private:
+  typedef boost::property_tree::ptree JsonTree;
+
+  //Features of a vector file over the footprint of an image, with the stamp of the vector file
+  struct WarmIndex
+  {
+    std::string stamp;
+    otb::FootprintFeatureIndex index;
+  };
+
+  //Opened image, read in its own pixel type, with its feature indexes
+  struct WarmImage
+  {
+    std::string stamp;
+    itk::ImageIOBase::IOComponentType componentType;
+    itk::ProcessObject::Pointer reader;
+    itk::DataObject::Pointer image;
+    std::map<std::string, WarmIndex> indexes;
+    unsigned long lastUse;
+
+    WarmImage() : componentType(itk::ImageIOBase::UNKNOWNCOMPONENTTYPE), lastUse(0) {}
+  };
+
+  struct WarmVector
+  {
+    std::string stamp;
+    otb::ogr::DataSource::Pointer dataSource;
+  };
+
+  void DoInit()
+  {
+    SetName("SamplingServer");
+    SetDescription("This application serves sampling, statistics and analysis jobs sent as JSON over a Unix domain socket, keeping the images, feature indexes and decoded tiles open between the jobs.");
+
+    AddParameter(ParameterType_String, "socket", "Path of the Unix domain socket");
+
+    AddParameter(ParameterType_Int, "tiles", "Size of square tiles");
+    SetDefaultParameterInt("tiles", 200);
+    MandatoryOff("tiles");
+
+    AddParameter(ParameterType_Int, "cache", "RAM budget of the decoded tile cache shared by the images (MB)");
+    SetDefaultParameterInt("cache", 512);
+    MandatoryOff("cache");
+
+    AddParameter(ParameterType_Directory, "cachedir", "Scratch directory of the tiles evicted from the cache");
+    MandatoryOff("cachedir");
+    AddParameter(ParameterType_Int, "cachedisk", "Disk budget of the scratch directory (MB), the least recently used tiles being deleted beyond it");
+    SetDefaultParameterInt("cachedisk", 4096);
+    MandatoryOff("cachedisk");
+
+    AddParameter(ParameterType_Int, "images", "Maximum number of images kept open, the least recently used being closed");
+    SetDefaultParameterInt("images", 8);
+    MandatoryOff("images");
+
+    AddParameter(ParameterType_Int, "timeout", "Time given to a client to send its request or read the reply (s)");
+    SetDefaultParameterInt("timeout", 10);
+    MandatoryOff("timeout");
+
+    AddParameter(ParameterType_Int, "nd", "NoData value, when a job does not give one");
+    SetDefaultParameterInt("nd", 0);
+    MandatoryOff("nd");
+  }
+
+  void DoUpdateParameters()
+  {
+  }
+
+  void DoExecute()
+  {
+    m_TileCache.SetBudget(static_cast<unsigned long>(GetParameterInt("cache"))*1024*1024);
+    if(IsParameterEnabled("cachedir") && HasValue("cachedir"))
+    {
+      m_TileCache.SetScratchDirectory(GetParameterString("cachedir"), static_cast<unsigned long long>(GetParameterInt("cachedisk"))*1024*1024);
+    }
+    m_NbJobs = 0;
+
+    otb::LocalSocketServer server;
+    server.Open(GetParameterString("socket"));
+    otbAppLogINFO(<< "Listening on " << GetParameterString("socket") << std::endl);
+
+    bool running = true;
+    while(running)
+    {
+      int connection = server.Accept(GetParameterInt("timeout"));
+      std::string request, reply;
+      if(otb::LocalSocketServer::ReadRequest(connection, request, 1 << 20))
+      {
+        reply = HandleRequest(request, running);
+      }
+      else
+      {
+        JsonTree error;
+        error.put("status", "error");
+        error.put("message", "Incomplete request");
+        reply = WriteJson(error);
+      }
+      otb::LocalSocketServer::WriteReply(connection, reply);
+      otb::LocalSocketServer::CloseConnection(connection);
+    }
+    otbAppLogINFO(<< m_NbJobs << " jobs served" << std::endl);
+  }
+
+  //Run a job, the errors being returned to the client
+  std::string HandleRequest(const std::string& request, bool& running)
+  {
+    double start = itksys::SystemTools::GetTime();
+    JsonTree reply;
+    std::string type;
+    try
+    {
+      JsonTree job;
+      std::istringstream iss(request);
+      boost::property_tree::read_json(iss, job);
+      type = job.get<std::string>("job");
+
+      if(type == "statistics" || type == "analysis" || type == "sampling")
+      {
+        RunImageJob(type, job, reply);
+      }
+      else if(type == "status")
+      {
+        Status(reply);
+      }
+      else if(type == "shutdown")
+      {
+        running = false;
+      }
+      else
+      {
+        itkExceptionMacro(<< "Unknown job " << type);
+      }
+      reply.put("status", "ok");
+    }
+    catch(std::exception& e)
+    {
+      reply.clear();
+      reply.put("status", "error");
+      reply.put("message", e.what());
+    }
+
+    ++m_NbJobs;
+    double elapsed = 1000*(itksys::SystemTools::GetTime() - start);
+    reply.put("time", elapsed);
+    otbAppLogINFO(<< "Job " << type << " : " << reply.get<std::string>("status") << ", " << elapsed << " ms" << std::endl);
+    return WriteJson(reply);
+  }
+
+  static std::string WriteJson(const JsonTree& tree)
+  {
+    std::ostringstream oss;
+    boost::property_tree::write_json(oss, tree, false);
+    return oss.str();
+  }
+
+  void Status(JsonTree& reply)
+  {
+    JsonTree images;
+    for(std::map<std::string, WarmImage>::const_iterator it = m_Images.begin(); it != m_Images.end(); ++it)
+    {
+      JsonTree image;
+      image.put("image", it->first);
+      image.put("indexes", it->second.indexes.size());
+      images.push_back(std::make_pair("", image));
+    }
+    reply.add_child("images", images);
+    reply.put("vectors", m_Vectors.size());
+    reply.put("jobs", m_NbJobs);
+    reply.put("tiles.hits", m_TileCache.GetHits());
+    reply.put("tiles.misses", m_TileCache.GetMisses());
+  }
+
+  //Stamp of an input file, without the extended filename options
+  static std::string FileStamp(const std::string& filename)
+  {
+    std::string path = filename.substr(0, filename.find('?'));
+    if(!itksys::SystemTools::FileExists(path.c_str()))
+    {
+      itkGenericExceptionMacro(<< "No such file " << path);
+    }
+    return otb::AnalysisFileStamp(path);
+  }
+
+  //Opened image of a job, reopened when the file changed
+  void RunImageJob(const std::string& type, const JsonTree& job, JsonTree& reply)
+  {
+    const std::string filename = job.get<std::string>("image");
+    const std::string stamp = FileStamp(filename);
+
+    std::map<std::string, WarmImage>::iterator found = m_Images.find(filename);
+    if(found == m_Images.end() || found->second.stamp != stamp)
+    {
+      if(found == m_Images.end() && m_Images.size() >= static_cast<unsigned long>(std::max(1, GetParameterInt("images"))))
+      {
+        CloseLeastRecentImage();
+      }
+      WarmImage& warm = m_Images[filename];
+      warm = WarmImage();
+      warm.stamp = stamp;
+      warm.componentType = otb::ReadImageComponentType(filename);
+    }
+    WarmImage& warm = m_Images[filename];
+    warm.lastUse = m_NbJobs;
+
+    //The image is processed in the pixel type of the file
+    switch(warm.componentType)
+    {
+      case itk::ImageIOBase::UCHAR:
+        RunImageJobTyped<UInt8VectorImageType>(type, job, warm, reply);
+        break;
+      case itk::ImageIOBase::USHORT:
+        RunImageJobTyped<UInt16VectorImageType>(type, job, warm, reply);
+        break;
+      case itk::ImageIOBase::SHORT:
+        RunImageJobTyped<Int16VectorImageType>(type, job, warm, reply);
+        break;
+      default:
+        RunImageJobTyped<FloatVectorImageType>(type, job, warm, reply);
+        break;
+    }
+  }
+
+  void CloseLeastRecentImage()
+  {
+    std::map<std::string, WarmImage>::iterator oldest = m_Images.begin();
+    for(std::map<std::string, WarmImage>::iterator it = m_Images.begin(); it != m_Images.end(); ++it)
+    {
+      if(it->second.lastUse < oldest->second.lastUse)
+      {
+        oldest = it;
+      }
+    }
+    if(oldest != m_Images.end())
+    {
+      m_Images.erase(oldest);
+    }
+  }
+
+  //Layer of an opened vector file, reopened when the file changed
+  otb::ogr::Layer GetVectorLayer(const std::string& filename, std::string& stamp)
+  {
+    stamp = FileStamp(filename);
+    WarmVector& warm = m_Vectors[filename];
+    if(warm.dataSource.IsNull() || warm.stamp != stamp)
+    {
+      warm.dataSource = NULL;
+      warm.dataSource = otb::ogr::DataSource::New(filename.c_str(), otb::ogr::DataSource::Modes::Read);
+      warm.stamp = stamp;
+    }
+    return warm.dataSource->GetLayer(0);
+  }
+
+  //Pixels of the area of interest of a job, given in map coordinates
+  template <class TImage>
+  static itk::ImageRegion<2> AreaRegion(const TImage* image, const JsonTree& job)
+  {
+    itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+    boost::optional<const JsonTree&> aoi = job.get_child_optional("aoi");
+    if(!aoi)
+    {
+      return imageRegion;
+    }
+
+    itk::Point<double, 2> lowerPoint, upperPoint;
+    lowerPoint[0] = aoi->get<double>("minx");
+    lowerPoint[1] = aoi->get<double>("miny");
+    upperPoint[0] = aoi->get<double>("maxx");
+    upperPoint[1] = aoi->get<double>("maxy");
+    itk::ContinuousIndex<double, 2> lowerIndex, upperIndex;
+    image->TransformPhysicalPointToContinuousIndex(lowerPoint, lowerIndex);
+    image->TransformPhysicalPointToContinuousIndex(upperPoint, upperIndex);
+
+    //Pixels whose centre is in the area, the axes being possibly flipped
+    itk::ImageRegion<2> area;
+    for(unsigned int d = 0; d < 2; ++d)
+    {
+      double first = std::ceil(std::min(lowerIndex[d], upperIndex[d]) - 0.5);
+      double last = std::floor(std::max(lowerIndex[d], upperIndex[d]) + 0.5);
+      if(last < first)
+      {
+        last = first;
+      }
+      area.SetIndex(d, static_cast<itk::IndexValueType>(first));
+      area.SetSize(d, static_cast<itk::SizeValueType>(last - first + 1));
+    }
+    if(!area.Crop(imageRegion))
+    {
+      itkGenericExceptionMacro(<< "The area of interest is outside the image");
+    }
+    return area;
+  }
+
+  template <class TImage>
+  void RunImageJobTyped(const std::string& type, const JsonTree& job, WarmImage& warm, JsonTree& reply)
+  {
+    typedef TImage                                  ImageType;
+    typedef typename ImageType::InternalPixelType   ImagePixelType;
+
+    const std::string filename = job.get<std::string>("image");
+    if(warm.image.IsNull())
+    {
+      typedef otb::ImageFileReader<ImageType> ReaderType;
+      typename ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(filename);
+      reader->GetOutput()->UpdateOutputInformation();
+      warm.reader = reader.GetPointer();
+      warm.image = reader->GetOutput();
+    }
+    ImageType* image = static_cast<ImageType*>(warm.image.GetPointer());
+
+    //Features over the footprint of the image, indexed once per vector file
+    const std::string vectorFilename = job.get<std::string>("vector");
+    std::string vectorStamp;
+    otb::ogr::Layer layer = GetVectorLayer(vectorFilename, vectorStamp);
+    WarmIndex& warmIndex = warm.indexes[vectorFilename];
+    if(warmIndex.stamp != vectorStamp)
+    {
+      warmIndex.index.Build(image, layer, 3);
+      warmIndex.stamp = vectorStamp;
+    }
+    otb::FootprintFeatureIndex& featureIndex = warmIndex.index;
+
+    const std::string classField = job.get<std::string>("cfield");
+    const int noDataValue = job.get<int>("nd", GetParameterInt("nd"));
+    const std::string imageKey = otb::TileCache::MakeImageKey(filename, "", typeid(ImagePixelType).name());
+
+    //Windows of the area of interest: the tiles of the image grid it touches, cropped to it. The whole
+    //tiles are read, so that the cached tiles serve any area.
+    const itk::ImageRegion<2> area = AreaRegion(image, job);
+    otb::SamplingWindowList windows;
+    std::vector<itk::ImageRegion<2> > tileRegions;
+    {
+      otb::SamplingWindowList grid = otb::GenerateGridWindows(image->GetLargestPossibleRegion(), GetParameterInt("tiles"));
+      for(unsigned long w = 0; w < grid.size(); ++w)
+      {
+        otb::SamplingWindow window = grid[w];
+        if(window.region.Crop(area))
+        {
+          windows.push_back(window);
+          tileRegions.push_back(grid[w].region);
+        }
+      }
+    }
+
+    // *** *** PROSPECTION      *** ***
+    otb::ImageAnalysis analysis;
+    for(unsigned long w = 0; w < windows.size(); ++w)
+    {
+      std::vector<otb::ogr::Feature> features = featureIndex.GetWindowFeatures(image, windows[w]);
+      if(features.empty())
+      {
+        continue;
+      }
+      typename ImageType::Pointer tile = otb::ExtractTile(image, tileRegions[w], &m_TileCache, imageKey);
+      otb::AnalyzeWindow(image, tile.GetPointer(), windows[w], features, classField, noDataValue, analysis);
+    }
+    reply.put("pixels", analysis.nbPixels);
+    reply.put("polygons", analysis.polygonCounts.size());
+
+    if(type == "statistics")
+    {
+      JsonTree classes;
+      for(std::map<int, int>::const_iterator iClass = analysis.classCounts.begin(); iClass != analysis.classCounts.end(); ++iClass)
+      {
+        JsonTree node;
+        node.put("count", iClass->second);
+        std::map<int, BandStatistics>::const_iterator statistics = analysis.classStatistics.find(iClass->first);
+        if(statistics != analysis.classStatistics.end())
+        {
+          JsonTree mean, stddev, min, max;
+          for(unsigned int b = 0; b < statistics->second.GetNumberOfBands(); ++b)
+          {
+            AppendValue(mean, statistics->second.GetMean(b));
+            AppendValue(stddev, std::sqrt(statistics->second.GetVariance(b)));
+            AppendValue(min, statistics->second.GetMinimum(b));
+            AppendValue(max, statistics->second.GetMaximum(b));
+          }
+          node.add_child("mean", mean);
+          node.add_child("stddev", stddev);
+          node.add_child("min", min);
+          node.add_child("max", max);
+        }
+        std::ostringstream className;
+        className << iClass->first;
+        classes.add_child(className.str(), node);
+      }
+      reply.add_child("classes", classes);
+      return;
+    }
+
+    if(type == "analysis")
+    {
+      const std::string out = job.get<std::string>("out");
+      otb::PolygonStatisticsFile::Write(out, analysis.classCounts, analysis.polygonCounts,
+                                        analysis.classStatistics, analysis.polygonStatistics, analysis.classSketches);
+      reply.put("out", out);
+      return;
+    }
+
+    // *** *** SAMPLING   *** ***
+    const std::string samplingMode = job.get<std::string>("mode", "random");
+    if(samplingMode != "exhaustive" && samplingMode != "random" && samplingMode != "randomequally"
+       && samplingMode != "periodic" && samplingMode != "periodicrandom" && samplingMode != "quota")
+    {
+      itkExceptionMacro(<< "Unknown sampling mode " << samplingMode);
+    }
+    const int samples = job.get<int>("samples");
+    const std::string textFilename = job.get<std::string>("out");
+    const std::string maskFilename = job.get<std::string>("v");
+
+    std::map<int, int> nbSamples;
+    for(std::map<int, int>::const_iterator iClass = analysis.classCounts.begin(); iClass != analysis.classCounts.end(); ++iClass)
+    {
+      nbSamples[iClass->first] = std::min(samples, iClass->second);
+    }
+
+    std::ofstream myfile(textFilename.c_str());
+    std::string projRef = image->GetProjectionRef();
+    OGRSpatialReference oSRS(projRef.c_str());
+    otb::ogr::DataSource::Pointer ogrDS = otb::ogr::DataSource::New(maskFilename, otb::ogr::DataSource::Modes::Overwrite);
+    otb::ogr::Layer samplesLayer = otb::CreateSamplesLayer(ogrDS.GetPointer(), maskFilename, &oSRS, std::vector<unsigned int>(),
+                                                           image->GetNumberOfComponentsPerPixel(), layer.GetLayerDefn());
+
+    typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+    GeneratorType::Pointer generator = GeneratorType::New();
+    generator->Initialize();
+    generator->SetSeed(job.get<int>("seed", 0));
+
+    //Pixel counts of the area, looked up in memory
+    otb::PolygonStatisticsFile polygonStats;
+    polygonStats.Assign(analysis.classCounts, analysis.polygonCounts);
+
+    otb::ImageSampler<ImageType> sampler;
+    sampler.SetMode(samplingMode);
+    sampler.SetClassField(classField);
+    sampler.SetNoDataValue(noDataValue);
+    sampler.SetGenerator(generator);
+    sampler.SetOutputs(&myfile, samplesLayer);
+    sampler.SetAnalysis(&polygonStats, nbSamples);
+
+    std::vector<unsigned long> order(windows.size());
+    for(unsigned long w = 0; w < windows.size(); ++w)
+    {
+      order[w] = w;
+    }
+    if(samplingMode == "quota")
+    {
+      otb::ShuffleList(order, generator.GetPointer());
+    }
+
+    for(unsigned long i = 0; i < order.size() && !sampler.IsComplete(); ++i)
+    {
+      unsigned long w = order[i];
+      std::vector<otb::ogr::Feature> features = featureIndex.GetWindowFeatures(image, windows[w]);
+      if(features.empty() || !sampler.IsWindowNeeded(features))
+      {
+        continue;
+      }
+      typename ImageType::Pointer tile = otb::ExtractTile(image, tileRegions[w], &m_TileCache, imageKey);
+      sampler.SampleWindow(image, tile.GetPointer(), windows[w], features);
+    }
+    myfile.close();
+    if(!myfile)
+    {
+      itkExceptionMacro(<< "Unable to write the samples " << textFilename);
+    }
+
+    JsonTree raised;
+    const std::map<int, int>& pixelsRaised = sampler.GetNumberOfPixelsRaised();
+    for(std::map<int, int>::const_iterator iClass = pixelsRaised.begin(); iClass != pixelsRaised.end(); ++iClass)
+    {
+      std::ostringstream className;
+      className << iClass->first;
+      raised.put(className.str(), iClass->second);
+    }
+    reply.add_child("samples", raised);
+    reply.put("out", textFilename);
+    reply.put("v", maskFilename);
+  }
+
+  static void AppendValue(JsonTree& list, double value)
+  {
+    JsonTree node;
+    node.put("", value);
+    list.push_back(std::make_pair("", node));
+  }
+
+  std::map<std::string, WarmImage> m_Images;
+  std::map<std::string, WarmVector> m_Vectors;
+  otb::TileCache m_TileCache;
+  unsigned long m_NbJobs;
+};
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::SamplingServer)
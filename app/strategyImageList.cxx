@@ -34,7 +34,18 @@
 #include "vcl_algorithm.h"
 #include "otbMultiToMonoChannelExtractROI.h"
 #include "otbStatisticsXMLFileWriter.h"
+#include "otbPolygonStatisticsFile.h"
+#include "otbSamplingStrategy.h"
+#include "otbSamplingCost.h"
+#include "otbSamplingImageIO.h"
+#include "otbStrategyState.h"
+#include "itksys/SystemTools.hxx"
+#include "itkMultiThreader.h"
+#include <set>
 #include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
 #include <iterator>   
 
 namespace otb
@@ -63,112 +74,382 @@ private:
   void DoInit()
   {
     SetName("StrategyImageList");
-    SetDescription("This application generate the right sampling strategy for images from .xml files.");    
+    SetDescription("This application generate the right sampling strategy for images from their analysis files.");    
     
-    AddParameter(ParameterType_InputFilenameList, "xml", "XML Analysis File");
+    AddParameter(ParameterType_InputFilenameList, "xml", "Analysis files (binary or XML)");
     AddParameter(ParameterType_OutputFilename, "out", "Output XML file");
     AddParameter(ParameterType_Int, "samples", "Number of samples per classes");
     
     AddParameter(ParameterType_Choice, "strategy", "Strategy of sampling");
     AddChoice("strategy.equally", "Equal repartion across the images");
     AddChoice("strategy.proportional", "Proportional repartion across the images");
+    AddChoice("strategy.neyman", "Neyman allocation, more samples for the classes and images of higher spectral variance (band statistics of the analysis files)");
+    AddChoice("strategy.cost", "Repartition at the lowest read cost, the samples of each class being taken from the images where the class is the most compact. The cost model assumes the quota sampling mode of SamplingImageList, the other modes reading all the windows whatever the repartition");
+    AddParameter(ParameterType_InputFilenameList, "strategy.cost.il", "Images of the analysis files, in the same order");
+    AddParameter(ParameterType_InputFilename, "strategy.cost.shp", "Vectoriel File of the analysis");
+    AddParameter(ParameterType_String, "strategy.cost.cfield", "Field of class");
+    AddParameter(ParameterType_Int, "strategy.cost.tiles", "Size of the square tiles read by the sampling");
+    SetDefaultParameterInt("strategy.cost.tiles", 200);
+    AddParameter(ParameterType_Float, "strategy.cost.spread", "Fraction of its proportional share of the samples kept by every image (0 to 1)");
+    SetDefaultParameterFloat("strategy.cost.spread", 0.2);
+    
+    AddParameter(ParameterType_OutputFilename, "outstats", "Band statistics of the pixels of all the classes and images (XML), for the feature normalization");
+    MandatoryOff("outstats");
+    
+    AddParameter(ParameterType_OutputFilename, "outquantiles", "Percentiles of the bands of each class over all the images (XML)");
+    MandatoryOff("outquantiles");
+    AddParameter(ParameterType_StringList, "quantiles", "Percentiles to output, 2 25 50 75 98 by default");
+    MandatoryOff("quantiles");
+    
+    AddParameter(ParameterType_OutputFilename, "state", "Persistent state of the campaign (XML), updated with the images added, removed or analysed again since the last run");
+    MandatoryOff("state");
+    AddParameter(ParameterType_Float, "tolerance", "Relative change of the quotas of an image below which its previous quotas are kept, with the state");
+    SetDefaultParameterFloat("tolerance", 0.);
+    MandatoryOff("tolerance");
+    AddParameter(ParameterType_OutputFilename, "outchanged", "Images whose quotas changed, to be sampled again (text file : image number, analysis file)");
+    MandatoryOff("outchanged");
   }
 
   void DoUpdateParameters()
   {
   }
 
+  typedef otb::PolygonStatisticsFile::ClassCountMap      ClassCountMap;
+  typedef otb::PolygonStatisticsFile::ClassStatisticsMap ClassStatisticsMap;
+  
+  //Analysis files read by the threads : class counts (and band statistics if kept) of each image, and per-thread totals,
+  //band statistics and quantile sketches of each class
+  struct ReadTask
+  {
+    const std::vector<std::string>* filenames;
+    bool keepImageStatistics;
+    std::vector<ClassCountMap> imageCounts;
+    std::vector<ClassStatisticsMap> imageStatistics;
+    std::vector<ClassCountMap> partialTotals;
+    std::vector<ClassStatisticsMap> partialStatistics;
+    std::vector<otb::ClassQuantileSketchMap> partialSketches;
+    std::vector<std::string> errors;
+  };
+  
+  static ITK_THREAD_RETURN_TYPE ReadClassCountsThread(void* arg)
+  {
+    itk::MultiThreader::ThreadInfoStruct* info = static_cast<itk::MultiThreader::ThreadInfoStruct*>(arg);
+    ReadTask* task = static_cast<ReadTask*>(info->UserData);
+    
+    //Contiguous range of files of the thread
+    unsigned long nbFiles = task->filenames->size();
+    unsigned long begin = nbFiles * info->ThreadID / info->NumberOfThreads;
+    unsigned long end = nbFiles * (info->ThreadID + 1) / info->NumberOfThreads;
+    
+    ClassCountMap& totals = task->partialTotals[info->ThreadID];
+    ClassStatisticsMap& statistics = task->partialStatistics[info->ThreadID];
+    otb::ClassQuantileSketchMap& sketches = task->partialSketches[info->ThreadID];
+    for(unsigned long i = begin; i < end; ++i)
+    {
+      ClassStatisticsMap imageStatistics;
+      otb::ClassQuantileSketchMap imageSketches;
+      try
+      {
+        otb::PolygonStatisticsFile::ReadClassTable((*task->filenames)[i], task->imageCounts[i], imageStatistics, imageSketches);
+      }
+      catch(std::exception& e)
+      {
+        task->errors[info->ThreadID] = e.what();
+        break;
+      }
+      for(ClassCountMap::const_iterator iClass = task->imageCounts[i].begin(); iClass != task->imageCounts[i].end(); ++iClass)
+      {
+        totals[iClass->first] += iClass->second;
+      }
+      for(ClassStatisticsMap::const_iterator iClass = imageStatistics.begin(); iClass != imageStatistics.end(); ++iClass)
+      {
+        statistics[iClass->first].Merge(iClass->second);
+      }
+      otb::MergeClassQuantileSketches(sketches, imageSketches);
+      if(task->keepImageStatistics)
+      {
+        task->imageStatistics[i].swap(imageStatistics);
+      }
+    }
+    return ITK_THREAD_RETURN_VALUE;
+  }
+
   void DoExecute()
   { 
-    std::map<int, std::map<int, int> > nbSamples;
-    std::map<int, std::map<int, int> > elmtsInClass;
-    std::map<int, int> elmtsInClassGlobal;
-    int imageCount = 0;
-    
     //Strategy recuperation from the parameter
     const std::string samplingStrategy = GetParameterString("strategy");
     
     std::vector<std::string> xmlFilenameList = GetParameterStringList("xml");
     
-    for (std::vector<std::string>::iterator f = xmlFilenameList.begin() ; f != xmlFilenameList.end(); ++f)
+    //With a persistent state, the images removed from the list are dropped from it, and only the analysis
+    //files that are new or rewritten since are read
+    const bool persistent = IsParameterEnabled("state") && HasValue("state");
+    otb::StrategyState state;
+    std::vector<std::string> readFilenameList = xmlFilenameList;
+    std::vector<std::string> stamps;
+    if(persistent)
     {
-      std::cout << *f << std::endl;
-      
-      TiXmlDocument doc(f->c_str());
-      if(!doc.LoadFile())
+      if(IsParameterEnabled("outquantiles") && HasValue("outquantiles"))
       {
-        std::cout << "le DOC n'existe pas" << std::endl;
+        itkExceptionMacro(<< "The quantile sketches are not kept in the state, the percentiles need all the analysis files");
       }
-      TiXmlElement *elem = doc.FirstChildElement()->FirstChildElement();
-      if(!elem)
+      if(itksys::SystemTools::FileExists(GetParameterString("state").c_str()))
       {
-        std::cout << "le elem n'existe pas" << std::endl;
+        state.Load(GetParameterString("state"));
+      }
+      
+      std::set<std::string> listed(xmlFilenameList.begin(), xmlFilenameList.end());
+      std::vector<std::string> names = state.GetImageNames();
+      for(std::vector<std::string>::iterator name = names.begin(); name != names.end(); ++name)
+      {
+        if(listed.count(*name) == 0)
+        {
+          state.RemoveImage(*name);
+          otbAppLogINFO(<< *name << " removed from the state" << std::endl);
+        }
       }
-
-      for(TiXmlElement* sample = elem->FirstChildElement("Class"); sample != NULL; sample = sample->NextSiblingElement())
-      {
-        // Get the current value of the statistic vector
-        int name, value;
-        sample->QueryIntAttribute("name", &name);
-        sample->QueryIntAttribute("value", &value);
-        elmtsInClassGlobal[name] += value;
-        elmtsInClass[imageCount][name] = value;
-      }   
       
-      imageCount++;
+      readFilenameList.clear();
+      for(std::vector<std::string>::iterator filename = xmlFilenameList.begin(); filename != xmlFilenameList.end(); ++filename)
+      {
+        std::string stamp = otb::AnalysisFileStamp(*filename);
+        if(!state.IsCurrent(*filename, stamp))
+        {
+          readFilenameList.push_back(*filename);
+          stamps.push_back(stamp);
+        }
+      }
+      otbAppLogINFO(<< readFilenameList.size() << " analysis files read, " << xmlFilenameList.size() - readFilenameList.size()
+                    << " kept from the state" << std::endl);
     }
-        
-    for(std::map<int, std::map<int, int> >::iterator iImage = elmtsInClass.begin(); iImage != elmtsInClass.end(); ++iImage)
+    
+    //Only the class table of each analysis file is read, in parallel
+    ReadTask task;
+    task.filenames = &readFilenameList;
+    task.keepImageStatistics = samplingStrategy == "neyman" || persistent;
+    task.imageCounts.resize(readFilenameList.size());
+    if(task.keepImageStatistics)
+    {
+      task.imageStatistics.resize(readFilenameList.size());
+    }
+    
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    unsigned int nbThreads = std::max(1u, std::min(static_cast<unsigned int>(readFilenameList.size()),
+                                                   static_cast<unsigned int>(threader->GetNumberOfThreads())));
+    threader->SetNumberOfThreads(nbThreads);
+    task.partialTotals.resize(nbThreads);
+    task.partialStatistics.resize(nbThreads);
+    task.partialSketches.resize(nbThreads);
+    task.errors.resize(nbThreads);
+    threader->SetSingleMethod(ReadClassCountsThread, &task);
+    threader->SingleMethodExecute();
+    
+    for(unsigned int t = 0; t < nbThreads; ++t)
+    {
+      if(!task.errors[t].empty())
+      {
+        itkExceptionMacro(<< task.errors[t]);
+      }
+    }
+    
+    //Tree reduction of the per-thread totals, statistics and sketches
+    for(unsigned int stride = 1; stride < nbThreads; stride *= 2)
     {
-      for(std::map<int, int>::iterator iClass = (*iImage).second.begin(); iClass != (*iImage).second.end(); ++iClass)
+      for(unsigned int t = 0; t + stride < nbThreads; t += 2*stride)
       {
-        if (samplingStrategy == "equally")
+        ClassCountMap& partial = task.partialTotals[t + stride];
+        for(ClassCountMap::const_iterator iClass = partial.begin(); iClass != partial.end(); ++iClass)
         {
-          nbSamples[(*iImage).first][(*iClass).first] = GetParameterInt("samples");
-          if(nbSamples[(*iImage).first][(*iClass).first] > (*iClass).second)
-          {
-            nbSamples[(*iImage).first][(*iClass).first] = (*iClass).second;
-          }
+          task.partialTotals[t][iClass->first] += iClass->second;
         }
+        partial.clear();
         
-        else if (samplingStrategy == "proportional")
+        ClassStatisticsMap& partialStatistics = task.partialStatistics[t + stride];
+        for(ClassStatisticsMap::const_iterator iClass = partialStatistics.begin(); iClass != partialStatistics.end(); ++iClass)
         {
-          
-          std::cout << "coef " << static_cast<float>((*iClass).second) / static_cast<float>(elmtsInClassGlobal[(*iClass).first]) << std::endl;
-          nbSamples[(*iImage).first][(*iClass).first] = GetParameterInt("samples") * static_cast<float>((*iClass).second) / static_cast<float>(elmtsInClassGlobal[(*iClass).first]);
-          
-          if(nbSamples[(*iImage).first][(*iClass).first] > (*iClass).second)
+          task.partialStatistics[t][iClass->first].Merge(iClass->second);
+        }
+        partialStatistics.clear();
+        
+        otb::MergeClassQuantileSketches(task.partialSketches[t], task.partialSketches[t + stride]);
+        task.partialSketches[t + stride].clear();
+      }
+    }
+    
+    //Counts of all the images of the list from the state, updated with the files read
+    if(persistent)
+    {
+      for(unsigned long k = 0; k < readFilenameList.size(); ++k)
+      {
+        state.AddImage(readFilenameList[k], stamps[k], task.imageCounts[k], task.imageStatistics[k]);
+      }
+      task.imageCounts.assign(xmlFilenameList.size(), ClassCountMap());
+      task.imageStatistics.assign(xmlFilenameList.size(), ClassStatisticsMap());
+      for(unsigned long i = 0; i < xmlFilenameList.size(); ++i)
+      {
+        const otb::StrategyState::ImageEntry* entry = state.FindImage(xmlFilenameList[i]);
+        task.imageCounts[i] = entry->counts;
+        task.imageStatistics[i] = entry->statistics;
+      }
+      task.partialTotals[0] = state.GetTotals();
+      task.partialStatistics[0] = state.MergeClassStatistics();
+    }
+    const ClassCountMap& elmtsInClassGlobal = task.partialTotals[0];
+    
+    //Band statistics of all the classes of all the images, for the feature normalization
+    if(IsParameterEnabled("outstats") && HasValue("outstats"))
+    {
+      const ClassStatisticsMap& classStatistics = task.partialStatistics[0];
+      if(classStatistics.empty())
+      {
+        itkExceptionMacro(<< "The analysis files have no band statistics");
+      }
+      otb::BandStatistics globalStatistics;
+      for(ClassStatisticsMap::const_iterator iClass = classStatistics.begin(); iClass != classStatistics.end(); ++iClass)
+      {
+        globalStatistics.Merge(iClass->second);
+      }
+      otb::WriteBandStatisticsXML(GetParameterString("outstats"), globalStatistics);
+    }
+    
+    //Percentiles of the bands of each class, over all the images
+    if(IsParameterEnabled("outquantiles") && HasValue("outquantiles"))
+    {
+      const otb::ClassQuantileSketchMap& classSketches = task.partialSketches[0];
+      if(classSketches.empty())
+      {
+        itkExceptionMacro(<< "The analysis files have no quantile sketches");
+      }
+      
+      std::vector<double> percentiles;
+      if(HasValue("quantiles"))
+      {
+        std::vector<std::string> levels = GetParameterStringList("quantiles");
+        for(std::vector<std::string>::iterator level = levels.begin(); level != levels.end(); ++level)
+        {
+          percentiles.push_back(atof(level->c_str()));
+        }
+      }
+      else
+      {
+        double defaultPercentiles[] = {2, 25, 50, 75, 98};
+        percentiles.assign(defaultPercentiles, defaultPercentiles + 5);
+      }
+      
+      std::ofstream quantilesFile(GetParameterString("outquantiles").c_str());
+      quantilesFile << "<?xml version=\"1.0\" ?>" << std::endl;
+      quantilesFile << "<Quantiles>" << std::endl;
+      for(otb::ClassQuantileSketchMap::const_iterator iClass = classSketches.begin(); iClass != classSketches.end(); ++iClass)
+      {
+        quantilesFile << "    <Class name=\"" << iClass->first << "\">" << std::endl;
+        for(unsigned int b = 0; b < iClass->second.size(); ++b)
+        {
+          quantilesFile << "        <Band index=\"" << b+1 << "\">" << std::endl;
+          for(std::vector<double>::iterator level = percentiles.begin(); level != percentiles.end(); ++level)
           {
-            nbSamples[(*iImage).first][(*iClass).first] = (*iClass).second;
+            quantilesFile << "            <Quantile percent=\"" << *level << "\" value=\"" << iClass->second[b].GetQuantile(*level / 100.) << "\" />" << std::endl;
           }
-        } 
-      }        
-    }   
+          quantilesFile << "        </Band>" << std::endl;
+        }
+        quantilesFile << "    </Class>" << std::endl;
+      }
+      quantilesFile << "</Quantiles>" << std::endl;
+    }
+    
+    otbAppLogINFO(<< xmlFilenameList.size() << " analysis files, " << elmtsInClassGlobal.size() << " classes" << std::endl);
     
-    TiXmlDocument docGlobal;
-    TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "", "");
-    docGlobal.LinkEndChild(decl);
+    //The strategy is written image by image
+    std::vector<std::map<int, int> > imageSamples;
+    if(samplingStrategy == "cost")
+    {
+      if(GetParameterFloat("strategy.cost.spread") < 0 || GetParameterFloat("strategy.cost.spread") > 1)
+      {
+        itkExceptionMacro(<< "The spread of the samples must be between 0 and 1");
+      }
+      std::vector<std::map<int, double> > sampleCosts = EstimateSampleCosts(task.imageCounts);
+      imageSamples = otb::ComputeCostAwareStrategy(GetParameterInt("samples"), task.imageCounts, elmtsInClassGlobal,
+                                                   sampleCosts, GetParameterFloat("strategy.cost.spread"));
       
-    TiXmlElement * root = new TiXmlElement("StrategyGlobal");
-    docGlobal.LinkEndChild(root);     
+      std::vector<std::map<int, int> > proportional = otb::ComputeSamplingStrategy("proportional", GetParameterInt("samples"),
+                                                                                   task.imageCounts, elmtsInClassGlobal);
+      otbAppLogINFO(<< "Estimated read cost with the quota sampling mode : " << otb::ComputeStrategyReadCost(imageSamples, sampleCosts) / (1024*1024)
+                    << " MB, " << otb::ComputeStrategyReadCost(proportional, sampleCosts) / (1024*1024)
+                    << " MB with the proportional strategy; the other sampling modes read all the windows" << std::endl);
+    }
+    else if(samplingStrategy == "neyman")
+    {
+      if(task.partialStatistics[0].empty())
+      {
+        itkExceptionMacro(<< "The Neyman strategy needs the band statistics of the analysis files");
+      }
+      imageSamples = otb::ComputeNeymanStrategy(GetParameterInt("samples"), task.imageCounts, elmtsInClassGlobal,
+                                                task.imageStatistics, task.partialStatistics[0]);
+    }
+    else
+    {
+      imageSamples = otb::ComputeSamplingStrategy(samplingStrategy, GetParameterInt("samples"), task.imageCounts, elmtsInClassGlobal);
+    }
     
-    for(std::map<int, std::map<int, int> >::iterator iImage = nbSamples.begin(); iImage != nbSamples.end(); ++iImage)
+    //Images whose quotas moved beyond the tolerance get the new ones and are to be sampled again, the others
+    //keep the quotas of their samples
+    if(persistent)
     {
-      TiXmlElement * featureImage = new TiXmlElement("Image");
-      featureImage->SetDoubleAttribute("name", (*iImage).first+1);
-      root->LinkEndChild(featureImage); 
-      for(std::map<int, int>::iterator iClass = (*iImage).second.begin(); iClass != (*iImage).second.end(); ++iClass)
-      {
-        TiXmlElement * featureClass = new TiXmlElement("Class");
-        featureClass->SetDoubleAttribute("name", (*iClass).first);
-        featureClass->SetAttribute("value", (*iClass).second);
-        featureImage->LinkEndChild(featureClass);
-      }            
+      std::ostringstream changed;
+      unsigned long nbChanged = 0;
+      for(unsigned long i = 0; i < xmlFilenameList.size(); ++i)
+      {
+        const otb::StrategyState::ImageEntry* entry = state.FindImage(xmlFilenameList[i]);
+        if(entry->hasQuotas && !otb::QuotasMoved(entry->quotas, imageSamples[i], GetParameterFloat("tolerance")))
+        {
+          imageSamples[i] = entry->quotas;
+          continue;
+        }
+        state.SetQuotas(xmlFilenameList[i], imageSamples[i]);
+        changed << i+1 << " " << xmlFilenameList[i] << std::endl;
+        ++nbChanged;
+      }
+      otbAppLogINFO(<< nbChanged << " images with new quotas, to be sampled again" << std::endl);
+      
+      if(IsParameterEnabled("outchanged") && HasValue("outchanged"))
+      {
+        std::ofstream changedFile(GetParameterString("outchanged").c_str());
+        changedFile << changed.str();
+      }
+      state.Save(GetParameterString("state"));
     }
+    otb::WriteSamplingStrategyXML(GetParameterString("out"), imageSamples);
+  }
+  
+  //Cost of a sample of each class of each image, from the windows touched by the features of the class
+  //over the image and the bytes of a window. Only the image headers are read.
+  std::vector<std::map<int, double> > EstimateSampleCosts(const std::vector<ClassCountMap>& imageCounts)
+  {
+    std::vector<std::string> imageFilenameList = GetParameterStringList("strategy.cost.il");
+    if(imageFilenameList.size() != imageCounts.size())
+    {
+      itkExceptionMacro(<< "One image per analysis file is needed, " << imageFilenameList.size() << " given for "
+                        << imageCounts.size() << " analysis files");
+    }
+    const std::string classField = GetParameterString("strategy.cost.cfield");
+    unsigned long sizeTiles = GetParameterInt("strategy.cost.tiles");
+    
+    otb::ogr::DataSource::Pointer vectorData = otb::ogr::DataSource::New(GetParameterString("strategy.cost.shp").c_str(), otb::ogr::DataSource::Modes::Read);
+    otb::ogr::Layer layer = vectorData->GetLayer(0);
     
-    docGlobal.SaveFile(GetParameterString("out").c_str());
-         
-  }    
+    std::vector<std::map<int, double> > sampleCosts(imageFilenameList.size());
+    for(unsigned long i = 0; i < imageFilenameList.size(); ++i)
+    {
+      typedef otb::ImageFileReader<FloatVectorImageType> ReaderType;
+      ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(imageFilenameList[i]);
+      FloatVectorImageType::Pointer image = reader->GetOutput();
+      image->UpdateOutputInformation();
+      
+      std::map<int, unsigned long> classWindows = otb::CountClassWindows(image.GetPointer(), layer, classField, sizeTiles);
+      sampleCosts[i] = otb::ComputeClassSampleCosts(classWindows, imageCounts[i], otb::EstimateWindowMemory(imageFilenameList[i], sizeTiles));
+    }
+    return sampleCosts;
+  }
 };
 }
 }
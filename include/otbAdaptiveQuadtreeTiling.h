@@ -0,0 +1,169 @@
+#ifndef __otbAdaptiveQuadtreeTiling__
+#define __otbAdaptiveQuadtreeTiling__
+
+#include <vector>
+#include "otbSamplingWindow.h"
+#include "otbOGRDataSourceWrapper.h"
+
+namespace otb
+{
+
+// Adaptive tiling of an image driven by the density of the feature envelopes.
+// A tile costs a fixed overhead (extraction, spatial filter query) plus one
+// point-in-polygon test per pixel and candidate feature. The image is split
+// as a quadtree: a cell is kept as a tile when it is cheaper than the best
+// tiling of its four children, so dense areas get small tiles and sparse areas
+// large ones. Cells without any candidate feature are dropped.
+class AdaptiveQuadtreeTiling
+{
+public:
+  typedef itk::ImageRegion<2> RegionType;
+
+  AdaptiveQuadtreeTiling() :
+    m_MinimumSize(50),
+    m_MaximumSize(1000),
+    m_TileOverhead(1e5),
+    m_LineBuffer(0)
+  {
+  }
+
+  // Tiles are never split below this side
+  void SetMinimumSize(unsigned long size)
+  {
+    m_MinimumSize = size;
+  }
+
+  // Tiles are always split above this side, to bound the tile buffer
+  void SetMaximumSize(unsigned long size)
+  {
+    m_MaximumSize = size;
+  }
+
+  // Fixed cost of a tile, expressed in pixel x feature tests
+  void SetTileOverhead(double overhead)
+  {
+    m_TileOverhead = overhead;
+  }
+
+  // Line strings are processed as buffers of this width (map units)
+  void SetLineBuffer(double lineBuffer)
+  {
+    m_LineBuffer = lineBuffer;
+  }
+
+  // Register a feature with its bounding region in image index space
+  void AddFeature(const RegionType& region)
+  {
+    m_Regions.push_back(region);
+  }
+
+  // Scan the layer once over the image extent and register every feature
+  // whose envelope intersects the image
+  template <class TImage>
+  void AddLayer(const TImage* image, otb::ogr::Layer& layer)
+  {
+    std::vector<long> fids;
+    ScanLayerEnvelopes(image, layer, m_LineBuffer, fids, m_Regions);
+  }
+
+  // Build the tiles covering the features of the image region, in quadtree order
+  SamplingWindowList GenerateWindows(const RegionType& imageRegion)
+  {
+    std::vector<unsigned long> candidates;
+    for(unsigned long i = 0; i < m_Regions.size(); ++i)
+    {
+      RegionType region = m_Regions[i];
+      if(region.Crop(imageRegion))
+      {
+        candidates.push_back(i);
+      }
+    }
+
+    SamplingWindowList windows;
+    Build(imageRegion, candidates, windows);
+    return windows;
+  }
+
+private:
+  // Best tiling of a cell, appended to windows; returns its cost
+  double Build(const RegionType& cell, const std::vector<unsigned long>& candidates, SamplingWindowList& windows)
+  {
+    if(candidates.empty())
+    {
+      return 0;
+    }
+
+    double leafCost = m_TileOverhead + static_cast<double>(candidates.size()) * cell.GetNumberOfPixels();
+
+    bool splitX = cell.GetSize()[0] > m_MinimumSize;
+    bool splitY = cell.GetSize()[1] > m_MinimumSize;
+    bool mustSplit = cell.GetSize()[0] > m_MaximumSize || cell.GetSize()[1] > m_MaximumSize;
+
+    if(!splitX && !splitY)
+    {
+      SamplingWindow leaf;
+      leaf.region = cell;
+      windows.push_back(leaf);
+      return leafCost;
+    }
+
+    // Children of the cell, split in halves along the dimensions above the minimum size
+    std::vector<RegionType> children;
+    unsigned long halfX = splitX ? cell.GetSize()[0]/2 : cell.GetSize()[0];
+    unsigned long halfY = splitY ? cell.GetSize()[1]/2 : cell.GetSize()[1];
+    for(unsigned int j = 0; j < (splitY ? 2u : 1u); ++j)
+    {
+      for(unsigned int i = 0; i < (splitX ? 2u : 1u); ++i)
+      {
+        RegionType::IndexType start = cell.GetIndex();
+        RegionType::SizeType size;
+        start[0] += i*halfX;
+        start[1] += j*halfY;
+        size[0] = (i == 0 ? halfX : cell.GetSize()[0] - halfX);
+        size[1] = (j == 0 ? halfY : cell.GetSize()[1] - halfY);
+        RegionType child;
+        child.SetIndex(start);
+        child.SetSize(size);
+        children.push_back(child);
+      }
+    }
+
+    SamplingWindowList childWindows;
+    double childCost = 0;
+    for(std::vector<RegionType>::const_iterator child = children.begin(); child != children.end(); ++child)
+    {
+      std::vector<unsigned long> childCandidates;
+      for(std::vector<unsigned long>::const_iterator c = candidates.begin(); c != candidates.end(); ++c)
+      {
+        RegionType region = m_Regions[*c];
+        if(region.Crop(*child))
+        {
+          childCandidates.push_back(*c);
+        }
+      }
+      childCost += Build(*child, childCandidates, childWindows);
+    }
+
+    if(mustSplit || childCost < leafCost)
+    {
+      windows.insert(windows.end(), childWindows.begin(), childWindows.end());
+      return childCost;
+    }
+
+    // Merge: the cell is cheaper as a single tile
+    SamplingWindow leaf;
+    leaf.region = cell;
+    windows.push_back(leaf);
+    return leafCost;
+  }
+
+  unsigned long m_MinimumSize;
+  unsigned long m_MaximumSize;
+  double m_TileOverhead;
+  double m_LineBuffer;
+  std::vector<RegionType> m_Regions;
+};
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef __otbBandStatistics__
+#define __otbBandStatistics__
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "itkIntTypes.h"
+#include "itkVariableLengthVector.h"
+#include "otbStatisticsXMLFileWriter.h"
+
+namespace otb
+{
+
+// Running statistics of the bands of a set of pixels: count, mean, sum of
+// squared deviations (M2), minimum and maximum. Pixels are added with
+// Welford's update, and two accumulators over disjoint sets of pixels (tiles,
+// threads, images) are merged with Chan's pairwise formula, so the result does
+// not depend on how the pixels were split.
+class BandStatistics
+{
+public:
+  BandStatistics() : m_Count(0) {}
+
+  explicit BandStatistics(unsigned int nbBands) : m_Count(0)
+  {
+    Reset(nbBands);
+  }
+
+  void Reset(unsigned int nbBands)
+  {
+    m_Count = 0;
+    m_Mean.assign(nbBands, 0.);
+    m_M2.assign(nbBands, 0.);
+    m_Min.assign(nbBands, std::numeric_limits<double>::max());
+    m_Max.assign(nbBands, -std::numeric_limits<double>::max());
+  }
+
+  // Add one pixel, of any type with operator[] over the bands
+  template <class TPixel>
+  void Add(const TPixel& pixel)
+  {
+    ++m_Count;
+    for(unsigned int b = 0; b < m_Mean.size(); ++b)
+    {
+      double value = static_cast<double>(pixel[b]);
+      double delta = value - m_Mean[b];
+      m_Mean[b] += delta / m_Count;
+      m_M2[b] += delta * (value - m_Mean[b]);
+      m_Min[b] = std::min(m_Min[b], value);
+      m_Max[b] = std::max(m_Max[b], value);
+    }
+  }
+
+  // Merge the statistics of another set of pixels
+  void Merge(const BandStatistics& other)
+  {
+    if(m_Count == 0)
+    {
+      *this = other;
+      return;
+    }
+    if(other.m_Count == 0)
+    {
+      return;
+    }
+
+    double count = static_cast<double>(m_Count + other.m_Count);
+    for(unsigned int b = 0; b < m_Mean.size(); ++b)
+    {
+      double delta = other.m_Mean[b] - m_Mean[b];
+      m_Mean[b] += delta * other.m_Count / count;
+      m_M2[b] += other.m_M2[b] + delta * delta * m_Count * other.m_Count / count;
+      m_Min[b] = std::min(m_Min[b], other.m_Min[b]);
+      m_Max[b] = std::max(m_Max[b], other.m_Max[b]);
+    }
+    m_Count += other.m_Count;
+  }
+
+  // Set the statistics from stored values
+  void Set(itk::uint64_t count, unsigned int band, double mean, double m2, double min, double max)
+  {
+    m_Count = count;
+    m_Mean[band] = mean;
+    m_M2[band] = m2;
+    m_Min[band] = min;
+    m_Max[band] = max;
+  }
+
+  unsigned int GetNumberOfBands() const
+  {
+    return m_Mean.size();
+  }
+
+  itk::uint64_t GetCount() const
+  {
+    return m_Count;
+  }
+
+  double GetMean(unsigned int band) const
+  {
+    return m_Mean[band];
+  }
+
+  double GetM2(unsigned int band) const
+  {
+    return m_M2[band];
+  }
+
+  // Unbiased variance, 0 below two pixels
+  double GetVariance(unsigned int band) const
+  {
+    return m_Count > 1 ? m_M2[band] / (m_Count - 1) : 0.;
+  }
+
+  double GetMinimum(unsigned int band) const
+  {
+    return m_Min[band];
+  }
+
+  double GetMaximum(unsigned int band) const
+  {
+    return m_Max[band];
+  }
+
+private:
+  itk::uint64_t m_Count;
+  std::vector<double> m_Mean;
+  std::vector<double> m_M2;
+  std::vector<double> m_Min;
+  std::vector<double> m_Max;
+};
+
+// Write the statistics in the OTB statistics XML format (mean, stddev, min,
+// max), as read by the feature normalization of the classifiers
+inline void WriteBandStatisticsXML(const std::string& filename, const BandStatistics& statistics)
+{
+  typedef itk::VariableLengthVector<double>             MeasurementType;
+  typedef otb::StatisticsXMLFileWriter<MeasurementType> StatisticsWriterType;
+
+  unsigned int nbBands = statistics.GetNumberOfBands();
+  MeasurementType mean(nbBands), stddev(nbBands), min(nbBands), max(nbBands);
+  for(unsigned int b = 0; b < nbBands; ++b)
+  {
+    mean[b] = statistics.GetMean(b);
+    stddev[b] = std::sqrt(statistics.GetVariance(b));
+    min[b] = statistics.GetMinimum(b);
+    max[b] = statistics.GetMaximum(b);
+  }
+
+  StatisticsWriterType::Pointer writer = StatisticsWriterType::New();
+  writer->SetFileName(filename);
+  writer->AddInput("mean", mean);
+  writer->AddInput("stddev", stddev);
+  writer->AddInput("min", min);
+  writer->AddInput("max", max);
+  writer->Update();
+}
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef __otbImageAnalysis__
+#define __otbImageAnalysis__
+
+#include <map>
+#include <vector>
+#include <string>
+#include "itkMacro.h"
+#include "itkImageRegionIterator.h"
+#include "ogr_geometry.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbBandStatistics.h"
+#include "otbSamplingWindow.h"
+#include "otbOverlapMask.h"
+#include "otbQuantileSketch.h"
+#include "otbSubsampleEstimate.h"
+
+namespace otb
+{
+
+// Pixel counts and band statistics of the polygons and classes of an image,
+// accumulated window after window, as written to an analysis file. It is a
+// plain value: analyses of several images can be stored and copied freely.
+struct ImageAnalysis
+{
+  // Number of pixels in each class and in each polygon
+  std::map<int, int> classCounts;
+  std::map<unsigned long, int> polygonCounts;
+
+  // Band statistics of the pixels of each class and of each polygon
+  std::map<int, BandStatistics> classStatistics;
+  std::map<unsigned long, BandStatistics> polygonStatistics;
+
+  // Quantile sketches of the bands of each class, of parameter sketchSize
+  ClassQuantileSketchMap classSketches;
+  unsigned int sketchSize;
+
+  // Number of pixels in all the polygons
+  int nbPixels;
+
+  ImageAnalysis() : sketchSize(200), nbPixels(0) {}
+
+  // Add the analysis of another image; a polygon over both images gets the
+  // pixels of both
+  void Merge(const ImageAnalysis& other)
+  {
+    for(std::map<int, int>::const_iterator it = other.classCounts.begin(); it != other.classCounts.end(); ++it)
+    {
+      classCounts[it->first] += it->second;
+    }
+    for(std::map<unsigned long, int>::const_iterator it = other.polygonCounts.begin(); it != other.polygonCounts.end(); ++it)
+    {
+      polygonCounts[it->first] += it->second;
+    }
+    for(std::map<int, BandStatistics>::const_iterator it = other.classStatistics.begin(); it != other.classStatistics.end(); ++it)
+    {
+      classStatistics[it->first].Merge(it->second);
+    }
+    for(std::map<unsigned long, BandStatistics>::const_iterator it = other.polygonStatistics.begin(); it != other.polygonStatistics.end(); ++it)
+    {
+      polygonStatistics[it->first].Merge(it->second);
+    }
+    MergeClassQuantileSketches(classSketches, other.classSketches);
+    nbPixels += other.nbPixels;
+  }
+};
+
+// Scale the pixel counts of an analysis made over a fraction of the pixels
+// (approximate modes) to the whole image
+inline void ScaleImageAnalysis(ImageAnalysis& analysis, double fraction)
+{
+  for(std::map<int, int>::iterator iClass = analysis.classCounts.begin(); iClass != analysis.classCounts.end(); ++iClass)
+  {
+    iClass->second = static_cast<int>(EstimateTotal(iClass->second, fraction) + 0.5);
+  }
+  for(std::map<unsigned long, int>::iterator iPolygon = analysis.polygonCounts.begin(); iPolygon != analysis.polygonCounts.end(); ++iPolygon)
+  {
+    iPolygon->second = static_cast<int>(EstimateTotal(iPolygon->second, fraction) + 0.5);
+  }
+  analysis.nbPixels = static_cast<int>(EstimateTotal(analysis.nbPixels, fraction) + 0.5);
+}
+
+// Count the pixels of the features processed in a read window, and add their
+// bands to the statistics. The tile is the extracted window, the features
+// those of GetWindowFeatures; line strings are processed as 3 map units
+// buffers. The pixels in the overlap mask, if any, belong to another image and
+// are skipped.
+template <class TImage>
+void AnalyzeWindow(const TImage* image, TImage* tile, const SamplingWindow& window,
+                   std::vector<otb::ogr::Feature>& features, const std::string& classField,
+                   int noDataValue, ImageAnalysis& analysis, const OverlapMask* overlap = NULL)
+{
+  typedef itk::ImageRegionIterator<TImage> IteratorType;
+  unsigned int nbComponents = image->GetNumberOfComponentsPerPixel();
+
+  //Loop across the features in the layer
+  for(std::vector<otb::ogr::Feature>::iterator featIt = features.begin(); featIt != features.end(); ++featIt)
+  {
+    OGRGeometry * geom = featIt->ogr().GetGeometryRef();
+
+    //A feature without geometry has no pixels, the next ones still have
+    if(!geom)
+    {
+      itkGenericOutputMacro(<< "The feature " << featIt->ogr().GetFID() << " has no geometry, it is skipped");
+      continue;
+    }
+
+    bool testPoly = false;
+    OGRGeometry * buffer = NULL;
+    if(geom->getGeometryType() == wkbLineString)
+    {
+      buffer = geom->Buffer(3);
+      geom = buffer;
+    }
+
+    if(geom->getGeometryType() == wkbPolygon25D || geom->getGeometryType() == wkbPolygon)
+    {
+      testPoly = true;
+    }
+
+    //Region of the window over which the feature is processed
+    typename TImage::RegionType featureRegion;
+    if(!testPoly || !otb::GeometryRegionInWindow(image, geom, window, featureRegion))
+    {
+      if(buffer)
+      {
+        OGRGeometryFactory::destroyGeometry(buffer);
+      }
+      continue;
+    }
+
+    //We are dealing with simple polygons
+    OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);
+    OGRLinearRing * exteriorRing = inPolygon->getExteriorRing();
+    IteratorType it(tile, featureRegion);
+
+    //Class name recuperation
+    int className = featIt->ogr().GetFieldAsInteger(classField.c_str());
+
+    //Number of pixels in a polygon, and statistics of their bands
+    int nbOfPixelsInGeom = 0;
+    otb::BandStatistics geomStatistics(nbComponents);
+
+    //Loop across pixels in the tile
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+      itk::Point<double, 2> point;
+      tile->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+
+      //Pixel of an overlap analyzed with another image
+      if(overlap && overlap->Contains(point[0], point[1]))
+      {
+        continue;
+      }
+
+      //Access to the pixel value
+      typename TImage::PixelType pixelValue = it.Get();
+
+      //Tranformation in OGRPoint in order to know if it's in the geometry
+      OGRPoint pointOGR;
+      pointOGR.setX(point[0]);
+      pointOGR.setY(point[1]);
+
+      //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
+      bool noDataTest = false;
+      for (unsigned int i=0; i<nbComponents; i++)
+      {
+        if(pixelValue[i] == noDataValue)
+        {
+          noDataTest = true;
+        }
+      }
+
+      //Test if the current pixel is in a polygon hole
+      bool isNotInHole = true;
+      for (int i=0; i < inPolygon->getNumInteriorRings(); ++i)
+      {
+        if(inPolygon->getInteriorRing(i) != NULL)
+        {
+          OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
+          if(interiorRing->isPointInRing(&pointOGR, TRUE))
+          {
+            isNotInHole = false;
+          }
+        }
+      }
+
+      //If the pixel is not "No-Data" and is in the geometry, them we count it
+      if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole)
+      {
+        nbOfPixelsInGeom++;
+        analysis.nbPixels++;
+        geomStatistics.Add(pixelValue);
+        std::vector<QuantileSketch>& sketches = analysis.classSketches[className];
+        if(sketches.empty())
+        {
+          sketches.resize(nbComponents, QuantileSketch(analysis.sketchSize));
+        }
+        for(unsigned int b = 0; b < nbComponents; ++b)
+        {
+          sketches[b].Add(static_cast<double>(pixelValue[b]));
+        }
+      }
+    }
+
+    //Counters update, number of pixel in each classes and in each polygones
+    analysis.polygonCounts[featIt->ogr().GetFID()] += nbOfPixelsInGeom;
+    analysis.polygonStatistics[featIt->ogr().GetFID()].Merge(geomStatistics);
+    analysis.classStatistics[className].Merge(geomStatistics);
+    analysis.classCounts[className] += nbOfPixelsInGeom;
+
+    if(buffer)
+    {
+      OGRGeometryFactory::destroyGeometry(buffer);
+    }
+  }
+}
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,542 @@
+#ifndef __otbImageSampler__
+#define __otbImageSampler__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include "itksys/SystemTools.hxx"
+#include "itkMacro.h"
+#include "itkImageRegionIterator.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "ogr_geometry.h"
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbSamplingWindow.h"
+#include "otbSamplingImageIO.h"
+#include "otbPolygonStatisticsFile.h"
+#include "otbQuotaSampler.h"
+#include "otbOverlapMask.h"
+
+namespace otb
+{
+
+// Layer of the sampled pixels, as points with the values of the bands then
+// the fields of the sampled features (those of sourceDefn)
+inline otb::ogr::Layer CreateSamplesLayer(otb::ogr::DataSource* dataSource, const std::string& filename,
+                                          OGRSpatialReference* srs, const std::vector<unsigned int>& bands,
+                                          unsigned int nbComponents, OGRFeatureDefn& sourceDefn)
+{
+  std::vector<std::string> options;
+  std::string layername = itksys::SystemTools::GetFilenameName(filename.c_str());
+  std::string extension = itksys::SystemTools::GetFilenameLastExtension(filename.c_str());
+  layername = layername.substr(0,layername.size()-(extension.size()));
+  otb::ogr::Layer layer = dataSource->CreateLayer(layername, srs, wkbPoint, options);
+
+  for(unsigned int comp = 0; comp<nbComponents; ++comp)
+  {
+    OGRFieldDefn field(otb::BandFieldName(bands, comp).c_str(), OFTReal);
+    layer.CreateField(field, true);
+  }
+
+  for(int comp = 0; comp < sourceDefn.GetFieldCount(); ++comp)
+  {
+    OGRFieldDefn field(sourceDefn.GetFieldDefn(comp)->GetNameRef(), sourceDefn.GetFieldDefn(comp)->GetType());
+    layer.CreateField(field, true);
+  }
+  return layer;
+}
+
+// Sampling of the pixels of the polygons of an image, window after window,
+// from the pixel counts of its analysis and the number of samples of each
+// class given by the strategy. The sampled pixels are written to a text file
+// (class then index:value of the bands) and to a point layer.
+template <class TImage>
+class ImageSampler
+{
+public:
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+
+  ImageSampler() :
+    m_NoDataValue(0),
+    m_NbPixelsGlobal(0),
+    m_Analysis(NULL),
+    m_File(NULL),
+    m_Layer(NULL, false),
+    m_PolyForced(0),
+    m_NextFID(0),
+    m_Overlap(NULL)
+  {
+  }
+
+  // Mode of sampling : exhaustive, random, randomequally, periodic,
+  // periodicrandom or quota
+  void SetMode(const std::string& mode)
+  {
+    m_Mode = mode;
+  }
+
+  const std::string& GetMode() const
+  {
+    return m_Mode;
+  }
+
+  void SetClassField(const std::string& classField)
+  {
+    m_ClassField = classField;
+  }
+
+  void SetNoDataValue(int noDataValue)
+  {
+    m_NoDataValue = noDataValue;
+  }
+
+  // Seeded generator, used in the order of the windows
+  void SetGenerator(GeneratorType* generator)
+  {
+    m_Generator = generator;
+  }
+
+  // Pixels belonging to other images of the list, which are not sampled
+  // (kept by the caller); they must be those skipped by the analysis
+  void SetOverlapMask(const OverlapMask* overlap)
+  {
+    m_Overlap = overlap;
+  }
+
+  // Outputs of the sampled pixels, the layer from CreateSamplesLayer
+  void SetOutputs(std::ostream* file, otb::ogr::Layer layer)
+  {
+    m_File = file;
+    m_Layer = layer;
+  }
+
+  // Analysis of the image (kept open by the caller) and number of samples of
+  // each class. The random positions of the polygons where only one pixel is
+  // needed are drawn here, in the order of the analysis.
+  void SetAnalysis(const PolygonStatisticsFile* analysis, const std::map<int, int>& nbSamples)
+  {
+    m_Analysis = analysis;
+    m_NbSamples = nbSamples;
+
+    m_ElmtsInClass.clear();
+    m_NbPixelsGlobal = 0;
+    const PolygonStatisticsFile::ClassCountMap& classCounts = analysis->GetClassCounts();
+    for(PolygonStatisticsFile::ClassCountMap::const_iterator iClass = classCounts.begin(); iClass != classCounts.end(); ++iClass)
+    {
+      m_ElmtsInClass[static_cast<int>(iClass->first)] = static_cast<int>(iClass->second);
+      m_NbPixelsGlobal += static_cast<int>(iClass->second);
+    }
+
+    m_RandomPositionInPolygon.resize(analysis->GetNumberOfPolygons());
+    for(unsigned long i = 0; i < analysis->GetNumberOfPolygons(); ++i)
+    {
+      m_RandomPositionInPolygon[i] = static_cast<int>(m_Generator->GetUniformVariate(0, analysis->GetPolygonCount(i)));
+    }
+
+    //Quota mode : selection sampling of each class
+    m_QuotaSampler = QuotaSampler();
+    for(std::map<int, int>::iterator iClass = m_NbSamples.begin(); iClass != m_NbSamples.end(); ++iClass)
+    {
+      m_QuotaSampler.SetQuota(iClass->first, iClass->second, m_ElmtsInClass[iClass->first]);
+    }
+  }
+
+  // Quota mode : every class quota is met, the remaining windows need not be read
+  bool IsComplete() const
+  {
+    return m_Mode == "quota" && m_QuotaSampler.IsComplete();
+  }
+
+  // Quota mode : false when all the classes of the features of a window are complete
+  bool IsWindowNeeded(std::vector<otb::ogr::Feature>& features) const
+  {
+    if(m_Mode != "quota")
+    {
+      return true;
+    }
+    for(std::vector<otb::ogr::Feature>::iterator featIt = features.begin(); featIt != features.end(); ++featIt)
+    {
+      if(!m_QuotaSampler.IsClassComplete(featIt->ogr().GetFieldAsInteger(m_ClassField.c_str())))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Sample the pixels of the features processed in a read window, the tile
+  // being the extracted window
+  void SampleWindow(const TImage* image, TImage* tile, const SamplingWindow& window,
+                    std::vector<otb::ogr::Feature>& features)
+  {
+    typedef itk::ImageRegionIterator<TImage> IteratorType;
+    unsigned int nbComponents = image->GetNumberOfComponentsPerPixel();
+
+    //Loop across the features in the layer
+    for(std::vector<otb::ogr::Feature>::iterator featIt = features.begin(); featIt!=features.end(); ++featIt)
+    {
+      OGRGeometry * geom = featIt->ogr().GetGeometryRef();
+      if(geom->getGeometryType() != wkbPolygon25D && geom->getGeometryType() != wkbPolygon
+         && geom->getGeometryType() != wkbLineString)
+      {
+        continue;
+      }
+
+      //Class name recuperation
+      int className = featIt->ogr().GetFieldAsInteger(m_ClassField.c_str());
+      if(m_Mode == "quota" && m_QuotaSampler.IsClassComplete(className))
+      {
+        continue;
+      }
+
+      //We are dealing with simple polygons
+      OGRPolygon * inPolygon = dynamic_cast<OGRPolygon *>(geom);
+      if(!inPolygon)
+      {
+        continue;
+      }
+      OGRLinearRing * exteriorRing = inPolygon->getExteriorRing();
+
+      //Region of the window over which the feature is processed
+      typename TImage::RegionType featureRegion;
+      if(!otb::GeometryRegionInWindow(image, geom, window, featureRegion))
+      {
+        continue;
+      }
+      IteratorType it(tile, featureRegion);
+
+      //Number of pixels in the polygon, from the analysis
+      const unsigned long fid = featIt->ogr().GetFID();
+      long polygonIndex = m_Analysis->FindPolygon(fid);
+      int nbPixelsInGeom = polygonIndex < 0 ? 0 : static_cast<int>(m_Analysis->GetPolygonCount(polygonIndex));
+      int randomPosition = polygonIndex < 0 ? 0 : m_RandomPositionInPolygon[polygonIndex];
+
+      //Compute the number of pixel we need to sample in each polygons
+      int nbPixelsInPolygon = m_ElmtsInClass[className] > 0 ?
+        static_cast<int>((m_NbSamples[className])*(nbPixelsInGeom)/(m_ElmtsInClass[className])) : 0;
+
+      //If this number is less then 1, we force it to be 1
+      if(nbPixelsInPolygon < 1)
+      {
+        nbPixelsInPolygon = 1;
+        m_PolyForced++;
+      }
+
+      //Compute of the period of sampling, every n-pixels we raise one
+      int periodOfSampling = std::max(1, static_cast<int>(nbPixelsInGeom/nbPixelsInPolygon));
+
+      //Shifted counter, to anticipate the position of the next raised pixel
+      m_CounterPixelsInPolygonShifted[fid] = m_CounterPixelsInPolygon[fid] + periodOfSampling;
+      //Position of the next pixel raised
+      int nextPixelRaisedPosition = periodOfSampling;
+
+      //Loop across pixels in the tile
+      for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+      {
+        itk::Point<double, 2> point;
+        tile->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+
+        //Pixel of an overlap sampled with another image
+        if(m_Overlap && m_Overlap->Contains(point[0], point[1]))
+        {
+          continue;
+        }
+
+        //Access to the pixel value
+        typename TImage::PixelType pixelValue = it.Get();
+
+        //Tranformation in OGRPoint in order to know if it's in the geometry
+        OGRPoint pointOGR;
+        pointOGR.setX(point[0]);
+        pointOGR.setY(point[1]);
+
+        //Test if the pixel is not a "No-Data-Pixel", with one of its elmts = 0
+        bool noDataTest = false;
+        for (unsigned int i=0; i<nbComponents; i++)
+        {
+          if(pixelValue[i] == m_NoDataValue)
+          {
+            noDataTest = true;
+          }
+        }
+
+        //Boolean variable, we sample the current pixel or not
+        bool resultTest = false;
+        if(nbPixelsInGeom != 0)
+        {
+          resultTest = SelectPixel(className, fid, nbPixelsInPolygon, randomPosition, periodOfSampling, nextPixelRaisedPosition);
+        }
+
+        //Test if the current pixel is in a polygon hole
+        bool isNotInHole = true;
+        for (int i=0; i != inPolygon->getNumInteriorRings(); ++i)
+        {
+          if(inPolygon->getInteriorRing(i) != NULL)
+          {
+            OGRLinearRing * interiorRing = inPolygon->getInteriorRing(i);
+            if(interiorRing->isPointInRing(&pointOGR, TRUE))
+            {
+              isNotInHole = false;
+            }
+          }
+        }
+
+        //If the pixel is not "No-Data" and is in the geometry, them we count it
+        if(!noDataTest && exteriorRing->isPointInRing(&pointOGR, TRUE) && isNotInHole)
+        {
+          //Quota mode : the pixel is selected among the pixels of its class not seen yet
+          if(m_Mode == "quota")
+          {
+            resultTest = m_QuotaSampler.Select(className, m_Generator->GetUniformVariate(0, 1));
+          }
+
+          if(resultTest)
+          {
+            WriteSample(className, pointOGR, pixelValue, nbComponents, *featIt);
+          }
+          //Incrementation of counters of pixels studied
+          m_CounterPixelsInPolygon[fid]++;
+          m_CounterPixelsInPolygonShifted[fid]++;
+        }
+      }
+    }
+  }
+
+  // Number of pixels sampled in each class
+  const std::map<int, int>& GetNumberOfPixelsRaised() const
+  {
+    return m_NbPixelsRaised;
+  }
+
+  // Number of polygons where one pixel was forced although fewer were needed
+  int GetNumberOfForcedPolygons() const
+  {
+    return m_PolyForced;
+  }
+
+  // FID following the last feature written to the layer
+  long GetNextFID() const
+  {
+    return m_NextFID;
+  }
+
+  // State of the sampling after the windows processed so far, to resume a run
+  // at a checkpoint : the counters of the polygons and of the classes, then
+  // the quotas. The random positions are drawn again by SetAnalysis.
+  void WriteState(std::ostream& os) const
+  {
+    os << m_PolyForced << " " << m_NextFID;
+    WriteMap(os, m_CounterPixelsInPolygon);
+    WriteMap(os, m_CounterPixelsInPolygonShifted);
+    WriteMap(os, m_NbPixelsRaised);
+    os << " ";
+    m_QuotaSampler.WriteState(os);
+  }
+
+  void ReadState(std::istream& is)
+  {
+    is >> m_PolyForced >> m_NextFID;
+    ReadMap(is, m_CounterPixelsInPolygon);
+    ReadMap(is, m_CounterPixelsInPolygonShifted);
+    ReadMap(is, m_NbPixelsRaised);
+    m_QuotaSampler.ReadState(is);
+    if(!is)
+    {
+      itkGenericExceptionMacro(<< "Invalid state of the sampler");
+    }
+  }
+
+private:
+  template <class TKey>
+  static void WriteMap(std::ostream& os, const std::map<TKey, int>& values)
+  {
+    os << " " << values.size();
+    for(typename std::map<TKey, int>::const_iterator it = values.begin(); it != values.end(); ++it)
+    {
+      os << " " << it->first << " " << it->second;
+    }
+  }
+
+  template <class TKey>
+  static void ReadMap(std::istream& is, std::map<TKey, int>& values)
+  {
+    values.clear();
+    unsigned long size = 0;
+    is >> size;
+    for(unsigned long i = 0; i < size && is; ++i)
+    {
+      TKey key;
+      is >> key;
+      is >> values[key];
+    }
+  }
+
+  // Sampling decision of the modes other than quota, for the next pixel of a polygon
+  bool SelectPixel(int className, unsigned long fid, int nbPixelsInPolygon, int randomPosition,
+                   int periodOfSampling, int& nextPixelRaisedPosition)
+  {
+    bool resultTest = false;
+    int counter = m_CounterPixelsInPolygon[fid];
+
+    //Exhautive mode : we extract all pixels in every polygons in every classes
+    if (m_Mode == "exhaustive")
+    {
+      resultTest = true;
+    }
+
+    //Random mode : we extract nbSamples pixels randomly in all the image
+    if (m_Mode == "random")
+    {
+      //The probability of sampling a pixel is function of the number of pixels in every classes
+      float probability = static_cast<float>(m_NbSamples[className])/static_cast<float>(m_NbPixelsGlobal);
+      if(m_Generator->GetUniformVariate(0, 1) < probability)
+      {
+        resultTest = true;
+      }
+    }
+
+    //Random mode equally : we extract nbSAmples pixels for each classes
+    if (m_Mode == "randomequally")
+    {
+      //The probability of sampling a pixel is function of the number of pixels in each classes
+      float probability = static_cast<float>(m_NbSamples[className])/static_cast<float>(m_ElmtsInClass[className]);
+      if(m_Generator->GetUniformVariate(0, 1) < probability)
+      {
+        resultTest = true;
+      }
+    }
+
+    //Periodic : we extract, more or less, nbsamples pixels for each classes every n pixels
+    if (m_Mode == "periodic")
+    {
+      //In a polygon where we only need one pixel, we raise it at a radom position
+      if(counter == randomPosition && nbPixelsInPolygon == 1)
+      {
+        resultTest = true;
+      }
+      //If we need more then one pixel in the polygon, we sample a pixel periodicly, every n-pixels
+      if(counter%periodOfSampling == 0 && nbPixelsInPolygon != 1)
+      {
+        resultTest = true;
+      }
+    }
+
+    //Periodic random : we extract, more or less, nbsmaples pixels for each classes every n+-delta pixels ( 0<delta<n/2 )
+    if (m_Mode == "periodicrandom")
+    {
+      int shifted = m_CounterPixelsInPolygonShifted[fid];
+      //In a polygon where we only need one pixel, we raise it at a radom position
+      if(counter == randomPosition && nbPixelsInPolygon == 1)
+      {
+        resultTest = true;
+      }
+      //If we need more then one pixel in the polygon
+      else if(nbPixelsInPolygon != 1)
+      {
+        //The first pixel raised is randomly choosen
+        if(counter == static_cast<int>(m_Generator->GetUniformVariate(0, (periodOfSampling/2))))
+        {
+          resultTest = true;
+        }
+
+        //We raised the pixel if we are at the good position
+        if(counter == nextPixelRaisedPosition)
+        {
+          resultTest = true;
+        }
+
+        //Every n-pixels we compute the position of the next pixel sampled
+        if(shifted%periodOfSampling == 0)
+        {
+          int sign = m_Generator->GetUniformVariate(0, 1);
+          int rdm = static_cast<int>(m_Generator->GetUniformVariate(0, (periodOfSampling/2)));
+
+          if (sign<0.5)
+          {
+            nextPixelRaisedPosition = shifted - rdm;
+          }
+          else
+          {
+            nextPixelRaisedPosition = shifted + rdm;
+          }
+        }
+      }
+    }
+    return resultTest;
+  }
+
+  // Add a sampled pixel to the text file and to the layer
+  void WriteSample(int className, OGRPoint& pointOGR, const typename TImage::PixelType& pixelValue,
+                   unsigned int nbComponents, otb::ogr::Feature& feature)
+  {
+    std::ostringstream message;
+    message << className;
+    otb::ogr::Feature featureOutput(m_Layer.GetLayerDefn());
+
+    //Adding the raised pixel to our output shape file
+    featureOutput.SetGeometry(&pointOGR);
+
+    //Completing the text and shape output files with the pixel values
+    for (unsigned int i=0; i<nbComponents; i++)
+    {
+      message << " " << i+1 << ":" << static_cast<double>(pixelValue[i]);
+      featureOutput.ogr().SetField(i, static_cast<double>(pixelValue[i]));
+    }
+
+    //We also add informations about where the pixel is extract from
+    for(int c = 0; c < feature.ogr().GetFieldCount(); ++c)
+    {
+      if(feature.ogr().GetFieldDefnRef(c)->GetType() == OFTString)
+      {
+        featureOutput.ogr().SetField(nbComponents + c, feature.ogr().GetFieldAsString(c));
+      }
+      else if(feature.ogr().GetFieldDefnRef(c)->GetType() == OFTInteger)
+      {
+        featureOutput.ogr().SetField(nbComponents + c, feature.ogr().GetFieldAsInteger(c));
+      }
+    }
+
+    m_Layer.CreateFeature(featureOutput);
+    m_NextFID = std::max(m_NextFID, static_cast<long>(featureOutput.GetFID()) + 1);
+    //Not flushed line by line, the caller flushes at its checkpoints
+    if(m_File)
+    {
+      *m_File << message.str() << "\n";
+    }
+    //Incrementation of the counter of raised pixels in each classes
+    m_NbPixelsRaised[className]++;
+  }
+
+  std::string m_Mode;
+  std::string m_ClassField;
+  int m_NoDataValue;
+  GeneratorType::Pointer m_Generator;
+
+  //Number of pixels in each classes and in all the polygons, and number of samples of each class
+  std::map<int, int> m_ElmtsInClass;
+  int m_NbPixelsGlobal;
+  std::map<int, int> m_NbSamples;
+  const PolygonStatisticsFile* m_Analysis;
+
+  //Random position of the pixel sampled in the polygons where only one is needed, in the order of the analysis
+  std::vector<int> m_RandomPositionInPolygon;
+  //Counter of pixels in the current polygon, and shifted counter
+  std::map<unsigned long, int> m_CounterPixelsInPolygon;
+  std::map<unsigned long, int> m_CounterPixelsInPolygonShifted;
+  QuotaSampler m_QuotaSampler;
+
+  std::ostream* m_File;
+  otb::ogr::Layer m_Layer;
+  std::map<int, int> m_NbPixelsRaised;
+  int m_PolyForced;
+  long m_NextFID;
+  const OverlapMask* m_Overlap;
+};
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef __otbIncrementalAnalysis__
+#define __otbIncrementalAnalysis__
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include "itkMacro.h"
+#include "itkIntTypes.h"
+#include "ogr_core.h"
+#include "ogr_geometry.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbImageAnalysis.h"
+#include "otbPolygonStatisticsFile.h"
+
+namespace otb
+{
+
+// Content of a feature at the time of an analysis: its class and a hash of
+// its geometry and class
+struct FeatureRecord
+{
+  itk::int64_t classValue;
+  itk::uint64_t hash;
+};
+
+typedef std::map<itk::int64_t, FeatureRecord> FeatureHashMap;
+
+// Record of a feature: 64 bits FNV-1a hash of the WKB of its geometry and of
+// its class
+inline FeatureRecord HashFeature(otb::ogr::Feature& feature, const std::string& classField)
+{
+  FeatureRecord record;
+  record.classValue = feature.ogr().GetFieldAsInteger(classField.c_str());
+
+  std::vector<unsigned char> bytes(sizeof(record.classValue));
+  std::memcpy(&bytes[0], &record.classValue, sizeof(record.classValue));
+  OGRGeometry * geom = feature.ogr().GetGeometryRef();
+  if(geom)
+  {
+    bytes.resize(sizeof(record.classValue) + geom->WkbSize());
+    geom->exportToWkb(wkbNDR, &bytes[sizeof(record.classValue)]);
+  }
+
+  record.hash = 14695981039346656037ULL;
+  for(unsigned long i = 0; i < bytes.size(); ++i)
+  {
+    record.hash ^= bytes[i];
+    record.hash *= 1099511628211ULL;
+  }
+  return record;
+}
+
+// Records of the features of an analysis
+inline FeatureHashMap HashFeatures(std::vector<otb::ogr::Feature>& features, const std::string& classField)
+{
+  FeatureHashMap records;
+  for(std::vector<otb::ogr::Feature>::iterator feature = features.begin(); feature != features.end(); ++feature)
+  {
+    records[feature->ogr().GetFID()] = HashFeature(*feature, classField);
+  }
+  return records;
+}
+
+// Feature records stored next to an analysis file, in native byte order:
+//
+//   header   magic "OTBFHASH", version, number of features
+//   records  (FID int64, class int64, hash uint64), sorted by FID
+//
+inline std::string FeatureHashFilename(const std::string& analysisFilename)
+{
+  return analysisFilename + ".fhash";
+}
+
+inline void WriteFeatureHashes(const std::string& filename, const FeatureHashMap& records)
+{
+  std::vector<itk::int64_t> table;
+  for(FeatureHashMap::const_iterator it = records.begin(); it != records.end(); ++it)
+  {
+    table.push_back(it->first);
+    table.push_back(it->second.classValue);
+    table.push_back(static_cast<itk::int64_t>(it->second.hash));
+  }
+
+  itk::uint64_t header[2] = {1, records.size()};
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  file.write("OTBFHASH", 8);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  if(!table.empty())
+  {
+    file.write(reinterpret_cast<const char*>(&table[0]), table.size()*sizeof(itk::int64_t));
+  }
+  if(!file)
+  {
+    itkGenericExceptionMacro(<< "Unable to write the feature hash file " << filename);
+  }
+}
+
+// Read the feature records of an analysis, false if there are none
+inline bool ReadFeatureHashes(const std::string& filename, FeatureHashMap& records)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if(!file)
+  {
+    return false;
+  }
+
+  file.seekg(0, std::ios::end);
+  const std::streamoff length = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  char magic[8];
+  itk::uint64_t header[2];
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if(!file || std::memcmp(magic, "OTBFHASH", sizeof(magic)) != 0 || header[0] != 1)
+  {
+    itkGenericExceptionMacro(<< "Invalid feature hash file " << filename);
+  }
+
+  // The number of records is checked against the file length before any
+  // allocation
+  const itk::uint64_t recordSize = 3*sizeof(itk::int64_t);
+  const itk::uint64_t payload = static_cast<itk::uint64_t>(length) - sizeof(magic) - sizeof(header);
+  if(header[1] > payload / recordSize)
+  {
+    itkGenericExceptionMacro(<< "Truncated feature hash file " << filename);
+  }
+
+  std::vector<itk::int64_t> table(3*header[1] + 1);
+  file.read(reinterpret_cast<char*>(&table[0]), header[1]*recordSize);
+  if(!file)
+  {
+    itkGenericExceptionMacro(<< "Truncated feature hash file " << filename);
+  }
+
+  records.clear();
+  for(itk::uint64_t i = 0; i < header[1]; ++i)
+  {
+    FeatureRecord& record = records[table[3*i]];
+    record.classValue = table[3*i+1];
+    record.hash = static_cast<itk::uint64_t>(table[3*i+2]);
+  }
+  return true;
+}
+
+// Features edited since an analysis: the stale ones (removed or modified),
+// whose counts are dropped, and the changed ones (added or modified), which
+// are analyzed again
+inline void DiffFeatureHashes(const FeatureHashMap& stored, const FeatureHashMap& current,
+                              std::set<long>& stale, std::set<long>& changed)
+{
+  for(FeatureHashMap::const_iterator it = stored.begin(); it != stored.end(); ++it)
+  {
+    FeatureHashMap::const_iterator found = current.find(it->first);
+    if(found == current.end() || found->second.hash != it->second.hash)
+    {
+      stale.insert(static_cast<long>(it->first));
+    }
+  }
+  for(FeatureHashMap::const_iterator it = current.begin(); it != current.end(); ++it)
+  {
+    FeatureHashMap::const_iterator found = stored.find(it->first);
+    if(found == stored.end() || found->second.hash != it->second.hash)
+    {
+      changed.insert(static_cast<long>(it->first));
+    }
+  }
+}
+
+// Classes of the stale features, as stored. Their quantile sketches can not
+// lose the pixels of these features: they are rebuilt from all the current
+// features of the class, added to the changed ones.
+inline std::set<itk::int64_t> ResketchClasses(const FeatureHashMap& stored, const FeatureHashMap& current,
+                                              const std::set<long>& stale, std::set<long>& changed)
+{
+  std::set<itk::int64_t> classes;
+  for(std::set<long>::const_iterator fid = stale.begin(); fid != stale.end(); ++fid)
+  {
+    FeatureHashMap::const_iterator found = stored.find(static_cast<itk::int64_t>(*fid));
+    if(found != stored.end())
+    {
+      classes.insert(found->second.classValue);
+    }
+  }
+  for(FeatureHashMap::const_iterator it = current.begin(); it != current.end(); ++it)
+  {
+    if(classes.count(it->second.classValue))
+    {
+      changed.insert(static_cast<long>(it->first));
+    }
+  }
+  return classes;
+}
+
+// Analysis file loaded back into an analysis, to be patched
+inline void LoadImageAnalysis(const std::string& filename, ImageAnalysis& analysis)
+{
+  PolygonStatisticsFile file;
+  file.Open(filename);
+
+  analysis = ImageAnalysis();
+  for(unsigned long i = 0; i < file.GetNumberOfPolygons(); ++i)
+  {
+    unsigned long fid = static_cast<unsigned long>(file.GetPolygonFID(i));
+    analysis.polygonCounts[fid] = static_cast<int>(file.GetPolygonCount(i));
+    if(file.GetNumberOfBands() > 0)
+    {
+      analysis.polygonStatistics[fid] = file.GetPolygonStatistics(i);
+    }
+  }
+  for(PolygonStatisticsFile::ClassCountMap::const_iterator it = file.GetClassCounts().begin(); it != file.GetClassCounts().end(); ++it)
+  {
+    analysis.classCounts[static_cast<int>(it->first)] = static_cast<int>(it->second);
+    analysis.nbPixels += static_cast<int>(it->second);
+  }
+  for(PolygonStatisticsFile::ClassStatisticsMap::const_iterator it = file.GetClassStatistics().begin(); it != file.GetClassStatistics().end(); ++it)
+  {
+    analysis.classStatistics[static_cast<int>(it->first)] = it->second;
+  }
+  analysis.classSketches = file.GetClassSketches();
+}
+
+// Patch an analysis with the analysis of the changed features: the stale
+// polygons are dropped, the changed ones added, and the class counts and
+// statistics rebuilt from the polygons and the current classes. The quantile
+// sketches of the classes of ResketchClasses are replaced by those of the
+// changed analysis, which holds all their features; the changed features of
+// the other classes are new ones, whose sketches are merged.
+inline void PatchImageAnalysis(ImageAnalysis& analysis, const std::set<long>& stale, const ImageAnalysis& changed,
+                               const FeatureHashMap& records, const std::set<itk::int64_t>& resketchClasses)
+{
+  for(std::set<long>::const_iterator fid = stale.begin(); fid != stale.end(); ++fid)
+  {
+    analysis.polygonCounts.erase(static_cast<unsigned long>(*fid));
+    analysis.polygonStatistics.erase(static_cast<unsigned long>(*fid));
+  }
+  for(std::map<unsigned long, int>::const_iterator it = changed.polygonCounts.begin(); it != changed.polygonCounts.end(); ++it)
+  {
+    analysis.polygonCounts[it->first] = it->second;
+  }
+  for(std::map<unsigned long, BandStatistics>::const_iterator it = changed.polygonStatistics.begin(); it != changed.polygonStatistics.end(); ++it)
+  {
+    analysis.polygonStatistics[it->first] = it->second;
+  }
+  for(std::set<itk::int64_t>::const_iterator iClass = resketchClasses.begin(); iClass != resketchClasses.end(); ++iClass)
+  {
+    analysis.classSketches.erase(*iClass);
+  }
+  MergeClassQuantileSketches(analysis.classSketches, changed.classSketches);
+
+  analysis.classCounts.clear();
+  analysis.classStatistics.clear();
+  analysis.nbPixels = 0;
+  for(std::map<unsigned long, int>::const_iterator it = analysis.polygonCounts.begin(); it != analysis.polygonCounts.end(); ++it)
+  {
+    FeatureHashMap::const_iterator record = records.find(static_cast<itk::int64_t>(it->first));
+    if(record == records.end())
+    {
+      continue;
+    }
+    int className = static_cast<int>(record->second.classValue);
+    analysis.classCounts[className] += it->second;
+    analysis.nbPixels += it->second;
+
+    std::map<unsigned long, BandStatistics>::const_iterator statistics = analysis.polygonStatistics.find(it->first);
+    if(statistics != analysis.polygonStatistics.end())
+    {
+      analysis.classStatistics[className].Merge(statistics->second);
+    }
+  }
+}
+
+} // namespace otb
+
+#endif
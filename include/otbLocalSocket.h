@@ -0,0 +1,222 @@
+#ifndef __otbLocalSocket__
+#define __otbLocalSocket__
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include "itkMacro.h"
+
+namespace otb
+{
+
+// Listening Unix domain socket of a local server. A client connects, writes
+// one request ended by a newline (or by shutting down its side), and reads
+// the reply until the server closes the connection. The socket file is only
+// accessible to its owner, and removed when the server closes.
+class LocalSocketServer
+{
+public:
+  LocalSocketServer() : m_Socket(-1) {}
+
+  ~LocalSocketServer()
+  {
+    Close();
+  }
+
+#if !defined(_WIN32)
+  void Open(const std::string& path)
+  {
+    struct sockaddr_un address;
+    if(path.size() >= sizeof(address.sun_path))
+    {
+      itkGenericExceptionMacro(<< "The socket path " << path << " is too long");
+    }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+
+    // A socket file left by a server that died is replaced, not one in use
+    struct stat status;
+    if(lstat(path.c_str(), &status) == 0)
+    {
+      if(!S_ISSOCK(status.st_mode))
+      {
+        itkGenericExceptionMacro(<< "The socket path " << path << " is an existing file");
+      }
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      bool inUse = probe >= 0 && connect(probe, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+      if(probe >= 0)
+      {
+        close(probe);
+      }
+      if(inUse)
+      {
+        itkGenericExceptionMacro(<< "A server is already listening on " << path);
+      }
+      unlink(path.c_str());
+    }
+
+    m_Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_Socket < 0)
+    {
+      itkGenericExceptionMacro(<< "Unable to create a socket : " << std::strerror(errno));
+    }
+    mode_t mask = umask(0077);
+    int bound = bind(m_Socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    umask(mask);
+    if(bound != 0 || listen(m_Socket, 16) != 0)
+    {
+      std::string error = std::strerror(errno);
+      close(m_Socket);
+      m_Socket = -1;
+      itkGenericExceptionMacro(<< "Unable to listen on " << path << " : " << error);
+    }
+    m_Path = path;
+
+    // A client leaving before its reply must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+  }
+
+  // Wait for the next client, the connection being returned. A client that
+  // stays silent is dropped after timeout seconds.
+  int Accept(unsigned int timeout)
+  {
+    for(;;)
+    {
+      int connection = accept(m_Socket, NULL, NULL);
+      if(connection >= 0)
+      {
+        struct timeval delay;
+        delay.tv_sec = timeout;
+        delay.tv_usec = 0;
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &delay, sizeof(delay));
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &delay, sizeof(delay));
+        return connection;
+      }
+      if(errno != EINTR && errno != ECONNABORTED)
+      {
+        itkGenericExceptionMacro(<< "Unable to accept a connection : " << std::strerror(errno));
+      }
+    }
+  }
+
+  // Read a request, up to the first newline or the end of the stream. False
+  // on a timeout, a read error or a request over maxSize bytes.
+  static bool ReadRequest(int connection, std::string& request, unsigned long maxSize)
+  {
+    request.clear();
+    char buffer[4096];
+    for(;;)
+    {
+      ssize_t nbRead = read(connection, buffer, sizeof(buffer));
+      if(nbRead < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if(nbRead < 0)
+      {
+        return false;
+      }
+      if(nbRead == 0)
+      {
+        return !request.empty();
+      }
+      const char* end = static_cast<const char*>(std::memchr(buffer, '\n', nbRead));
+      request.append(buffer, end ? end - buffer : nbRead);
+      if(request.size() > maxSize)
+      {
+        return false;
+      }
+      if(end)
+      {
+        return true;
+      }
+    }
+  }
+
+  // Write a reply, false if the client is gone
+  static bool WriteReply(int connection, const std::string& reply)
+  {
+    unsigned long written = 0;
+    while(written < reply.size())
+    {
+      ssize_t nbWritten = write(connection, reply.data() + written, reply.size() - written);
+      if(nbWritten < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if(nbWritten <= 0)
+      {
+        return false;
+      }
+      written += nbWritten;
+    }
+    return true;
+  }
+
+  static void CloseConnection(int connection)
+  {
+    close(connection);
+  }
+
+  void Close()
+  {
+    if(m_Socket >= 0)
+    {
+      close(m_Socket);
+      unlink(m_Path.c_str());
+      m_Socket = -1;
+    }
+  }
+#else
+  // No Unix domain sockets
+  void Open(const std::string&)
+  {
+    itkGenericExceptionMacro(<< "The local server needs Unix domain sockets, not available on this platform");
+  }
+
+  int Accept(unsigned int)
+  {
+    return -1;
+  }
+
+  static bool ReadRequest(int, std::string&, unsigned long)
+  {
+    return false;
+  }
+
+  static bool WriteReply(int, const std::string&)
+  {
+    return false;
+  }
+
+  static void CloseConnection(int)
+  {
+  }
+
+  void Close()
+  {
+  }
+#endif
+
+private:
+  // Not copyable, the socket being closed by the destructor
+  LocalSocketServer(const LocalSocketServer&);
+  void operator=(const LocalSocketServer&);
+
+  int m_Socket;
+  std::string m_Path;
+};
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef __otbOverlapMask__
+#define __otbOverlapMask__
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include "gdal.h"
+#include "ogr_core.h"
+#include "ogr_spatialref.h"
+#include "itkMacro.h"
+#include "itkImageIOBase.h"
+#include "otbImageIOFactory.h"
+#include "otbSamplingWindow.h"
+
+namespace otb
+{
+
+// Extent, projection and valid data footprint of an image file. The
+// footprint is a coarse grid of cells over the image, a cell being valid when
+// a pixel read in it (from an overview when GDAL has one) is neither NaN nor
+// has a band equal to the nodata value, as tested by the sampling. Only the
+// cells along the edge of the valid data are misjudged.
+struct ImageFootprint
+{
+  OGREnvelope extent;
+  std::string projection;
+
+  // Outer corner of the first pixel, pixel spacing and size of the image
+  double corner[2];
+  double spacing[2];
+  unsigned long size[2];
+
+  // Validity of the cells, row after row
+  unsigned long nbCells[2];
+  std::vector<char> valid;
+
+  // The point is in a valid cell
+  bool IsValid(double x, double y) const
+  {
+    long column = static_cast<long>(std::floor((x - corner[0]) / spacing[0]));
+    long row = static_cast<long>(std::floor((y - corner[1]) / spacing[1]));
+    if(column < 0 || row < 0 || column >= static_cast<long>(size[0]) || row >= static_cast<long>(size[1]))
+    {
+      return false;
+    }
+    return valid[Cell(row, 1) * nbCells[0] + Cell(column, 0)] != 0;
+  }
+
+  // Every cell meeting the area is valid
+  bool IsValidOver(const OGREnvelope& area) const
+  {
+    double columns[2] = {(area.MinX - corner[0]) / spacing[0], (area.MaxX - corner[0]) / spacing[0]};
+    double rows[2] = {(area.MinY - corner[1]) / spacing[1], (area.MaxY - corner[1]) / spacing[1]};
+    long firstColumn = static_cast<long>(std::floor(std::min(columns[0], columns[1])));
+    long lastColumn = static_cast<long>(std::floor(std::max(columns[0], columns[1])));
+    long firstRow = static_cast<long>(std::floor(std::min(rows[0], rows[1])));
+    long lastRow = static_cast<long>(std::floor(std::max(rows[0], rows[1])));
+    if(firstColumn < 0 || firstRow < 0 || lastColumn >= static_cast<long>(size[0]) || lastRow >= static_cast<long>(size[1]))
+    {
+      return false;
+    }
+    for(unsigned long cy = Cell(firstRow, 1); cy <= Cell(lastRow, 1); ++cy)
+    {
+      for(unsigned long cx = Cell(firstColumn, 0); cx <= Cell(lastColumn, 0); ++cx)
+      {
+        if(!valid[cy * nbCells[0] + cx])
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+private:
+  // Cell of a pixel index along a dimension
+  unsigned long Cell(long index, unsigned int dim) const
+  {
+    return static_cast<unsigned long>(index) * nbCells[dim] / size[dim];
+  }
+};
+
+// Footprint of an image file, of at most maxCells cells along each dimension.
+// The extent is read from the image header, the projection and the cells
+// with GDAL, in one decimated read of all the bands.
+inline ImageFootprint ReadImageFootprint(const std::string& filename, double noDataValue, unsigned long maxCells = 256)
+{
+  std::string path = filename.substr(0, filename.find('?'));
+
+  itk::ImageIOBase::Pointer imageIO = otb::ImageIOFactory::CreateImageIO(path.c_str(), otb::ImageIOFactory::ReadMode);
+  if(imageIO.IsNull())
+  {
+    itkGenericExceptionMacro(<< "Unable to read the image " << path);
+  }
+  imageIO->SetFileName(path);
+  imageIO->ReadImageInformation();
+
+  // The origin is the centre of the first pixel
+  ImageFootprint footprint;
+  double bounds[2][2];
+  for(unsigned int dim = 0; dim < 2; ++dim)
+  {
+    footprint.spacing[dim] = imageIO->GetSpacing(dim);
+    footprint.size[dim] = imageIO->GetDimensions(dim);
+    footprint.corner[dim] = imageIO->GetOrigin(dim) - footprint.spacing[dim] / 2;
+    footprint.nbCells[dim] = std::max(1UL, std::min(maxCells, footprint.size[dim]));
+
+    double first = imageIO->GetOrigin(dim);
+    double last = first + (static_cast<double>(footprint.size[dim]) - 1) * footprint.spacing[dim];
+    double half = std::fabs(footprint.spacing[dim]) / 2;
+    bounds[dim][0] = std::min(first, last) - half;
+    bounds[dim][1] = std::max(first, last) + half;
+  }
+  footprint.extent.MinX = bounds[0][0];
+  footprint.extent.MaxX = bounds[0][1];
+  footprint.extent.MinY = bounds[1][0];
+  footprint.extent.MaxY = bounds[1][1];
+
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if(dataset == NULL)
+  {
+    itkGenericExceptionMacro(<< "Unable to open " << path);
+  }
+  const char* projection = GDALGetProjectionRef(dataset);
+  footprint.projection = projection ? projection : "";
+
+  const unsigned long nbCells = footprint.nbCells[0] * footprint.nbCells[1];
+  const int nbBands = GDALGetRasterCount(dataset);
+  std::vector<double> values(nbCells * std::max(1, nbBands));
+  CPLErr error = CE_None;
+  if(nbBands > 0)
+  {
+    error = GDALDatasetRasterIO(dataset, GF_Read, 0, 0, GDALGetRasterXSize(dataset), GDALGetRasterYSize(dataset),
+                                &values[0], footprint.nbCells[0], footprint.nbCells[1], GDT_Float64,
+                                nbBands, NULL, 0, 0, 0);
+  }
+  GDALClose(dataset);
+  if(error != CE_None)
+  {
+    itkGenericExceptionMacro(<< "Unable to read the footprint of " << path);
+  }
+
+  // Bands one after the other
+  footprint.valid.assign(nbCells, 1);
+  for(int b = 0; b < nbBands; ++b)
+  {
+    for(unsigned long c = 0; c < nbCells; ++c)
+    {
+      double value = values[b * nbCells + c];
+      if(value != value || value == noDataValue)
+      {
+        footprint.valid[c] = 0;
+      }
+    }
+  }
+  return footprint;
+}
+
+// Areas of an image whose pixels belong to other images of the list, of
+// higher priority, where they overlap and these images have valid data: the
+// pixels whose centre is inside one of these areas are neither counted nor
+// sampled with this image, so that the pixels of an overlap are processed
+// once, with one image. Under the nodata collar of an image of higher
+// priority, the pixels stay with this image.
+class OverlapMask
+{
+public:
+  // Area owned by an image of higher priority, of the given footprint
+  void AddArea(const OGREnvelope& area, const ImageFootprint& owner)
+  {
+    m_Areas.push_back(area);
+    m_Owners.push_back(owner);
+  }
+
+  bool IsEmpty() const
+  {
+    return m_Areas.empty();
+  }
+
+  unsigned long GetNumberOfAreas() const
+  {
+    return m_Areas.size();
+  }
+
+  // The point belongs to another image (areas are half-open, so that a pixel
+  // centre on the edge shared by two areas is in only one of them)
+  bool Contains(double x, double y) const
+  {
+    for(unsigned long a = 0; a < m_Areas.size(); ++a)
+    {
+      if(InArea(m_Areas[a], x, y) && m_Owners[a].IsValid(x, y))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // All the pixels of the window belong to one other image: the window needs
+  // not be read
+  template <class TImage>
+  bool CoversWindow(const TImage* image, const SamplingWindow& window) const
+  {
+    itk::Point<double, 2> lowerPoint, upperPoint;
+    image->TransformIndexToPhysicalPoint(window.region.GetIndex(), lowerPoint);
+    image->TransformIndexToPhysicalPoint(window.region.GetUpperIndex(), upperPoint);
+    OGREnvelope envelope;
+    envelope.MinX = std::min(lowerPoint[0], upperPoint[0]);
+    envelope.MaxX = std::max(lowerPoint[0], upperPoint[0]);
+    envelope.MinY = std::min(lowerPoint[1], upperPoint[1]);
+    envelope.MaxY = std::max(lowerPoint[1], upperPoint[1]);
+
+    for(unsigned long a = 0; a < m_Areas.size(); ++a)
+    {
+      if(InArea(m_Areas[a], lowerPoint[0], lowerPoint[1]) && InArea(m_Areas[a], upperPoint[0], upperPoint[1])
+         && m_Owners[a].IsValidOver(envelope))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static bool InArea(const OGREnvelope& area, double x, double y)
+  {
+    return x >= area.MinX && x < area.MaxX && y >= area.MinY && y < area.MaxY;
+  }
+
+  std::vector<OGREnvelope> m_Areas;
+  std::vector<ImageFootprint> m_Owners;
+};
+
+// Overlap masks of the images of a list, from their footprints and a priority
+// score (lower is better, such as the cloud cover or the off-nadir angle; the
+// first image of the list wins a tie): the mask of an image holds the parts of
+// its extent covered by the images of higher priority, with their footprint.
+// The extents are compared in one projection: images in different ones are
+// rejected.
+inline std::vector<OverlapMask> ComputeOverlapMasks(const std::vector<ImageFootprint>& footprints, const std::vector<double>& scores)
+{
+  for(unsigned long i = 1; i < footprints.size(); ++i)
+  {
+    OGRSpatialReference first(footprints[0].projection.c_str());
+    OGRSpatialReference other(footprints[i].projection.c_str());
+    if(footprints[i].projection.empty() != footprints[0].projection.empty()
+       || (!footprints[0].projection.empty() && !first.IsSame(&other)))
+    {
+      itkGenericExceptionMacro(<< "The overlaps are resolved between images of one projection, the images 1 and " << i+1 << " differ");
+    }
+  }
+
+  std::vector<OverlapMask> masks(footprints.size());
+  for(unsigned long i = 0; i < footprints.size(); ++i)
+  {
+    for(unsigned long j = 0; j < footprints.size(); ++j)
+    {
+      bool priority = scores[j] < scores[i] || (scores[j] == scores[i] && j < i);
+      if(j == i || !priority)
+      {
+        continue;
+      }
+
+      const OGREnvelope& extentI = footprints[i].extent;
+      const OGREnvelope& extentJ = footprints[j].extent;
+      OGREnvelope area;
+      area.MinX = std::max(extentI.MinX, extentJ.MinX);
+      area.MaxX = std::min(extentI.MaxX, extentJ.MaxX);
+      area.MinY = std::max(extentI.MinY, extentJ.MinY);
+      area.MaxY = std::min(extentI.MaxY, extentJ.MaxY);
+      if(area.MinX < area.MaxX && area.MinY < area.MaxY)
+      {
+        masks[i].AddArea(area, footprints[j]);
+      }
+    }
+  }
+  return masks;
+}
+
+// Overlap masks of the images of a list under a resolution rule: none (empty,
+// every image processes all its pixels), first (an overlap belongs to the
+// first image of the list covering it with valid data) or score (to the image
+// of lowest score, one score being given per image)
+inline std::vector<OverlapMask> ResolveImageListOverlaps(const std::string& rule, const std::vector<std::string>& filenames,
+                                                         const std::vector<std::string>& scoreList, double noDataValue)
+{
+  if(rule == "none")
+  {
+    return std::vector<OverlapMask>();
+  }
+
+  std::vector<double> scores(filenames.size(), 0.);
+  if(rule == "score")
+  {
+    if(scoreList.size() != filenames.size())
+    {
+      itkGenericExceptionMacro(<< "One overlap score per image is needed, " << scoreList.size() << " given for " << filenames.size() << " images");
+    }
+    for(unsigned long i = 0; i < scoreList.size(); ++i)
+    {
+      scores[i] = std::atof(scoreList[i].c_str());
+    }
+  }
+
+  std::vector<ImageFootprint> footprints;
+  for(unsigned long i = 0; i < filenames.size(); ++i)
+  {
+    footprints.push_back(ReadImageFootprint(filenames[i], noDataValue));
+  }
+  return ComputeOverlapMasks(footprints, scores);
+}
+
+} // namespace otb
+
+#endif
@@ -6,6 +6,12 @@
 #include "otbOGRDataSourceWrapper.h"
 #include "otbMaskedIteratorDecorator.h"
 #include "itkImageRegionIterator.h"
+#include "otbQuantileSketch.h"
+#include "otbBandStatistics.h"
+#include "otbSamplingWindow.h"
+#include "ogr_geometry.h"
+#include <vector>
+#include <string>
 #include <iostream>
 
 namespace otb
@@ -45,8 +51,40 @@ public:
     //elmtsInClass[className] = elmtsInClass[className] + nbOfPixelsInGeom;
   }
 
+  // Add the bands of a pixel of a class to the quantile sketches of the class
+  template <typename TPixel>
+  void AddPixel(int className, const TPixel& pixel, unsigned int nbBands)
+  {
+    std::vector<QuantileSketch>& sketches = m_ClassSketches[className];
+    if(sketches.empty())
+    {
+      sketches.resize(nbBands, QuantileSketch(m_SketchSize));
+    }
+    for(unsigned int b = 0; b < nbBands; ++b)
+    {
+      sketches[b].Add(static_cast<double>(pixel[b]));
+    }
+  }
+
+  // Merge the accumulator of another thread or tile
+  void Merge(const Self* other)
+  {
+    MergeClassQuantileSketches(m_ClassSketches, other->m_ClassSketches);
+  }
+
+  // Parameter k of the sketches, larger is more accurate and bigger
+  void SetSketchSize(unsigned int k)
+  {
+    m_SketchSize = k;
+  }
+
+  const ClassQuantileSketchMap& GetClassSketches() const
+  {
+    return m_ClassSketches;
+  }
+
 protected:
-  PolygonClassStatisticsAccumulator() {}
+  PolygonClassStatisticsAccumulator() : m_SketchSize(200) {}
 
 private:
   //Number of pixels in all the polygons
@@ -55,12 +93,40 @@ private:
   std::map<int, int> m_elmtsInClass;
   //Number of pixels in each polygons
   std::map<unsigned long, int> m_polygon;
+  //Quantile sketches of the bands in each class
+  ClassQuantileSketchMap m_ClassSketches;
+  unsigned int m_SketchSize;
 
   // Not implemented
   PolygonClassStatisticsAccumulator(const Self&);
   void operator=(const Self&);
 };
 
+// Statistics of the pixels of one polygon: moments of the bands and,
+// optionally, a histogram of each band over a fixed range
+struct ZonalStatistics
+{
+  BandStatistics moments;
+
+  // Bins of band b are [b*nbBins, (b+1)*nbBins), values out of the range
+  // fall in the first or last bin
+  std::vector<itk::uint64_t> histogram;
+
+  void Merge(const ZonalStatistics& other)
+  {
+    moments.Merge(other.moments);
+    if(histogram.empty())
+    {
+      histogram = other.histogram;
+      return;
+    }
+    for(unsigned long i = 0; i < other.histogram.size(); ++i)
+    {
+      histogram[i] += other.histogram[i];
+    }
+  }
+};
+
 // how to make input mask optional wrt template params?
 // set a default type? use same type as image
 template <class TInputImage, class TInputMask>
@@ -72,6 +138,8 @@ public:
   typedef otb::PersistentImageFilter<TInputImage, TInputImage> Superclass;
   typedef itk::SmartPointer<Self> Pointer;
 
+  typedef std::vector<ZonalStatistics> ZonalStatisticsList;
+
   itkNewMacro(Self);
   itkTypeMacro(Self, PersistentImageFilter);
 
@@ -90,17 +158,68 @@ public:
     m_layerIndex = index;
   }
 
-  void GetResult()
+  // Field of the class of the polygons, empty to ignore the classes
+  void SetClassField(const std::string& field)
+  {
+    m_classField = field;
+  }
+
+  // Compute the statistics of the bands of every polygon (zonal statistics)
+  void SetZonalStatistics(bool zonal)
   {
+    m_zonal = zonal;
+  }
+
+  // Histograms of the zonal statistics, nbBins bins over [min, max], 0 bins for none
+  void SetHistogram(unsigned int nbBins, double min, double max)
+  {
+    if(nbBins > 0 && !(max > min))
+    {
+      itkExceptionMacro(<< "The histogram upper bound must be greater than its lower bound");
+    }
+    m_histogramBins = nbBins;
+    m_histogramMin = min;
+    m_histogramMax = max;
+  }
+
+  // FIDs of the polygons, by dense ordinal (order of the layer)
+  const std::vector<long>& GetPolygonFIDs() const
+  {
+    return m_fids;
+  }
+
+  // Classes of the polygons, by dense ordinal
+  const std::vector<int>& GetPolygonClasses() const
+  {
+    return m_classes;
+  }
+
+  // Zonal statistics of the polygons, by dense ordinal
+  const ZonalStatisticsList& GetZonalStatistics() const
+  {
+    return m_zonalStatistics;
+  }
+
+  // Class statistics merged over the threads
+  const PolygonClassStatisticsAccumulator* GetClassStatistics() const
+  {
+    return m_resultPolygonStatistics.GetPointer();
   }
 
 public: // Software guide says this should be protected, but it won't compile
   PolygonClassStatisticsFilter() :
-    m_layerIndex(0)
+    m_layerIndex(0),
+    m_zonal(false),
+    m_histogramBins(0),
+    m_histogramMin(0),
+    m_histogramMax(0)
   {
   }
 
-  virtual ~PolygonClassStatisticsFilter() {}
+  virtual ~PolygonClassStatisticsFilter()
+  {
+    ClearPreparedPolygons();
+  }
 
   void Reset()
   {
@@ -114,12 +233,40 @@ public: // Software guide says this should be protected, but it won't compile
       *it = PolygonClassStatisticsAccumulator::New();
     }
     m_resultPolygonStatistics = PolygonClassStatisticsAccumulator::New();
+    m_threadZonalStatistics = std::vector<std::map<unsigned long, ZonalStatistics> >(numberOfThreads);
+
+    // Dense ordinal of the polygons, so that the results are plain arrays
+    m_fids.clear();
+    m_classes.clear();
+    m_ordinals.clear();
+    otb::ogr::Layer layer = m_polygons->GetLayer(m_layerIndex);
+    layer.SetSpatialFilter(NULL);
+    for(otb::ogr::Layer::const_iterator featIt = layer.begin(); featIt != layer.end(); ++featIt)
+    {
+      m_ordinals[featIt->ogr().GetFID()] = m_fids.size();
+      m_fids.push_back(featIt->ogr().GetFID());
+      m_classes.push_back(m_classField.empty() ? 0 : featIt->ogr().GetFieldAsInteger(m_classField.c_str()));
+    }
+    m_zonalStatistics = ZonalStatisticsList(m_zonal ? m_fids.size() : 0);
   }
 
-  virtual void Synthetize() {}
+  virtual void Synthetize()
+  {
+    std::vector<PolygonClassStatisticsAccumulator::Pointer>::iterator it = m_temporaryPolygonStatistics.begin();
+    for (; it != m_temporaryPolygonStatistics.end(); it++)
+    {
+      m_resultPolygonStatistics->Merge(*it);
+    }
+  }
 
 protected:
 
+  // The filter does not modify the image: the input is passed through as the output
+  void AllocateOutputs()
+  {
+    this->GraftOutput(const_cast<TInputImage*>(this->GetInput()));
+  }
+
   // Internal method for filtering polygons inside the current requested region
   void ApplyPolygonsSpatialFilter(const TInputImage* image, const typename Self::OutputImageRegionType& requestedRegion)
   {
@@ -132,78 +279,187 @@ protected:
     image->TransformIndexToPhysicalPoint(upperIndex, upperPoint);
     image->TransformIndexToPhysicalPoint(lowerIndex, lowerPoint);  
 
-    m_polygons->GetLayer(m_layerIndex).SetSpatialFilterRect(lowerPoint[0], lowerPoint[1], upperPoint[0], upperPoint[1]);         
+    // Spacing may be negative (north up images)
+    m_polygons->GetLayer(m_layerIndex).SetSpatialFilterRect(std::min(lowerPoint[0], upperPoint[0]), std::min(lowerPoint[1], upperPoint[1]),
+                                                            std::max(lowerPoint[0], upperPoint[0]), std::max(lowerPoint[1], upperPoint[1]));
   }
 
+  // Polygons of the requested region are copied before the threads start,
+  // since an OGR layer can not be read by several threads
   void BeforeThreadedGenerateData()
   {
     TInputImage* inputImage = const_cast<TInputImage*>(this->GetInput());
     const typename TInputImage::RegionType& requestedRegion = inputImage->GetRequestedRegion();
     ApplyPolygonsSpatialFilter(inputImage, requestedRegion);
-  }
-
-  // Convert an OGR ImageRegion
-  typename TInputImage::RegionType EnvelopeToRegion(const TInputImage* image, OGREnvelope envelope) const
-  {
-    itk::Point<double, 2> lowerPoint, upperPoint;
-    lowerPoint[0] = envelope.MinX;
-    lowerPoint[1] = envelope.MinY;
-    upperPoint[0] = envelope.MaxX;
-    upperPoint[1] = envelope.MaxY;
-
-    typename TInputImage::IndexType lowerIndex;
-    typename TInputImage::IndexType upperIndex;
 
-    image->TransformPhysicalPointToIndex(lowerPoint, lowerIndex);
-    image->TransformPhysicalPointToIndex(upperPoint, upperIndex);
+    ClearPreparedPolygons();
+    otb::ogr::Layer layer = m_polygons->GetLayer(m_layerIndex);
+    for(otb::ogr::Layer::const_iterator featIt = layer.begin(); featIt != layer.end(); ++featIt)
+    {
+      OGRGeometry* geom = featIt->ogr().GetGeometryRef();
+      if(!geom)
+      {
+        continue;
+      }
+      OGRwkbGeometryType type = wkbFlatten(geom->getGeometryType());
+      if(type != wkbPolygon && type != wkbMultiPolygon)
+      {
+        continue;
+      }
 
-    typename TInputImage::RegionType region;
-    region.SetIndex(lowerIndex);
-    region.SetUpperIndex(upperIndex);
-    return region;
+      PreparedPolygon polygon;
+      polygon.ordinal = m_ordinals[featIt->ogr().GetFID()];
+      polygon.region = FeatureBoundingRegion(inputImage, *featIt);
+      if(!polygon.region.Crop(requestedRegion))
+      {
+        continue;
+      }
+      polygon.geometry = geom->clone();
+      m_preparedPolygons.push_back(polygon);
+    }
   }
-  
+
   // ImageRegion containing the polygon feature
   typename TInputImage::RegionType FeatureBoundingRegion(const TInputImage* image, const otb::ogr::Feature& feature) const
   {
     // otb::ogr wrapper is incomplete and leaky abstraction is inevitable here
     OGREnvelope envelope;
     feature.GetGeometry()->getEnvelope(&envelope);
-    return EnvelopeToRegion(image, envelope);
+    return EnvelopeToImageRegion(image, envelope);
+  }
+
+  // Point inside a polygon (not in its holes) or inside a part of a multipolygon
+  static bool IsPointInGeometry(const OGRGeometry* geom, const OGRPoint& point)
+  {
+    if(wkbFlatten(geom->getGeometryType()) == wkbMultiPolygon)
+    {
+      const OGRMultiPolygon* multiPolygon = static_cast<const OGRMultiPolygon*>(geom);
+      for(int i = 0; i < multiPolygon->getNumGeometries(); ++i)
+      {
+        if(IsPointInGeometry(multiPolygon->getGeometryRef(i), point))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    const OGRPolygon* polygon = static_cast<const OGRPolygon*>(geom);
+    if(!polygon->getExteriorRing() || !polygon->getExteriorRing()->isPointInRing(&point, TRUE))
+    {
+      return false;
+    }
+    for(int i = 0; i < polygon->getNumInteriorRings(); ++i)
+    {
+      if(polygon->getInteriorRing(i) && polygon->getInteriorRing(i)->isPointInRing(&point, TRUE))
+      {
+        return false;
+      }
+    }
+    return true;
   }
 
   void ThreadedGenerateData(const typename Self::OutputImageRegionType& threadRegion, itk::ThreadIdType threadId)
   {
     // Retrieve inputs
     TInputImage* inputImage = const_cast<TInputImage*>(this->GetInput());
+    unsigned int nbBands = inputImage->GetNumberOfComponentsPerPixel();
 
-    // Loop across the features in the layer (filtered by requested region in BeforeTGD already)
-    otb::ogr::Layer::const_iterator featIt = m_polygons->GetLayer(m_layerIndex).begin(); 
-    for(; featIt!=m_polygons->GetLayer(m_layerIndex).end(); featIt++)
+    std::map<unsigned long, ZonalStatistics>& threadZonalStatistics = m_threadZonalStatistics[threadId];
+
+    // Loop across the polygons of the requested region (prepared in BeforeTGD)
+    typename std::vector<PreparedPolygon>::const_iterator polygonIt = m_preparedPolygons.begin();
+    for(; polygonIt != m_preparedPolygons.end(); ++polygonIt)
     {
       // Compute the intersection of thread region and polygon bounding region, called "considered region"
-      // This need not be done in ThreadedGenerateData and could be pre-processed and cached before filter execution if needed
-      typename TInputImage::RegionType consideredRegion = FeatureBoundingRegion(inputImage, *featIt);
-      bool regionNotEmpty = consideredRegion.Crop(threadRegion);
+      typename TInputImage::RegionType consideredRegion = polygonIt->region;
+      if (!consideredRegion.Crop(threadRegion))
+      {
+        continue;
+      }
 
-      if (regionNotEmpty)
+      ZonalStatistics* zonalStatistics = NULL;
+      if(m_zonal)
       {
-        // For pixels in consideredRegion and not masked
-        otb::MaskedIteratorDecorator<itk::ImageRegionIterator<TInputImage> > it(m_mask, inputImage, consideredRegion);
-        for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+        zonalStatistics = &threadZonalStatistics[polygonIt->ordinal];
+        if(zonalStatistics->moments.GetNumberOfBands() == 0)
         {
-          // add to thread statistics
-          m_temporaryPolygonStatistics[threadId]->Add(featIt, it);
+          zonalStatistics->moments.Reset(nbBands);
+          zonalStatistics->histogram.assign(nbBands*m_histogramBins, 0);
+        }
+      }
+      int className = m_classes[polygonIt->ordinal];
+
+      // For pixels in consideredRegion, not masked and inside the polygon
+      otb::MaskedIteratorDecorator<itk::ImageRegionIterator<TInputImage> > it(m_mask, inputImage, consideredRegion);
+      for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+      {
+        itk::Point<double, 2> point;
+        inputImage->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+        OGRPoint pointOGR(point[0], point[1]);
+        if(!IsPointInGeometry(polygonIt->geometry, pointOGR))
+        {
+          continue;
+        }
+
+        typename TInputImage::PixelType pixel = it.Get();
+        if(zonalStatistics)
+        {
+          zonalStatistics->moments.Add(pixel);
+          for(unsigned int b = 0; b < nbBands && m_histogramBins > 0; ++b)
+          {
+            double position = (static_cast<double>(pixel[b]) - m_histogramMin) / (m_histogramMax - m_histogramMin);
+            if(position != position)
+            {
+              continue;
+            }
+            long bin = static_cast<long>(position * m_histogramBins);
+            bin = std::max(0L, std::min(static_cast<long>(m_histogramBins) - 1, bin));
+            zonalStatistics->histogram[b*m_histogramBins + bin]++;
+          }
+        }
+
+        // add to thread statistics
+        if(!m_classField.empty())
+        {
+          m_temporaryPolygonStatistics[threadId]->AddPixel(className, pixel, nbBands);
         }
       }
     }
   }
 
+  // Merge the statistics of the threads for this requested region
   void AfterThreadedGenerateData()
   {
+    for(unsigned int t = 0; t < m_threadZonalStatistics.size(); ++t)
+    {
+      std::map<unsigned long, ZonalStatistics>::const_iterator it = m_threadZonalStatistics[t].begin();
+      for(; it != m_threadZonalStatistics[t].end(); ++it)
+      {
+        m_zonalStatistics[it->first].Merge(it->second);
+      }
+      m_threadZonalStatistics[t].clear();
+    }
+    ClearPreparedPolygons();
   }
 
 private:
+  struct PreparedPolygon
+  {
+    unsigned long ordinal;
+    typename TInputImage::RegionType region;
+    OGRGeometry* geometry;
+  };
+
+  void ClearPreparedPolygons()
+  {
+    for(unsigned long i = 0; i < m_preparedPolygons.size(); ++i)
+    {
+      OGRGeometryFactory::destroyGeometry(m_preparedPolygons[i].geometry);
+    }
+    m_preparedPolygons.clear();
+  }
+
   typename TInputMask::Pointer m_mask;
 
   // Polygons layer of the current tile
@@ -218,6 +474,25 @@ private:
 
   // Layer to use in the shape file, default to 0
   vcl_size_t m_layerIndex;
+
+  // Field of the class, empty if the classes are ignored
+  std::string m_classField;
+
+  // Dense ordinals of the polygons, and their FID and class by ordinal
+  std::map<long, unsigned long> m_ordinals;
+  std::vector<long> m_fids;
+  std::vector<int> m_classes;
+
+  // Polygons of the current requested region
+  std::vector<PreparedPolygon> m_preparedPolygons;
+
+  // Zonal statistics, per thread for the current requested region, and merged
+  bool m_zonal;
+  unsigned int m_histogramBins;
+  double m_histogramMin;
+  double m_histogramMax;
+  std::vector<std::map<unsigned long, ZonalStatistics> > m_threadZonalStatistics;
+  ZonalStatisticsList m_zonalStatistics;
 };
 
 } // namespace otb
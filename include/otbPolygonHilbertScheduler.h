@@ -0,0 +1,187 @@
+#ifndef __otbPolygonHilbertScheduler__
+#define __otbPolygonHilbertScheduler__
+
+#include <vector>
+#include <algorithm>
+#include "itkIntTypes.h"
+#include "otbSamplingWindow.h"
+#include "otbOGRDataSourceWrapper.h"
+
+namespace otb
+{
+
+// Polygon-driven traversal of an image. The features are sorted by the Hilbert
+// key of their envelope centre, nearby small features are grouped into read
+// windows of at most sizeTiles x sizeTiles pixels, and every big feature gets
+// its own bounding window. Each feature is thus processed in one window only,
+// and only the areas covered by features are read.
+class PolygonHilbertScheduler
+{
+public:
+  typedef itk::ImageRegion<2> RegionType;
+
+  PolygonHilbertScheduler() : m_SizeTiles(200), m_LineBuffer(0) {}
+
+  // Maximum side of a window grouping small features
+  void SetSizeTiles(unsigned long sizeTiles)
+  {
+    m_SizeTiles = sizeTiles;
+  }
+
+  // Line strings are processed as buffers of this width (map units)
+  void SetLineBuffer(double lineBuffer)
+  {
+    m_LineBuffer = lineBuffer;
+  }
+
+  // Register a feature with its bounding region in image index space
+  void AddFeature(long fid, const RegionType& region)
+  {
+    FeatureEntry entry;
+    entry.fid = fid;
+    entry.region = region;
+    entry.key = 0;
+    m_Features.push_back(entry);
+  }
+
+  // Scan the layer once over the image extent and register every feature
+  // whose envelope intersects the image
+  template <class TImage>
+  void AddLayer(const TImage* image, otb::ogr::Layer& layer)
+  {
+    std::vector<long> fids;
+    std::vector<RegionType> regions;
+    ScanLayerEnvelopes(image, layer, m_LineBuffer, fids, regions);
+    for(unsigned long i = 0; i < fids.size(); ++i)
+    {
+      AddFeature(fids[i], regions[i]);
+    }
+  }
+
+  // Build the read windows, in Hilbert order of their features
+  SamplingWindowList GenerateWindows()
+  {
+    SamplingWindowList windows;
+    if(m_Features.empty())
+    {
+      return windows;
+    }
+
+    // Hilbert curve covering the bounding box of all the features
+    RegionType extent = m_Features[0].region;
+    for(std::vector<FeatureEntry>::const_iterator it = m_Features.begin(); it != m_Features.end(); ++it)
+    {
+      extent = Union(extent, it->region);
+    }
+    itk::uint64_t order = 1;
+    while(order < extent.GetSize()[0] || order < extent.GetSize()[1])
+    {
+      order *= 2;
+    }
+
+    for(std::vector<FeatureEntry>::iterator it = m_Features.begin(); it != m_Features.end(); ++it)
+    {
+      itk::uint64_t x = (2*(it->region.GetIndex()[0] - extent.GetIndex()[0]) + it->region.GetSize()[0]) / 2;
+      itk::uint64_t y = (2*(it->region.GetIndex()[1] - extent.GetIndex()[1]) + it->region.GetSize()[1]) / 2;
+      it->key = HilbertKey(order, x, y);
+    }
+    std::stable_sort(m_Features.begin(), m_Features.end(), CompareKey);
+
+    SamplingWindow current;
+    for(std::vector<FeatureEntry>::const_iterator it = m_Features.begin(); it != m_Features.end(); ++it)
+    {
+      // Big feature: processed alone over its own bounding window
+      if(it->region.GetSize()[0] > m_SizeTiles || it->region.GetSize()[1] > m_SizeTiles)
+      {
+        SamplingWindow big;
+        big.region = it->region;
+        big.fids.push_back(it->fid);
+        windows.push_back(big);
+        continue;
+      }
+
+      if(!current.fids.empty())
+      {
+        RegionType merged = Union(current.region, it->region);
+        if(merged.GetSize()[0] <= m_SizeTiles && merged.GetSize()[1] <= m_SizeTiles)
+        {
+          current.region = merged;
+          current.fids.push_back(it->fid);
+          continue;
+        }
+        windows.push_back(current);
+        current.fids.clear();
+      }
+      current.region = it->region;
+      current.fids.push_back(it->fid);
+    }
+    if(!current.fids.empty())
+    {
+      windows.push_back(current);
+    }
+
+    return windows;
+  }
+
+  // Distance along the Hilbert curve of side order (a power of two) of the cell (x, y)
+  static itk::uint64_t HilbertKey(itk::uint64_t order, itk::uint64_t x, itk::uint64_t y)
+  {
+    itk::uint64_t key = 0;
+    for(itk::uint64_t s = order/2; s > 0; s /= 2)
+    {
+      itk::uint64_t rx = (x & s) > 0 ? 1 : 0;
+      itk::uint64_t ry = (y & s) > 0 ? 1 : 0;
+      key += s * s * ((3 * rx) ^ ry);
+
+      // Rotate the quadrant
+      if(ry == 0)
+      {
+        if(rx == 1)
+        {
+          x = order - 1 - x;
+          y = order - 1 - y;
+        }
+        std::swap(x, y);
+      }
+    }
+    return key;
+  }
+
+private:
+  struct FeatureEntry
+  {
+    long fid;
+    RegionType region;
+    itk::uint64_t key;
+  };
+
+  static bool CompareKey(const FeatureEntry& a, const FeatureEntry& b)
+  {
+    return a.key < b.key;
+  }
+
+  static RegionType Union(const RegionType& a, const RegionType& b)
+  {
+    RegionType::IndexType start;
+    RegionType::SizeType size;
+    for(unsigned int dim = 0; dim < 2; ++dim)
+    {
+      long lower = std::min(a.GetIndex()[dim], b.GetIndex()[dim]);
+      long upper = std::max(a.GetUpperIndex()[dim], b.GetUpperIndex()[dim]);
+      start[dim] = lower;
+      size[dim] = upper - lower + 1;
+    }
+    RegionType region;
+    region.SetIndex(start);
+    region.SetSize(size);
+    return region;
+  }
+
+  unsigned long m_SizeTiles;
+  double m_LineBuffer;
+  std::vector<FeatureEntry> m_Features;
+};
+
+} // namespace otb
+
+#endif
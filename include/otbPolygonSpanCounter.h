@@ -0,0 +1,148 @@
+#ifndef __otbPolygonSpanCounter__
+#define __otbPolygonSpanCounter__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "itkImageRegion.h"
+#include "itkIntTypes.h"
+#include "ogr_geometry.h"
+
+namespace otb
+{
+
+// Run of pixels of one image row whose centres are inside a geometry, in the
+// index space of the image: columns [begin, end)
+struct PixelSpan
+{
+  long row;
+  long begin;
+  long end;
+};
+
+typedef std::vector<PixelSpan> PixelSpanList;
+
+// Edges of the rings of a polygon or multipolygon, as (x1, y1, x2, y2)
+inline void CollectRingEdges(const OGRGeometry* geom, std::vector<double>& edges)
+{
+  OGRwkbGeometryType type = wkbFlatten(geom->getGeometryType());
+  if(type == wkbMultiPolygon)
+  {
+    const OGRMultiPolygon* multiPolygon = static_cast<const OGRMultiPolygon*>(geom);
+    for(int i = 0; i < multiPolygon->getNumGeometries(); ++i)
+    {
+      CollectRingEdges(multiPolygon->getGeometryRef(i), edges);
+    }
+    return;
+  }
+  if(type != wkbPolygon)
+  {
+    return;
+  }
+
+  const OGRPolygon* polygon = static_cast<const OGRPolygon*>(geom);
+  std::vector<const OGRLinearRing*> rings;
+  rings.push_back(polygon->getExteriorRing());
+  for(int i = 0; i < polygon->getNumInteriorRings(); ++i)
+  {
+    rings.push_back(polygon->getInteriorRing(i));
+  }
+  for(unsigned int r = 0; r < rings.size(); ++r)
+  {
+    if(!rings[r])
+    {
+      continue;
+    }
+    int nbPoints = rings[r]->getNumPoints();
+    for(int p = 0; p + 1 < nbPoints; ++p)
+    {
+      edges.push_back(rings[r]->getX(p));
+      edges.push_back(rings[r]->getY(p));
+      edges.push_back(rings[r]->getX(p+1));
+      edges.push_back(rings[r]->getY(p+1));
+    }
+  }
+}
+
+// Spans of the pixel centres inside a polygon or multipolygon, over a region
+// of the image (usually the bounding region of the geometry, cropped to the
+// image), computed from the geometry only: each row of pixel centres is
+// intersected with the ring edges and the crossings are paired (even-odd
+// rule, so holes are excluded). A centre on a left boundary is inside, on a
+// right one outside, so adjacent polygons never count a pixel twice.
+template <class TImage>
+PixelSpanList ComputeGeometrySpans(const TImage* image, const OGRGeometry* geom, const itk::ImageRegion<2>& region)
+{
+  PixelSpanList spans;
+  std::vector<double> edges;
+  CollectRingEdges(geom, edges);
+  if(edges.empty())
+  {
+    return spans;
+  }
+
+  const double originX = image->GetOrigin()[0];
+  const double originY = image->GetOrigin()[1];
+  const double spacingX = image->GetSpacing()[0];
+  const double spacingY = image->GetSpacing()[1];
+  const long firstColumn = region.GetIndex()[0];
+  const long endColumn = firstColumn + static_cast<long>(region.GetSize()[0]);
+
+  std::vector<double> crossings;
+  for(long row = region.GetIndex()[1]; row < region.GetIndex()[1] + static_cast<long>(region.GetSize()[1]); ++row)
+  {
+    double y = originY + row * spacingY;
+    crossings.clear();
+    for(unsigned long e = 0; e < edges.size(); e += 4)
+    {
+      double x1 = edges[e], y1 = edges[e+1], x2 = edges[e+2], y2 = edges[e+3];
+      if((y1 <= y) != (y2 <= y))
+      {
+        crossings.push_back(x1 + (y - y1) * (x2 - x1) / (y2 - y1));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    for(unsigned long c = 0; c + 1 < crossings.size(); c += 2)
+    {
+      // Columns whose centre x satisfies crossings[c] <= x < crossings[c+1]
+      long begin, end;
+      if(spacingX > 0)
+      {
+        begin = static_cast<long>(std::ceil((crossings[c] - originX) / spacingX));
+        end = static_cast<long>(std::ceil((crossings[c+1] - originX) / spacingX));
+      }
+      else
+      {
+        begin = static_cast<long>(std::floor((crossings[c+1] - originX) / spacingX)) + 1;
+        end = static_cast<long>(std::floor((crossings[c] - originX) / spacingX)) + 1;
+      }
+      begin = std::max(begin, firstColumn);
+      end = std::min(end, endColumn);
+      if(begin < end)
+      {
+        PixelSpan span;
+        span.row = row;
+        span.begin = begin;
+        span.end = end;
+        spans.push_back(span);
+      }
+    }
+  }
+  return spans;
+}
+
+// Number of pixels of a list of spans
+inline itk::uint64_t CountSpanPixels(const PixelSpanList& spans)
+{
+  itk::uint64_t count = 0;
+  for(PixelSpanList::const_iterator it = spans.begin(); it != spans.end(); ++it)
+  {
+    count += it->end - it->begin;
+  }
+  return count;
+}
+
+} // namespace otb
+
+#endif
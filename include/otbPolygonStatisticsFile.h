@@ -0,0 +1,683 @@
+#ifndef __otbPolygonStatisticsFile__
+#define __otbPolygonStatisticsFile__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "itkMacro.h"
+#include "itkIntTypes.h"
+#include "otbBandStatistics.h"
+#include "otbQuantileSketch.h"
+#include "otb_tinyxml.h"
+
+namespace otb
+{
+
+// Per-polygon and per-class pixel counts of an image analysis, stored in a
+// compact binary file (native byte order):
+//
+//   header   magic "OTBPSTAT", version, number of bands, number of polygons,
+//            number of classes, checksum of the payload (64 bits FNV-1a)
+//   payload  FIDs of the polygons (int64, sorted),
+//            pixel counts of the polygons (uint64, same order),
+//            classes as (name int64, pixel count uint64) pairs, sorted,
+//            band statistics of the classes then of the polygons, as
+//            (mean, M2, min, max) doubles per band; absent with 0 bands,
+//            optionally the quantile sketches of the classes, in the order of
+//            the class table: number of bands (uint32), then one serialized
+//            QuantileSketch per band
+//
+// The file is memory-mapped when read, and polygons are looked up by binary
+// search, or directly when the FIDs are contiguous. The XML analysis files
+// are still read, and can still be written as an export.
+class PolygonStatisticsFile
+{
+public:
+  typedef itk::int64_t                         FIDType;
+  typedef itk::uint64_t                        CountType;
+  typedef std::map<itk::int64_t, CountType>    ClassCountMap;
+  typedef std::map<itk::int64_t, BandStatistics> ClassStatisticsMap;
+
+  PolygonStatisticsFile() :
+    m_Mapped(NULL),
+    m_MappedSize(0),
+    m_NumberOfPolygons(0),
+    m_NumberOfBands(0),
+    m_FIDs(NULL),
+    m_Counts(NULL),
+    m_PolygonStatistics(NULL)
+  {
+  }
+
+  ~PolygonStatisticsFile()
+  {
+    Close();
+  }
+
+  // True if the file starts with the binary magic
+  static bool IsBinary(const std::string& filename)
+  {
+    char magic[8];
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, Magic(), sizeof(magic)) == 0;
+  }
+
+  // Write the counts in the binary format
+  template <class TClassMap, class TPolygonMap>
+  static void Write(const std::string& filename, const TClassMap& classCounts, const TPolygonMap& polygonCounts)
+  {
+    Write(filename, classCounts, polygonCounts, std::map<int, BandStatistics>(), std::map<unsigned long, BandStatistics>());
+  }
+
+  // Write the counts and the band statistics of the classes and polygons in
+  // the binary format; the statistics are left out when both maps are empty
+  template <class TClassMap, class TPolygonMap, class TClassStatisticsMap, class TPolygonStatisticsMap>
+  static void Write(const std::string& filename, const TClassMap& classCounts, const TPolygonMap& polygonCounts,
+                    const TClassStatisticsMap& classStatistics, const TPolygonStatisticsMap& polygonStatistics)
+  {
+    Write(filename, classCounts, polygonCounts, classStatistics, polygonStatistics, ClassQuantileSketchMap());
+  }
+
+  // Same, with the quantile sketches of the classes, left out when empty
+  template <class TClassMap, class TPolygonMap, class TClassStatisticsMap, class TPolygonStatisticsMap>
+  static void Write(const std::string& filename, const TClassMap& classCounts, const TPolygonMap& polygonCounts,
+                    const TClassStatisticsMap& classStatistics, const TPolygonStatisticsMap& polygonStatistics,
+                    const ClassQuantileSketchMap& classSketches)
+  {
+    std::vector<FIDType> fids;
+    std::vector<CountType> counts;
+    for(typename TPolygonMap::const_iterator it = polygonCounts.begin(); it != polygonCounts.end(); ++it)
+    {
+      fids.push_back(static_cast<FIDType>(it->first));
+      counts.push_back(static_cast<CountType>(it->second));
+    }
+    std::vector<FIDType> classes;
+    for(typename TClassMap::const_iterator it = classCounts.begin(); it != classCounts.end(); ++it)
+    {
+      classes.push_back(static_cast<FIDType>(it->first));
+      classes.push_back(static_cast<FIDType>(it->second));
+    }
+
+    unsigned int nbBands = 0;
+    if(!classStatistics.empty())
+    {
+      nbBands = classStatistics.begin()->second.GetNumberOfBands();
+    }
+    else if(!polygonStatistics.empty())
+    {
+      nbBands = polygonStatistics.begin()->second.GetNumberOfBands();
+    }
+    std::vector<double> statistics;
+    if(nbBands > 0)
+    {
+      for(typename TClassMap::const_iterator it = classCounts.begin(); it != classCounts.end(); ++it)
+      {
+        typename TClassStatisticsMap::const_iterator found = classStatistics.find(it->first);
+        AppendStatistics(statistics, found != classStatistics.end() ? found->second : BandStatistics(nbBands));
+      }
+      for(typename TPolygonMap::const_iterator it = polygonCounts.begin(); it != polygonCounts.end(); ++it)
+      {
+        typename TPolygonStatisticsMap::const_iterator found = polygonStatistics.find(it->first);
+        AppendStatistics(statistics, found != polygonStatistics.end() ? found->second : BandStatistics(nbBands));
+      }
+    }
+
+    std::vector<char> sketches;
+    if(!classSketches.empty())
+    {
+      for(typename TClassMap::const_iterator it = classCounts.begin(); it != classCounts.end(); ++it)
+      {
+        ClassQuantileSketchMap::const_iterator found = classSketches.find(it->first);
+        itk::uint32_t nbSketches = found != classSketches.end() ? found->second.size() : 0;
+        const char* bytes = reinterpret_cast<const char*>(&nbSketches);
+        sketches.insert(sketches.end(), bytes, bytes + sizeof(nbSketches));
+        for(unsigned int b = 0; b < nbSketches; ++b)
+        {
+          found->second[b].Serialize(sketches);
+        }
+      }
+    }
+
+    Header header;
+    std::memcpy(header.magic, Magic(), sizeof(header.magic));
+    header.version = 1;
+    header.numberOfBands = nbBands;
+    header.numberOfPolygons = fids.size();
+    header.numberOfClasses = classCounts.size();
+    header.checksum = Checksum(Checksum(Checksum(Checksum(Checksum(Seed(), fids), counts), classes), statistics), sketches);
+
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    WriteColumn(file, fids);
+    WriteColumn(file, counts);
+    WriteColumn(file, classes);
+    WriteColumn(file, statistics);
+    WriteColumn(file, sketches);
+    if(!file)
+    {
+      itkGenericExceptionMacro(<< "Unable to write the statistics file " << filename);
+    }
+  }
+
+  // Write the counts in the XML analysis format. The standard errors of the
+  // estimated class counts, if any, are written next to them (stderr), the
+  // unknown (NaN) ones being left out.
+  template <class TClassMap, class TPolygonMap>
+  static void WriteXML(const std::string& filename, const TClassMap& classCounts, const TPolygonMap& polygonCounts,
+                       const std::map<int, double>* classErrors = NULL)
+  {
+    TiXmlDocument doc;
+    TiXmlDeclaration* decl = new TiXmlDeclaration("1.0", "", "");
+    doc.LinkEndChild(decl);
+
+    TiXmlElement * root = new TiXmlElement("ImageAnalysis");
+    doc.LinkEndChild(root);
+
+    TiXmlElement * featureImage = new TiXmlElement("Image");
+    root->LinkEndChild(featureImage);
+    for(typename TClassMap::const_iterator iClass = classCounts.begin(); iClass != classCounts.end(); ++iClass)
+    {
+      TiXmlElement * featureClass = new TiXmlElement("Class");
+      featureClass->SetDoubleAttribute("name", static_cast<double>(iClass->first));
+      featureClass->SetDoubleAttribute("value", static_cast<double>(iClass->second));
+      if(classErrors)
+      {
+        std::map<int, double>::const_iterator error = classErrors->find(static_cast<int>(iClass->first));
+        if(error != classErrors->end() && error->second == error->second)
+        {
+          featureClass->SetDoubleAttribute("stderr", error->second);
+        }
+      }
+      featureImage->LinkEndChild(featureClass);
+    }
+
+    TiXmlElement * featurePolygon = new TiXmlElement("Polygon");
+    root->LinkEndChild(featurePolygon);
+    for(typename TPolygonMap::const_iterator iPolygon = polygonCounts.begin(); iPolygon != polygonCounts.end(); ++iPolygon)
+    {
+      TiXmlElement * featureId = new TiXmlElement("Id");
+      featureId->SetDoubleAttribute("name", static_cast<double>(iPolygon->first));
+      featureId->SetDoubleAttribute("value", static_cast<double>(iPolygon->second));
+      featurePolygon->LinkEndChild(featureId);
+    }
+
+    doc.SaveFile(filename.c_str());
+  }
+
+  // Open a binary or XML analysis file. The binary file is memory-mapped and
+  // its checksum verified; the XML file is parsed in memory.
+  void Open(const std::string& filename)
+  {
+    Close();
+    if(IsBinary(filename))
+    {
+      OpenBinary(filename);
+    }
+    else
+    {
+      OpenXML(filename);
+    }
+  }
+
+  // Counts computed in memory, looked up as those of an opened file, without
+  // going through a file
+  template <class TClassMap, class TPolygonMap>
+  void Assign(const TClassMap& classCounts, const TPolygonMap& polygonCounts)
+  {
+    Close();
+    for(typename TClassMap::const_iterator it = classCounts.begin(); it != classCounts.end(); ++it)
+    {
+      m_ClassCounts[static_cast<itk::int64_t>(it->first)] = static_cast<CountType>(it->second);
+    }
+    std::map<FIDType, CountType> polygons;
+    for(typename TPolygonMap::const_iterator it = polygonCounts.begin(); it != polygonCounts.end(); ++it)
+    {
+      polygons[static_cast<FIDType>(it->first)] = static_cast<CountType>(it->second);
+    }
+    AssignPolygons(polygons);
+  }
+
+  // Read only the class table of an analysis file, with the band statistics
+  // and the quantile sketches of the classes when present. For a binary file
+  // this reads the header, the table and the sketches, without touching the
+  // polygon columns; the checksum, which covers them, is therefore not verified.
+  static void ReadClassTable(const std::string& filename, ClassCountMap& classCounts, ClassStatisticsMap& classStatistics,
+                             ClassQuantileSketchMap& classSketches)
+  {
+    if(!IsBinary(filename))
+    {
+      PolygonStatisticsFile stats;
+      stats.Open(filename);
+      classCounts = stats.GetClassCounts();
+      classStatistics = stats.GetClassStatistics();
+      classSketches = stats.GetClassSketches();
+      return;
+    }
+
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    Header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.seekg(0, std::ios::end);
+    unsigned long size = static_cast<unsigned long>(file.tellg());
+    if(!file || header.version != 1 || !HeaderFits(header, size))
+    {
+      itkGenericExceptionMacro(<< "Invalid statistics file " << filename);
+    }
+
+    // Class table, class statistics and sketches are contiguous, up to the end of the file
+    unsigned long tableSize = size - sizeof(header) - 2*header.numberOfPolygons*sizeof(FIDType)
+                            - header.numberOfPolygons*header.numberOfBands*4*sizeof(double);
+    unsigned long sketchesSize = size - sizeof(header) - PayloadSize(header);
+    std::vector<FIDType> table(tableSize/sizeof(FIDType) + 1);
+    file.seekg(sizeof(header) + 2*header.numberOfPolygons*sizeof(FIDType), std::ios::beg);
+    file.read(reinterpret_cast<char*>(&table[0]), tableSize - sketchesSize);
+    if(sketchesSize > 0)
+    {
+      // Skip the polygon statistics
+      file.seekg(size - sketchesSize, std::ios::beg);
+      file.read(reinterpret_cast<char*>(&table[0]) + tableSize - sketchesSize, sketchesSize);
+    }
+    if(!file)
+    {
+      itkGenericExceptionMacro(<< "Truncated statistics file " << filename);
+    }
+
+    classCounts.clear();
+    classStatistics.clear();
+    classSketches.clear();
+    const char* bytes = reinterpret_cast<const char*>(&table[0]);
+    ReadClasses(header, bytes, classCounts, classStatistics);
+    ReadSketches(header, bytes, bytes + tableSize - sketchesSize, sketchesSize, classSketches);
+  }
+
+  // Read only the class counts of an analysis file
+  static ClassCountMap ReadClassCounts(const std::string& filename)
+  {
+    ClassCountMap classCounts;
+    ClassStatisticsMap classStatistics;
+    ClassQuantileSketchMap classSketches;
+    ReadClassTable(filename, classCounts, classStatistics, classSketches);
+    return classCounts;
+  }
+
+  void Close()
+  {
+#if !defined(_WIN32)
+    if(m_Mapped)
+    {
+      munmap(m_Mapped, m_MappedSize);
+    }
+#endif
+    m_Mapped = NULL;
+    m_MappedSize = 0;
+    m_NumberOfPolygons = 0;
+    m_NumberOfBands = 0;
+    m_FIDs = NULL;
+    m_Counts = NULL;
+    m_PolygonStatistics = NULL;
+    m_Buffer.clear();
+    m_ClassCounts.clear();
+    m_ClassStatistics.clear();
+    m_ClassSketches.clear();
+  }
+
+  const ClassCountMap& GetClassCounts() const
+  {
+    return m_ClassCounts;
+  }
+
+  // Band statistics of the classes, empty if the file has none
+  const ClassStatisticsMap& GetClassStatistics() const
+  {
+    return m_ClassStatistics;
+  }
+
+  // Quantile sketches of the bands of the classes, empty if the file has none
+  const ClassQuantileSketchMap& GetClassSketches() const
+  {
+    return m_ClassSketches;
+  }
+
+  // Number of bands of the statistics, 0 if the file has none
+  unsigned int GetNumberOfBands() const
+  {
+    return m_NumberOfBands;
+  }
+
+  unsigned long GetNumberOfPolygons() const
+  {
+    return m_NumberOfPolygons;
+  }
+
+  FIDType GetPolygonFID(unsigned long index) const
+  {
+    return m_FIDs[index];
+  }
+
+  CountType GetPolygonCount(unsigned long index) const
+  {
+    return m_Counts[index];
+  }
+
+  BandStatistics GetPolygonStatistics(unsigned long index) const
+  {
+    BandStatistics statistics(m_NumberOfBands);
+    ReadStatistics(m_PolygonStatistics + index*m_NumberOfBands*4, m_Counts[index], statistics);
+    return statistics;
+  }
+
+  // Index of the polygon, -1 if it is not in the file
+  long FindPolygon(FIDType fid) const
+  {
+    if(m_NumberOfPolygons == 0)
+    {
+      return -1;
+    }
+
+    // Contiguous FIDs: direct lookup
+    if(m_FIDs[m_NumberOfPolygons-1] - m_FIDs[0] == static_cast<FIDType>(m_NumberOfPolygons - 1))
+    {
+      if(fid < m_FIDs[0] || fid > m_FIDs[m_NumberOfPolygons-1])
+      {
+        return -1;
+      }
+      return static_cast<long>(fid - m_FIDs[0]);
+    }
+
+    const FIDType* found = std::lower_bound(m_FIDs, m_FIDs + m_NumberOfPolygons, fid);
+    if(found == m_FIDs + m_NumberOfPolygons || *found != fid)
+    {
+      return -1;
+    }
+    return static_cast<long>(found - m_FIDs);
+  }
+
+  // Pixel count of the polygon, 0 if it is not in the file
+  CountType GetCountOfPolygon(FIDType fid) const
+  {
+    long index = FindPolygon(fid);
+    return index < 0 ? 0 : m_Counts[index];
+  }
+
+private:
+  struct Header
+  {
+    char magic[8];
+    itk::uint32_t version;
+    itk::uint32_t numberOfBands;
+    itk::uint64_t numberOfPolygons;
+    itk::uint64_t numberOfClasses;
+    itk::uint64_t checksum;
+  };
+
+  static const char* Magic()
+  {
+    return "OTBPSTAT";
+  }
+
+  static itk::uint64_t Seed()
+  {
+    return 14695981039346656037ULL;
+  }
+
+  static itk::uint64_t Checksum(itk::uint64_t hash, const char* bytes, unsigned long size)
+  {
+    for(unsigned long i = 0; i < size; ++i)
+    {
+      hash ^= static_cast<unsigned char>(bytes[i]);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  template <class T>
+  static itk::uint64_t Checksum(itk::uint64_t hash, const std::vector<T>& column)
+  {
+    return column.empty() ? hash : Checksum(hash, reinterpret_cast<const char*>(&column[0]), column.size()*sizeof(T));
+  }
+
+  // The tables of the header fit in a file of size bytes, checked before
+  // PayloadSize so that the counts of a corrupt header cannot overflow it
+  static bool HeaderFits(const Header& header, unsigned long size)
+  {
+    if(size < sizeof(header))
+    {
+      return false;
+    }
+    unsigned long left = size - sizeof(header);
+    if(header.numberOfPolygons > left / (2*sizeof(FIDType)) || header.numberOfClasses > left / (2*sizeof(FIDType))
+       || header.numberOfBands > left / (4*sizeof(double)))
+    {
+      return false;
+    }
+    if(header.numberOfBands > 0
+       && header.numberOfPolygons + header.numberOfClasses > left / (header.numberOfBands * 4 * sizeof(double)))
+    {
+      return false;
+    }
+    return PayloadSize(header) <= left;
+  }
+
+  static unsigned long PayloadSize(const Header& header)
+  {
+    return (2*header.numberOfPolygons + 2*header.numberOfClasses) * sizeof(FIDType)
+         + (header.numberOfClasses + header.numberOfPolygons) * header.numberOfBands * 4 * sizeof(double);
+  }
+
+  static void AppendStatistics(std::vector<double>& column, const BandStatistics& statistics)
+  {
+    for(unsigned int b = 0; b < statistics.GetNumberOfBands(); ++b)
+    {
+      column.push_back(statistics.GetMean(b));
+      column.push_back(statistics.GetM2(b));
+      column.push_back(statistics.GetMinimum(b));
+      column.push_back(statistics.GetMaximum(b));
+    }
+  }
+
+  static void ReadStatistics(const double* values, CountType count, BandStatistics& statistics)
+  {
+    for(unsigned int b = 0; b < statistics.GetNumberOfBands(); ++b)
+    {
+      statistics.Set(count, b, values[4*b], values[4*b+1], values[4*b+2], values[4*b+3]);
+    }
+  }
+
+  // Class table, followed by the class statistics
+  static void ReadClasses(const Header& header, const char* table, ClassCountMap& classCounts, ClassStatisticsMap& classStatistics)
+  {
+    const FIDType* classes = reinterpret_cast<const FIDType*>(table);
+    const double* statistics = reinterpret_cast<const double*>(table + 2*header.numberOfClasses*sizeof(FIDType));
+    for(unsigned long i = 0; i < header.numberOfClasses; ++i)
+    {
+      classCounts[classes[2*i]] = static_cast<CountType>(classes[2*i+1]);
+      if(header.numberOfBands > 0)
+      {
+        BandStatistics& classStats = classStatistics[classes[2*i]];
+        classStats.Reset(header.numberOfBands);
+        ReadStatistics(statistics + i*header.numberOfBands*4, classes[2*i+1], classStats);
+      }
+    }
+  }
+
+  // Sketches of the classes, in the order of the class table
+  static void ReadSketches(const Header& header, const char* classes, const char* data, unsigned long size,
+                           ClassQuantileSketchMap& classSketches)
+  {
+    if(size == 0)
+    {
+      return;
+    }
+    const char* end = data + size;
+    for(unsigned long i = 0; i < header.numberOfClasses; ++i)
+    {
+      FIDType className;
+      std::memcpy(&className, classes + 2*i*sizeof(FIDType), sizeof(className));
+      itk::uint32_t nbSketches;
+      // A sketch takes at least its k, number of levels and count
+      const unsigned long minSketchSize = 2*sizeof(itk::uint32_t) + sizeof(itk::uint64_t);
+      if(static_cast<unsigned long>(end - data) < sizeof(nbSketches))
+      {
+        itkGenericExceptionMacro(<< "Truncated quantile sketches in the statistics file");
+      }
+      std::memcpy(&nbSketches, data, sizeof(nbSketches));
+      data += sizeof(nbSketches);
+      if(nbSketches > static_cast<unsigned long>(end - data) / minSketchSize)
+      {
+        itkGenericExceptionMacro(<< "Invalid quantile sketches in the statistics file : " << nbSketches << " bands");
+      }
+      std::vector<QuantileSketch>& sketches = classSketches[className];
+      sketches.resize(nbSketches);
+      for(unsigned int b = 0; b < nbSketches; ++b)
+      {
+        data = sketches[b].Deserialize(data, end);
+      }
+    }
+  }
+
+  template <class T>
+  static void WriteColumn(std::ofstream& file, const std::vector<T>& column)
+  {
+    if(!column.empty())
+    {
+      file.write(reinterpret_cast<const char*>(&column[0]), column.size()*sizeof(T));
+    }
+  }
+
+  void OpenBinary(const std::string& filename)
+  {
+    const char* bytes = NULL;
+    unsigned long size = 0;
+
+#if !defined(_WIN32)
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+      if(fd >= 0)
+      {
+        close(fd);
+      }
+      itkGenericExceptionMacro(<< "Unable to open the statistics file " << filename);
+    }
+    size = info.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+    {
+      itkGenericExceptionMacro(<< "Unable to map the statistics file " << filename);
+    }
+    m_Mapped = mapped;
+    m_MappedSize = size;
+    bytes = static_cast<const char*>(mapped);
+#else
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    file.seekg(0, std::ios::end);
+    size = static_cast<unsigned long>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    m_Buffer.resize(size / sizeof(FIDType) + 1);
+    file.read(reinterpret_cast<char*>(&m_Buffer[0]), size);
+    bytes = reinterpret_cast<const char*>(&m_Buffer[0]);
+#endif
+
+    Header header;
+    if(size < sizeof(header))
+    {
+      itkGenericExceptionMacro(<< "Truncated statistics file " << filename);
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+
+    if(header.version != 1 || !HeaderFits(header, size))
+    {
+      itkGenericExceptionMacro(<< "Invalid statistics file " << filename);
+    }
+    const char* payload = bytes + sizeof(header);
+    if(Checksum(Seed(), payload, size - sizeof(header)) != header.checksum)
+    {
+      itkGenericExceptionMacro(<< "Corrupted statistics file " << filename << " (checksum mismatch)");
+    }
+
+    m_NumberOfPolygons = header.numberOfPolygons;
+    m_NumberOfBands = header.numberOfBands;
+    m_FIDs = reinterpret_cast<const FIDType*>(payload);
+    m_Counts = reinterpret_cast<const CountType*>(payload + m_NumberOfPolygons*sizeof(FIDType));
+
+    const char* table = payload + 2*m_NumberOfPolygons*sizeof(FIDType);
+    ReadClasses(header, table, m_ClassCounts, m_ClassStatistics);
+    m_PolygonStatistics = reinterpret_cast<const double*>(table + 2*header.numberOfClasses*sizeof(FIDType)
+                                                          + header.numberOfClasses*m_NumberOfBands*4*sizeof(double));
+    ReadSketches(header, table, payload + PayloadSize(header), size - sizeof(header) - PayloadSize(header), m_ClassSketches);
+  }
+
+  void OpenXML(const std::string& filename)
+  {
+    TiXmlDocument doc(filename.c_str());
+    if(!doc.LoadFile() || !doc.FirstChildElement() || !doc.FirstChildElement()->FirstChildElement("Image"))
+    {
+      itkGenericExceptionMacro(<< "Unable to read the analysis file " << filename);
+    }
+    TiXmlElement* root = doc.FirstChildElement();
+
+    for(TiXmlElement* sample = root->FirstChildElement("Image")->FirstChildElement("Class"); sample != NULL; sample = sample->NextSiblingElement("Class"))
+    {
+      double name = 0, value = 0;
+      sample->QueryDoubleAttribute("name", &name);
+      sample->QueryDoubleAttribute("value", &value);
+      m_ClassCounts[static_cast<itk::int64_t>(name)] = static_cast<CountType>(value);
+    }
+
+    std::map<FIDType, CountType> polygons;
+    if(root->FirstChildElement("Polygon"))
+    {
+      for(TiXmlElement* sample = root->FirstChildElement("Polygon")->FirstChildElement("Id"); sample != NULL; sample = sample->NextSiblingElement("Id"))
+      {
+        double name = 0, value = 0;
+        sample->QueryDoubleAttribute("name", &name);
+        sample->QueryDoubleAttribute("value", &value);
+        polygons[static_cast<FIDType>(name)] = static_cast<CountType>(value);
+      }
+    }
+    AssignPolygons(polygons);
+  }
+
+  // FIDs and counts stored in the same buffer, as in the binary layout
+  void AssignPolygons(const std::map<FIDType, CountType>& polygons)
+  {
+    m_NumberOfPolygons = polygons.size();
+    m_Buffer.resize(2*m_NumberOfPolygons + 1);
+    unsigned long i = 0;
+    for(std::map<FIDType, CountType>::const_iterator it = polygons.begin(); it != polygons.end(); ++it, ++i)
+    {
+      m_Buffer[i] = it->first;
+      m_Buffer[m_NumberOfPolygons + i] = static_cast<FIDType>(it->second);
+    }
+    m_FIDs = &m_Buffer[0];
+    m_Counts = reinterpret_cast<const CountType*>(&m_Buffer[m_NumberOfPolygons]);
+  }
+
+  void* m_Mapped;
+  unsigned long m_MappedSize;
+  unsigned long m_NumberOfPolygons;
+  unsigned int m_NumberOfBands;
+  const FIDType* m_FIDs;
+  const CountType* m_Counts;
+  const double* m_PolygonStatistics;
+  std::vector<FIDType> m_Buffer;
+  ClassCountMap m_ClassCounts;
+  ClassStatisticsMap m_ClassStatistics;
+  ClassQuantileSketchMap m_ClassSketches;
+};
+
+} // namespace otb
+
+#endif
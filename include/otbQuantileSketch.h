@@ -0,0 +1,269 @@
+#ifndef __otbQuantileSketch__
+#define __otbQuantileSketch__
+
+#include <map>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "itkIntTypes.h"
+#include "itkMacro.h"
+
+namespace otb
+{
+
+// Bounded-memory quantile sketch of a stream of values (KLL). Values are
+// stored in levels of compactors: a full level is sorted and every other
+// value is promoted to the next level with twice the weight. The capacity of
+// the levels decreases geometrically from the top one, so the size of the
+// sketch is about 3k values whatever the number of values added, and the rank
+// error is about 1.7/k. Sketches built with the same k are merged by
+// concatenating their levels, which gives fleet-wide quantiles from per-image
+// sketches. The compactors use a deterministic coin, so runs are reproducible.
+class QuantileSketch
+{
+public:
+  explicit QuantileSketch(unsigned int k = 200) :
+    m_K(k),
+    m_Count(0),
+    m_Coin(0x9E3779B97F4A7C15ULL)
+  {
+    Grow();
+  }
+
+  void Add(double value)
+  {
+    m_Levels[0].push_back(value);
+    ++m_Count;
+    if(m_Levels[0].size() >= m_Capacities[0])
+    {
+      Compress();
+    }
+  }
+
+  // Merge a sketch over another set of values, built with the same k
+  void Merge(const QuantileSketch& other)
+  {
+    while(m_Levels.size() < other.m_Levels.size())
+    {
+      Grow();
+    }
+    for(unsigned int level = 0; level < other.m_Levels.size(); ++level)
+    {
+      m_Levels[level].insert(m_Levels[level].end(), other.m_Levels[level].begin(), other.m_Levels[level].end());
+    }
+    m_Count += other.m_Count;
+    Compress();
+  }
+
+  itk::uint64_t GetCount() const
+  {
+    return m_Count;
+  }
+
+  // Estimate of the q-quantile, q in [0, 1]
+  double GetQuantile(double q) const
+  {
+    std::vector<std::pair<double, itk::uint64_t> > items;
+    itk::uint64_t totalWeight = 0;
+    for(unsigned int level = 0; level < m_Levels.size(); ++level)
+    {
+      for(std::vector<double>::const_iterator it = m_Levels[level].begin(); it != m_Levels[level].end(); ++it)
+      {
+        items.push_back(std::make_pair(*it, static_cast<itk::uint64_t>(1) << level));
+        totalWeight += static_cast<itk::uint64_t>(1) << level;
+      }
+    }
+    if(items.empty())
+    {
+      return 0.;
+    }
+    std::sort(items.begin(), items.end());
+
+    double rank = std::min(std::max(q, 0.), 1.) * totalWeight;
+    itk::uint64_t cumulated = 0;
+    for(std::vector<std::pair<double, itk::uint64_t> >::const_iterator it = items.begin(); it != items.end(); ++it)
+    {
+      cumulated += it->second;
+      if(cumulated >= rank)
+      {
+        return it->first;
+      }
+    }
+    return items.back().first;
+  }
+
+  // Estimate of the fraction of the values below a value
+  double GetRank(double value) const
+  {
+    itk::uint64_t below = 0, totalWeight = 0;
+    for(unsigned int level = 0; level < m_Levels.size(); ++level)
+    {
+      for(std::vector<double>::const_iterator it = m_Levels[level].begin(); it != m_Levels[level].end(); ++it)
+      {
+        totalWeight += static_cast<itk::uint64_t>(1) << level;
+        if(*it < value)
+        {
+          below += static_cast<itk::uint64_t>(1) << level;
+        }
+      }
+    }
+    return totalWeight > 0 ? static_cast<double>(below) / totalWeight : 0.;
+  }
+
+  // Append the sketch to a buffer: k, number of levels, count, then the size
+  // and the values of each level
+  void Serialize(std::vector<char>& buffer) const
+  {
+    itk::uint32_t k = m_K;
+    itk::uint32_t nbLevels = m_Levels.size();
+    Append(buffer, &k, sizeof(k));
+    Append(buffer, &nbLevels, sizeof(nbLevels));
+    Append(buffer, &m_Count, sizeof(m_Count));
+    for(unsigned int level = 0; level < m_Levels.size(); ++level)
+    {
+      itk::uint64_t size = m_Levels[level].size();
+      Append(buffer, &size, sizeof(size));
+      if(size > 0)
+      {
+        Append(buffer, &m_Levels[level][0], size*sizeof(double));
+      }
+    }
+  }
+
+  // Read a sketch written by Serialize from the bytes [data, end), return
+  // the end of its data. A sketch running past end is an exception.
+  const char* Deserialize(const char* data, const char* end)
+  {
+    itk::uint32_t k, nbLevels;
+    Read(data, end, &k, sizeof(k));
+    Read(data, end, &nbLevels, sizeof(nbLevels));
+    Read(data, end, &m_Count, sizeof(m_Count));
+    // Every level holds at least its size
+    if(nbLevels > static_cast<unsigned long>(end - data) / sizeof(itk::uint64_t))
+    {
+      itkGenericExceptionMacro(<< "Invalid quantile sketch : " << nbLevels << " levels");
+    }
+
+    m_K = k;
+    m_Levels.clear();
+    m_Capacities.clear();
+    Grow();
+    while(m_Levels.size() < nbLevels)
+    {
+      Grow();
+    }
+    for(unsigned int level = 0; level < nbLevels; ++level)
+    {
+      itk::uint64_t size;
+      Read(data, end, &size, sizeof(size));
+      if(size > static_cast<unsigned long>(end - data) / sizeof(double))
+      {
+        itkGenericExceptionMacro(<< "Truncated quantile sketch");
+      }
+      m_Levels[level].resize(size);
+      if(size > 0)
+      {
+        Read(data, end, &m_Levels[level][0], size*sizeof(double));
+      }
+    }
+    return data;
+  }
+
+private:
+  static void Append(std::vector<char>& buffer, const void* data, unsigned long size)
+  {
+    const char* bytes = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+  }
+
+  static void Read(const char*& data, const char* end, void* value, unsigned long size)
+  {
+    if(static_cast<unsigned long>(end - data) < size)
+    {
+      itkGenericExceptionMacro(<< "Truncated quantile sketch");
+    }
+    std::memcpy(value, data, size);
+    data += size;
+  }
+
+  // Add a level on top, and update the capacities: k for the top level, 2/3
+  // of the level above for the others, at least 2
+  void Grow()
+  {
+    m_Levels.push_back(std::vector<double>());
+    m_Capacities.resize(m_Levels.size());
+    for(unsigned int level = 0; level < m_Levels.size(); ++level)
+    {
+      double capacity = std::ceil(m_K * std::pow(2./3., static_cast<double>(m_Levels.size() - level - 1)));
+      m_Capacities[level] = std::max(2ul, static_cast<unsigned long>(capacity));
+    }
+  }
+
+  // Compact every level over its capacity, from the bottom
+  void Compress()
+  {
+    for(unsigned int level = 0; level < m_Levels.size(); ++level)
+    {
+      if(m_Levels[level].size() < m_Capacities[level])
+      {
+        continue;
+      }
+      if(level + 1 == m_Levels.size())
+      {
+        Grow();
+      }
+
+      std::vector<double>& values = m_Levels[level];
+      std::sort(values.begin(), values.end());
+
+      // An odd value out stays at this level
+      unsigned long paired = values.size() - values.size() % 2;
+      unsigned long offset = NextCoin();
+      for(unsigned long i = offset; i < paired; i += 2)
+      {
+        m_Levels[level+1].push_back(values[i]);
+      }
+      values.erase(values.begin(), values.begin() + paired);
+    }
+  }
+
+  unsigned long NextCoin()
+  {
+    m_Coin ^= m_Coin << 13;
+    m_Coin ^= m_Coin >> 7;
+    m_Coin ^= m_Coin << 17;
+    return static_cast<unsigned long>(m_Coin >> 63);
+  }
+
+  unsigned int m_K;
+  itk::uint64_t m_Count;
+  itk::uint64_t m_Coin;
+  std::vector<std::vector<double> > m_Levels;
+  std::vector<unsigned long> m_Capacities;
+};
+
+// Quantile sketches of the bands of each class
+typedef std::map<itk::int64_t, std::vector<QuantileSketch> > ClassQuantileSketchMap;
+
+// Merge the sketches of a set of classes into another one
+inline void MergeClassQuantileSketches(ClassQuantileSketchMap& sketches, const ClassQuantileSketchMap& other)
+{
+  for(ClassQuantileSketchMap::const_iterator iClass = other.begin(); iClass != other.end(); ++iClass)
+  {
+    std::vector<QuantileSketch>& classSketches = sketches[iClass->first];
+    if(classSketches.empty())
+    {
+      classSketches = iClass->second;
+      continue;
+    }
+    for(unsigned int b = 0; b < classSketches.size() && b < iClass->second.size(); ++b)
+    {
+      classSketches[b].Merge(iClass->second[b]);
+    }
+  }
+}
+
+} // namespace otb
+
+#endif
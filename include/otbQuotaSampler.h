@@ -0,0 +1,133 @@
+#ifndef __otbQuotaSampler__
+#define __otbQuotaSampler__
+
+#include <map>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include "itkIntTypes.h"
+
+namespace otb
+{
+
+// Random sampling of a fixed number of pixels per class, pixel after pixel,
+// with selection sampling (Knuth's algorithm S): a pixel is selected with the
+// probability (samples still needed) / (pixels of the class not seen yet).
+// Every subset of the class pixels of the requested size is then equally
+// likely, whatever the order in which the pixels are visited, so the read
+// windows can be processed in a random order and the reading stopped as soon
+// as every class is complete: its quota is met, or no pixel of it is left.
+class QuotaSampler
+{
+public:
+  // Quota of a class with population pixels (from the analysis)
+  void SetQuota(int className, itk::uint64_t samples, itk::uint64_t population)
+  {
+    ClassQuota& quota = m_Quotas[className];
+    quota.needed = std::min(samples, population);
+    quota.remaining = population;
+  }
+
+  // Visit a pixel of a class, with a uniform variate in [0, 1): returns
+  // whether the pixel is sampled
+  bool Select(int className, double uniform)
+  {
+    std::map<int, ClassQuota>::iterator found = m_Quotas.find(className);
+    if(found == m_Quotas.end() || found->second.needed == 0)
+    {
+      return false;
+    }
+
+    ClassQuota& quota = found->second;
+    // The analysis may have counted fewer pixels than there are: the
+    // remaining ones are then all taken
+    bool selected = quota.remaining <= quota.needed ||
+      uniform * quota.remaining < quota.needed;
+    if(quota.remaining > 0)
+    {
+      --quota.remaining;
+    }
+    if(selected)
+    {
+      --quota.needed;
+    }
+    return selected;
+  }
+
+  // The class needs no more samples, or has no pixel left
+  bool IsClassComplete(int className) const
+  {
+    std::map<int, ClassQuota>::const_iterator found = m_Quotas.find(className);
+    return found == m_Quotas.end() || found->second.needed == 0 || found->second.remaining == 0;
+  }
+
+  bool IsComplete() const
+  {
+    for(std::map<int, ClassQuota>::const_iterator it = m_Quotas.begin(); it != m_Quotas.end(); ++it)
+    {
+      if(it->second.needed > 0 && it->second.remaining > 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Samples still needed in a class
+  itk::uint64_t GetNeeded(int className) const
+  {
+    std::map<int, ClassQuota>::const_iterator found = m_Quotas.find(className);
+    return found == m_Quotas.end() ? 0 : found->second.needed;
+  }
+
+  // State of the quotas, to resume a run : number of classes, then class,
+  // samples needed and pixels remaining
+  void WriteState(std::ostream& os) const
+  {
+    os << m_Quotas.size();
+    for(std::map<int, ClassQuota>::const_iterator it = m_Quotas.begin(); it != m_Quotas.end(); ++it)
+    {
+      os << " " << it->first << " " << it->second.needed << " " << it->second.remaining;
+    }
+  }
+
+  void ReadState(std::istream& is)
+  {
+    m_Quotas.clear();
+    unsigned long nbClasses = 0;
+    is >> nbClasses;
+    for(unsigned long i = 0; i < nbClasses && is; ++i)
+    {
+      int className = 0;
+      is >> className;
+      ClassQuota& quota = m_Quotas[className];
+      is >> quota.needed >> quota.remaining;
+    }
+  }
+
+private:
+  struct ClassQuota
+  {
+    itk::uint64_t needed;
+    itk::uint64_t remaining;
+  };
+
+  std::map<int, ClassQuota> m_Quotas;
+};
+
+// Shuffle a list (Fisher-Yates) with a seeded generator, such as the
+// Mersenne Twister of the applications
+template <class TList, class TGenerator>
+void ShuffleList(TList& list, TGenerator* generator)
+{
+  for(unsigned long i = list.size(); i > 1; --i)
+  {
+    unsigned long j = static_cast<unsigned long>(generator->GetUniformVariate(0, 1) * i);
+    std::swap(list[i-1], list[std::min(j, i-1)]);
+  }
+}
+
+} // namespace otb
+
+#endif
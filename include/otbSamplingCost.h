@@ -0,0 +1,97 @@
+#ifndef __otbSamplingCost__
+#define __otbSamplingCost__
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <utility>
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+#include "otbSamplingWindow.h"
+
+namespace otb
+{
+
+// Number of windows of the regular grid of square tiles of sizeTiles pixels
+// touched by the features of each class over the image, from the envelopes of
+// the features: the windows read to sample the whole class.
+template <class TImage>
+std::map<int, unsigned long> CountClassWindows(const TImage* image, otb::ogr::Layer& layer, const std::string& classField,
+                                               unsigned long sizeTiles)
+{
+  std::vector<long> fids;
+  std::vector<itk::ImageRegion<2> > regions;
+  ScanLayerEnvelopes(image, layer, 3, fids, regions);
+
+  const itk::ImageRegion<2>::IndexType imageIndex = image->GetLargestPossibleRegion().GetIndex();
+  std::map<int, std::set<std::pair<long, long> > > classWindows;
+  for(unsigned long f = 0; f < fids.size(); ++f)
+  {
+    int className = layer.GetFeature(fids[f]).ogr().GetFieldAsInteger(classField.c_str());
+    std::set<std::pair<long, long> >& windows = classWindows[className];
+
+    const itk::ImageRegion<2>& region = regions[f];
+    long firstX = (region.GetIndex()[0] - imageIndex[0]) / static_cast<long>(sizeTiles);
+    long lastX = (region.GetUpperIndex()[0] - imageIndex[0]) / static_cast<long>(sizeTiles);
+    long firstY = (region.GetIndex()[1] - imageIndex[1]) / static_cast<long>(sizeTiles);
+    long lastY = (region.GetUpperIndex()[1] - imageIndex[1]) / static_cast<long>(sizeTiles);
+    for(long y = firstY; y <= lastY; ++y)
+    {
+      for(long x = firstX; x <= lastX; ++x)
+      {
+        windows.insert(std::make_pair(x, y));
+      }
+    }
+  }
+
+  std::map<int, unsigned long> counts;
+  for(std::map<int, std::set<std::pair<long, long> > >::const_iterator iClass = classWindows.begin(); iClass != classWindows.end(); ++iClass)
+  {
+    counts[iClass->first] = iClass->second.size();
+  }
+  return counts;
+}
+
+// Read cost of a sample of each class of an image, in bytes, under the quota
+// sampling mode: the windows of a class being read in a random order until its
+// quota is met, sampling n of the N pixels of the class reads about n/N of its
+// windows. The other modes read all the windows, whatever the quotas.
+template <class TCountMap>
+std::map<int, double> ComputeClassSampleCosts(const std::map<int, unsigned long>& classWindows, const TCountMap& classCounts,
+                                              unsigned long windowBytes)
+{
+  std::map<int, double> costs;
+  for(typename TCountMap::const_iterator iClass = classCounts.begin(); iClass != classCounts.end(); ++iClass)
+  {
+    std::map<int, unsigned long>::const_iterator windows = classWindows.find(static_cast<int>(iClass->first));
+    if(iClass->second > 0 && windows != classWindows.end())
+    {
+      costs[static_cast<int>(iClass->first)] = static_cast<double>(windows->second) * windowBytes / static_cast<double>(iClass->second);
+    }
+  }
+  return costs;
+}
+
+// Total read cost of a strategy, in bytes, from the sample costs of the images
+inline double ComputeStrategyReadCost(const std::vector<std::map<int, int> >& imageSamples,
+                                      const std::vector<std::map<int, double> >& sampleCosts)
+{
+  double cost = 0.;
+  for(unsigned long image = 0; image < imageSamples.size(); ++image)
+  {
+    for(std::map<int, int>::const_iterator iClass = imageSamples[image].begin(); iClass != imageSamples[image].end(); ++iClass)
+    {
+      std::map<int, double>::const_iterator sampleCost = sampleCosts[image].find(iClass->first);
+      if(sampleCost != sampleCosts[image].end())
+      {
+        cost += iClass->second * sampleCost->second;
+      }
+    }
+  }
+  return cost;
+}
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef __otbSamplingImageIO__
+#define __otbSamplingImageIO__
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include "gdal.h"
+#include "itkMacro.h"
+#include "itkImageIOBase.h"
+#include "otbImageIOFactory.h"
+
+namespace otb
+{
+
+// Component type of the pixels stored in an image file (GDAL data type of
+// the bands), read from the image header only
+inline itk::ImageIOBase::IOComponentType ReadImageComponentType(const std::string& filename)
+{
+  // Extended filename options are not part of the path
+  std::string path = filename.substr(0, filename.find('?'));
+
+  itk::ImageIOBase::Pointer imageIO = otb::ImageIOFactory::CreateImageIO(path.c_str(), otb::ImageIOFactory::ReadMode);
+  if(imageIO.IsNull())
+  {
+    return itk::ImageIOBase::UNKNOWNCOMPONENTTYPE;
+  }
+  imageIO->SetFileName(path);
+  imageIO->ReadImageInformation();
+  return imageIO->GetComponentType();
+}
+
+// Bounds [min, max) of the values of the integer component types of at most
+// 16 bits, over which a histogram has exact bins; false for the other types
+inline bool ComponentTypeRange(itk::ImageIOBase::IOComponentType type, double& min, double& max)
+{
+  switch(type)
+  {
+    case itk::ImageIOBase::UCHAR:
+      min = 0;
+      max = 256;
+      return true;
+    case itk::ImageIOBase::CHAR:
+      min = -128;
+      max = 128;
+      return true;
+    case itk::ImageIOBase::USHORT:
+      min = 0;
+      max = 65536;
+      return true;
+    case itk::ImageIOBase::SHORT:
+      min = -32768;
+      max = 32768;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Memory of a decoded square window of an image file, with all its bands, in
+// bytes, read from the image header only
+inline unsigned long EstimateWindowMemory(const std::string& filename, unsigned long sizeTiles)
+{
+  std::string path = filename.substr(0, filename.find('?'));
+
+  itk::ImageIOBase::Pointer imageIO = otb::ImageIOFactory::CreateImageIO(path.c_str(), otb::ImageIOFactory::ReadMode);
+  if(imageIO.IsNull())
+  {
+    itkGenericExceptionMacro(<< "Unable to read the image " << path);
+  }
+  imageIO->SetFileName(path);
+  imageIO->ReadImageInformation();
+  return sizeTiles * sizeTiles * imageIO->GetNumberOfComponents() * imageIO->GetComponentSize();
+}
+
+// Parse a list of band indices, starting at 1
+inline std::vector<unsigned int> ParseBandList(const std::vector<std::string>& bandList)
+{
+  std::vector<unsigned int> bands;
+  for(std::vector<std::string>::const_iterator it = bandList.begin(); it != bandList.end(); ++it)
+  {
+    int band = std::atoi(it->c_str());
+    if(band < 1)
+    {
+      itkGenericExceptionMacro(<< "Invalid band index " << *it << ", bands are numbered from 1");
+    }
+    bands.push_back(band);
+  }
+  return bands;
+}
+
+// Band list as written in the extended filename, empty for all the bands
+inline std::string BandListToString(const std::vector<unsigned int>& bands)
+{
+  std::ostringstream oss;
+  for(std::vector<unsigned int>::const_iterator it = bands.begin(); it != bands.end(); ++it)
+  {
+    oss << (it == bands.begin() ? "" : ",") << *it;
+  }
+  return oss.str();
+}
+
+// Filename with one more extended filename option
+inline std::string AppendFilenameOption(const std::string& filename, const std::string& option)
+{
+  return filename + (filename.find('?') == std::string::npos ? "?&" : "&") + option;
+}
+
+// Filename with the band subset extended filename option, so that GDAL only
+// decodes the selected bands
+inline std::string BandSubsetFilename(const std::string& filename, const std::vector<unsigned int>& bands)
+{
+  if(bands.empty())
+  {
+    return filename;
+  }
+  return AppendFilenameOption(filename, "bands=" + BandListToString(bands));
+}
+
+// Overview level of the image whose resolution is the nearest to a requested
+// one, in the unit of the pixel spacing (ratios are compared, so 15 is nearer
+// to 10 than to 30), 0 for the full resolution. The size ratio between the
+// full resolution and the level is returned in factor.
+inline unsigned int NearestOverviewLevel(const std::string& filename, double resolution, double& factor)
+{
+  std::string path = filename.substr(0, filename.find('?'));
+  GDALAllRegister();
+  GDALDatasetH dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+  if(dataset == NULL)
+  {
+    itkGenericExceptionMacro(<< "Unable to open " << path);
+  }
+
+  double transform[6];
+  double pixelSize = 1.;
+  if(GDALGetGeoTransform(dataset, transform) == CE_None)
+  {
+    pixelSize = std::fabs(transform[1]);
+  }
+  int width = GDALGetRasterXSize(dataset);
+  GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+
+  unsigned int level = 0;
+  factor = 1.;
+  double bestDistance = std::fabs(std::log(resolution / pixelSize));
+  for(int i = 0; i < GDALGetOverviewCount(band); ++i)
+  {
+    GDALRasterBandH overview = GDALGetOverview(band, i);
+    double overviewFactor = static_cast<double>(width) / GDALGetRasterBandXSize(overview);
+    double distance = std::fabs(std::log(resolution / (pixelSize*overviewFactor)));
+    if(distance < bestDistance)
+    {
+      bestDistance = distance;
+      level = i + 1;
+      factor = overviewFactor;
+    }
+  }
+  GDALClose(dataset);
+  return level;
+}
+
+// Filename with the resolution extended filename option, so that GDAL reads
+// an overview level (0 is the full resolution)
+inline std::string OverviewFilename(const std::string& filename, unsigned int level)
+{
+  if(level == 0)
+  {
+    return filename;
+  }
+  std::ostringstream oss;
+  oss << "resol=" << level;
+  return AppendFilenameOption(filename, oss.str());
+}
+
+// Name of the output field of the i-th read band, after the band number in
+// the file so that a subset keeps the names of the full output
+inline std::string BandFieldName(const std::vector<unsigned int>& bands, unsigned int i)
+{
+  std::ostringstream oss;
+  oss << "b" << (bands.empty() ? i : bands[i] - 1);
+  return oss.str();
+}
+
+} // namespace otb
+
+#endif
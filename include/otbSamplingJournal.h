@@ -0,0 +1,149 @@
+#ifndef __otbSamplingJournal__
+#define __otbSamplingJournal__
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#include "itkMacro.h"
+#include "itkIntTypes.h"
+#include "itksys/SystemTools.hxx"
+
+namespace otb
+{
+
+// Checkpoint of a sampling run, the last consistent state of its outputs:
+// the windows before nextWindow are sampled, the text file holds textOffset
+// bytes and the point layer the features of FID below nextFID. The generator
+// is seeded again at each window from the seed and the window index, so it has
+// no state to keep. The sampler counters are kept as written by
+// ImageSampler::WriteState.
+struct SamplingCheckpoint
+{
+  unsigned long number;
+  unsigned long nextWindow;
+  bool complete;
+  itk::uint64_t textOffset;
+  itk::int64_t nextFID;
+  std::string samplerState;
+
+  SamplingCheckpoint() : number(0), nextWindow(0), complete(false), textOffset(0), nextFID(0) {}
+};
+
+// Journal of a sampling run, a small text file rewritten at each checkpoint:
+//
+//   OTBSJRNL 1
+//   <signature of the run>
+//   number nextWindow complete textOffset nextFID
+//   <sampler state>
+//
+// The signature (inputs and parameters the windows and draws depend on) must
+// match to resume. The journal is written to a temporary file and renamed, so
+// that a crash leaves the previous checkpoint.
+inline void WriteSamplingJournal(const std::string& filename, const std::string& signature,
+                                 const SamplingCheckpoint& checkpoint)
+{
+  std::string tmp = filename + ".tmp";
+  std::ofstream file(tmp.c_str());
+  file << "OTBSJRNL 1" << std::endl;
+  file << signature << std::endl;
+  file << checkpoint.number << " " << checkpoint.nextWindow << " " << (checkpoint.complete ? 1 : 0) << " "
+       << checkpoint.textOffset << " " << checkpoint.nextFID << std::endl;
+  file << checkpoint.samplerState << std::endl;
+  file.close();
+
+  if(!file)
+  {
+    std::remove(tmp.c_str());
+    itkGenericExceptionMacro(<< "Unable to write the sampling journal " << filename);
+  }
+#if defined(_WIN32)
+  // rename does not replace an existing file
+  std::remove(filename.c_str());
+#endif
+  if(std::rename(tmp.c_str(), filename.c_str()) != 0)
+  {
+    itkGenericExceptionMacro(<< "Unable to write the sampling journal " << filename);
+  }
+}
+
+// Read the last checkpoint of a run, false if there is no journal
+inline bool ReadSamplingJournal(const std::string& filename, const std::string& signature,
+                                SamplingCheckpoint& checkpoint)
+{
+  std::ifstream file(filename.c_str());
+  if(!file)
+  {
+    return false;
+  }
+
+  std::string magic, storedSignature, line;
+  std::getline(file, magic);
+  std::getline(file, storedSignature);
+  if(magic != "OTBSJRNL 1")
+  {
+    itkGenericExceptionMacro(<< "Invalid sampling journal " << filename);
+  }
+  if(storedSignature != signature)
+  {
+    itkGenericExceptionMacro(<< "The sampling journal " << filename << " was written by a run with other inputs or parameters");
+  }
+
+  int complete = 0;
+  std::getline(file, line);
+  std::istringstream values(line);
+  values >> checkpoint.number >> checkpoint.nextWindow >> complete >> checkpoint.textOffset >> checkpoint.nextFID;
+  std::getline(file, checkpoint.samplerState);
+  if(!values || !file)
+  {
+    itkGenericExceptionMacro(<< "Truncated sampling journal " << filename);
+  }
+  checkpoint.complete = complete != 0;
+  return true;
+}
+
+// Cut a text output back to the size it had at a checkpoint
+inline void TruncateTextOutput(const std::string& filename, itk::uint64_t size)
+{
+  if(static_cast<itk::uint64_t>(itksys::SystemTools::FileLength(filename.c_str())) < size)
+  {
+    itkGenericExceptionMacro(<< "The output " << filename << " is shorter than at the last checkpoint");
+  }
+#if !defined(_WIN32)
+  if(truncate(filename.c_str(), static_cast<off_t>(size)) != 0)
+  {
+    itkGenericExceptionMacro(<< "Unable to truncate the output " << filename);
+  }
+#else
+  // No truncate : the kept part is copied
+  std::string tmp = filename + ".tmp";
+  {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    itk::uint64_t left = size;
+    while(left > 0 && in)
+    {
+      std::streamsize chunk = static_cast<std::streamsize>(std::min<itk::uint64_t>(left, buffer.size()));
+      in.read(&buffer[0], chunk);
+      out.write(&buffer[0], in.gcount());
+      left -= in.gcount();
+    }
+  }
+  std::remove(filename.c_str());
+  if(std::rename(tmp.c_str(), filename.c_str()) != 0)
+  {
+    itkGenericExceptionMacro(<< "Unable to truncate the output " << filename);
+  }
+#endif
+}
+
+} // namespace otb
+
+#endif
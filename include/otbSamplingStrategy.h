@@ -0,0 +1,235 @@
+#ifndef __otbSamplingStrategy__
+#define __otbSamplingStrategy__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include "itkMacro.h"
+#include "otbBandStatistics.h"
+
+namespace otb
+{
+
+// Number of samples of a class in one image, out of the samples requested per
+// class: the same number in every image (equally), or a share of them
+// proportional to the pixels of the class in the image over all the images
+// (proportional). It never exceeds the pixels of the class in the image.
+inline int ComputeClassSamples(const std::string& strategy, int samples, double imageCount, double globalCount)
+{
+  int nbSamples = 0;
+  if(strategy == "equally")
+  {
+    nbSamples = samples;
+  }
+  else if(strategy == "proportional" && globalCount > 0)
+  {
+    float coef = static_cast<float>(imageCount) / static_cast<float>(globalCount);
+    nbSamples = samples * coef;
+  }
+
+  if(nbSamples > imageCount)
+  {
+    nbSamples = static_cast<int>(imageCount);
+  }
+  return nbSamples;
+}
+
+// Number of samples of each class in each image, from the class counts of the
+// images and their totals over all the images
+template <class TCountMap, class TTotalMap>
+std::vector<std::map<int, int> > ComputeSamplingStrategy(const std::string& strategy, int samples,
+                                                          const std::vector<TCountMap>& imageCounts,
+                                                          const TTotalMap& totals)
+{
+  std::vector<std::map<int, int> > imageSamples(imageCounts.size());
+  for(unsigned long image = 0; image < imageCounts.size(); ++image)
+  {
+    for(typename TCountMap::const_iterator iClass = imageCounts[image].begin(); iClass != imageCounts[image].end(); ++iClass)
+    {
+      typename TTotalMap::const_iterator total = totals.find(iClass->first);
+      double globalCount = total != totals.end() ? static_cast<double>(total->second) : 0.;
+      imageSamples[image][static_cast<int>(iClass->first)] =
+        ComputeClassSamples(strategy, samples, static_cast<double>(iClass->second), globalCount);
+    }
+  }
+  return imageSamples;
+}
+
+// Number of samples of each class in each image at the lowest read cost, from
+// the cost of a sample of each class of each image (ComputeClassSampleCosts).
+// Every image first gets the spread fraction (0 to 1) of its proportional
+// share, so that the samples still cover all the images; the rest of the
+// samples of the class are taken from the cheapest images first, up to the
+// pixels of the class in each image. Images without a cost come last.
+template <class TCountMap, class TTotalMap>
+std::vector<std::map<int, int> > ComputeCostAwareStrategy(int samples, const std::vector<TCountMap>& imageCounts,
+                                                           const TTotalMap& totals,
+                                                           const std::vector<std::map<int, double> >& sampleCosts,
+                                                           double spread)
+{
+  std::vector<std::map<int, int> > imageSamples(imageCounts.size());
+  for(typename TTotalMap::const_iterator total = totals.begin(); total != totals.end(); ++total)
+  {
+    int className = static_cast<int>(total->first);
+    double globalCount = static_cast<double>(total->second);
+    int remaining = static_cast<int>(std::min(static_cast<double>(samples), globalCount));
+
+    //Guaranteed share of each image, then images by increasing cost
+    std::vector<std::pair<double, unsigned long> > order;
+    std::vector<int> available(imageCounts.size(), 0);
+    for(unsigned long image = 0; image < imageCounts.size(); ++image)
+    {
+      typename TCountMap::const_iterator count = imageCounts[image].find(total->first);
+      if(count == imageCounts[image].end() || count->second <= 0)
+      {
+        continue;
+      }
+      available[image] = static_cast<int>(count->second);
+      int share = ComputeClassSamples("proportional", samples, static_cast<double>(count->second), globalCount);
+      int base = std::min(static_cast<int>(spread * share), remaining);
+      imageSamples[image][className] = base;
+      available[image] -= base;
+      remaining -= base;
+
+      std::map<int, double>::const_iterator cost = sampleCosts[image].find(className);
+      double sampleCost = cost != sampleCosts[image].end() ? cost->second : std::numeric_limits<double>::max();
+      order.push_back(std::make_pair(sampleCost, image));
+    }
+
+    std::sort(order.begin(), order.end());
+    for(unsigned long k = 0; k < order.size() && remaining > 0; ++k)
+    {
+      unsigned long image = order[k].second;
+      int taken = std::min(available[image], remaining);
+      imageSamples[image][className] += taken;
+      remaining -= taken;
+    }
+  }
+  return imageSamples;
+}
+
+// Spectral spread of the pixels of a class: standard deviation of their bands
+// standardized by the variance of all the pixels (as the features are for the
+// training), averaged over the bands
+inline double ComputeStandardizedDeviation(const BandStatistics& statistics, const BandStatistics& global)
+{
+  double variance = 0.;
+  unsigned int nbBands = 0;
+  for(unsigned int b = 0; b < statistics.GetNumberOfBands() && b < global.GetNumberOfBands(); ++b)
+  {
+    if(global.GetVariance(b) > 0)
+    {
+      variance += statistics.GetVariance(b) / global.GetVariance(b);
+      ++nbBands;
+    }
+  }
+  return nbBands > 0 ? std::sqrt(variance / nbBands) : 0.;
+}
+
+// Number of samples of each class in each image by Neyman allocation, from the
+// band statistics of the classes in each image and over all the images. The
+// samples of all the classes (samples per class on average) are shared among
+// the classes in proportion to their spread, homogeneous classes getting fewer
+// samples, with at least one each; those of a class are shared among the
+// images in proportion to its pixels times its spread in each image. No image
+// gets more samples than its pixels of the class.
+template <class TCountMap, class TTotalMap, class TStatisticsMap>
+std::vector<std::map<int, int> > ComputeNeymanStrategy(int samples, const std::vector<TCountMap>& imageCounts,
+                                                        const TTotalMap& totals,
+                                                        const std::vector<TStatisticsMap>& imageStatistics,
+                                                        const TStatisticsMap& classStatistics)
+{
+  BandStatistics global;
+  for(typename TStatisticsMap::const_iterator iClass = classStatistics.begin(); iClass != classStatistics.end(); ++iClass)
+  {
+    global.Merge(iClass->second);
+  }
+
+  std::map<int, double> classDeviations;
+  double sumDeviations = 0.;
+  for(typename TTotalMap::const_iterator total = totals.begin(); total != totals.end(); ++total)
+  {
+    typename TStatisticsMap::const_iterator statistics = classStatistics.find(total->first);
+    double deviation = statistics != classStatistics.end() ? ComputeStandardizedDeviation(statistics->second, global) : 0.;
+    classDeviations[static_cast<int>(total->first)] = deviation;
+    sumDeviations += deviation;
+  }
+
+  std::vector<std::map<int, int> > imageSamples(imageCounts.size());
+  double budget = static_cast<double>(samples) * totals.size();
+  for(typename TTotalMap::const_iterator total = totals.begin(); total != totals.end(); ++total)
+  {
+    int className = static_cast<int>(total->first);
+    double classSamples = sumDeviations > 0 ? budget * classDeviations[className] / sumDeviations : samples;
+    classSamples = std::min(std::max(classSamples, 1.), static_cast<double>(total->second));
+
+    //Weight of each image : pixels of the class times their spread
+    std::vector<double> weights(imageCounts.size(), 0.);
+    double sumWeights = 0.;
+    for(unsigned long image = 0; image < imageCounts.size(); ++image)
+    {
+      typename TCountMap::const_iterator count = imageCounts[image].find(total->first);
+      if(count == imageCounts[image].end())
+      {
+        continue;
+      }
+      typename TStatisticsMap::const_iterator statistics = imageStatistics[image].find(total->first);
+      double deviation = statistics != imageStatistics[image].end() ? ComputeStandardizedDeviation(statistics->second, global) : 0.;
+      weights[image] = static_cast<double>(count->second) * deviation;
+      sumWeights += weights[image];
+    }
+
+    for(unsigned long image = 0; image < imageCounts.size(); ++image)
+    {
+      typename TCountMap::const_iterator count = imageCounts[image].find(total->first);
+      if(count == imageCounts[image].end())
+      {
+        continue;
+      }
+      //A class without spread in any image is shared in proportion to its pixels
+      double share = 0.;
+      if(sumWeights > 0)
+      {
+        share = weights[image] / sumWeights;
+      }
+      else if(total->second > 0)
+      {
+        share = static_cast<double>(count->second) / static_cast<double>(total->second);
+      }
+      imageSamples[image][className] = static_cast<int>(std::min(classSamples * share, static_cast<double>(count->second)));
+    }
+  }
+  return imageSamples;
+}
+
+// Strategy file read by SamplingImageList: the number of samples of each class
+// of each image, the images being numbered from 1 in the order of the list
+inline void WriteSamplingStrategyXML(const std::string& filename, const std::vector<std::map<int, int> >& imageSamples)
+{
+  std::ofstream out(filename.c_str());
+  out << "<?xml version=\"1.0\" ?>" << std::endl;
+  out << "<StrategyGlobal>" << std::endl;
+  for(unsigned long image = 0; image < imageSamples.size(); ++image)
+  {
+    out << "    <Image name=\"" << image+1 << "\">" << std::endl;
+    for(std::map<int, int>::const_iterator iClass = imageSamples[image].begin(); iClass != imageSamples[image].end(); ++iClass)
+    {
+      out << "        <Class name=\"" << iClass->first << "\" value=\"" << iClass->second << "\" />" << std::endl;
+    }
+    out << "    </Image>" << std::endl;
+  }
+  out << "</StrategyGlobal>" << std::endl;
+  if(!out)
+  {
+    itkGenericExceptionMacro(<< "Unable to write the strategy file " << filename);
+  }
+}
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef __otbSamplingWindow__
+#define __otbSamplingWindow__
+
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include "itkImageRegion.h"
+#include "itkPoint.h"
+#include "ogr_geometry.h"
+#include "otbOGRDataSourceWrapper.h"
+#include "otbOGRFeatureWrapper.h"
+
+namespace otb
+{
+
+// Read window of the input image, with the features processed inside it
+struct SamplingWindow
+{
+  typedef itk::ImageRegion<2> RegionType;
+
+  // Region of the window in the index space of the whole image
+  RegionType region;
+
+  // FIDs of the features processed over this window, each one over its whole
+  // bounding region. An empty list means a grid tile: the features are then
+  // fetched with a spatial filter on the tile extent.
+  std::vector<long> fids;
+};
+
+typedef std::vector<SamplingWindow> SamplingWindowList;
+
+// Regular grid of square tiles over the whole image, row by row
+inline SamplingWindowList GenerateGridWindows(const itk::ImageRegion<2>& imageRegion, unsigned long sizeTiles)
+{
+  SamplingWindowList windows;
+
+  unsigned long sizeImageX = imageRegion.GetSize()[0];
+  unsigned long sizeImageY = imageRegion.GetSize()[1];
+  unsigned long nbTilesX = sizeImageX/sizeTiles + (sizeImageX%sizeTiles > 0 ? 1 : 0);
+  unsigned long nbTilesY = sizeImageY/sizeTiles + (sizeImageY%sizeTiles > 0 ? 1 : 0);
+
+  for(unsigned long row = 0; row < nbTilesY; ++row)
+  {
+    for(unsigned long column = 0; column < nbTilesX; ++column)
+    {
+      SamplingWindow window;
+      itk::ImageRegion<2>::IndexType start;
+      itk::ImageRegion<2>::SizeType size;
+      start[0] = imageRegion.GetIndex()[0] + column*sizeTiles;
+      start[1] = imageRegion.GetIndex()[1] + row*sizeTiles;
+      size[0] = std::min(sizeTiles, sizeImageX - column*sizeTiles);
+      size[1] = std::min(sizeTiles, sizeImageY - row*sizeTiles);
+      window.region.SetIndex(start);
+      window.region.SetSize(size);
+      windows.push_back(window);
+    }
+  }
+  return windows;
+}
+
+// Systematic subsample of the windows: one window out of step, starting with
+// the first one. The fraction of the pixels kept is returned in fraction.
+inline SamplingWindowList SubsampleWindows(const SamplingWindowList& windows, unsigned long step, double& fraction)
+{
+  SamplingWindowList kept;
+  double totalPixels = 0, keptPixels = 0;
+  for(unsigned long w = 0; w < windows.size(); ++w)
+  {
+    totalPixels += windows[w].region.GetNumberOfPixels();
+    if(step <= 1 || w % step == 0)
+    {
+      kept.push_back(windows[w]);
+      keptPixels += windows[w].region.GetNumberOfPixels();
+    }
+  }
+  fraction = totalPixels > 0 ? keptPixels / totalPixels : 1.;
+  return kept;
+}
+
+// Image region containing an OGR envelope, with one pixel of margin so that
+// every pixel centre inside the envelope is kept. The region is not cropped.
+template <class TImage>
+itk::ImageRegion<2> EnvelopeToImageRegion(const TImage* image, const OGREnvelope& envelope)
+{
+  itk::Point<double, 2> lowerPoint, upperPoint;
+  lowerPoint[0] = envelope.MinX;
+  lowerPoint[1] = envelope.MinY;
+  upperPoint[0] = envelope.MaxX;
+  upperPoint[1] = envelope.MaxY;
+
+  typename TImage::IndexType lowerIndex, upperIndex;
+  image->TransformPhysicalPointToIndex(lowerPoint, lowerIndex);
+  image->TransformPhysicalPointToIndex(upperPoint, upperIndex);
+
+  // Spacing may be negative (north up images), so sort the corners
+  itk::ImageRegion<2>::IndexType start;
+  itk::ImageRegion<2>::SizeType size;
+  for(unsigned int dim = 0; dim < 2; ++dim)
+  {
+    start[dim] = std::min(lowerIndex[dim], upperIndex[dim]) - 1;
+    size[dim] = std::max(lowerIndex[dim], upperIndex[dim]) - start[dim] + 2;
+  }
+
+  itk::ImageRegion<2> region;
+  region.SetIndex(start);
+  region.SetSize(size);
+  return region;
+}
+
+// Region of the window, in the index space of the extracted window image,
+// over which a geometry is processed. A grid tile is processed as a whole;
+// a polygon-driven window only over the envelope of the geometry.
+template <class TImage>
+bool GeometryRegionInWindow(const TImage* image, OGRGeometry* geom, const SamplingWindow& window, itk::ImageRegion<2>& region)
+{
+  itk::ImageRegion<2>::IndexType origin;
+  origin.Fill(0);
+  region.SetIndex(origin);
+  region.SetSize(window.region.GetSize());
+
+  if(window.fids.empty())
+  {
+    return true;
+  }
+
+  OGREnvelope envelope;
+  geom->getEnvelope(&envelope);
+  itk::ImageRegion<2> geomRegion = EnvelopeToImageRegion(image, envelope);
+  if(!geomRegion.Crop(window.region))
+  {
+    return false;
+  }
+
+  itk::ImageRegion<2>::IndexType localIndex;
+  for(unsigned int dim = 0; dim < 2; ++dim)
+  {
+    localIndex[dim] = geomRegion.GetIndex()[dim] - window.region.GetIndex()[dim];
+  }
+  region.SetIndex(localIndex);
+  region.SetSize(geomRegion.GetSize());
+  return true;
+}
+
+// Scan the layer once over the image extent and collect the FID and the
+// bounding region (cropped to the image) of every feature intersecting it.
+// Line strings are processed as buffers of lineBuffer map units.
+template <class TImage>
+void ScanLayerEnvelopes(const TImage* image, otb::ogr::Layer& layer, double lineBuffer,
+                        std::vector<long>& fids, std::vector<itk::ImageRegion<2> >& regions)
+{
+  const itk::ImageRegion<2>& imageRegion = image->GetLargestPossibleRegion();
+
+  itk::Point<double, 2> ulPoint, lrPoint;
+  typename TImage::IndexType ulIndex = imageRegion.GetIndex();
+  typename TImage::IndexType lrIndex = imageRegion.GetUpperIndex();
+  image->TransformIndexToPhysicalPoint(ulIndex, ulPoint);
+  image->TransformIndexToPhysicalPoint(lrIndex, lrPoint);
+  layer.SetSpatialFilterRect(std::min(ulPoint[0], lrPoint[0]), std::min(ulPoint[1], lrPoint[1]),
+                             std::max(ulPoint[0], lrPoint[0]), std::max(ulPoint[1], lrPoint[1]));
+
+  for(otb::ogr::Layer::const_iterator featIt = layer.begin(); featIt != layer.end(); ++featIt)
+  {
+    OGRGeometry * geom = featIt->ogr().GetGeometryRef();
+    if(!geom)
+    {
+      continue;
+    }
+
+    OGREnvelope envelope;
+    geom->getEnvelope(&envelope);
+    if(geom->getGeometryType() == wkbLineString)
+    {
+      envelope.MinX -= lineBuffer;
+      envelope.MinY -= lineBuffer;
+      envelope.MaxX += lineBuffer;
+      envelope.MaxY += lineBuffer;
+    }
+
+    itk::ImageRegion<2> region = EnvelopeToImageRegion(image, envelope);
+    if(region.Crop(imageRegion))
+    {
+      fids.push_back(featIt->ogr().GetFID());
+      regions.push_back(region);
+    }
+  }
+
+  layer.SetSpatialFilter(NULL);
+}
+
+// Features to process in a window: spatial filter on the extent of a grid
+// tile, or direct access by FID for a polygon-driven window
+template <class TImage>
+std::vector<otb::ogr::Feature> GetWindowFeatures(const TImage* image, otb::ogr::Layer& layer, const SamplingWindow& window)
+{
+  std::vector<otb::ogr::Feature> features;
+
+  if(!window.fids.empty())
+  {
+    layer.SetSpatialFilter(NULL);
+    for(std::vector<long>::const_iterator fid = window.fids.begin(); fid != window.fids.end(); ++fid)
+    {
+      features.push_back(layer.GetFeature(*fid));
+    }
+    return features;
+  }
+
+  typename TImage::IndexType urIndex;
+  typename TImage::IndexType llIndex;
+  urIndex[0] = window.region.GetIndex()[0] + window.region.GetSize()[0];
+  urIndex[1] = window.region.GetIndex()[1] + window.region.GetSize()[1];
+  llIndex[0] = window.region.GetIndex()[0];
+  llIndex[1] = window.region.GetIndex()[1];
+
+  itk::Point<double, 2> ulPoint;
+  itk::Point<double, 2> lrPoint;
+  image->TransformIndexToPhysicalPoint(urIndex, lrPoint);
+  image->TransformIndexToPhysicalPoint(llIndex, ulPoint);
+
+  layer.SetSpatialFilterRect(ulPoint[0], ulPoint[1], lrPoint[0], lrPoint[1]);
+  for(otb::ogr::Layer::const_iterator featIt = layer.begin(); featIt != layer.end(); ++featIt)
+  {
+    features.push_back(*featIt);
+  }
+  return features;
+}
+
+// Features of a layer over the footprint of an image, fetched once with their
+// envelopes and then served window by window without querying the layer: a
+// layer shared by several images is only used (and locked) while the index of
+// each image is built.
+class FootprintFeatureIndex
+{
+public:
+  // Fetch the features intersecting the image extent. Line strings are
+  // processed as buffers of lineBuffer map units.
+  template <class TImage>
+  void Build(const TImage* image, otb::ogr::Layer& layer, double lineBuffer)
+  {
+    m_Features.clear();
+    m_Envelopes.clear();
+    m_Positions.clear();
+
+    const itk::ImageRegion<2>& imageRegion = image->GetLargestPossibleRegion();
+    OGREnvelope extent = RegionExtent(image, imageRegion.GetIndex(), imageRegion.GetUpperIndex());
+    layer.SetSpatialFilterRect(extent.MinX, extent.MinY, extent.MaxX, extent.MaxY);
+
+    for(otb::ogr::Layer::const_iterator featIt = layer.begin(); featIt != layer.end(); ++featIt)
+    {
+      OGRGeometry * geom = featIt->ogr().GetGeometryRef();
+      if(!geom)
+      {
+        continue;
+      }
+
+      OGREnvelope envelope;
+      geom->getEnvelope(&envelope);
+      if(geom->getGeometryType() == wkbLineString)
+      {
+        envelope.MinX -= lineBuffer;
+        envelope.MinY -= lineBuffer;
+        envelope.MaxX += lineBuffer;
+        envelope.MaxY += lineBuffer;
+      }
+
+      m_Positions[featIt->ogr().GetFID()] = m_Features.size();
+      m_Features.push_back(*featIt);
+      m_Envelopes.push_back(envelope);
+    }
+
+    layer.SetSpatialFilter(NULL);
+  }
+
+  unsigned long GetNumberOfFeatures() const
+  {
+    return m_Features.size();
+  }
+
+  std::vector<otb::ogr::Feature>& GetFeatures()
+  {
+    return m_Features;
+  }
+
+  // Keep only the listed features, so that only the windows they touch are
+  // processed
+  void Retain(const std::set<long>& fids)
+  {
+    std::vector<otb::ogr::Feature> features;
+    std::vector<OGREnvelope> envelopes;
+    m_Positions.clear();
+    for(unsigned long f = 0; f < m_Features.size(); ++f)
+    {
+      if(fids.count(m_Features[f].ogr().GetFID()) > 0)
+      {
+        m_Positions[m_Features[f].ogr().GetFID()] = features.size();
+        features.push_back(m_Features[f]);
+        envelopes.push_back(m_Envelopes[f]);
+      }
+    }
+    m_Features.swap(features);
+    m_Envelopes.swap(envelopes);
+  }
+
+  // Features to process in a window, as GetWindowFeatures: those whose
+  // envelope intersects a grid tile, or those listed by a polygon-driven window
+  template <class TImage>
+  std::vector<otb::ogr::Feature> GetWindowFeatures(const TImage* image, const SamplingWindow& window) const
+  {
+    std::vector<otb::ogr::Feature> features;
+
+    if(!window.fids.empty())
+    {
+      for(std::vector<long>::const_iterator fid = window.fids.begin(); fid != window.fids.end(); ++fid)
+      {
+        std::map<long, unsigned long>::const_iterator found = m_Positions.find(*fid);
+        if(found != m_Positions.end())
+        {
+          features.push_back(m_Features[found->second]);
+        }
+      }
+      return features;
+    }
+
+    typename TImage::IndexType upperIndex;
+    upperIndex[0] = window.region.GetIndex()[0] + window.region.GetSize()[0];
+    upperIndex[1] = window.region.GetIndex()[1] + window.region.GetSize()[1];
+    OGREnvelope extent = RegionExtent(image, window.region.GetIndex(), upperIndex);
+
+    for(unsigned long f = 0; f < m_Features.size(); ++f)
+    {
+      const OGREnvelope& envelope = m_Envelopes[f];
+      if(envelope.MaxX >= extent.MinX && envelope.MinX <= extent.MaxX &&
+         envelope.MaxY >= extent.MinY && envelope.MinY <= extent.MaxY)
+      {
+        features.push_back(m_Features[f]);
+      }
+    }
+    return features;
+  }
+
+private:
+  // Physical extent between the centres of two pixels
+  template <class TImage>
+  static OGREnvelope RegionExtent(const TImage* image, const typename TImage::IndexType& lowerIndex,
+                                  const typename TImage::IndexType& upperIndex)
+  {
+    itk::Point<double, 2> lowerPoint, upperPoint;
+    image->TransformIndexToPhysicalPoint(lowerIndex, lowerPoint);
+    image->TransformIndexToPhysicalPoint(upperIndex, upperPoint);
+
+    OGREnvelope extent;
+    extent.MinX = std::min(lowerPoint[0], upperPoint[0]);
+    extent.MaxX = std::max(lowerPoint[0], upperPoint[0]);
+    extent.MinY = std::min(lowerPoint[1], upperPoint[1]);
+    extent.MaxY = std::max(lowerPoint[1], upperPoint[1]);
+    return extent;
+  }
+
+  std::vector<otb::ogr::Feature> m_Features;
+  std::vector<OGREnvelope> m_Envelopes;
+  std::map<long, unsigned long> m_Positions;
+};
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef __otbShardPlan__
+#define __otbShardPlan__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include "itkMacro.h"
+#include "itkIntTypes.h"
+#include "otbBandStatistics.h"
+
+namespace otb
+{
+
+// Shard i of K, as given on the command line ("i/K", i from 1 to K)
+inline void ParseShard(const std::string& description, unsigned int& index, unsigned int& count)
+{
+  std::istringstream iss(description);
+  char slash = 0;
+  if(!(iss >> index >> slash >> count) || slash != '/' || count == 0 || index < 1 || index > count)
+  {
+    itkGenericExceptionMacro(<< "Invalid shard " << description << ", expected i/K with i from 1 to K");
+  }
+}
+
+// Windows of a shard, [first, last) in the traversal order of the read
+// windows. The traversals keep neighbouring windows together (rows of the
+// grid, segments of the Hilbert curve, quadtree order), so a contiguous range
+// is a compact part of the image, and the shards in their order process the
+// windows in the order of a single process.
+inline void ShardWindowRange(unsigned long nbWindows, unsigned int index, unsigned int count,
+                             unsigned long& first, unsigned long& last)
+{
+  first = static_cast<unsigned long>(static_cast<itk::uint64_t>(nbWindows) * (index - 1) / count);
+  last = static_cast<unsigned long>(static_cast<itk::uint64_t>(nbWindows) * index / count);
+}
+
+// Seed of the random stream of a read window, so that the draws in a window
+// do not depend on the windows read before it, in this process or another
+inline unsigned int WindowSeed(int seed, unsigned long window)
+{
+  itk::uint64_t state = (static_cast<itk::uint64_t>(static_cast<unsigned int>(seed)) << 32) ^ window;
+  //SplitMix64 finalizer
+  state += 0x9E3779B97F4A7C15ULL;
+  state = (state ^ (state >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  state = (state ^ (state >> 27)) * 0x94D049BB133111EBULL;
+  state ^= state >> 31;
+  return static_cast<unsigned int>(state >> 32);
+}
+
+// Pixel counts of the windows of a shard, for the sampling of the other
+// shards: the counts of the polygons and classes with the band statistics of
+// the classes, as accumulated by the prospection, and the pixels of each
+// polygon seen by the sampling (nodata excluded), from which a shard starts
+// the counters of the polygons shared with the shards before it.
+struct ShardCounts
+{
+  std::map<unsigned long, int> polygonCounts;
+  std::map<unsigned long, int> sampledCounts;
+  std::map<int, int> classCounts;
+  std::map<int, BandStatistics> classStatistics;
+  int nbPixels;
+
+  ShardCounts() : nbPixels(0) {}
+
+  // Add the counts of the next shard
+  void Merge(const ShardCounts& other)
+  {
+    for(std::map<unsigned long, int>::const_iterator it = other.polygonCounts.begin(); it != other.polygonCounts.end(); ++it)
+    {
+      polygonCounts[it->first] += it->second;
+    }
+    for(std::map<unsigned long, int>::const_iterator it = other.sampledCounts.begin(); it != other.sampledCounts.end(); ++it)
+    {
+      sampledCounts[it->first] += it->second;
+    }
+    for(std::map<int, int>::const_iterator it = other.classCounts.begin(); it != other.classCounts.end(); ++it)
+    {
+      classCounts[it->first] += it->second;
+    }
+    for(std::map<int, BandStatistics>::const_iterator it = other.classStatistics.begin(); it != other.classStatistics.end(); ++it)
+    {
+      classStatistics[it->first].Merge(it->second);
+    }
+    nbPixels += other.nbPixels;
+  }
+};
+
+// Shard counts file, in native byte order:
+//
+//   header    magic "OTBSHARD", version, number of polygons, number of
+//             classes, number of bands, number of pixels
+//   polygons  (FID, count, sampled count) int64, sorted by FID
+//   classes   (class, count, statistics count) int64, then mean, m2, min
+//             and max of each band as doubles, sorted by class
+//
+inline void WriteShardCounts(const std::string& filename, const ShardCounts& counts)
+{
+  unsigned int nbBands = counts.classStatistics.empty() ? 0 : counts.classStatistics.begin()->second.GetNumberOfBands();
+  itk::uint64_t header[5] = {1, counts.polygonCounts.size(), counts.classCounts.size(), nbBands,
+                             static_cast<itk::uint64_t>(counts.nbPixels)};
+
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  file.write("OTBSHARD", 8);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  for(std::map<unsigned long, int>::const_iterator it = counts.polygonCounts.begin(); it != counts.polygonCounts.end(); ++it)
+  {
+    std::map<unsigned long, int>::const_iterator sampled = counts.sampledCounts.find(it->first);
+    itk::int64_t record[3] = {static_cast<itk::int64_t>(it->first), it->second,
+                              sampled != counts.sampledCounts.end() ? sampled->second : 0};
+    file.write(reinterpret_cast<const char*>(record), sizeof(record));
+  }
+  for(std::map<int, int>::const_iterator it = counts.classCounts.begin(); it != counts.classCounts.end(); ++it)
+  {
+    std::map<int, BandStatistics>::const_iterator statistics = counts.classStatistics.find(it->first);
+    bool hasStatistics = statistics != counts.classStatistics.end() && statistics->second.GetNumberOfBands() == nbBands;
+    itk::int64_t record[3] = {it->first, it->second, hasStatistics ? static_cast<itk::int64_t>(statistics->second.GetCount()) : 0};
+    file.write(reinterpret_cast<const char*>(record), sizeof(record));
+    for(unsigned int b = 0; b < nbBands; ++b)
+    {
+      double values[4] = {0., 0., 0., 0.};
+      if(hasStatistics)
+      {
+        values[0] = statistics->second.GetMean(b);
+        values[1] = statistics->second.GetM2(b);
+        values[2] = statistics->second.GetMinimum(b);
+        values[3] = statistics->second.GetMaximum(b);
+      }
+      file.write(reinterpret_cast<const char*>(values), sizeof(values));
+    }
+  }
+  if(!file)
+  {
+    itkGenericExceptionMacro(<< "Unable to write the shard counts " << filename);
+  }
+}
+
+inline ShardCounts ReadShardCounts(const std::string& filename)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  char magic[8];
+  itk::uint64_t header[5];
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if(!file || std::memcmp(magic, "OTBSHARD", sizeof(magic)) != 0 || header[0] != 1)
+  {
+    itkGenericExceptionMacro(<< "Invalid shard counts " << filename);
+  }
+
+  ShardCounts counts;
+  counts.nbPixels = static_cast<int>(header[4]);
+  for(itk::uint64_t i = 0; i < header[1] && file; ++i)
+  {
+    itk::int64_t record[3];
+    file.read(reinterpret_cast<char*>(record), sizeof(record));
+    counts.polygonCounts[static_cast<unsigned long>(record[0])] = static_cast<int>(record[1]);
+    counts.sampledCounts[static_cast<unsigned long>(record[0])] = static_cast<int>(record[2]);
+  }
+  const unsigned int nbBands = static_cast<unsigned int>(header[3]);
+  for(itk::uint64_t i = 0; i < header[2] && file; ++i)
+  {
+    itk::int64_t record[3];
+    file.read(reinterpret_cast<char*>(record), sizeof(record));
+    int className = static_cast<int>(record[0]);
+    counts.classCounts[className] = static_cast<int>(record[1]);
+    BandStatistics statistics(nbBands);
+    for(unsigned int b = 0; b < nbBands; ++b)
+    {
+      double values[4];
+      file.read(reinterpret_cast<char*>(values), sizeof(values));
+      statistics.Set(static_cast<itk::uint64_t>(record[2]), b, values[0], values[1], values[2], values[3]);
+    }
+    if(record[2] > 0)
+    {
+      counts.classStatistics[className] = statistics;
+    }
+  }
+  if(!file)
+  {
+    itkGenericExceptionMacro(<< "Truncated shard counts " << filename);
+  }
+  return counts;
+}
+
+} // namespace otb
+
+#endif
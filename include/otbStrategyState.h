@@ -0,0 +1,304 @@
+#ifndef __otbStrategyState__
+#define __otbStrategyState__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include "itkMacro.h"
+#include "itksys/SystemTools.hxx"
+#include "otb_tinyxml.h"
+#include "otbBandStatistics.h"
+#include "otbPolygonStatisticsFile.h"
+
+namespace otb
+{
+
+// Stamp of an analysis file, its size and modification time: a rewritten
+// file gets a new stamp
+inline std::string AnalysisFileStamp(const std::string& filename)
+{
+  std::ostringstream stamp;
+  stamp << itksys::SystemTools::FileLength(filename.c_str()) << "-" << itksys::SystemTools::ModifiedTime(filename.c_str());
+  return stamp.str();
+}
+
+// The quotas of an image moved beyond the tolerance: a class gained or lost,
+// or a quota changed by more than tolerance times its previous value
+inline bool QuotasMoved(const std::map<int, int>& previous, const std::map<int, int>& current, double tolerance)
+{
+  if(previous.size() != current.size())
+  {
+    return true;
+  }
+  for(std::map<int, int>::const_iterator iClass = current.begin(); iClass != current.end(); ++iClass)
+  {
+    std::map<int, int>::const_iterator found = previous.find(iClass->first);
+    if(found == previous.end())
+    {
+      return true;
+    }
+    double difference = iClass->second > found->second ? iClass->second - found->second : found->second - iClass->second;
+    if(difference > tolerance * found->second)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Aggregate state of the strategy of a campaign, kept between the runs of
+// StrategyImageList: the class counts and band statistics of each analysis
+// file with its stamp, the quotas last written for it, and the class totals
+// over all the files. Adding or removing an image updates the totals in
+// O(classes); only new or rewritten analysis files are read again.
+class StrategyState
+{
+public:
+  typedef PolygonStatisticsFile::ClassCountMap      ClassCountMap;
+  typedef PolygonStatisticsFile::ClassStatisticsMap ClassStatisticsMap;
+
+  struct ImageEntry
+  {
+    std::string stamp;
+    ClassCountMap counts;
+    ClassStatisticsMap statistics;
+    bool hasQuotas;
+    std::map<int, int> quotas;
+
+    ImageEntry() : hasQuotas(false) {}
+  };
+
+  // The image is in the state, from an analysis file of the same stamp
+  bool IsCurrent(const std::string& name, const std::string& stamp) const
+  {
+    std::map<std::string, ImageEntry>::const_iterator found = m_Images.find(name);
+    return found != m_Images.end() && found->second.stamp == stamp;
+  }
+
+  const ImageEntry* FindImage(const std::string& name) const
+  {
+    std::map<std::string, ImageEntry>::const_iterator found = m_Images.find(name);
+    return found != m_Images.end() ? &found->second : NULL;
+  }
+
+  std::vector<std::string> GetImageNames() const
+  {
+    std::vector<std::string> names;
+    for(std::map<std::string, ImageEntry>::const_iterator it = m_Images.begin(); it != m_Images.end(); ++it)
+    {
+      names.push_back(it->first);
+    }
+    return names;
+  }
+
+  // Add the counts of an image, replacing those it had; its quotas are kept
+  void AddImage(const std::string& name, const std::string& stamp, const ClassCountMap& counts, const ClassStatisticsMap& statistics)
+  {
+    ImageEntry entry;
+    std::map<std::string, ImageEntry>::iterator found = m_Images.find(name);
+    if(found != m_Images.end())
+    {
+      entry.hasQuotas = found->second.hasQuotas;
+      entry.quotas = found->second.quotas;
+      RemoveImage(name);
+    }
+    entry.stamp = stamp;
+    entry.counts = counts;
+    entry.statistics = statistics;
+    AddToTotals(entry);
+    m_Images[name] = entry;
+  }
+
+  void RemoveImage(const std::string& name)
+  {
+    std::map<std::string, ImageEntry>::iterator found = m_Images.find(name);
+    if(found == m_Images.end())
+    {
+      return;
+    }
+    for(ClassCountMap::const_iterator iClass = found->second.counts.begin(); iClass != found->second.counts.end(); ++iClass)
+    {
+      m_Totals[iClass->first] -= iClass->second;
+      // A class is dropped with the last image holding it
+      if(--m_ClassImages[iClass->first] == 0)
+      {
+        m_Totals.erase(iClass->first);
+        m_ClassImages.erase(iClass->first);
+      }
+    }
+    m_Images.erase(found);
+  }
+
+  void SetQuotas(const std::string& name, const std::map<int, int>& quotas)
+  {
+    ImageEntry& entry = m_Images[name];
+    entry.hasQuotas = true;
+    entry.quotas = quotas;
+  }
+
+  // Class totals over all the images
+  const ClassCountMap& GetTotals() const
+  {
+    return m_Totals;
+  }
+
+  // Band statistics of each class over all the images
+  ClassStatisticsMap MergeClassStatistics() const
+  {
+    ClassStatisticsMap statistics;
+    for(std::map<std::string, ImageEntry>::const_iterator it = m_Images.begin(); it != m_Images.end(); ++it)
+    {
+      for(ClassStatisticsMap::const_iterator iClass = it->second.statistics.begin(); iClass != it->second.statistics.end(); ++iClass)
+      {
+        statistics[iClass->first].Merge(iClass->second);
+      }
+    }
+    return statistics;
+  }
+
+  // Read a state file; the totals are rebuilt from the images
+  void Load(const std::string& filename)
+  {
+    TiXmlDocument doc(filename.c_str());
+    if(!doc.LoadFile() || !doc.FirstChildElement("StrategyState"))
+    {
+      itkGenericExceptionMacro(<< "Unable to read the strategy state " << filename);
+    }
+
+    m_Images.clear();
+    m_Totals.clear();
+    m_ClassImages.clear();
+    for(TiXmlElement* image = doc.FirstChildElement("StrategyState")->FirstChildElement("Image"); image != NULL; image = image->NextSiblingElement("Image"))
+    {
+      ImageEntry entry;
+      entry.stamp = image->Attribute("stamp") ? image->Attribute("stamp") : "";
+      int hasQuotas = 0;
+      image->QueryIntAttribute("quotas", &hasQuotas);
+      entry.hasQuotas = hasQuotas != 0;
+
+      for(TiXmlElement* sample = image->FirstChildElement("Class"); sample != NULL; sample = sample->NextSiblingElement("Class"))
+      {
+        double name = 0, count = 0;
+        sample->QueryDoubleAttribute("name", &name);
+        sample->QueryDoubleAttribute("count", &count);
+        itk::int64_t className = static_cast<itk::int64_t>(name);
+        entry.counts[className] = static_cast<PolygonStatisticsFile::CountType>(count);
+
+        int quota = 0;
+        if(sample->QueryIntAttribute("quota", &quota) == TIXML_SUCCESS)
+        {
+          entry.quotas[static_cast<int>(className)] = quota;
+        }
+
+        TiXmlElement* statistics = sample->FirstChildElement("Statistics");
+        if(statistics)
+        {
+          double statisticsCount = 0;
+          statistics->QueryDoubleAttribute("count", &statisticsCount);
+          std::vector<TiXmlElement*> bands;
+          for(TiXmlElement* band = statistics->FirstChildElement("Band"); band != NULL; band = band->NextSiblingElement("Band"))
+          {
+            bands.push_back(band);
+          }
+          BandStatistics& classStatistics = entry.statistics[className];
+          classStatistics.Reset(bands.size());
+          for(unsigned int b = 0; b < bands.size(); ++b)
+          {
+            double mean = 0, m2 = 0, min = 0, max = 0;
+            bands[b]->QueryDoubleAttribute("mean", &mean);
+            bands[b]->QueryDoubleAttribute("m2", &m2);
+            bands[b]->QueryDoubleAttribute("min", &min);
+            bands[b]->QueryDoubleAttribute("max", &max);
+            classStatistics.Set(static_cast<itk::uint64_t>(statisticsCount), b, mean, m2, min, max);
+          }
+        }
+      }
+
+      AddToTotals(entry);
+      m_Images[image->Attribute("file") ? image->Attribute("file") : ""] = entry;
+    }
+  }
+
+  void Save(const std::string& filename) const
+  {
+    TiXmlDocument doc;
+    doc.LinkEndChild(new TiXmlDeclaration("1.0", "", ""));
+    TiXmlElement * root = new TiXmlElement("StrategyState");
+    doc.LinkEndChild(root);
+
+    for(std::map<std::string, ImageEntry>::const_iterator it = m_Images.begin(); it != m_Images.end(); ++it)
+    {
+      TiXmlElement * image = new TiXmlElement("Image");
+      image->SetAttribute("file", it->first.c_str());
+      image->SetAttribute("stamp", it->second.stamp.c_str());
+      image->SetAttribute("quotas", it->second.hasQuotas ? 1 : 0);
+      root->LinkEndChild(image);
+
+      for(ClassCountMap::const_iterator iClass = it->second.counts.begin(); iClass != it->second.counts.end(); ++iClass)
+      {
+        TiXmlElement * sample = new TiXmlElement("Class");
+        sample->SetAttribute("name", ToString(iClass->first).c_str());
+        sample->SetAttribute("count", ToString(iClass->second).c_str());
+        std::map<int, int>::const_iterator quota = it->second.quotas.find(static_cast<int>(iClass->first));
+        if(quota != it->second.quotas.end())
+        {
+          sample->SetAttribute("quota", quota->second);
+        }
+        image->LinkEndChild(sample);
+
+        ClassStatisticsMap::const_iterator classStatistics = it->second.statistics.find(iClass->first);
+        if(classStatistics == it->second.statistics.end())
+        {
+          continue;
+        }
+        TiXmlElement * statistics = new TiXmlElement("Statistics");
+        statistics->SetAttribute("count", ToString(classStatistics->second.GetCount()).c_str());
+        sample->LinkEndChild(statistics);
+        for(unsigned int b = 0; b < classStatistics->second.GetNumberOfBands(); ++b)
+        {
+          TiXmlElement * band = new TiXmlElement("Band");
+          band->SetAttribute("mean", ToString(classStatistics->second.GetMean(b)).c_str());
+          band->SetAttribute("m2", ToString(classStatistics->second.GetM2(b)).c_str());
+          band->SetAttribute("min", ToString(classStatistics->second.GetMinimum(b)).c_str());
+          band->SetAttribute("max", ToString(classStatistics->second.GetMaximum(b)).c_str());
+          statistics->LinkEndChild(band);
+        }
+      }
+    }
+
+    if(!doc.SaveFile(filename.c_str()))
+    {
+      itkGenericExceptionMacro(<< "Unable to write the strategy state " << filename);
+    }
+  }
+
+private:
+  void AddToTotals(const ImageEntry& entry)
+  {
+    for(ClassCountMap::const_iterator iClass = entry.counts.begin(); iClass != entry.counts.end(); ++iClass)
+    {
+      m_Totals[iClass->first] += iClass->second;
+      ++m_ClassImages[iClass->first];
+    }
+  }
+
+  // Full precision, SetDoubleAttribute keeping only a few digits
+  template <class T>
+  static std::string ToString(T value)
+  {
+    std::ostringstream oss;
+    oss.precision(17);
+    oss << value;
+    return oss.str();
+  }
+
+  std::map<std::string, ImageEntry> m_Images;
+  ClassCountMap m_Totals;
+  // Number of images holding each class
+  std::map<itk::int64_t, unsigned long> m_ClassImages;
+};
+
+} // namespace otb
+
+#endif
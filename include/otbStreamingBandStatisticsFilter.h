@@ -0,0 +1,252 @@
+#ifndef __otbStreamingBandStatisticsFilter__
+#define __otbStreamingBandStatisticsFilter__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "otbPersistentImageFilter.h"
+#include "itkImageRegionConstIterator.h"
+#include "otbBandStatistics.h"
+#include "otbQuantileSketch.h"
+
+namespace otb
+{
+
+// Statistics of one band of an image: moments and extrema of the valid
+// values, number of nodata values, histogram and quantile sketch
+struct BandSummary
+{
+  BandStatistics moments;
+  itk::uint64_t nodata;
+  std::vector<itk::uint64_t> histogram;
+  QuantileSketch sketch;
+
+  BandSummary() : moments(1), nodata(0) {}
+
+  void Merge(const BandSummary& other)
+  {
+    moments.Merge(other.moments);
+    nodata += other.nodata;
+    for(unsigned long i = 0; i < histogram.size() && i < other.histogram.size(); ++i)
+    {
+      histogram[i] += other.histogram[i];
+    }
+    sketch.Merge(other.sketch);
+  }
+};
+
+// Per-band statistics of a multiband image in one streamed pass: min, max,
+// mean, standard deviation, nodata count and a fixed-bin histogram of every
+// band. Each thread accumulates its own summaries, merged in Synthetize.
+// When the histogram range is not given, it can not be known before the pass:
+// the histogram is then estimated at the end over [min, max] from a quantile
+// sketch of each band.
+template <class TInputImage>
+class ITK_EXPORT PersistentBandStatisticsFilter :
+  public otb::PersistentImageFilter<TInputImage, TInputImage>
+{
+public:
+  typedef PersistentBandStatisticsFilter<TInputImage>          Self;
+  typedef otb::PersistentImageFilter<TInputImage, TInputImage> Superclass;
+  typedef itk::SmartPointer<Self>                              Pointer;
+
+  typedef std::vector<BandSummary> BandSummaryList;
+
+  itkNewMacro(Self);
+  itkTypeMacro(Self, PersistentImageFilter);
+
+  // Value of the nodata pixels, excluded from the statistics and counted apart
+  void SetNoDataValue(double value)
+  {
+    m_noDataValue = value;
+    m_useNoData = true;
+  }
+
+  // Number of bins of the histograms, 0 for no histogram
+  void SetHistogramBins(unsigned int nbBins)
+  {
+    m_histogramBins = nbBins;
+  }
+
+  // Fixed range of the histograms; without it the range of each band is used
+  void SetHistogramRange(double min, double max)
+  {
+    m_histogramMin = min;
+    m_histogramMax = max;
+    m_histogramRange = true;
+  }
+
+  unsigned int GetHistogramBins() const
+  {
+    return m_histogramBins;
+  }
+
+  // True when the histograms are estimated from the quantile sketches, without
+  // a fixed range: each bin edge then has a rank error of about 1/sketch size
+  // of the pixels, more than an average bin holds
+  bool IsHistogramEstimated() const
+  {
+    return m_histogramBins > 0 && !m_histogramRange;
+  }
+
+  // Bounds of the histogram of a band
+  double GetHistogramMinimum(unsigned int band) const
+  {
+    return m_histogramRange ? m_histogramMin : m_result[band].moments.GetMinimum(0);
+  }
+
+  double GetHistogramMaximum(unsigned int band) const
+  {
+    return m_histogramRange ? m_histogramMax : m_result[band].moments.GetMaximum(0);
+  }
+
+  // Statistics of the bands, valid after the streamed pass
+  const BandSummaryList& GetBandSummaries() const
+  {
+    return m_result;
+  }
+
+  // Count and sum of the valid values of a band accumulated since Reset,
+  // before Synthetize: the blocks of a strided pass are told apart by their
+  // differences
+  void GetRunningSums(unsigned int band, double& count, double& sum) const
+  {
+    count = 0;
+    sum = 0;
+    for(unsigned int t = 0; t < m_threadSummaries.size(); ++t)
+    {
+      const BandStatistics& moments = m_threadSummaries[t][band].moments;
+      count += moments.GetCount();
+      sum += moments.GetMean(0) * moments.GetCount();
+    }
+  }
+
+public: // Software guide says this should be protected, but it won't compile
+  PersistentBandStatisticsFilter() :
+    m_useNoData(false),
+    m_noDataValue(0),
+    m_histogramBins(0),
+    m_histogramRange(false),
+    m_histogramMin(0),
+    m_histogramMax(0)
+  {
+  }
+
+  virtual ~PersistentBandStatisticsFilter() {}
+
+  void Reset()
+  {
+    TInputImage* inputImage = const_cast<TInputImage*>(this->GetInput());
+    inputImage->UpdateOutputInformation();
+    unsigned int nbBands = inputImage->GetNumberOfComponentsPerPixel();
+
+    BandSummary empty;
+    if(m_histogramRange)
+    {
+      empty.histogram.assign(m_histogramBins, 0);
+    }
+    m_threadSummaries = std::vector<BandSummaryList>(this->GetNumberOfThreads(), BandSummaryList(nbBands, empty));
+    m_result = BandSummaryList(nbBands, empty);
+  }
+
+  virtual void Synthetize()
+  {
+    for(unsigned int t = 0; t < m_threadSummaries.size(); ++t)
+    {
+      for(unsigned int b = 0; b < m_result.size(); ++b)
+      {
+        m_result[b].Merge(m_threadSummaries[t][b]);
+      }
+    }
+    m_threadSummaries.clear();
+
+    // Histograms over [min, max] estimated from the sketches
+    if(!m_histogramRange && m_histogramBins > 0)
+    {
+      for(unsigned int b = 0; b < m_result.size(); ++b)
+      {
+        BandSummary& summary = m_result[b];
+        itk::uint64_t count = summary.moments.GetCount();
+        summary.histogram.assign(m_histogramBins, 0);
+        if(count == 0)
+        {
+          continue;
+        }
+        double min = summary.moments.GetMinimum(0);
+        double width = (summary.moments.GetMaximum(0) - min) / m_histogramBins;
+        itk::uint64_t cumulated = 0;
+        for(unsigned int bin = 0; bin + 1 < m_histogramBins; ++bin)
+        {
+          itk::uint64_t upper = static_cast<itk::uint64_t>(summary.sketch.GetRank(min + (bin+1)*width) * count + 0.5);
+          upper = std::max(cumulated, std::min(count, upper));
+          summary.histogram[bin] = upper - cumulated;
+          cumulated = upper;
+        }
+        summary.histogram[m_histogramBins-1] = count - cumulated;
+      }
+    }
+  }
+
+protected:
+
+  // The filter does not modify the image: the input is passed through as the output
+  void AllocateOutputs()
+  {
+    this->GraftOutput(const_cast<TInputImage*>(this->GetInput()));
+  }
+
+  void ThreadedGenerateData(const typename Self::OutputImageRegionType& threadRegion, itk::ThreadIdType threadId)
+  {
+    const TInputImage* inputImage = this->GetInput();
+    BandSummaryList& summaries = m_threadSummaries[threadId];
+    unsigned int nbBands = summaries.size();
+    bool fixedHistogram = m_histogramRange && m_histogramBins > 0;
+
+    itk::ImageRegionConstIterator<TInputImage> it(inputImage, threadRegion);
+    for(it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+      typename TInputImage::PixelType pixel = it.Get();
+      for(unsigned int b = 0; b < nbBands; ++b)
+      {
+        BandSummary& summary = summaries[b];
+        double value = static_cast<double>(pixel[b]);
+        if(value != value || (m_useNoData && value == m_noDataValue))
+        {
+          ++summary.nodata;
+          continue;
+        }
+        summary.moments.Add(&value);
+        if(fixedHistogram)
+        {
+          double position = (value - m_histogramMin) / (m_histogramMax - m_histogramMin);
+          long bin = static_cast<long>(position * m_histogramBins);
+          bin = std::max(0L, std::min(static_cast<long>(m_histogramBins) - 1, bin));
+          summary.histogram[bin]++;
+        }
+        else if(m_histogramBins > 0)
+        {
+          summary.sketch.Add(value);
+        }
+      }
+    }
+  }
+
+private:
+  PersistentBandStatisticsFilter(const Self&); // Not implemented
+  void operator=(const Self&);
+
+  bool m_useNoData;
+  double m_noDataValue;
+  unsigned int m_histogramBins;
+  bool m_histogramRange;
+  double m_histogramMin;
+  double m_histogramMax;
+
+  // Summaries of each thread, then merged result
+  std::vector<BandSummaryList> m_threadSummaries;
+  BandSummaryList m_result;
+};
+
+} // namespace otb
+
+#endif
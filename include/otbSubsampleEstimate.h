@@ -0,0 +1,126 @@
+#ifndef __otbSubsampleEstimate__
+#define __otbSubsampleEstimate__
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+namespace otb
+{
+
+// Estimates of full-resolution statistics from a subsample of the pixels (an
+// overview level or a strided subset of the blocks) holding a fraction of
+// them.
+//
+// The strided subsample reads whole blocks, whose pixels are spatially
+// correlated: it is a cluster sample, and its errors are estimated from the
+// variation between the read blocks, the systematic subset of the blocks being
+// taken as a simple random sample of them. An overview level is made of
+// resampled averages, not of sampled pixels, and has no sampling error.
+
+// Estimate of a total (a pixel count) from its value in the subsample
+inline double EstimateTotal(double sampled, double fraction)
+{
+  return fraction > 0 ? sampled / fraction : 0.;
+}
+
+// Standard error of a total estimated from its value in each read block, the
+// blocks being a fraction of those of the image. Unknown (NaN) below two
+// blocks.
+inline double ClusterTotalStandardError(const std::vector<double>& blockTotals, double fraction)
+{
+  const double n = blockTotals.size();
+  if(n < 2 || fraction <= 0)
+  {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  double mean = 0;
+  for(unsigned long i = 0; i < blockTotals.size(); ++i)
+  {
+    mean += blockTotals[i];
+  }
+  mean /= n;
+  double squares = 0;
+  for(unsigned long i = 0; i < blockTotals.size(); ++i)
+  {
+    squares += (blockTotals[i] - mean) * (blockTotals[i] - mean);
+  }
+  double variance = n * std::max(0., 1. - fraction) * (squares / (n - 1)) / (fraction * fraction);
+  return std::sqrt(variance);
+}
+
+// Standard errors of the class totals (pixel counts) estimated from the class
+// counts of each read block, the blocks without a class counting as zero.
+// Unknown (NaN) below two blocks.
+inline std::map<int, double> ClassTotalStandardErrors(const std::vector<std::map<int, int> >& blockClassCounts,
+                                                      const std::map<int, int>& classes, double fraction)
+{
+  std::map<int, double> errors;
+  for(std::map<int, int>::const_iterator iClass = classes.begin(); iClass != classes.end(); ++iClass)
+  {
+    std::vector<double> blockTotals(blockClassCounts.size(), 0.);
+    for(unsigned long b = 0; b < blockClassCounts.size(); ++b)
+    {
+      std::map<int, int>::const_iterator found = blockClassCounts[b].find(iClass->first);
+      if(found != blockClassCounts[b].end())
+      {
+        blockTotals[b] = found->second;
+      }
+    }
+    errors[iClass->first] = ClusterTotalStandardError(blockTotals, fraction);
+  }
+  return errors;
+}
+
+// Standard errors of the class totals of independent subsamples (the images
+// of a list) added together: their variances add up
+inline void AddClassStandardErrors(std::map<int, double>& errors, const std::map<int, double>& other)
+{
+  for(std::map<int, double>::const_iterator iClass = other.begin(); iClass != other.end(); ++iClass)
+  {
+    std::map<int, double>::iterator found = errors.find(iClass->first);
+    if(found == errors.end())
+    {
+      errors[iClass->first] = iClass->second;
+    }
+    else
+    {
+      found->second = std::sqrt(found->second * found->second + iClass->second * iClass->second);
+    }
+  }
+}
+
+// Standard error of a mean estimated from the sum and the count of the values
+// of each read block, as a ratio of the totals. Unknown (NaN) below two blocks
+// with values.
+inline double ClusterMeanStandardError(const std::vector<double>& blockSums, const std::vector<double>& blockCounts,
+                                       double fraction)
+{
+  const double n = blockSums.size();
+  double sum = 0, count = 0;
+  for(unsigned long i = 0; i < blockSums.size(); ++i)
+  {
+    sum += blockSums[i];
+    count += blockCounts[i];
+  }
+  if(n < 2 || count <= 0)
+  {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  const double ratio = sum / count;
+  double squares = 0;
+  for(unsigned long i = 0; i < blockSums.size(); ++i)
+  {
+    double residual = blockSums[i] - ratio * blockCounts[i];
+    squares += residual * residual;
+  }
+  const double meanCount = count / n;
+  double variance = std::max(0., 1. - fraction) * (squares / (n - 1)) / (n * meanCount * meanCount);
+  return std::sqrt(variance);
+}
+
+} // namespace otb
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef __otbTileCache__
+#define __otbTileCache__
+
+#include <map>
+#include <list>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#endif
+#include "itkImageRegion.h"
+#include "itksys/Directory.hxx"
+#include "otbMultiChannelExtractROI.h"
+
+namespace otb
+{
+
+// LRU cache of decoded image tiles, bounded by a RAM budget. Tiles are keyed
+// by image path, modification time, window, bands and pixel type, so that a
+// modified image never hits. Evicted tiles, and the tiles still in memory when
+// the cache is destroyed, are spilled to a scratch directory when one is set;
+// they are then memory-mapped back on a miss, by this process or by a later
+// one on the same host. The scratch directory is bounded by a disk budget, the
+// least recently used tiles being deleted first.
+class TileCache
+{
+public:
+  TileCache() : m_Budget(0), m_Used(0), m_Hits(0), m_Misses(0), m_DiskBudget(0), m_DiskUsed(0), m_DiskScanned(false) {}
+
+  ~TileCache()
+  {
+    Flush();
+  }
+
+  // RAM budget in bytes, 0 disables the cache
+  void SetBudget(unsigned long budget)
+  {
+    m_Budget = budget;
+  }
+
+  // Directory of the spilled tiles, empty to keep tiles in memory only, and
+  // its disk budget in bytes, 0 to spill nothing. The budget holds for all
+  // the processes sharing the directory: the tiles of any of them are deleted,
+  // the least recently used first.
+  void SetScratchDirectory(const std::string& directory, unsigned long long diskBudget)
+  {
+    m_ScratchDirectory = directory;
+    m_DiskBudget = diskBudget;
+    m_DiskScanned = false;
+  }
+
+  bool IsEnabled() const
+  {
+    return m_Budget > 0;
+  }
+
+  unsigned long GetHits() const
+  {
+    return m_Hits;
+  }
+
+  unsigned long GetMisses() const
+  {
+    return m_Misses;
+  }
+
+  // Key of the image part: path, modification time, extended filename options,
+  // bands and pixel type. The options select what is read (an overview level
+  // with resol, for instance): tiles read with other options are never shared.
+  static std::string MakeImageKey(const std::string& filename, const std::string& bands, const std::string& pixelType)
+  {
+    std::string::size_type question = filename.find('?');
+    std::string path = filename.substr(0, question);
+    std::string options = question == std::string::npos ? "" : filename.substr(question);
+    struct stat info;
+    long mtime = 0;
+    if(stat(path.c_str(), &info) == 0)
+    {
+      mtime = static_cast<long>(info.st_mtime);
+    }
+    std::ostringstream oss;
+    oss << path << "|" << mtime << "|" << options << "|" << bands << "|" << pixelType;
+    return oss.str();
+  }
+
+  // Key of a tile of the image
+  static std::string MakeTileKey(const std::string& imageKey, const itk::ImageRegion<2>& region)
+  {
+    std::ostringstream oss;
+    oss << imageKey << "|" << region.GetIndex()[0] << "," << region.GetIndex()[1]
+        << "," << region.GetSize()[0] << "," << region.GetSize()[1];
+    return oss.str();
+  }
+
+  // Copy the tile into buffer; false if it is neither in memory nor spilled
+  bool Get(const std::string& key, void* buffer, unsigned long size)
+  {
+    std::map<std::string, EntryIterator>::iterator found = m_Index.find(key);
+    if(found != m_Index.end() && found->second->data.size() == size)
+    {
+      // Move to the front of the LRU list
+      m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+      std::memcpy(buffer, &(found->second->data[0]), size);
+      ++m_Hits;
+      return true;
+    }
+
+    if(ReadSpilled(key, buffer, size))
+    {
+      Put(key, buffer, size);
+      // Already on disk, no need to spill it again
+      found = m_Index.find(key);
+      if(found != m_Index.end())
+      {
+        found->second->spilled = true;
+      }
+      ++m_Hits;
+      return true;
+    }
+
+    ++m_Misses;
+    return false;
+  }
+
+  // Store a decoded tile, evicting the least recently used ones over the budget
+  void Put(const std::string& key, const void* buffer, unsigned long size)
+  {
+    if(size == 0 || size > m_Budget)
+    {
+      return;
+    }
+
+    std::map<std::string, EntryIterator>::iterator found = m_Index.find(key);
+    if(found != m_Index.end())
+    {
+      Evict(found->second, false);
+    }
+
+    while(m_Used + size > m_Budget && !m_Entries.empty())
+    {
+      EntryIterator last = m_Entries.end();
+      --last;
+      Evict(last, true);
+    }
+
+    m_Entries.push_front(Entry());
+    Entry& entry = m_Entries.front();
+    entry.key = key;
+    entry.spilled = false;
+    entry.data.assign(static_cast<const char*>(buffer), static_cast<const char*>(buffer) + size);
+    m_Index[key] = m_Entries.begin();
+    m_Used += size;
+  }
+
+  // Spill every tile still in memory
+  void Flush()
+  {
+    for(EntryIterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+    {
+      if(!it->spilled)
+      {
+        Spill(*it);
+        it->spilled = true;
+      }
+    }
+  }
+
+private:
+  struct Entry
+  {
+    std::string key;
+    std::vector<char> data;
+    bool spilled;
+  };
+  typedef std::list<Entry>::iterator EntryIterator;
+
+  void Evict(EntryIterator entry, bool spill)
+  {
+    if(spill && !entry->spilled)
+    {
+      Spill(*entry);
+    }
+    m_Used -= entry->data.size();
+    m_Index.erase(entry->key);
+    m_Entries.erase(entry);
+  }
+
+  // 64 bits FNV-1a hash of the key, used as file name
+  std::string SpillFilename(const std::string& key) const
+  {
+    unsigned long long hash = 14695981039346656037ULL;
+    for(std::string::const_iterator c = key.begin(); c != key.end(); ++c)
+    {
+      hash ^= static_cast<unsigned char>(*c);
+      hash *= 1099511628211ULL;
+    }
+    char name[32];
+    std::sprintf(name, "%016llx.tile", hash);
+    return m_ScratchDirectory + "/" + name;
+  }
+
+  // File layout: key size, key, data size, data. Written to a temporary file
+  // and renamed, so that a concurrent reader never sees a partial tile.
+  void Spill(const Entry& entry)
+  {
+#if !defined(_WIN32)
+    if(m_ScratchDirectory.empty() || m_DiskBudget == 0)
+    {
+      return;
+    }
+    std::string filename = SpillFilename(entry.key);
+    std::ostringstream tmp;
+    tmp << filename << "." << getpid() << ".tmp";
+
+    std::ofstream file(tmp.str().c_str(), std::ios::binary);
+    unsigned long keySize = entry.key.size();
+    unsigned long dataSize = entry.data.size();
+    file.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+    file.write(entry.key.data(), keySize);
+    file.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+    file.write(&(entry.data[0]), dataSize);
+    file.close();
+
+    if(!file || std::rename(tmp.str().c_str(), filename.c_str()) != 0)
+    {
+      std::remove(tmp.str().c_str());
+      return;
+    }
+
+    // The usage of the directory is only known from a scan, the other
+    // processes spilling into it too: it is estimated between two scans
+    m_DiskUsed += 2*sizeof(unsigned long) + keySize + dataSize;
+    if(!m_DiskScanned || m_DiskUsed > m_DiskBudget)
+    {
+      TrimScratchDirectory();
+    }
+#endif
+  }
+
+#if !defined(_WIN32)
+  // Delete the least recently used tiles of the directory down to three
+  // quarters of the disk budget, so that it is not scanned at every spill
+  void TrimScratchDirectory()
+  {
+    itksys::Directory directory;
+    if(!directory.Load(m_ScratchDirectory.c_str()))
+    {
+      return;
+    }
+
+    std::vector<std::pair<long, std::string> > tiles;
+    std::vector<unsigned long long> sizes;
+    unsigned long long used = 0;
+    for(unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+      std::string name = directory.GetFile(i);
+      if(name.size() < 5 || name.compare(name.size() - 5, 5, ".tile") != 0)
+      {
+        continue;
+      }
+      std::string filename = m_ScratchDirectory + "/" + name;
+      struct stat info;
+      if(stat(filename.c_str(), &info) == 0)
+      {
+        tiles.push_back(std::make_pair(static_cast<long>(info.st_mtime), filename));
+        sizes.push_back(static_cast<unsigned long long>(info.st_size));
+        used += info.st_size;
+      }
+    }
+
+    if(used > m_DiskBudget)
+    {
+      std::vector<unsigned long> order(tiles.size());
+      for(unsigned long i = 0; i < order.size(); ++i)
+      {
+        order[i] = i;
+      }
+      std::sort(order.begin(), order.end(), OlderTile(tiles));
+      const unsigned long long target = m_DiskBudget / 4 * 3;
+      for(unsigned long i = 0; i < order.size() && used > target; ++i)
+      {
+        if(std::remove(tiles[order[i]].second.c_str()) == 0)
+        {
+          used -= sizes[order[i]];
+        }
+      }
+    }
+    m_DiskUsed = used;
+    m_DiskScanned = true;
+  }
+
+  struct OlderTile
+  {
+    explicit OlderTile(const std::vector<std::pair<long, std::string> >& tiles) : m_Tiles(&tiles) {}
+
+    bool operator()(unsigned long a, unsigned long b) const
+    {
+      return (*m_Tiles)[a].first < (*m_Tiles)[b].first;
+    }
+
+    const std::vector<std::pair<long, std::string> >* m_Tiles;
+  };
+#endif
+
+  bool ReadSpilled(const std::string& key, void* buffer, unsigned long size) const
+  {
+#if defined(_WIN32)
+    return false;
+#else
+    if(m_ScratchDirectory.empty())
+    {
+      return false;
+    }
+
+    std::string filename = SpillFilename(key);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+
+    struct stat info;
+    unsigned long headerSize = 2*sizeof(unsigned long) + key.size();
+    if(fstat(fd, &info) != 0 || static_cast<unsigned long>(info.st_size) != headerSize + size)
+    {
+      close(fd);
+      return false;
+    }
+
+    void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+    {
+      return false;
+    }
+
+    // Check the full key, the file name is only a hash
+    const char* bytes = static_cast<const char*>(mapped);
+    unsigned long keySize, dataSize;
+    std::memcpy(&keySize, bytes, sizeof(keySize));
+    std::memcpy(&dataSize, bytes + sizeof(keySize) + key.size(), sizeof(dataSize));
+    bool valid = keySize == key.size()
+      && std::memcmp(bytes + sizeof(keySize), key.data(), key.size()) == 0
+      && dataSize == size;
+    if(valid)
+    {
+      std::memcpy(buffer, bytes + headerSize, size);
+    }
+
+    munmap(mapped, info.st_size);
+    // Mark the tile as recently used, for the trimming of the directory
+    if(valid)
+    {
+      utime(filename.c_str(), NULL);
+    }
+    return valid;
+#endif
+  }
+
+  unsigned long m_Budget;
+  unsigned long m_Used;
+  unsigned long m_Hits;
+  unsigned long m_Misses;
+  std::string m_ScratchDirectory;
+  unsigned long long m_DiskBudget;
+  unsigned long long m_DiskUsed;
+  bool m_DiskScanned;
+  std::list<Entry> m_Entries;
+  std::map<std::string, EntryIterator> m_Index;
+};
+
+// Extract a tile of the image, from the cache when possible. Without cache
+// (NULL or disabled) this is a plain MultiChannelExtractROI.
+template <class TImage>
+typename TImage::Pointer ExtractTile(TImage* image, const itk::ImageRegion<2>& region, TileCache* cache, const std::string& imageKey)
+{
+  typedef typename TImage::InternalPixelType PixelType;
+  typedef otb::MultiChannelExtractROI<PixelType, PixelType> ExtractROIFilterType;
+
+  typename ExtractROIFilterType::Pointer extractROIFilter = ExtractROIFilterType::New();
+  extractROIFilter->SetInput(image);
+  extractROIFilter->SetStartX(region.GetIndex()[0]);
+  extractROIFilter->SetStartY(region.GetIndex()[1]);
+  extractROIFilter->SetSizeX(region.GetSize()[0]);
+  extractROIFilter->SetSizeY(region.GetSize()[1]);
+
+  if(!cache || !cache->IsEnabled())
+  {
+    extractROIFilter->Update();
+    return extractROIFilter->GetOutput();
+  }
+
+  // Same geometry as the extracted tile, without decoding it
+  extractROIFilter->UpdateOutputInformation();
+  typename TImage::Pointer tile = TImage::New();
+  tile->CopyInformation(extractROIFilter->GetOutput());
+  tile->SetNumberOfComponentsPerPixel(extractROIFilter->GetOutput()->GetNumberOfComponentsPerPixel());
+  tile->SetRegions(extractROIFilter->GetOutput()->GetLargestPossibleRegion());
+  tile->Allocate();
+
+  unsigned long size = region.GetNumberOfPixels() * tile->GetNumberOfComponentsPerPixel() * sizeof(PixelType);
+  std::string key = TileCache::MakeTileKey(imageKey, region);
+  if(cache->Get(key, tile->GetBufferPointer(), size))
+  {
+    return tile;
+  }
+
+  extractROIFilter->Update();
+  cache->Put(key, extractROIFilter->GetOutput()->GetBufferPointer(), size);
+  return extractROIFilter->GetOutput();
+}
+
+} // namespace otb
+
+#endif